@@ -44,8 +44,10 @@ extern "C" {
 struct drm_amdgpu_info_hw_ip;
 struct drm_amdgpu_info_uq_fw_areas;
 struct drm_amdgpu_bo_list_entry;
+struct drm_amdgpu_cs_chunk;
 struct drm_amdgpu_userq_signal;
 struct drm_amdgpu_userq_wait;
+struct drm_amdgpu_userq_fence_info;
 
 /*--------------------------------------------------------------------------*/
 /* --------------------------- Defines ------------------------------------ */
@@ -136,6 +138,16 @@ typedef struct amdgpu_bo *amdgpu_bo_handle;
  */
 typedef struct amdgpu_bo_list *amdgpu_bo_list_handle;
 
+/**
+ * Define handle for an incrementally built BO list
+ */
+typedef struct amdgpu_bo_list_builder *amdgpu_bo_list_builder_handle;
+
+/**
+ * Define handle for a batch of VA operations
+ */
+typedef struct amdgpu_bo_va_batch *amdgpu_bo_va_batch_handle;
+
 /**
  * Define handle to be used to work with VA allocated ranges
  */
@@ -152,6 +164,21 @@ typedef struct amdgpu_va_manager *amdgpu_va_manager_handle;
  */
 typedef struct amdgpu_semaphore *amdgpu_semaphore_handle;
 
+/**
+ * Define handle for a prebuilt command submission
+ */
+typedef struct amdgpu_cs_submission *amdgpu_cs_submission_handle;
+
+/**
+ * Define handle for a user mode queue ring buffer
+ */
+typedef struct amdgpu_userq_ring *amdgpu_userq_ring_handle;
+
+/**
+ * Define handle for a submission scheduler
+ */
+typedef struct amdgpu_cs_scheduler *amdgpu_cs_scheduler_handle;
+
 /*--------------------------------------------------------------------------*/
 /* -------------------------- Structures ---------------------------------- */
 /*--------------------------------------------------------------------------*/
@@ -252,6 +279,162 @@ struct amdgpu_bo_import_result {
 	uint64_t alloc_size;
 };
 
+/**
+ * Statistics of the freed buffer reuse cache
+ *
+ * \sa amdgpu_bo_cache_enable(), amdgpu_bo_cache_query_stats()
+ *
+ */
+struct amdgpu_bo_cache_stats {
+	/** Allocations served from the cache */
+	uint64_t hits;
+
+	/** Allocations which had to go to the kernel */
+	uint64_t misses;
+
+	/** Cached buffers released because they got too old */
+	uint64_t purged;
+
+	/** Number and total size of buffers currently in the cache */
+	uint64_t cached_count;
+	uint64_t cached_size;
+};
+
+/**
+ * Statistics of a batch of VA operations
+ *
+ * \sa amdgpu_bo_va_batch_query_stats()
+ *
+ */
+struct amdgpu_bo_va_batch_stats {
+	/** Operations added to the batch */
+	uint64_t ops;
+
+	/** Operations merged into an adjacent one */
+	uint64_t coalesced;
+
+	/** Operations dropped because a later unmap undid them */
+	uint64_t cancelled;
+
+	/** VA ioctls the flushes took */
+	uint64_t ioctls;
+};
+
+/**
+ * Statistics of the CPU mapping cache
+ *
+ * \sa amdgpu_bo_set_vma_cache_size(), amdgpu_bo_vma_cache_query_stats()
+ *
+ */
+struct amdgpu_bo_vma_cache_stats {
+	/** amdgpu_bo_cpu_map() calls served by a kept-alive mapping */
+	uint64_t hits;
+
+	/** amdgpu_bo_cpu_map() calls which had to create a new mapping */
+	uint64_t misses;
+
+	/** Kept-alive mappings unmapped to stay within the limit */
+	uint64_t evictions;
+
+	/** Mappings currently kept alive and currently in use */
+	uint32_t cached_count;
+	uint32_t open_count;
+};
+
+/**
+ * Fence query statistics of a context
+ *
+ * \sa amdgpu_cs_query_fence_status(), amdgpu_cs_ctx_query_fence_stats()
+ *
+ */
+struct amdgpu_cs_fence_stats {
+	/** Queries answered as signaled from the user fence memory */
+	uint64_t user_fence_signaled;
+
+	/** Zero timeout queries answered as busy from the user fence memory */
+	uint64_t user_fence_busy;
+
+	/** Queries which had to ask the kernel */
+	uint64_t ioctls;
+};
+
+/**
+ * Job for a submission scheduler
+ *
+ * \sa amdgpu_cs_scheduler_add_job()
+ *
+ */
+struct amdgpu_cs_sched_job {
+	/** Context to submit to */
+	amdgpu_context_handle context;
+
+	/** Raw BO list handle, 0 for none */
+	uint32_t bo_list_handle;
+
+	/** Chunks as for amdgpu_cs_submit_raw2(). The array is copied, the
+	 *  chunk data must stay valid until the job is submitted. */
+	uint32_t num_chunks;
+	struct drm_amdgpu_cs_chunk *chunks;
+
+	/** Ids of jobs which must execute before this one */
+	uint32_t num_dependencies;
+	const uint32_t *dependencies;
+
+	/** Optional, receives the sequence number once submitted */
+	uint64_t *seq_no;
+};
+
+/**
+ * Statistics of a submission scheduler
+ *
+ * \sa amdgpu_cs_scheduler_query_stats()
+ *
+ */
+struct amdgpu_cs_scheduler_stats {
+	/** Jobs submitted successfully and jobs which failed or were
+	 *  cancelled because a dependency failed */
+	uint64_t submitted;
+	uint64_t failed;
+
+	/** Jobs waiting for a worker now and at most */
+	uint32_t queue_depth;
+	uint32_t max_queue_depth;
+
+	/** Jobs added but not submitted yet */
+	uint32_t outstanding;
+
+	/** Time from a job becoming ready until its submission returned */
+	uint64_t total_latency_ns;
+	uint64_t max_latency_ns;
+};
+
+/**
+ * CPU view of a user mode queue
+ *
+ * The memory can be the mappings of the queue, wptr, rptr and doorbell
+ * buffers given to amdgpu_create_userqueue(), or plain memory when the
+ * ring is driven by something else than the firmware.
+ *
+ * \sa amdgpu_userq_ring_create()
+ *
+ */
+struct amdgpu_userq_ring_info {
+	/** Queue id returned by amdgpu_create_userqueue() */
+	uint32_t queue_id;
+
+	/** Ring buffer, the size in dwords must be a power of two */
+	uint32_t *ring;
+	uint32_t ring_size_dw;
+
+	/** Write pointer read and read pointer written by the consumer,
+	 *  both in dwords */
+	volatile uint64_t *wptr;
+	volatile uint64_t *rptr;
+
+	/** Doorbell written with the new wptr, can be NULL */
+	volatile uint64_t *doorbell;
+};
+
 /**
  *
  * Structure to describe GDS partitioning information.
@@ -294,6 +477,38 @@ struct amdgpu_cs_fence {
 	uint64_t fence;
 };
 
+/**
+ * Kinds of things amdgpu_cs_wait_items() can wait for
+ */
+enum amdgpu_cs_wait_item_type {
+	/** A submission fence, in amdgpu_cs_wait_item::fence */
+	AMDGPU_CS_WAIT_ITEM_FENCE,
+	/** A binary syncobj, in amdgpu_cs_wait_item::syncobj */
+	AMDGPU_CS_WAIT_ITEM_SYNCOBJ,
+	/** A point on a timeline syncobj */
+	AMDGPU_CS_WAIT_ITEM_TIMELINE,
+};
+
+/**
+ * One fence, syncobj or timeline point to wait for
+ *
+ * \sa amdgpu_cs_wait_items()
+ *
+*/
+struct amdgpu_cs_wait_item {
+	/** AMDGPU_CS_WAIT_ITEM_* */
+	uint32_t type;
+
+	/** Syncobj handle for the syncobj types */
+	uint32_t syncobj;
+
+	/** Timeline point for AMDGPU_CS_WAIT_ITEM_TIMELINE */
+	uint64_t point;
+
+	/** Fence for AMDGPU_CS_WAIT_ITEM_FENCE */
+	struct amdgpu_cs_fence fence;
+};
+
 /**
  * Structure describing IB
  *
@@ -430,6 +645,65 @@ struct amdgpu_heap_info {
 	uint64_t max_allocation;
 };
 
+/**
+ * Heaps amdgpu_query_heap_usage() keeps numbers for. Buffers count for the
+ * first of VRAM, GTT and CPU in their preferred heap.
+ */
+#define AMDGPU_HEAP_USAGE_VRAM		0
+#define AMDGPU_HEAP_USAGE_GTT		1
+/** CPU domain and user memory buffers */
+#define AMDGPU_HEAP_USAGE_CPU		2
+/** GDS, GWS, OA and doorbell buffers */
+#define AMDGPU_HEAP_USAGE_OTHER		3
+/** Imported buffers, their placement isn't known */
+#define AMDGPU_HEAP_USAGE_IMPORTED	4
+#define AMDGPU_HEAP_USAGE_NUM		5
+
+/** Buckets of amdgpu_heap_usage::size_histogram */
+#define AMDGPU_HEAP_USAGE_BUCKETS	16
+
+/** Query the kernel heap numbers now, see amdgpu_query_heap_usage() */
+#define AMDGPU_HEAP_USAGE_REFRESH_BUDGET	(1 << 0)
+
+/**
+ * Usage of a heap by the buffers of this process
+ *
+ * \sa amdgpu_query_heap_usage()
+ *
+*/
+struct amdgpu_heap_usage {
+	/** Size and number of the buffers currently allocated */
+	uint64_t live_bytes;
+	uint64_t live_count;
+
+	/** Size and number of freed buffers kept by the reuse cache */
+	uint64_t cached_bytes;
+	uint64_t cached_count;
+
+	/** Highest live_bytes so far */
+	uint64_t peak_bytes;
+
+	/** Number of buffers allocated so far */
+	uint64_t allocations;
+
+	/**
+	 * Buffers allocated so far by size. Bucket i counts the sizes from
+	 * 4KB << i up to twice that, the first and last bucket also count
+	 * anything smaller and larger.
+	 */
+	uint64_t size_histogram[AMDGPU_HEAP_USAGE_BUCKETS];
+
+	/**
+	 * Kernel numbers for the heap, for all processes, as of
+	 * budget_timestamp_ns. Only VRAM and GTT have them, they are 0 until
+	 * the first refresh.
+	 */
+	uint64_t budget_size;
+	uint64_t budget_usage;
+	/** CLOCK_MONOTONIC time of the last refresh */
+	uint64_t budget_timestamp_ns;
+};
+
 /**
  * Describe GPU h/w info needed for UMD correct initialization
  *
@@ -794,6 +1068,42 @@ int amdgpu_bo_cpu_map(amdgpu_bo_handle buf_handle, void **cpu);
 */
 int amdgpu_bo_cpu_unmap(amdgpu_bo_handle buf_handle);
 
+/**
+ * Set the maximum number of CPU mappings of a device.
+ *
+ * With a non-zero limit, amdgpu_bo_cpu_unmap() keeps the mapping of a buffer
+ * alive after its last user is gone, so a later amdgpu_bo_cpu_map() can
+ * return it without going to the kernel.  The least recently used kept-alive
+ * mappings are unmapped once the number of mappings in use plus the number
+ * kept alive exceeds the limit.  A limit of 0 (the default) disables this
+ * and releases all kept-alive mappings.
+ *
+ * \param   dev   - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   limit - \c [in] Maximum number of CPU mappings
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_cpu_map(), amdgpu_bo_cpu_unmap()
+ *
+*/
+int amdgpu_bo_set_vma_cache_size(amdgpu_device_handle dev, int limit);
+
+/**
+ * Query statistics of the CPU mapping cache.
+ *
+ * \param   dev   - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   stats - \c [out] Cache statistics
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_set_vma_cache_size()
+ *
+*/
+int amdgpu_bo_vma_cache_query_stats(amdgpu_device_handle dev,
+				    struct amdgpu_bo_vma_cache_stats *stats);
+
 /**
  * Wait until a buffer is not used by the device.
  *
@@ -811,6 +1121,44 @@ int amdgpu_bo_wait_for_idle(amdgpu_bo_handle buf_handle,
 			    uint64_t timeout_ns,
 			    bool *buffer_busy);
 
+/**
+ * Enable or disable the reuse cache of freed buffers.
+ *
+ * When enabled, amdgpu_bo_free() keeps private buffers around for a short
+ * time and amdgpu_bo_alloc() hands out an idle one with the same preferred
+ * heap, flags and size bucket instead of allocating a new one.  Allocation
+ * sizes are rounded up to the bucket size.  Buffers which have been exported,
+ * had metadata set or were created with VRAM_CLEARED/VRAM_WIPE_ON_RELEASE are
+ * never recycled, and neither are buffers freed while still mapped into the
+ * GPU VA space, the next owner would inherit the mappings.  Disabling the
+ * cache releases all cached buffers.
+ *
+ * \param   dev    - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   enable - \c [in] Whether freed buffers should be cached
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_cache_query_stats()
+ *
+*/
+int amdgpu_bo_cache_enable(amdgpu_device_handle dev, bool enable);
+
+/**
+ * Query statistics of the freed buffer reuse cache.
+ *
+ * \param   dev    - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   stats  - \c [out] Cache statistics
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_cache_enable()
+ *
+*/
+int amdgpu_bo_cache_query_stats(amdgpu_device_handle dev,
+				struct amdgpu_bo_cache_stats *stats);
+
 /**
  * Creates a BO list handle for command submission.
  *
@@ -893,6 +1241,113 @@ int amdgpu_bo_list_update(amdgpu_bo_list_handle handle,
 			  amdgpu_bo_handle *resources,
 			  uint8_t *resource_prios);
 
+/**
+ * Create an empty BO list which is kept across submissions
+ *
+ * Unlike amdgpu_bo_list_create(), the list is changed with small add and
+ * remove steps, and the memory for it is reused.
+ *
+ * \param   dev     - \c [in] Device handle.
+ *			   See #amdgpu_device_initialize()
+ * \param   builder - \c [out] BO list builder
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_list_builder_destroy()
+*/
+int amdgpu_bo_list_builder_create(amdgpu_device_handle dev,
+				  amdgpu_bo_list_builder_handle *builder);
+
+/**
+ * Destroy a BO list builder and its kernel BO list
+ *
+ * \param   builder - \c [in] BO list builder
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_list_builder_create()
+*/
+int amdgpu_bo_list_builder_destroy(amdgpu_bo_list_builder_handle builder);
+
+/**
+ * Add a BO to the list
+ *
+ * Adding a BO which is already in the list only raises its priority if
+ * the new one is higher.
+ *
+ * \param   builder  - \c [in] BO list builder
+ * \param   bo       - \c [in] BO to add
+ * \param   priority - \c [in] BO priority
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_bo_list_builder_add(amdgpu_bo_list_builder_handle builder,
+			       amdgpu_bo_handle bo, uint8_t priority);
+
+/**
+ * Remove a BO from the list
+ *
+ * The order of the remaining BOs isn't preserved.
+ *
+ * \param   builder - \c [in] BO list builder
+ * \param   bo      - \c [in] BO to remove
+ *
+ * \return   0 on success\n
+ *          -ENOENT if the BO is not in the list\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_bo_list_builder_remove(amdgpu_bo_list_builder_handle builder,
+				  amdgpu_bo_handle bo);
+
+/**
+ * Remove all BOs from the list
+ *
+ * \param   builder - \c [in] BO list builder
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_bo_list_builder_reset(amdgpu_bo_list_builder_handle builder);
+
+/**
+ * Get a kernel BO list with the current BOs
+ *
+ * The kernel list is created on first use and only updated when BOs were
+ * added or removed since the last call. It belongs to the builder and
+ * stays valid until the builder is destroyed.
+ *
+ * \param   builder - \c [in] BO list builder
+ * \param   bo_list - \c [out] Raw BO list handle, 0 if the list is empty
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_submit_raw2(), amdgpu_cs_submission_set_bo_list()
+*/
+int amdgpu_bo_list_builder_get_handle(amdgpu_bo_list_builder_handle builder,
+				      uint32_t *bo_list);
+
+/**
+ * Get an AMDGPU_CHUNK_ID_BO_HANDLES chunk with the current BOs
+ *
+ * This passes the BOs with the submission itself, which saves the BO list
+ * ioctls when the list changes every submission. The chunk points into the
+ * builder and stays valid until the builder is changed.
+ *
+ * \param   builder - \c [in] BO list builder
+ * \param   chunk   - \c [out] Chunk for amdgpu_cs_submit_raw2()
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_submit_raw2()
+*/
+int amdgpu_bo_list_builder_get_chunk(amdgpu_bo_list_builder_handle builder,
+				     struct drm_amdgpu_cs_chunk *chunk);
+
 /*
  * GPU Execution context
  *
@@ -1054,6 +1509,103 @@ int amdgpu_cs_submit(amdgpu_context_handle context,
 		     struct amdgpu_cs_request *ibs_request,
 		     uint32_t number_of_requests);
 
+/**
+ * Prebuild a command submission which is submitted repeatedly.
+ *
+ * The IB layout, user fence, BO list and dependencies of \c ibs_request are
+ * translated into the kernel chunk arrays once.  Each
+ * amdgpu_cs_submission_submit() then only appends pending semaphores and
+ * issues the ioctl, without allocating or rebuilding anything.
+ * Fields which change between submissions are updated with
+ * amdgpu_cs_submission_update_ib(), amdgpu_cs_submission_set_dependencies()
+ * and amdgpu_cs_submission_set_bo_list().
+ *
+ * \param   context     - \c [in]  GPU Context
+ * \param   ibs_request - \c [in]  Submission request to prebuild, with at
+ *				  most AMDGPU_CS_MAX_IBS_PER_SUBMIT IBs
+ * \param   submission  - \c [out] Prebuilt submission
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_submission_submit(), amdgpu_cs_submission_destroy()
+ *
+*/
+int amdgpu_cs_submission_create(amdgpu_context_handle context,
+				struct amdgpu_cs_request *ibs_request,
+				amdgpu_cs_submission_handle *submission);
+
+/**
+ * Replace the address, size and flags of one IB of a prebuilt submission.
+ *
+ * \param   submission - \c [in] Prebuilt submission
+ * \param   index      - \c [in] Index of the IB in the original request
+ * \param   ib         - \c [in] New IB information
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_cs_submission_update_ib(amdgpu_cs_submission_handle submission,
+				   uint32_t index,
+				   struct amdgpu_cs_ib_info *ib);
+
+/**
+ * Replace the dependencies of a prebuilt submission.
+ *
+ * \param   submission             - \c [in] Prebuilt submission
+ * \param   number_of_dependencies - \c [in] Number of dependencies, 0 for none
+ * \param   dependencies           - \c [in] Fences to wait for
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_cs_submission_set_dependencies(amdgpu_cs_submission_handle submission,
+					  uint32_t number_of_dependencies,
+					  struct amdgpu_cs_fence *dependencies);
+
+/**
+ * Replace the BO list of a prebuilt submission.
+ *
+ * \param   submission     - \c [in] Prebuilt submission
+ * \param   bo_list_handle - \c [in] Raw BO list handle (0 for none)
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_list_create_raw()
+ *
+*/
+int amdgpu_cs_submission_set_bo_list(amdgpu_cs_submission_handle submission,
+				     uint32_t bo_list_handle);
+
+/**
+ * Submit a prebuilt submission to the kernel.
+ *
+ * Same ordering and semaphore semantics as amdgpu_cs_submit().
+ *
+ * \param   submission - \c [in]  Prebuilt submission
+ * \param   seq_no     - \c [out] Sequence number of this submission
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_cs_submission_submit(amdgpu_cs_submission_handle submission,
+				uint64_t *seq_no);
+
+/**
+ * Destroy a prebuilt submission.
+ *
+ * \param   submission - \c [in] Prebuilt submission
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_cs_submission_destroy(amdgpu_cs_submission_handle submission);
+
 /**
  *  Query status of Command Buffer Submission
  *
@@ -1072,13 +1624,108 @@ int amdgpu_cs_submit(amdgpu_context_handle context,
  *	 returned in the case if submission was completed or timeout error
  *	 code.
  *
- * \sa amdgpu_cs_submit()
+ * \note If the last submission to the ring used a user fence in a buffer
+ *	 which is CPU mapped, the fence value is read from memory and the
+ *	 kernel is only asked when the fence isn't reached yet and timeout_ns
+ *	 is not 0. The user fence location must be dedicated to the ring.
+ *	 The context holds a reference and a CPU mapping of that buffer
+ *	 until it is freed, so the memory stays valid for queries which
+ *	 don't take any lock.
+ *
+ * \sa amdgpu_cs_submit(), amdgpu_cs_ctx_query_fence_stats()
 */
 int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 				 uint64_t timeout_ns,
 				 uint64_t flags,
 				 uint32_t *expired);
 
+/**
+ * Create a submission scheduler
+ *
+ * The scheduler submits jobs from a pool of worker threads. Jobs are
+ * ordered by their dependencies only, so independent jobs on different
+ * contexts or rings reach the kernel in parallel.
+ *
+ * \param   dev         - \c [in] Device handle
+ * \param   num_workers - \c [in] Number of worker threads
+ * \param   scheduler   - \c [out] Scheduler handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_scheduler_destroy()
+*/
+int amdgpu_cs_scheduler_create(amdgpu_device_handle dev,
+			       uint32_t num_workers,
+			       amdgpu_cs_scheduler_handle *scheduler);
+
+/**
+ * Wait for all jobs and destroy a submission scheduler
+ *
+ * \param   scheduler - \c [in] Scheduler handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_cs_scheduler_destroy(amdgpu_cs_scheduler_handle scheduler);
+
+/**
+ * Add a job to a submission scheduler
+ *
+ * The job is submitted as soon as all its dependencies are submitted, and
+ * waits for their fences on the GPU. Dependencies on jobs which already
+ * executed, or were added before the last amdgpu_cs_scheduler_wait_idle(),
+ * are satisfied right away. A job waits for the ring of the first IB chunk
+ * of each dependency, dependencies without IB chunks only order the
+ * submissions.
+ *
+ * \param   scheduler - \c [in] Scheduler handle
+ * \param   job       - \c [in] Job description
+ * \param   job_id    - \c [out] Id to use in dependencies of later jobs
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_cs_scheduler_add_job(amdgpu_cs_scheduler_handle scheduler,
+				const struct amdgpu_cs_sched_job *job,
+				uint32_t *job_id);
+
+/**
+ * Wait until all added jobs are submitted
+ *
+ * \param   scheduler - \c [in] Scheduler handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code of the first failed submission
+*/
+int amdgpu_cs_scheduler_wait_idle(amdgpu_cs_scheduler_handle scheduler);
+
+/**
+ * Query queue depth and latency counters of a submission scheduler
+ *
+ * \param   scheduler - \c [in] Scheduler handle
+ * \param   stats     - \c [out] Scheduler statistics
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_cs_scheduler_query_stats(amdgpu_cs_scheduler_handle scheduler,
+				    struct amdgpu_cs_scheduler_stats *stats);
+
+/**
+ * Query how fence queries on a context were answered
+ *
+ * \param   context - \c [in] GPU Context
+ * \param   stats   - \c [out] Fence query statistics
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_query_fence_status()
+*/
+int amdgpu_cs_ctx_query_fence_stats(amdgpu_context_handle context,
+				    struct amdgpu_cs_fence_stats *stats);
+
 /**
  *  Wait for multiple fences
  *
@@ -1102,6 +1749,42 @@ int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
 			  uint64_t timeout_ns,
 			  uint32_t *status, uint32_t *first);
 
+/**
+ *  Wait for any mix of fences, syncobjs and timeline points
+ *
+ * Everything is waited for with a single syncobj wait. Fences are turned
+ * into syncobjs with amdgpu_cs_fence_to_handle(), and the syncobjs are
+ * kept in a small per device cache so waiting for the same fence again
+ * doesn't convert it again. Fences the user fence shows as signaled
+ * don't need the kernel at all. Without any syncobj item, the fences are
+ * waited for as with amdgpu_cs_wait_fences() and \p flags is unused.
+ *
+ * \param   dev        - \c [in] Device handle.
+ *			     See #amdgpu_device_initialize()
+ * \param   items      - \c [in] The items to wait for
+ * \param   count      - \c [in] Number of items
+ * \param   wait_all   - \c [in] If true, wait for all items to be signaled,
+ *                               otherwise, wait for at least one
+ * \param   timeout_ns - \c [in] The timeout to wait, in nanoseconds
+ * \param   flags      - \c [in] Additional DRM_SYNCOBJ_WAIT_FLAGS_*, e.g.
+ *			     to wait for syncobjs without a fence yet
+ * \param   status     - \c [out] '1' for signaled, '0' for timeout
+ * \param   first      - \c [out] Index of the first signaled item, may be
+ *			     NULL
+ *
+ * \return  0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_wait_fences(), amdgpu_cs_syncobj_timeline_wait()
+*/
+int amdgpu_cs_wait_items(amdgpu_device_handle dev,
+			 const struct amdgpu_cs_wait_item *items,
+			 uint32_t count,
+			 bool wait_all,
+			 uint64_t timeout_ns,
+			 uint32_t flags,
+			 uint32_t *status, uint32_t *first);
+
 /*
  * Query / Info API
  *
@@ -1212,6 +1895,49 @@ int amdgpu_query_uq_fw_area_info(amdgpu_device_handle dev,
 int amdgpu_query_heap_info(amdgpu_device_handle dev, uint32_t heap,
 			   uint32_t flags, struct amdgpu_heap_info *info);
 
+/**
+ * Query the usage of a heap by this process
+ *
+ * The numbers are kept up to date by amdgpu_bo_alloc(), amdgpu_bo_import(),
+ * amdgpu_create_bo_from_user_mem() and amdgpu_bo_free(), so the query
+ * doesn't need the kernel. Buffers sitting in the reuse cache still take
+ * memory, they are counted apart from the live ones.
+ *
+ * The kernel budget numbers are the ones from the last refresh, by the
+ * timer started with amdgpu_heap_usage_set_budget_interval() or by a query
+ * with AMDGPU_HEAP_USAGE_REFRESH_BUDGET.
+ *
+ * \param   dev   - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   heap  - \c [in] AMDGPU_HEAP_USAGE_*
+ * \param   flags - \c [in] AMDGPU_HEAP_USAGE_REFRESH_BUDGET to query the
+ *			 kernel numbers first
+ * \param   usage - \c [out] Usage of the heap
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_query_heap_usage(amdgpu_device_handle dev, uint32_t heap,
+			    uint32_t flags, struct amdgpu_heap_usage *usage);
+
+/**
+ * Refresh the kernel heap numbers periodically
+ *
+ * A thread queries the kernel every interval_ns, so that
+ * amdgpu_query_heap_usage() can return recent budget numbers without an
+ * ioctl.
+ *
+ * \param   dev         - \c [in] Device handle.
+ *			       See #amdgpu_device_initialize()
+ * \param   interval_ns - \c [in] Time between refreshes, 0 stops them
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_heap_usage_set_budget_interval(amdgpu_device_handle dev,
+					  uint64_t interval_ns);
+
 /**
  * Get the CRTC ID from the mode object ID
  *
@@ -1484,6 +2210,73 @@ int amdgpu_va_range_alloc2(amdgpu_va_manager_handle va_mgr,
 			   amdgpu_va_handle *va_range_handle,
 			   uint64_t flags);
 
+/**
+ * Initialize a VA manager whose free ranges live in shared memory
+ *
+ * All processes initializing a manager with the same memory allocate from
+ * one address space, so addresses handed out in one process are never
+ * handed out in another, and buffers registered with
+ * amdgpu_va_range_alloc_shared() get the same address everywhere.
+ *
+ * The first process to use the memory sets it up, later ones must pass
+ * the same ranges and alignment. They wait up to a second for it, then set
+ * the memory up themselves if it died or failed, or return -EBUSY. The
+ * ranges must not be used by any other VA manager of the processes,
+ * including the one of the device.
+ *
+ * Ranges allocated by a process that dies are not given back. If it dies
+ * while changing the free ranges and leaves them inconsistent, allocations
+ * fail with -ENOTRECOVERABLE afterwards.
+ *
+ * \param va_mgr - \c [in] VA manager from amdgpu_va_manager_alloc()
+ * \param shm_fd - \c [in] Shared memory file, e.g. from memfd_create() or
+ *		  shm_open(). It is grown if it is empty.
+ * \param low_va_offset, low_va_max, high_va_offset, high_va_max,
+ *        virtual_address_alignment - \c [in] As for amdgpu_va_manager_init()
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_va_manager_deinit()
+*/
+int amdgpu_va_manager_init_shared(amdgpu_va_manager_handle va_mgr, int shm_fd,
+				  uint64_t low_va_offset, uint64_t low_va_max,
+				  uint64_t high_va_offset, uint64_t high_va_max,
+				  uint32_t virtual_address_alignment);
+
+/**
+ * Allocate the VA range of a buffer shared between processes
+ *
+ * The first allocation of a key allocates a range from a shared VA
+ * manager, the following ones, in any process, return the same address
+ * until every handle for the key has been freed with
+ * amdgpu_va_range_free().
+ *
+ * \param va_mgr - \c [in] VA manager from amdgpu_va_manager_init_shared()
+ * \param key - \c [in] Buffer identity all processes agree on, e.g. the
+ *	       inode number of its dma-buf
+ * \param va_range_type - \c [in] Type of MC va range from which to allocate
+ * \param size - \c [in] Size of the range, must not be larger than the one
+ *		the key was first allocated with
+ * \param va_base_alignment - \c [in] Base address alignment, 0 for the
+ *			     default one
+ * \param va_base_allocated - \c [out] Allocated VA base
+ * \param va_range_handle - \c [out] Handle to free the range with
+ * \param flags - \c [in] AMDGPU_VA_RANGE_* flags
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_va_range_alloc_shared(amdgpu_va_manager_handle va_mgr,
+				 uint64_t key,
+				 enum amdgpu_gpu_va_range va_range_type,
+				 uint64_t size,
+				 uint64_t va_base_alignment,
+				 uint64_t *va_base_allocated,
+				 amdgpu_va_handle *va_range_handle,
+				 uint64_t flags);
+
 /**
  *  VA mapping/unmapping for the buffer object
  *
@@ -1570,6 +2363,110 @@ int amdgpu_bo_va_op_raw2(amdgpu_device_handle dev,
 			 uint64_t input_fence_syncobj_array_in,
 			 uint32_t num_syncobj_handles_in);
 
+/**
+ * Create an empty batch of VA operations
+ *
+ * A batch collects the operations of amdgpu_bo_va_op_raw2() and sends them
+ * to the kernel on amdgpu_bo_va_batch_flush(), with adjacent ranges merged
+ * and operations which would be undone in the same batch left out.
+ *
+ * \param   dev   - \c [in] Device handle.
+ *			 See #amdgpu_device_initialize()
+ * \param   batch - \c [out] VA batch
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_va_batch_destroy()
+*/
+int amdgpu_bo_va_batch_create(amdgpu_device_handle dev,
+			      amdgpu_bo_va_batch_handle *batch);
+
+/**
+ * Destroy a batch of VA operations, dropping the ones not flushed
+ *
+ * \param   batch - \c [in] VA batch
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_va_batch_create()
+*/
+int amdgpu_bo_va_batch_destroy(amdgpu_bo_va_batch_handle batch);
+
+/**
+ * Add a VA operation to a batch
+ *
+ * Parameters are the same as for amdgpu_bo_va_op_raw(). The BO must stay
+ * valid until the batch is flushed.
+ *
+ * Unlike a single AMDGPU_VA_OP_UNMAP, an unmap in a batch removes whatever
+ * is mapped in the given range, as AMDGPU_VA_OP_CLEAR does. This allows
+ * unmapping part of a range which was mapped in pieces and merged.
+ *
+ * \param   batch  - \c [in] VA batch
+ * \param   bo     - \c [in] BO handle (may be NULL)
+ * \param   offset - \c [in] Start offset to map
+ * \param   size   - \c [in] Size to map
+ * \param   addr   - \c [in] Start virtual address
+ * \param   flags  - \c [in] Supported flags for mapping/unmapping
+ * \param   ops    - \c [in] AMDGPU_VA_OP_MAP, AMDGPU_VA_OP_UNMAP,
+ *			  AMDGPU_VA_OP_REPLACE or AMDGPU_VA_OP_CLEAR
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_bo_va_batch_add(amdgpu_bo_va_batch_handle batch,
+			   amdgpu_bo_handle bo,
+			   uint64_t offset,
+			   uint64_t size,
+			   uint64_t addr,
+			   uint64_t flags,
+			   uint32_t ops);
+
+/**
+ * Send the operations of a batch to the kernel and empty it
+ *
+ * Maps of neighbouring ranges with the same BO and flags are merged, as
+ * are neighbouring unmaps, and maps whose range is unmapped again right
+ * after are dropped along with the unmap. Operations are otherwise
+ * applied in the order they were added.
+ *
+ * The timeline point is signaled once the page table updates of all
+ * operations are done, including when nothing was left to send. The input
+ * fences are waited for before any operation.
+ *
+ * On error the remaining operations are dropped.
+ *
+ * \param   batch                       - \c [in] VA batch
+ * \param   vm_timeline_syncobj_out     - \c [in] Timeline syncobj to signal, 0 for none
+ * \param   vm_timeline_point           - \c [in] Point to signal on it
+ * \param   input_fence_syncobj_handles - \c [in] Array of syncobj handles to wait for
+ * \param   num_syncobj_handles         - \c [in] Number of syncobj handles
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_va_op_raw2()
+*/
+int amdgpu_bo_va_batch_flush(amdgpu_bo_va_batch_handle batch,
+			     uint32_t vm_timeline_syncobj_out,
+			     uint64_t vm_timeline_point,
+			     uint64_t input_fence_syncobj_handles,
+			     uint32_t num_syncobj_handles);
+
+/**
+ * Query how much a batch of VA operations saved
+ *
+ * \param   batch - \c [in] VA batch
+ * \param   stats - \c [out] Counters since the batch was created
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_bo_va_batch_query_stats(amdgpu_bo_va_batch_handle batch,
+				   struct amdgpu_bo_va_batch_stats *stats);
+
 /**
  *  create semaphore
  *
@@ -2060,6 +2957,121 @@ int amdgpu_userq_signal(amdgpu_device_handle dev,
 int amdgpu_userq_wait(amdgpu_device_handle dev,
 		      struct drm_amdgpu_userq_wait *wait_data);
 
+/**
+ * Create the submission helper for a user mode queue
+ *
+ * \param   dev     - \c [in] device handle
+ * \param   info    - \c [in] CPU view of the queue
+ * \param   ring    - \c [out] ring handle
+ *
+ * \return  0 on success otherwise POSIX Error code
+ */
+int amdgpu_userq_ring_create(amdgpu_device_handle dev,
+			     const struct amdgpu_userq_ring_info *info,
+			     amdgpu_userq_ring_handle *ring);
+
+/**
+ * Destroy the submission helper of a user mode queue
+ *
+ * The queue itself is not freed, see amdgpu_free_userqueue().
+ *
+ * \param   ring    - \c [in] ring handle
+ *
+ * \return  0 on success otherwise POSIX Error code
+ */
+int amdgpu_userq_ring_destroy(amdgpu_userq_ring_handle ring);
+
+/**
+ * Reserve space for a packet
+ *
+ * Safe to call from multiple threads without locking. Every reservation
+ * must be followed by amdgpu_userq_ring_commit() of the same size.
+ *
+ * \param   ring    - \c [in] ring handle
+ * \param   num_dw  - \c [in] packet size in dwords
+ * \param   pos     - \c [out] position of the packet
+ *
+ * \return  0 on success\n
+ *          -EBUSY if the consumer hasn't freed enough space yet, flush
+ *          the ring before retrying so it can make progress\n
+ *          otherwise POSIX Error code
+ */
+int amdgpu_userq_ring_reserve(amdgpu_userq_ring_handle ring,
+			      uint32_t num_dw, uint64_t *pos);
+
+/**
+ * Write packet dwords to reserved space, wrapping around the ring end
+ *
+ * \param   ring    - \c [in] ring handle
+ * \param   pos     - \c [in] position inside a reservation
+ * \param   dw      - \c [in] dwords to write
+ * \param   num_dw  - \c [in] number of dwords
+ */
+void amdgpu_userq_ring_write(amdgpu_userq_ring_handle ring, uint64_t pos,
+			     const uint32_t *dw, uint32_t num_dw);
+
+/**
+ * Mark a reserved packet as complete
+ *
+ * Packets become visible to amdgpu_userq_ring_flush() in reservation order,
+ * so this waits for the commit of all earlier reservations.
+ *
+ * \param   ring    - \c [in] ring handle
+ * \param   pos     - \c [in] position from amdgpu_userq_ring_reserve()
+ * \param   num_dw  - \c [in] packet size in dwords
+ *
+ * \return  0 on success otherwise POSIX Error code
+ */
+int amdgpu_userq_ring_commit(amdgpu_userq_ring_handle ring,
+			     uint64_t pos, uint32_t num_dw);
+
+/**
+ * Hand all committed packets to the consumer
+ *
+ * Updates the wptr and rings the doorbell once for everything committed
+ * since the last flush, nothing is written if there is nothing new.
+ *
+ * \param   ring    - \c [in] ring handle
+ * \param   wptr    - \c [out] optional, the wptr after the flush
+ *
+ * \return  0 on success otherwise POSIX Error code
+ */
+int amdgpu_userq_ring_flush(amdgpu_userq_ring_handle ring, uint64_t *wptr);
+
+/**
+ * Flush the ring and signal a syncobj when the consumer reaches the flushed
+ * packets
+ *
+ * \param   ring    - \c [in] ring handle
+ * \param   syncobj - \c [in] syncobj to signal
+ * \param   point   - \c [in] timeline point, 0 for a binary syncobj
+ *
+ * \return  0 on success otherwise POSIX Error code
+ */
+int amdgpu_userq_ring_signal(amdgpu_userq_ring_handle ring,
+			     uint32_t syncobj, uint64_t point);
+
+/**
+ * Get the memory locations and values the queue has to wait for before
+ * the given syncobjs are signaled
+ *
+ * \param   ring       - \c [in] ring handle
+ * \param   syncobjs   - \c [in] syncobj handles
+ * \param   points     - \c [in] timeline points, 0 for binary syncobjs,
+ *                                can be NULL if all are binary
+ * \param   count      - \c [in] number of syncobjs
+ * \param   fences     - \c [out] address/value pairs to wait for
+ * \param   num_fences - \c [in/out] size of fences, number of fences returned
+ *
+ * \return  0 on success otherwise POSIX Error code
+ */
+int amdgpu_userq_ring_get_wait_fences(amdgpu_userq_ring_handle ring,
+				      const uint32_t *syncobjs,
+				      const uint64_t *points,
+				      uint32_t count,
+				      struct drm_amdgpu_userq_fence_info *fences,
+				      uint32_t *num_fences);
+
 #ifdef __cplusplus
 }
 #endif
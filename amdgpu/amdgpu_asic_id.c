@@ -39,6 +39,44 @@
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
 
+struct amdgpu_asic_id {
+	uint16_t did;
+	uint8_t rid;
+	const char *name;
+};
+
+/* amdgpu.ids compiled at build time, sorted by device and revision id */
+#include "generated_static_table_asic_ids.h"
+
+static int compare_asic_id(const void *a, const void *b)
+{
+	const struct amdgpu_asic_id *id_a = a, *id_b = b;
+
+	if (id_a->did != id_b->did)
+		return id_a->did < id_b->did ? -1 : 1;
+	if (id_a->rid != id_b->rid)
+		return id_a->rid < id_b->rid ? -1 : 1;
+	return 0;
+}
+
+static void amdgpu_lookup_asic_id(struct amdgpu_device *dev)
+{
+	const struct amdgpu_asic_id *id;
+	struct amdgpu_asic_id key = { 0 };
+
+	if (dev->info.asic_id > UINT16_MAX || dev->info.pci_rev_id > UINT8_MAX)
+		return;
+
+	drmMsg("built-in amdgpu.ids version: %s\n", amdgpu_asic_id_table_version);
+
+	key.did = dev->info.asic_id;
+	key.rid = dev->info.pci_rev_id;
+	id = bsearch(&key, amdgpu_asic_id_table, ARRAY_SIZE(amdgpu_asic_id_table),
+		     sizeof(amdgpu_asic_id_table[0]), compare_asic_id);
+	if (id)
+		dev->marketing_name = strdup(id->name);
+}
+
 static int parse_one_line(struct amdgpu_device *dev, const char *line)
 {
 	char *buf, *saveptr;
@@ -271,7 +309,8 @@ static char *find_asic_id_table(void)
 }
 #endif
 
-void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
+static void amdgpu_parse_asic_id_file(struct amdgpu_device *dev,
+				      const char *amdgpu_asic_id_table_path)
 {
 	FILE *fp;
 	char *line = NULL;
@@ -280,21 +319,11 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 	int line_num = 1;
 	int r = 0;
 
-	char *amdgpu_asic_id_table_path = NULL;
-#if HAVE_SECURE_GETENV
-	// if this system lacks secure_getenv(), don't allow extra paths
-	// for security reasons.
-	amdgpu_asic_id_table_path = find_asic_id_table();
-#endif
-	// if not found, use the default AMDGPU_ASIC_ID_TABLE path
-	if (!amdgpu_asic_id_table_path)
-		amdgpu_asic_id_table_path = strdup(AMDGPU_ASIC_ID_TABLE);
-
 	fp = fopen(amdgpu_asic_id_table_path, "r");
 	if (!fp) {
 		fprintf(stderr, "%s: %s\n", amdgpu_asic_id_table_path,
 			strerror(errno));
-		goto get_cpu;
+		return;
 	}
 
 	/* 1st valid line is file version */
@@ -335,9 +364,29 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 
 	free(line);
 	fclose(fp);
+}
+
+void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
+{
+	char *amdgpu_asic_id_table_path = NULL;
+#if HAVE_SECURE_GETENV
+	// if this system lacks secure_getenv(), don't allow extra paths
+	// for security reasons.
+	amdgpu_asic_id_table_path = find_asic_id_table();
+#endif
+	if (amdgpu_asic_id_table_path) {
+		// a table found through AMDGPU_ASIC_ID_TABLE_PATHS replaces
+		// the built-in one
+		amdgpu_parse_asic_id_file(dev, amdgpu_asic_id_table_path);
+		free(amdgpu_asic_id_table_path);
+	} else {
+		amdgpu_lookup_asic_id(dev);
+
+		// the installed table may know ids added after the build
+		if (!dev->marketing_name)
+			amdgpu_parse_asic_id_file(dev, AMDGPU_ASIC_ID_TABLE);
+	}
 
-get_cpu:
-	free(amdgpu_asic_id_table_path);
 	if (dev->info.ids_flags & AMDGPU_IDS_FLAGS_FUSION &&
 	    dev->marketing_name == NULL) {
 		amdgpu_parse_proc_cpuinfo(dev);
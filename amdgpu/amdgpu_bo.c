@@ -62,23 +62,75 @@ static int amdgpu_bo_create(amdgpu_device_handle dev,
 	bo->alloc_size = size;
 	bo->handle = handle;
 	pthread_mutex_init(&bo->cpu_access_mutex, NULL);
+	list_inithead(&bo->vma_list);
 
 	*buf_handle = bo;
 	return 0;
 }
 
+/* Only plain memory allocations whose contents don't carry any promise
+ * beyond the lifetime of the handle may be recycled through the cache.
+ */
+static bool amdgpu_bo_is_reusable(struct amdgpu_bo_alloc_request *alloc_buffer)
+{
+	if (alloc_buffer->preferred_heap & ~(AMDGPU_GEM_DOMAIN_CPU |
+					     AMDGPU_GEM_DOMAIN_GTT |
+					     AMDGPU_GEM_DOMAIN_VRAM))
+		return false;
+
+	return !(alloc_buffer->flags & (AMDGPU_GEM_CREATE_VRAM_CLEARED |
+					AMDGPU_GEM_CREATE_VRAM_WIPE_ON_RELEASE));
+}
+
+/* Heap a buffer counts for in amdgpu_query_heap_usage() */
+static uint32_t amdgpu_bo_usage_heap(uint32_t preferred_heap)
+{
+	if (preferred_heap & AMDGPU_GEM_DOMAIN_VRAM)
+		return AMDGPU_HEAP_USAGE_VRAM;
+	if (preferred_heap & AMDGPU_GEM_DOMAIN_GTT)
+		return AMDGPU_HEAP_USAGE_GTT;
+	if (preferred_heap & AMDGPU_GEM_DOMAIN_CPU)
+		return AMDGPU_HEAP_USAGE_CPU;
+	return AMDGPU_HEAP_USAGE_OTHER;
+}
+
 drm_public int amdgpu_bo_alloc(amdgpu_device_handle dev,
 			       struct amdgpu_bo_alloc_request *alloc_buffer,
 			       amdgpu_bo_handle *buf_handle)
 {
 	union drm_amdgpu_gem_create args;
+	struct amdgpu_bo *bo;
+	uint32_t usage_heap;
+	uint64_t size;
+	bool reusable;
 	int r;
 
 	if (!alloc_buffer || !buf_handle)
 		return -EINVAL;
 
+	usage_heap = amdgpu_bo_usage_heap(alloc_buffer->preferred_heap);
+	size = alloc_buffer->alloc_size;
+	reusable = amdgpu_bo_is_reusable(alloc_buffer);
+	if (reusable) {
+		bo = amdgpu_bo_cache_alloc(&dev->bo_cache, &size,
+					   alloc_buffer->phys_alignment,
+					   alloc_buffer->preferred_heap,
+					   alloc_buffer->flags);
+		if (bo) {
+			pthread_mutex_lock(&dev->bo_table_mutex);
+			r = handle_table_insert(&dev->bo_handles, bo->handle, bo);
+			pthread_mutex_unlock(&dev->bo_table_mutex);
+			if (r) {
+				amdgpu_bo_destroy(bo);
+				return r;
+			}
+			*buf_handle = bo;
+			return 0;
+		}
+	}
+
 	memset(&args, 0, sizeof(args));
-	args.in.bo_size = alloc_buffer->alloc_size;
+	args.in.bo_size = size;
 	args.in.alignment = alloc_buffer->phys_alignment;
 
 	/* Set the placement. */
@@ -92,13 +144,20 @@ drm_public int amdgpu_bo_alloc(amdgpu_device_handle dev,
 		goto out;
 
 	pthread_mutex_lock(&dev->bo_table_mutex);
-	r = amdgpu_bo_create(dev, alloc_buffer->alloc_size, args.out.handle,
-			     buf_handle);
+	r = amdgpu_bo_create(dev, size, args.out.handle, buf_handle);
 	pthread_mutex_unlock(&dev->bo_table_mutex);
 	if (r) {
 		drmCloseBufferHandle(dev->fd, args.out.handle);
+		goto out;
 	}
 
+	bo = *buf_handle;
+	bo->phys_alignment = alloc_buffer->phys_alignment;
+	bo->alloc_flags = alloc_buffer->flags;
+	bo->preferred_heap = alloc_buffer->preferred_heap;
+	bo->reusable = reusable;
+	amdgpu_heap_usage_add(bo, usage_heap);
+
 out:
 	return r;
 }
@@ -111,6 +170,9 @@ drm_public int amdgpu_bo_set_metadata(amdgpu_bo_handle bo,
 	if (!info)
 		return -EINVAL;
 
+	/* Metadata describes the buffer to other users, don't recycle it. */
+	bo->reusable = false;
+
 	args.handle = bo->handle;
 	args.op = AMDGPU_GEM_METADATA_OP_SET_METADATA;
 	args.data.flags = info->flags;
@@ -231,6 +293,7 @@ drm_public int amdgpu_bo_export(amdgpu_bo_handle bo,
 
 	switch (type) {
 	case amdgpu_bo_handle_type_gem_flink_name:
+		bo->reusable = false;
 		r = amdgpu_bo_export_flink(bo);
 		if (r)
 			return r;
@@ -244,6 +307,7 @@ drm_public int amdgpu_bo_export(amdgpu_bo_handle bo,
 		return 0;
 
 	case amdgpu_bo_handle_type_dma_buf_fd:
+		bo->reusable = false;
 		return drmPrimeHandleToFD(bo->dev->fd, bo->handle,
 					  DRM_CLOEXEC | DRM_RDWR,
 					  (int*)shared_handle);
@@ -372,6 +436,8 @@ drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 
 	}
 
+	amdgpu_heap_usage_add(bo, AMDGPU_HEAP_USAGE_IMPORTED);
+
 	output->buf_handle = bo;
 	output->alloc_size = bo->alloc_size;
 	pthread_mutex_unlock(&dev->bo_table_mutex);
@@ -390,6 +456,26 @@ unlock:
 	return r;
 }
 
+drm_private void amdgpu_bo_destroy(struct amdgpu_bo *bo)
+{
+	struct amdgpu_device *dev = bo->dev;
+
+	/* Drop a mapping still kept alive by the vma cache. */
+	pthread_mutex_lock(&dev->vma_mutex);
+	if (bo->cpu_ptr) {
+		list_del(&bo->vma_list);
+		dev->vma_count--;
+		drm_munmap(bo->cpu_ptr, bo->alloc_size);
+		bo->cpu_ptr = NULL;
+	}
+	pthread_mutex_unlock(&dev->vma_mutex);
+
+	amdgpu_heap_usage_remove(bo);
+	drmCloseBufferHandle(bo->dev->fd, bo->handle);
+	pthread_mutex_destroy(&bo->cpu_access_mutex);
+	free(bo);
+}
+
 drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 {
 	struct amdgpu_device *dev;
@@ -413,9 +499,9 @@ drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 			amdgpu_bo_cpu_unmap(bo);
 		}
 
-		drmCloseBufferHandle(dev->fd, bo->handle);
-		pthread_mutex_destroy(&bo->cpu_access_mutex);
-		free(bo);
+		/* see if we can be green and recycle: */
+		if (amdgpu_bo_cache_free(&dev->bo_cache, bo))
+			amdgpu_bo_destroy(bo);
 	}
 
 	pthread_mutex_unlock(&dev->bo_table_mutex);
@@ -428,6 +514,84 @@ drm_public void amdgpu_bo_inc_ref(amdgpu_bo_handle bo)
 	atomic_inc(&bo->refcount);
 }
 
+static void amdgpu_bo_purge_vma_cache(struct amdgpu_device *dev)
+{
+	int limit;
+
+	/* Leave room for the mappings currently in use. */
+	limit = dev->vma_max - atomic_read(&dev->vma_open);
+	if (limit < 0)
+		limit = 0;
+
+	while (dev->vma_count > limit) {
+		struct amdgpu_bo *bo;
+
+		bo = LIST_ENTRY(struct amdgpu_bo, dev->vma_cache.next, vma_list);
+		list_delinit(&bo->vma_list);
+		drm_munmap(bo->cpu_ptr, bo->alloc_size);
+		bo->cpu_ptr = NULL;
+		dev->vma_count--;
+		dev->vma_evictions++;
+	}
+}
+
+drm_private void amdgpu_bo_vma_cache_init(struct amdgpu_device *dev)
+{
+	pthread_mutex_init(&dev->vma_mutex, NULL);
+	list_inithead(&dev->vma_cache);
+	atomic_set(&dev->vma_open, 0);
+	dev->vma_max = 0; /* disabled by default */
+}
+
+drm_private void amdgpu_bo_vma_cache_fini(struct amdgpu_device *dev)
+{
+	pthread_mutex_lock(&dev->vma_mutex);
+	dev->vma_max = 0;
+	amdgpu_bo_purge_vma_cache(dev);
+	pthread_mutex_unlock(&dev->vma_mutex);
+	pthread_mutex_destroy(&dev->vma_mutex);
+}
+
+/* Take the bo's mapping back out of the vma cache, if it is still there. */
+static void *amdgpu_bo_open_vma(struct amdgpu_bo *bo)
+{
+	struct amdgpu_device *dev = bo->dev;
+	void *ptr;
+
+	pthread_mutex_lock(&dev->vma_mutex);
+	ptr = bo->cpu_ptr;
+	if (ptr) {
+		list_delinit(&bo->vma_list);
+		dev->vma_count--;
+		dev->vma_hits++;
+	} else {
+		dev->vma_misses++;
+	}
+	atomic_inc(&dev->vma_open);
+	pthread_mutex_unlock(&dev->vma_mutex);
+
+	return ptr;
+}
+
+/* Returns true if the mapping was handed over to the vma cache. */
+static bool amdgpu_bo_close_vma(struct amdgpu_bo *bo)
+{
+	struct amdgpu_device *dev = bo->dev;
+	bool cached = false;
+
+	pthread_mutex_lock(&dev->vma_mutex);
+	atomic_dec(&dev->vma_open, 1);
+	if (dev->vma_max > 0) {
+		list_addtail(&bo->vma_list, &dev->vma_cache);
+		dev->vma_count++;
+		amdgpu_bo_purge_vma_cache(dev);
+		cached = true;
+	}
+	pthread_mutex_unlock(&dev->vma_mutex);
+
+	return cached;
+}
+
 drm_public int amdgpu_bo_cpu_map(amdgpu_bo_handle bo, void **cpu)
 {
 	union drm_amdgpu_gem_mmap args;
@@ -436,9 +600,9 @@ drm_public int amdgpu_bo_cpu_map(amdgpu_bo_handle bo, void **cpu)
 
 	pthread_mutex_lock(&bo->cpu_access_mutex);
 
-	if (bo->cpu_ptr) {
+	if (bo->cpu_map_count > 0) {
 		/* already mapped */
-		assert(bo->cpu_map_count > 0);
+		assert(bo->cpu_ptr);
 		bo->cpu_map_count++;
 		*cpu = bo->cpu_ptr;
 		pthread_mutex_unlock(&bo->cpu_access_mutex);
@@ -447,6 +611,10 @@ drm_public int amdgpu_bo_cpu_map(amdgpu_bo_handle bo, void **cpu)
 
 	assert(bo->cpu_map_count == 0);
 
+	ptr = amdgpu_bo_open_vma(bo);
+	if (ptr)
+		goto mapped;
+
 	memset(&args, 0, sizeof(args));
 
 	/* Query the buffer address (args.addr_ptr).
@@ -455,30 +623,34 @@ drm_public int amdgpu_bo_cpu_map(amdgpu_bo_handle bo, void **cpu)
 
 	r = drmCommandWriteRead(bo->dev->fd, DRM_AMDGPU_GEM_MMAP, &args,
 				sizeof(args));
-	if (r) {
-		pthread_mutex_unlock(&bo->cpu_access_mutex);
-		return r;
-	}
+	if (r)
+		goto fail;
 
 	/* Map the buffer. */
 	ptr = drm_mmap(NULL, bo->alloc_size, PROT_READ | PROT_WRITE, MAP_SHARED,
 		       bo->dev->fd, args.out.addr_ptr);
 	if (ptr == MAP_FAILED) {
-		pthread_mutex_unlock(&bo->cpu_access_mutex);
-		return -errno;
+		r = -errno;
+		goto fail;
 	}
 
+mapped:
 	bo->cpu_ptr = ptr;
 	bo->cpu_map_count = 1;
 	pthread_mutex_unlock(&bo->cpu_access_mutex);
 
 	*cpu = ptr;
 	return 0;
+
+fail:
+	atomic_dec(&bo->dev->vma_open, 1);
+	pthread_mutex_unlock(&bo->cpu_access_mutex);
+	return r;
 }
 
 drm_public int amdgpu_bo_cpu_unmap(amdgpu_bo_handle bo)
 {
-	int r;
+	int r = 0;
 
 	pthread_mutex_lock(&bo->cpu_access_mutex);
 	assert(bo->cpu_map_count >= 0);
@@ -496,12 +668,49 @@ drm_public int amdgpu_bo_cpu_unmap(amdgpu_bo_handle bo)
 		return 0;
 	}
 
-	r = drm_munmap(bo->cpu_ptr, bo->alloc_size) == 0 ? 0 : -errno;
-	bo->cpu_ptr = NULL;
+	/* Keep the mapping around for the next amdgpu_bo_cpu_map() if
+	 * the vma cache is enabled, otherwise unmap it right away.
+	 */
+	if (!amdgpu_bo_close_vma(bo)) {
+		r = drm_munmap(bo->cpu_ptr, bo->alloc_size) == 0 ? 0 : -errno;
+		bo->cpu_ptr = NULL;
+	}
 	pthread_mutex_unlock(&bo->cpu_access_mutex);
 	return r;
 }
 
+drm_public int amdgpu_bo_set_vma_cache_size(amdgpu_device_handle dev,
+					    int limit)
+{
+	if (!dev || limit < 0)
+		return -EINVAL;
+
+	pthread_mutex_lock(&dev->vma_mutex);
+	dev->vma_max = limit;
+	amdgpu_bo_purge_vma_cache(dev);
+	pthread_mutex_unlock(&dev->vma_mutex);
+
+	return 0;
+}
+
+drm_public int amdgpu_bo_vma_cache_query_stats(amdgpu_device_handle dev,
+					       struct amdgpu_bo_vma_cache_stats *stats)
+{
+	if (!dev || !stats)
+		return -EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+	pthread_mutex_lock(&dev->vma_mutex);
+	stats->hits = dev->vma_hits;
+	stats->misses = dev->vma_misses;
+	stats->evictions = dev->vma_evictions;
+	stats->cached_count = dev->vma_count;
+	stats->open_count = atomic_read(&dev->vma_open);
+	pthread_mutex_unlock(&dev->vma_mutex);
+
+	return 0;
+}
+
 drm_public int amdgpu_query_buffer_size_alignment(amdgpu_device_handle dev,
 				struct amdgpu_buffer_size_alignments *info)
 {
@@ -554,7 +763,7 @@ drm_public int amdgpu_find_bo_by_cpu_mapping(amdgpu_device_handle dev,
 	pthread_mutex_lock(&dev->bo_table_mutex);
 	for (i = 0; i < dev->bo_handles.max_key; i++) {
 		bo = handle_table_lookup(&dev->bo_handles, i);
-		if (!bo || !bo->cpu_ptr || size > bo->alloc_size)
+		if (!bo || !bo->cpu_map_count || size > bo->alloc_size)
 			continue;
 		if (cpu >= bo->cpu_ptr &&
 		    cpu < (void*)((uintptr_t)bo->cpu_ptr + (size_t)bo->alloc_size))
@@ -597,8 +806,11 @@ drm_public int amdgpu_create_bo_from_user_mem(amdgpu_device_handle dev,
 	pthread_mutex_unlock(&dev->bo_table_mutex);
 	if (r) {
 		drmCloseBufferHandle(dev->fd, args.handle);
+		goto out;
 	}
 
+	amdgpu_heap_usage_add(*buf_handle, AMDGPU_HEAP_USAGE_CPU);
+
 out:
 	return r;
 }
@@ -751,6 +963,202 @@ drm_public int amdgpu_bo_list_update(amdgpu_bo_list_handle handle,
 	return r;
 }
 
+drm_public int amdgpu_bo_list_builder_create(amdgpu_device_handle dev,
+					     amdgpu_bo_list_builder_handle *builder)
+{
+	struct amdgpu_bo_list_builder *b;
+
+	if (!dev || !builder)
+		return -EINVAL;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return -ENOMEM;
+
+	b->dev = dev;
+	*builder = b;
+	return 0;
+}
+
+drm_public int amdgpu_bo_list_builder_destroy(amdgpu_bo_list_builder_handle builder)
+{
+	int r = 0;
+
+	if (!builder)
+		return -EINVAL;
+
+	if (builder->kernel_handle)
+		r = amdgpu_bo_list_destroy_raw(builder->dev,
+					       builder->kernel_handle);
+	free(builder->entries);
+	free(builder->index);
+	free(builder);
+	return r;
+}
+
+drm_public int amdgpu_bo_list_builder_add(amdgpu_bo_list_builder_handle builder,
+					  amdgpu_bo_handle bo, uint8_t priority)
+{
+	struct drm_amdgpu_bo_list_entry *entry;
+	uint32_t handle;
+
+	if (!builder || !bo)
+		return -EINVAL;
+
+	handle = bo->handle;
+	if (handle < builder->index_size && builder->index[handle]) {
+		entry = &builder->entries[builder->index[handle] - 1];
+		if (priority > entry->bo_priority) {
+			entry->bo_priority = priority;
+			builder->kernel_dirty = true;
+		}
+		return 0;
+	}
+
+	if (handle >= builder->index_size) {
+		uint64_t size = MAX2((uint64_t)builder->index_size * 2, 256);
+		uint32_t *index;
+
+		while (size <= handle)
+			size *= 2;
+		/* The index size is 32 bits and has to fit into memory */
+		size = MIN2(size, UINT32_MAX);
+		if (handle >= size)
+			return -EINVAL;
+		if (size > SIZE_MAX / sizeof(*index))
+			return -ENOMEM;
+		index = realloc(builder->index, size * sizeof(*index));
+		if (!index)
+			return -ENOMEM;
+		memset(index + builder->index_size, 0,
+		       (size - builder->index_size) * sizeof(*index));
+		builder->index = index;
+		builder->index_size = size;
+	}
+
+	if (builder->num_entries == builder->max_entries) {
+		uint32_t max = MAX2(builder->max_entries * 2, 64);
+
+		entry = realloc(builder->entries, max * sizeof(*entry));
+		if (!entry)
+			return -ENOMEM;
+		builder->entries = entry;
+		builder->max_entries = max;
+	}
+
+	entry = &builder->entries[builder->num_entries++];
+	entry->bo_handle = handle;
+	entry->bo_priority = priority;
+	builder->index[handle] = builder->num_entries;
+	builder->kernel_dirty = true;
+	return 0;
+}
+
+drm_public int amdgpu_bo_list_builder_remove(amdgpu_bo_list_builder_handle builder,
+					     amdgpu_bo_handle bo)
+{
+	struct drm_amdgpu_bo_list_entry *last;
+	uint32_t handle, pos;
+
+	if (!builder || !bo)
+		return -EINVAL;
+
+	handle = bo->handle;
+	if (handle >= builder->index_size || !builder->index[handle])
+		return -ENOENT;
+
+	/* move the last entry into the hole */
+	pos = builder->index[handle] - 1;
+	last = &builder->entries[--builder->num_entries];
+	builder->entries[pos] = *last;
+	builder->index[last->bo_handle] = pos + 1;
+	builder->index[handle] = 0;
+	builder->kernel_dirty = true;
+	return 0;
+}
+
+drm_public int amdgpu_bo_list_builder_reset(amdgpu_bo_list_builder_handle builder)
+{
+	uint32_t i;
+
+	if (!builder)
+		return -EINVAL;
+
+	for (i = 0; i < builder->num_entries; i++)
+		builder->index[builder->entries[i].bo_handle] = 0;
+	builder->num_entries = 0;
+	builder->kernel_dirty = true;
+	return 0;
+}
+
+drm_public int amdgpu_bo_list_builder_get_handle(amdgpu_bo_list_builder_handle builder,
+						 uint32_t *bo_list)
+{
+	union drm_amdgpu_bo_list args;
+	int r;
+
+	if (!builder || !bo_list)
+		return -EINVAL;
+
+	if (!builder->num_entries) {
+		*bo_list = 0;
+		return 0;
+	}
+
+	if (builder->kernel_handle && !builder->kernel_dirty) {
+		*bo_list = builder->kernel_handle;
+		return 0;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.in.operation = builder->kernel_handle ? AMDGPU_BO_LIST_OP_UPDATE :
+						     AMDGPU_BO_LIST_OP_CREATE;
+	args.in.list_handle = builder->kernel_handle;
+	args.in.bo_number = builder->num_entries;
+	args.in.bo_info_size = sizeof(struct drm_amdgpu_bo_list_entry);
+	args.in.bo_info_ptr = (uintptr_t)builder->entries;
+
+	r = drmCommandWriteRead(builder->dev->fd, DRM_AMDGPU_BO_LIST,
+				&args, sizeof(args));
+	if (r)
+		return r;
+
+	if (!builder->kernel_handle)
+		builder->kernel_handle = args.out.list_handle;
+	builder->kernel_dirty = false;
+	*bo_list = builder->kernel_handle;
+	return 0;
+}
+
+drm_public int amdgpu_bo_list_builder_get_chunk(amdgpu_bo_list_builder_handle builder,
+						struct drm_amdgpu_cs_chunk *chunk)
+{
+	if (!builder || !chunk)
+		return -EINVAL;
+
+	memset(&builder->chunk_data, 0, sizeof(builder->chunk_data));
+	builder->chunk_data.bo_number = builder->num_entries;
+	builder->chunk_data.bo_info_size = sizeof(struct drm_amdgpu_bo_list_entry);
+	builder->chunk_data.bo_info_ptr = (uintptr_t)builder->entries;
+
+	chunk->chunk_id = AMDGPU_CHUNK_ID_BO_HANDLES;
+	chunk->length_dw = sizeof(builder->chunk_data) / 4;
+	chunk->chunk_data = (uintptr_t)&builder->chunk_data;
+	return 0;
+}
+
+/* Keep count of the mappings, mapped buffers must not be recycled. */
+static void amdgpu_bo_va_track(amdgpu_bo_handle bo, uint32_t ops)
+{
+	if (!bo)
+		return;
+
+	if (ops == AMDGPU_VA_OP_MAP || ops == AMDGPU_VA_OP_REPLACE)
+		atomic_inc(&bo->va_mappings);
+	else if (ops == AMDGPU_VA_OP_UNMAP)
+		atomic_dec(&bo->va_mappings, 1);
+}
+
 drm_public int amdgpu_bo_va_op(amdgpu_bo_handle bo,
 			       uint64_t offset,
 			       uint64_t size,
@@ -792,6 +1200,8 @@ drm_public int amdgpu_bo_va_op_raw(amdgpu_device_handle dev,
 	va.map_size = size;
 
 	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_GEM_VA, &va, sizeof(va));
+	if (!r)
+		amdgpu_bo_va_track(bo, ops);
 
 	return r;
 }
@@ -828,6 +1238,286 @@ drm_public int amdgpu_bo_va_op_raw2(amdgpu_device_handle dev,
 	va.num_syncobj_handles = num_syncobj_handles;
 
 	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_GEM_VA, &va, sizeof(va));
+	if (!r)
+		amdgpu_bo_va_track(bo, ops);
+
+	return r;
+}
+
+drm_public int amdgpu_bo_va_batch_create(amdgpu_device_handle dev,
+					 amdgpu_bo_va_batch_handle *batch)
+{
+	struct amdgpu_bo_va_batch *b;
+
+	if (!dev || !batch)
+		return -EINVAL;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return -ENOMEM;
+
+	b->dev = dev;
+	*batch = b;
+	return 0;
+}
+
+drm_public int amdgpu_bo_va_batch_destroy(amdgpu_bo_va_batch_handle batch)
+{
+	if (!batch)
+		return -EINVAL;
+
+	free(batch->ops);
+	free(batch);
+	return 0;
+}
+
+drm_public int amdgpu_bo_va_batch_add(amdgpu_bo_va_batch_handle batch,
+				      amdgpu_bo_handle bo,
+				      uint64_t offset,
+				      uint64_t size,
+				      uint64_t addr,
+				      uint64_t flags,
+				      uint32_t ops)
+{
+	struct amdgpu_bo_va_batch_op *op;
+
+	if (!batch || !size)
+		return -EINVAL;
+	if (ops != AMDGPU_VA_OP_MAP && ops != AMDGPU_VA_OP_UNMAP &&
+	    ops != AMDGPU_VA_OP_REPLACE && ops != AMDGPU_VA_OP_CLEAR)
+		return -EINVAL;
+
+	if (batch->num_ops == batch->max_ops) {
+		uint32_t max_ops = MAX2(batch->max_ops * 2, 64);
+
+		op = realloc(batch->ops, max_ops * sizeof(*op));
+		if (!op)
+			return -ENOMEM;
+		batch->ops = op;
+		batch->max_ops = max_ops;
+	}
+
+	op = &batch->ops[batch->num_ops++];
+	memset(op, 0, sizeof(*op));
+	op->addr = addr;
+	op->size = size;
+	if (ops == AMDGPU_VA_OP_UNMAP || ops == AMDGPU_VA_OP_CLEAR) {
+		/* clears don't care about the BO */
+		op->ops = AMDGPU_VA_OP_CLEAR;
+	} else {
+		op->bo = bo;
+		op->offset = offset;
+		op->flags = flags;
+		op->ops = ops;
+	}
+
+	batch->stats.ops++;
+	return 0;
+}
+
+static int amdgpu_bo_va_batch_compare(const void *a, const void *b)
+{
+	const struct amdgpu_bo_va_batch_op *x = a, *y = b;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
 
+static bool amdgpu_bo_va_batch_sorted(struct amdgpu_bo_va_batch *batch,
+				      uint32_t start, uint32_t end)
+{
+	uint32_t i;
+
+	for (i = start + 1; i < end; i++) {
+		if (batch->ops[i - 1].addr > batch->ops[i].addr)
+			return false;
+	}
+	return true;
+}
+
+/* Operations of the same kind which follow each other form a segment. */
+static uint32_t amdgpu_bo_va_batch_segment_end(struct amdgpu_bo_va_batch *batch,
+					       uint32_t start)
+{
+	uint32_t end = start + 1;
+
+	while (end < batch->num_ops &&
+	       batch->ops[end].ops == batch->ops[start].ops)
+		end++;
+
+	return end;
+}
+
+static bool amdgpu_bo_va_batch_mergeable(struct amdgpu_bo_va_batch_op *prev,
+					 struct amdgpu_bo_va_batch_op *op)
+{
+	if (op->ops == AMDGPU_VA_OP_CLEAR)
+		return op->addr <= prev->addr + prev->size;
+
+	return prev->addr + prev->size == op->addr && prev->bo == op->bo &&
+		prev->flags == op->flags &&
+		(!op->bo || prev->offset + prev->size == op->offset);
+}
+
+/* Merges each operation of a segment into the one before if possible. */
+static void amdgpu_bo_va_batch_merge(struct amdgpu_bo_va_batch *batch,
+				     uint32_t start, uint32_t end)
+{
+	struct amdgpu_bo_va_batch_op *prev = NULL, *op;
+	uint32_t i;
+
+	for (i = start; i < end; i++) {
+		op = &batch->ops[i];
+		if (op->cancelled)
+			continue;
+
+		if (prev && amdgpu_bo_va_batch_mergeable(prev, op)) {
+			prev->size = MAX2(prev->size,
+					  op->addr + op->size - prev->addr);
+			op->cancelled = true;
+			batch->stats.coalesced++;
+		} else {
+			prev = op;
+		}
+	}
+}
+
+/*
+ * A map can only succeed on an unmapped range, so a map which the
+ * following clears remove completely never needs to reach the kernel, and
+ * neither does a clear of nothing but such maps. Both segments are sorted
+ * by address and the clears are merged already.
+ */
+static void amdgpu_bo_va_batch_cancel(struct amdgpu_bo_va_batch *batch,
+				      uint32_t maps, uint32_t clears,
+				      uint32_t end)
+{
+	struct amdgpu_bo_va_batch_op *map, *clear;
+	uint32_t i, c = clears;
+
+	for (i = maps; i < clears; i++) {
+		map = &batch->ops[i];
+
+		while (c < end && (batch->ops[c].cancelled ||
+				   batch->ops[c].addr + batch->ops[c].size <=
+				   map->addr))
+			c++;
+		if (c == end)
+			break;
+
+		clear = &batch->ops[c];
+		if (clear->addr <= map->addr &&
+		    map->addr + map->size <= clear->addr + clear->size) {
+			map->cancelled = true;
+			clear->cancelled_size += map->size;
+			batch->stats.cancelled++;
+		}
+	}
+
+	for (i = clears; i < end; i++) {
+		clear = &batch->ops[i];
+		if (!clear->cancelled && clear->cancelled_size >= clear->size) {
+			clear->cancelled = true;
+			batch->stats.cancelled++;
+		}
+	}
+}
+
+drm_public int amdgpu_bo_va_batch_flush(amdgpu_bo_va_batch_handle batch,
+					uint32_t vm_timeline_syncobj_out,
+					uint64_t vm_timeline_point,
+					uint64_t input_fence_syncobj_handles,
+					uint32_t num_syncobj_handles)
+{
+	struct amdgpu_bo_va_batch_op *op;
+	uint32_t i, end, prev, last = UINT32_MAX;
+	int r = 0;
+
+	if (!batch)
+		return -EINVAL;
+
+	/* Maps of disjoint ranges and clears are independent of their
+	 * order, sort them to find neighbours. Replaces of overlapping
+	 * ranges aren't, so those are only merged in order.
+	 */
+	for (i = 0; i < batch->num_ops; i = end) {
+		end = amdgpu_bo_va_batch_segment_end(batch, i);
+		if (batch->ops[i].ops != AMDGPU_VA_OP_REPLACE &&
+		    !amdgpu_bo_va_batch_sorted(batch, i, end))
+			qsort(&batch->ops[i], end - i, sizeof(*op),
+			      amdgpu_bo_va_batch_compare);
+		if (batch->ops[i].ops == AMDGPU_VA_OP_CLEAR)
+			amdgpu_bo_va_batch_merge(batch, i, end);
+	}
+
+	for (i = 0, prev = 0; i < batch->num_ops; prev = i, i = end) {
+		end = amdgpu_bo_va_batch_segment_end(batch, i);
+		if (i && batch->ops[i].ops == AMDGPU_VA_OP_CLEAR &&
+		    batch->ops[prev].ops == AMDGPU_VA_OP_MAP)
+			amdgpu_bo_va_batch_cancel(batch, prev, i, end);
+	}
+
+	for (i = 0; i < batch->num_ops; i = end) {
+		end = amdgpu_bo_va_batch_segment_end(batch, i);
+		if (batch->ops[i].ops != AMDGPU_VA_OP_CLEAR)
+			amdgpu_bo_va_batch_merge(batch, i, end);
+	}
+
+	for (i = 0; i < batch->num_ops; i++) {
+		if (!batch->ops[i].cancelled)
+			last = i;
+	}
+
+	/* Page table updates of a VM complete in order, so only the last
+	 * operation needs to signal the timeline point.
+	 */
+	for (i = 0; !r && last != UINT32_MAX && i <= last; i++) {
+		op = &batch->ops[i];
+		if (op->cancelled)
+			continue;
+
+		r = amdgpu_bo_va_op_raw2(batch->dev, op->bo, op->offset,
+					 op->size, op->addr, op->flags, op->ops,
+					 i == last ? vm_timeline_syncobj_out : 0,
+					 i == last ? vm_timeline_point : 0,
+					 input_fence_syncobj_handles,
+					 num_syncobj_handles);
+		batch->stats.ioctls++;
+	}
+
+	if (!r && vm_timeline_syncobj_out && last == UINT32_MAX) {
+		/* Nothing was sent, the point still has to wait for the
+		 * updates of the previous flush.
+		 */
+		if (batch->last_syncobj)
+			r = drmSyncobjTransfer(batch->dev->fd,
+					       vm_timeline_syncobj_out,
+					       vm_timeline_point,
+					       batch->last_syncobj,
+					       batch->last_point, 0);
+		else if (vm_timeline_point)
+			r = drmSyncobjTimelineSignal(batch->dev->fd,
+						     &vm_timeline_syncobj_out,
+						     &vm_timeline_point, 1);
+		else
+			r = drmSyncobjSignal(batch->dev->fd,
+					     &vm_timeline_syncobj_out, 1);
+	}
+
+	if (!r && vm_timeline_syncobj_out) {
+		batch->last_syncobj = vm_timeline_syncobj_out;
+		batch->last_point = vm_timeline_point;
+	}
+
+	batch->num_ops = 0;
 	return r;
 }
+
+drm_public int amdgpu_bo_va_batch_query_stats(amdgpu_bo_va_batch_handle batch,
+					      struct amdgpu_bo_va_batch_stats *stats)
+{
+	if (!batch || !stats)
+		return -EINVAL;
+
+	*stats = batch->stats;
+	return 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright 2026 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file amdgpu_bo_cache.c
+ *
+ *  Size bucketed cache of freed buffer objects, so that allocation heavy
+ *  users don't go back to the kernel for every amdgpu_bo_alloc().
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+static void add_bucket(struct amdgpu_bo_cache *cache, uint64_t size)
+{
+	unsigned int i = cache->num_buckets;
+
+	assert(i < ARRAY_SIZE(cache->cache_bucket));
+
+	list_inithead(&cache->cache_bucket[i].list);
+	cache->cache_bucket[i].size = size;
+	cache->num_buckets++;
+}
+
+drm_private void amdgpu_bo_cache_init(struct amdgpu_bo_cache *cache)
+{
+	uint64_t size, cache_max_size = 64 * 1024 * 1024;
+
+	pthread_mutex_init(&cache->mutex, NULL);
+
+	/* Same layout as the freedreno and intel caches: three sizes
+	 * between each power of two to keep the rounding waste bounded.
+	 */
+	add_bucket(cache, 4096);
+	add_bucket(cache, 4096 * 2);
+	add_bucket(cache, 4096 * 3);
+
+	for (size = 4 * 4096; size <= cache_max_size; size *= 2) {
+		add_bucket(cache, size);
+		add_bucket(cache, size + size * 1 / 4);
+		add_bucket(cache, size + size * 2 / 4);
+		add_bucket(cache, size + size * 3 / 4);
+	}
+}
+
+static void amdgpu_bo_cache_evict(struct amdgpu_bo_cache *cache,
+				  struct amdgpu_bo *bo)
+{
+	list_del(&bo->list);
+	cache->cached_count--;
+	cache->cached_size -= bo->alloc_size;
+	cache->purged++;
+	amdgpu_bo_destroy(bo);
+}
+
+/* Frees older cached buffers.  Called with cache->mutex held. */
+static void amdgpu_bo_cache_cleanup(struct amdgpu_bo_cache *cache, time_t time)
+{
+	int i;
+
+	if (time && cache->time == time)
+		return;
+
+	for (i = 0; i < cache->num_buckets; i++) {
+		struct amdgpu_bo_bucket *bucket = &cache->cache_bucket[i];
+		struct amdgpu_bo *bo;
+
+		while (!LIST_IS_EMPTY(&bucket->list)) {
+			bo = LIST_ENTRY(struct amdgpu_bo, bucket->list.next,
+					list);
+
+			/* keep things in cache for at least 1 second: */
+			if (time && ((time - bo->free_time) <= 1))
+				break;
+
+			amdgpu_bo_cache_evict(cache, bo);
+		}
+	}
+
+	cache->time = time;
+}
+
+drm_private void amdgpu_bo_cache_fini(struct amdgpu_bo_cache *cache)
+{
+	pthread_mutex_lock(&cache->mutex);
+	amdgpu_bo_cache_cleanup(cache, 0);
+	pthread_mutex_unlock(&cache->mutex);
+	pthread_mutex_destroy(&cache->mutex);
+}
+
+static struct amdgpu_bo_bucket *get_bucket(struct amdgpu_bo_cache *cache,
+					   uint64_t size)
+{
+	int i;
+
+	for (i = 0; i < cache->num_buckets; i++) {
+		struct amdgpu_bo_bucket *bucket = &cache->cache_bucket[i];
+		if (bucket->size >= size)
+			return bucket;
+	}
+
+	return NULL;
+}
+
+static bool is_compatible(struct amdgpu_bo *bo, uint64_t alignment,
+			  uint32_t heap, uint64_t flags)
+{
+	if (bo->preferred_heap != heap || bo->alloc_flags != flags)
+		return false;
+
+	if (alignment > bo->phys_alignment)
+		return false;
+
+	return !alignment || (bo->phys_alignment % alignment) == 0;
+}
+
+static bool is_idle(struct amdgpu_bo *bo)
+{
+	bool busy = true;
+
+	return amdgpu_bo_wait_for_idle(bo, 0, &busy) == 0 && !busy;
+}
+
+static struct amdgpu_bo *find_in_bucket(struct amdgpu_bo_bucket *bucket,
+					uint64_t alignment, uint32_t heap,
+					uint64_t flags)
+{
+	struct amdgpu_bo *bo;
+
+	/* The list is in free order, so the first compatible buffer is
+	 * also the one most likely to be idle.  If that one is still busy
+	 * the later ones will be too, so don't bother looking further.
+	 */
+	LIST_FOR_EACH_ENTRY(bo, &bucket->list, list) {
+		if (!is_compatible(bo, alignment, heap, flags))
+			continue;
+
+		if (!is_idle(bo))
+			return NULL;
+
+		list_del(&bo->list);
+		return bo;
+	}
+
+	return NULL;
+}
+
+/* NOTE: size is rounded up to the bucket size if caching is enabled.
+ * The returned buffer still needs to be added to the handle table.
+ */
+drm_private struct amdgpu_bo *
+amdgpu_bo_cache_alloc(struct amdgpu_bo_cache *cache, uint64_t *size,
+		      uint64_t alignment, uint32_t heap, uint64_t flags)
+{
+	struct amdgpu_bo_bucket *bucket;
+	struct amdgpu_bo *bo = NULL;
+
+	pthread_mutex_lock(&cache->mutex);
+	if (!cache->enabled) {
+		pthread_mutex_unlock(&cache->mutex);
+		return NULL;
+	}
+
+	bucket = get_bucket(cache, ALIGN(*size, 4096));
+	if (bucket) {
+		*size = bucket->size;
+		bo = find_in_bucket(bucket, alignment, heap, flags);
+	}
+
+	if (bo) {
+		cache->hits++;
+		cache->cached_count--;
+		cache->cached_size -= bo->alloc_size;
+		amdgpu_heap_usage_reuse(bo);
+		atomic_set(&bo->refcount, 1);
+	} else {
+		cache->misses++;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return bo;
+}
+
+/* Called with the bo already removed from the device handle tables. */
+drm_private int amdgpu_bo_cache_free(struct amdgpu_bo_cache *cache,
+				     struct amdgpu_bo *bo)
+{
+	struct amdgpu_bo_bucket *bucket;
+	struct timespec time;
+
+	/* The kernel only drops GPU VA mappings when the handle is closed. */
+	if (!bo->reusable || atomic_read(&bo->va_mappings))
+		return -1;
+
+	pthread_mutex_lock(&cache->mutex);
+	bucket = cache->enabled ? get_bucket(cache, bo->alloc_size) : NULL;
+
+	/* Only buffers allocated at a bucket size can be handed out again. */
+	if (!bucket || bucket->size != bo->alloc_size) {
+		pthread_mutex_unlock(&cache->mutex);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	bo->free_time = time.tv_sec;
+	amdgpu_heap_usage_cache(bo);
+	list_addtail(&bo->list, &bucket->list);
+	cache->cached_count++;
+	cache->cached_size += bo->alloc_size;
+	amdgpu_bo_cache_cleanup(cache, time.tv_sec);
+	pthread_mutex_unlock(&cache->mutex);
+
+	return 0;
+}
+
+drm_public int amdgpu_bo_cache_enable(amdgpu_device_handle dev, bool enable)
+{
+	struct amdgpu_bo_cache *cache;
+
+	if (!dev)
+		return -EINVAL;
+
+	cache = &dev->bo_cache;
+	pthread_mutex_lock(&cache->mutex);
+	cache->enabled = enable;
+	if (!enable)
+		amdgpu_bo_cache_cleanup(cache, 0);
+	pthread_mutex_unlock(&cache->mutex);
+
+	return 0;
+}
+
+drm_public int amdgpu_bo_cache_query_stats(amdgpu_device_handle dev,
+					   struct amdgpu_bo_cache_stats *stats)
+{
+	struct amdgpu_bo_cache *cache;
+
+	if (!dev || !stats)
+		return -EINVAL;
+
+	cache = &dev->bo_cache;
+	memset(stats, 0, sizeof(*stats));
+	pthread_mutex_lock(&cache->mutex);
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->purged = cache->purged;
+	stats->cached_count = cache->cached_count;
+	stats->cached_size = cache->cached_size;
+	pthread_mutex_unlock(&cache->mutex);
+
+	return 0;
+}
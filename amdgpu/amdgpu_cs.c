@@ -35,9 +35,210 @@
 #include "xf86drm.h"
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
+#include "util_math.h"
 
 static int amdgpu_cs_unreference_sem(amdgpu_semaphore_handle sem);
 static int amdgpu_cs_reset_sem(amdgpu_semaphore_handle sem);
+static void amdgpu_cs_fence_handle_cache_purge(struct amdgpu_device *dev,
+					       uint32_t ctx_id);
+
+static void amdgpu_cs_release_fence_bo(struct amdgpu_bo *bo)
+{
+	amdgpu_bo_cpu_unmap(bo);
+	amdgpu_bo_free(bo);
+}
+
+/* Make room for retiring the tracked fence buffer of a ring. */
+static int amdgpu_cs_reserve_retired_fence_bo(amdgpu_context_handle context)
+{
+	uint32_t max = MAX2(context->max_retired_fence_bos * 2, 4);
+	struct amdgpu_bo **bos;
+
+	if (context->num_retired_fence_bos < context->max_retired_fence_bos)
+		return 0;
+
+	bos = realloc(context->retired_fence_bos, max * sizeof(*bos));
+	if (!bos)
+		return -ENOMEM;
+	context->retired_fence_bos = bos;
+	context->max_retired_fence_bos = max;
+	return 0;
+}
+
+/**
+ * Stop tracking the user fence of a ring. Fence queries may still be
+ * reading the old location, so the buffer stays mapped until the context
+ * is freed. Room must have been reserved with
+ * amdgpu_cs_reserve_retired_fence_bo().
+ * Must be called with the context sequence_mutex held.
+ */
+static void amdgpu_cs_untrack_user_fence(amdgpu_context_handle context,
+					 struct amdgpu_cs_user_fence *user_fence)
+{
+	struct amdgpu_bo *bo = user_fence->bo;
+	uint32_t i;
+
+	if (!bo)
+		return;
+
+	__atomic_store_n(&user_fence->cpu_addr, NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&user_fence->seq, 0, __ATOMIC_RELEASE);
+	user_fence->bo = NULL;
+	user_fence->offset = 0;
+
+	/* A buffer retired before keeps the mapping alive already */
+	for (i = 0; i < context->num_retired_fence_bos; i++) {
+		if (context->retired_fence_bos[i] == bo) {
+			amdgpu_cs_release_fence_bo(bo);
+			return;
+		}
+	}
+	context->retired_fence_bos[context->num_retired_fence_bos++] = bo;
+}
+
+/**
+ * Look up the state of a ring, optionally allocating the table for the IP
+ * type. Most contexts only ever use one or two IP types.
+ * Must be called with the context sequence_mutex held.
+ */
+static struct amdgpu_cs_ring_state *
+amdgpu_cs_get_ring_state(amdgpu_context_handle context, unsigned ip_type,
+			 unsigned ip_instance, uint32_t ring, bool create)
+{
+	struct amdgpu_cs_ring_state *state = context->ring_state[ip_type];
+
+	if (!state) {
+		if (!create)
+			return NULL;
+
+		state = calloc(AMDGPU_CS_RINGS_PER_IP, sizeof(*state));
+		if (!state)
+			return NULL;
+		/* published for the lock free fence queries */
+		__atomic_store_n(&context->ring_state[ip_type], state,
+				 __ATOMIC_RELEASE);
+	}
+
+	return &state[ip_instance * AMDGPU_CS_MAX_RINGS + ring];
+}
+
+static int amdgpu_cs_ring_add_sem(struct amdgpu_cs_ring_state *state,
+				  amdgpu_semaphore_handle sem)
+{
+	if (state->num_sems == state->max_sems) {
+		uint32_t max_sems = MAX2(state->max_sems * 2, 4);
+		struct drm_amdgpu_cs_chunk_dep *deps;
+		amdgpu_semaphore_handle *sems;
+
+		sems = realloc(state->sems, max_sems * sizeof(*sems));
+		if (!sems)
+			return -ENOMEM;
+		state->sems = sems;
+
+		deps = realloc(state->sem_deps, max_sems * sizeof(*deps));
+		if (!deps)
+			return -ENOMEM;
+		state->sem_deps = deps;
+		state->max_sems = max_sems;
+	}
+
+	amdgpu_cs_chunk_fence_to_dep(&sem->signal_fence,
+				     &state->sem_deps[state->num_sems]);
+	state->sems[state->num_sems++] = sem;
+	return 0;
+}
+
+/* Semaphores are used up by the submission they were waited for with. */
+static void amdgpu_cs_ring_release_sems(struct amdgpu_cs_ring_state *state)
+{
+	uint32_t i;
+
+	for (i = 0; i < state->num_sems; i++) {
+		amdgpu_cs_reset_sem(state->sems[i]);
+		amdgpu_cs_unreference_sem(state->sems[i]);
+	}
+	state->num_sems = 0;
+}
+
+/**
+ * Remember the user fence location of the last submission to a ring.
+ *
+ * Only buffers the caller already keeps mapped are tracked, since mapping
+ * the fence buffer would cost more than the fence queries it saves.
+ * Must be called with the context sequence_mutex held.
+ */
+static void amdgpu_cs_track_user_fence(amdgpu_context_handle context,
+				       struct amdgpu_cs_ring_state *state,
+				       struct amdgpu_cs_fence_info *fence_info,
+				       uint64_t seq)
+{
+	struct amdgpu_cs_user_fence *user_fence = &state->user_fence;
+	struct amdgpu_bo *bo = fence_info->handle;
+	void *cpu;
+
+	if (user_fence->bo == bo && user_fence->offset == fence_info->offset) {
+		__atomic_store_n(&user_fence->seq, seq, __ATOMIC_RELEASE);
+		return;
+	}
+
+	/* Without room to retire the old buffer keep tracking it, newer
+	 * fences are then simply left to the kernel. */
+	if (amdgpu_cs_reserve_retired_fence_bo(context))
+		return;
+	amdgpu_cs_untrack_user_fence(context, user_fence);
+
+	if (!bo->cpu_map_count ||
+	    (fence_info->offset + 1) * sizeof(uint64_t) > bo->alloc_size)
+		return;
+
+	if (amdgpu_bo_cpu_map(bo, &cpu))
+		return;
+
+	/* Our own reference, so the caller freeing the buffer can't pull
+	 * the mapping from under a query running without the lock. */
+	amdgpu_bo_inc_ref(bo);
+	user_fence->bo = bo;
+	user_fence->offset = fence_info->offset;
+	__atomic_store_n(&user_fence->seq, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&user_fence->cpu_addr,
+			 (uint64_t *)cpu + fence_info->offset, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check \p fence against the user fence of its ring, without the context
+ * sequence_mutex. Returns 1 if the user fence shows it as signaled, 0 if
+ * not yet, and -1 if only the kernel knows: the fence was submitted after
+ * the last submission with a tracked user fence, without a user fence or
+ * through amdgpu_cs_submit_raw2().
+ */
+static int amdgpu_cs_user_fence_check(struct amdgpu_cs_fence *fence)
+{
+	amdgpu_context_handle context = fence->context;
+	struct amdgpu_cs_ring_state *state;
+	volatile uint64_t *cpu_addr;
+	uint64_t seq;
+	int r = -1;
+
+	state = __atomic_load_n(&context->ring_state[fence->ip_type],
+				__ATOMIC_ACQUIRE);
+	if (!state)
+		return -1;
+	state += fence->ip_instance * AMDGPU_CS_MAX_RINGS + fence->ring;
+
+	/* Untracking a fence buffer clears cpu_addr before seq, tracking one
+	 * sets seq before cpu_addr. Seeing the same cpu_addr around seq means
+	 * both belong to the same buffer, which stays mapped anyway.
+	 */
+	cpu_addr = __atomic_load_n(&state->user_fence.cpu_addr,
+				   __ATOMIC_ACQUIRE);
+	seq = __atomic_load_n(&state->user_fence.seq, __ATOMIC_ACQUIRE);
+	if (cpu_addr && fence->fence <= seq &&
+	    __atomic_load_n(&state->user_fence.cpu_addr,
+			    __ATOMIC_ACQUIRE) == cpu_addr)
+		r = __atomic_load_n(cpu_addr, __ATOMIC_ACQUIRE) >= fence->fence;
+
+	return r;
+}
 
 /**
  * Create command submission context
@@ -54,7 +255,6 @@ drm_public int amdgpu_cs_ctx_create2(amdgpu_device_handle dev,
 {
 	struct amdgpu_context *gpu_context;
 	union drm_amdgpu_ctx args;
-	int i, j, k;
 	int r;
 	char *override_priority;
 
@@ -92,10 +292,6 @@ drm_public int amdgpu_cs_ctx_create2(amdgpu_device_handle dev,
 		goto error;
 
 	gpu_context->id = args.out.alloc.ctx_id;
-	for (i = 0; i < AMDGPU_HW_IP_NUM; i++)
-		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++)
-			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++)
-				list_inithead(&gpu_context->sem_list[i][j][k]);
 	*context = (amdgpu_context_handle)gpu_context;
 
 	return 0;
@@ -123,32 +319,42 @@ drm_public int amdgpu_cs_ctx_create(amdgpu_device_handle dev,
 drm_public int amdgpu_cs_ctx_free(amdgpu_context_handle context)
 {
 	union drm_amdgpu_ctx args;
-	int i, j, k;
+	uint32_t k;
+	int i, j;
 	int r;
 
 	if (!context)
 		return -EINVAL;
 
-	pthread_mutex_destroy(&context->sequence_mutex);
-
 	/* now deal with kernel side */
 	memset(&args, 0, sizeof(args));
 	args.in.op = AMDGPU_CTX_OP_FREE_CTX;
 	args.in.ctx_id = context->id;
 	r = drmCommandWriteRead(context->dev->fd, DRM_AMDGPU_CTX,
 				&args, sizeof(args));
+
+	/* The kernel hands the id out again, forget its converted fences. */
+	amdgpu_cs_fence_handle_cache_purge(context->dev, context->id);
+
 	for (i = 0; i < AMDGPU_HW_IP_NUM; i++) {
-		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++) {
-			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++) {
-				amdgpu_semaphore_handle sem, tmp;
-				LIST_FOR_EACH_ENTRY_SAFE(sem, tmp, &context->sem_list[i][j][k], list) {
-					list_del(&sem->list);
-					amdgpu_cs_reset_sem(sem);
-					amdgpu_cs_unreference_sem(sem);
-				}
-			}
+		struct amdgpu_cs_ring_state *state = context->ring_state[i];
+
+		if (!state)
+			continue;
+
+		for (j = 0; j < AMDGPU_CS_RINGS_PER_IP; j++) {
+			amdgpu_cs_ring_release_sems(&state[j]);
+			if (state[j].user_fence.bo)
+				amdgpu_cs_release_fence_bo(state[j].user_fence.bo);
+			free(state[j].sems);
+			free(state[j].sem_deps);
 		}
+		free(state);
 	}
+	for (k = 0; k < context->num_retired_fence_bos; k++)
+		amdgpu_cs_release_fence_bo(context->retired_fence_bos[k]);
+	free(context->retired_fence_bos);
+	pthread_mutex_destroy(&context->sequence_mutex);
 	free(context);
 
 	return r;
@@ -257,17 +463,17 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 	struct drm_amdgpu_cs_chunk *chunks;
 	struct drm_amdgpu_cs_chunk_data *chunk_data;
 	struct drm_amdgpu_cs_chunk_dep *dependencies = NULL;
-	struct drm_amdgpu_cs_chunk_dep *sem_dependencies = NULL;
 	amdgpu_device_handle dev = context->dev;
-	struct list_head *sem_list;
-	amdgpu_semaphore_handle sem, tmp;
-	uint32_t i, size, num_chunks, bo_list_handle = 0, sem_count = 0;
+	struct amdgpu_cs_ring_state *state;
+	uint32_t i, size, num_chunks, bo_list_handle = 0;
 	uint64_t seq_no;
 	bool user_fence;
 	int r = 0;
 
 	if (ibs_request->ip_type >= AMDGPU_HW_IP_NUM)
 		return -EINVAL;
+	if (ibs_request->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return -EINVAL;
 	if (ibs_request->ring >= AMDGPU_CS_MAX_RINGS)
 		return -EINVAL;
 	if (ibs_request->number_of_ibs == 0) {
@@ -305,8 +511,6 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 		chunk_data[i].ib_data.flags = ib->flags;
 	}
 
-	pthread_mutex_lock(&context->sequence_mutex);
-
 	if (user_fence) {
 		i = num_chunks++;
 
@@ -325,10 +529,6 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 	if (ibs_request->number_of_dependencies) {
 		dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) *
 			ibs_request->number_of_dependencies);
-		if (!dependencies) {
-			r = -ENOMEM;
-			goto error_unlock;
-		}
 
 		for (i = 0; i < ibs_request->number_of_dependencies; ++i) {
 			struct amdgpu_cs_fence *info = &ibs_request->dependencies[i];
@@ -349,44 +549,39 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 		chunks[i].chunk_data = (uint64_t)(uintptr_t)dependencies;
 	}
 
-	sem_list = &context->sem_list[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring];
-	LIST_FOR_EACH_ENTRY(sem, sem_list, list)
-		sem_count++;
-	if (sem_count) {
-		sem_dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) * sem_count);
-		if (!sem_dependencies) {
-			r = -ENOMEM;
-			goto error_unlock;
-		}
-		sem_count = 0;
-		LIST_FOR_EACH_ENTRY_SAFE(sem, tmp, sem_list, list) {
-			struct amdgpu_cs_fence *info = &sem->signal_fence;
-			struct drm_amdgpu_cs_chunk_dep *dep = &sem_dependencies[sem_count++];
-			dep->ip_type = info->ip_type;
-			dep->ip_instance = info->ip_instance;
-			dep->ring = info->ring;
-			dep->ctx_id = info->context->id;
-			dep->handle = info->fence;
+	/* Only the semaphores and the sequence number need the lock,
+	 * everything else has been built above.
+	 */
+	pthread_mutex_lock(&context->sequence_mutex);
 
-			list_del(&sem->list);
-			amdgpu_cs_reset_sem(sem);
-			amdgpu_cs_unreference_sem(sem);
-		}
+	state = amdgpu_cs_get_ring_state(context, ibs_request->ip_type,
+					 ibs_request->ip_instance,
+					 ibs_request->ring, true);
+	if (!state) {
+		r = -ENOMEM;
+		goto error_unlock;
+	}
+
+	if (state->num_sems) {
 		i = num_chunks++;
 
 		/* dependencies chunk */
 		chunks[i].chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
-		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 * sem_count;
-		chunks[i].chunk_data = (uint64_t)(uintptr_t)sem_dependencies;
+		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 * state->num_sems;
+		chunks[i].chunk_data = (uint64_t)(uintptr_t)state->sem_deps;
 	}
 
 	r = amdgpu_cs_submit_raw2(dev, context, bo_list_handle, num_chunks,
 				  chunks, &seq_no);
+	amdgpu_cs_ring_release_sems(state);
 	if (r)
 		goto error_unlock;
 
 	ibs_request->seq_no = seq_no;
-	context->last_seq[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring] = ibs_request->seq_no;
+	state->last_seq = ibs_request->seq_no;
+	if (user_fence)
+		amdgpu_cs_track_user_fence(context, state,
+					   &ibs_request->fence_info, seq_no);
 error_unlock:
 	pthread_mutex_unlock(&context->sequence_mutex);
 	return r;
@@ -414,6 +609,234 @@ drm_public int amdgpu_cs_submit(amdgpu_context_handle context,
 	return r;
 }
 
+/* Grow a dependency array without keeping the old contents. */
+static int amdgpu_cs_reserve_deps(struct drm_amdgpu_cs_chunk_dep **deps,
+				  uint32_t *max, uint32_t count)
+{
+	struct drm_amdgpu_cs_chunk_dep *tmp;
+	uint32_t new_max;
+
+	if (count <= *max)
+		return 0;
+
+	new_max = MAX2(count, *max * 2);
+	tmp = realloc(*deps, sizeof(**deps) * new_max);
+	if (!tmp)
+		return -ENOMEM;
+
+	*deps = tmp;
+	*max = new_max;
+	return 0;
+}
+
+drm_public int amdgpu_cs_submission_create(amdgpu_context_handle context,
+					   struct amdgpu_cs_request *ibs_request,
+					   amdgpu_cs_submission_handle *submission)
+{
+	struct amdgpu_cs_submission *sub;
+	uint32_t i;
+	int r;
+
+	if (!context || !ibs_request || !submission)
+		return -EINVAL;
+	if (ibs_request->ip_type >= AMDGPU_HW_IP_NUM)
+		return -EINVAL;
+	if (ibs_request->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return -EINVAL;
+	if (ibs_request->ring >= AMDGPU_CS_MAX_RINGS)
+		return -EINVAL;
+	if (ibs_request->number_of_ibs == 0 ||
+	    ibs_request->number_of_ibs > AMDGPU_CS_MAX_IBS_PER_SUBMIT)
+		return -EINVAL;
+
+	sub = calloc(1, sizeof(*sub));
+	if (!sub)
+		return -ENOMEM;
+
+	sub->context = context;
+	sub->ip_type = ibs_request->ip_type;
+	sub->ip_instance = ibs_request->ip_instance;
+	sub->ring = ibs_request->ring;
+	sub->number_of_ibs = ibs_request->number_of_ibs;
+	if (ibs_request->resources)
+		sub->bo_list_handle = ibs_request->resources->handle;
+
+	for (i = 0; i < AMDGPU_CS_SUBMISSION_MAX_CHUNKS; i++)
+		sub->chunk_array[i] = (uint64_t)(uintptr_t)&sub->chunks[i];
+
+	for (i = 0; i < sub->number_of_ibs; i++) {
+		sub->chunks[i].chunk_id = AMDGPU_CHUNK_ID_IB;
+		sub->chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_ib) / 4;
+		sub->chunks[i].chunk_data = (uint64_t)(uintptr_t)&sub->chunk_data[i];
+
+		sub->chunk_data[i].ib_data.ip_type = sub->ip_type;
+		sub->chunk_data[i].ib_data.ip_instance = sub->ip_instance;
+		sub->chunk_data[i].ib_data.ring = sub->ring;
+		amdgpu_cs_submission_update_ib(sub, i, &ibs_request->ibs[i]);
+	}
+	sub->num_fixed_chunks = sub->number_of_ibs;
+
+	if (ibs_request->fence_info.handle) {
+		i = sub->num_fixed_chunks++;
+
+		sub->chunks[i].chunk_id = AMDGPU_CHUNK_ID_FENCE;
+		sub->chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_fence) / 4;
+		sub->chunks[i].chunk_data = (uint64_t)(uintptr_t)&sub->chunk_data[i];
+		amdgpu_cs_chunk_fence_info_to_data(&ibs_request->fence_info,
+						   &sub->chunk_data[i]);
+		sub->fence_info = ibs_request->fence_info;
+	}
+
+	r = amdgpu_cs_submission_set_dependencies(sub,
+						  ibs_request->number_of_dependencies,
+						  ibs_request->dependencies);
+	if (r) {
+		amdgpu_cs_submission_destroy(sub);
+		return r;
+	}
+
+	*submission = sub;
+	return 0;
+}
+
+drm_public int amdgpu_cs_submission_update_ib(amdgpu_cs_submission_handle sub,
+					      uint32_t index,
+					      struct amdgpu_cs_ib_info *ib)
+{
+	struct drm_amdgpu_cs_chunk_ib *ib_data;
+
+	if (!sub || !ib || index >= sub->number_of_ibs)
+		return -EINVAL;
+
+	ib_data = &sub->chunk_data[index].ib_data;
+	ib_data->va_start = ib->ib_mc_address;
+	ib_data->ib_bytes = ib->size * 4;
+	ib_data->flags = ib->flags;
+	return 0;
+}
+
+drm_public int amdgpu_cs_submission_set_dependencies(amdgpu_cs_submission_handle sub,
+						     uint32_t number_of_dependencies,
+						     struct amdgpu_cs_fence *dependencies)
+{
+	uint32_t i;
+	int r;
+
+	if (!sub || (number_of_dependencies && !dependencies))
+		return -EINVAL;
+
+	r = amdgpu_cs_reserve_deps(&sub->dependencies, &sub->max_dependencies,
+				   number_of_dependencies);
+	if (r)
+		return r;
+
+	for (i = 0; i < number_of_dependencies; i++)
+		amdgpu_cs_chunk_fence_to_dep(&dependencies[i],
+					     &sub->dependencies[i]);
+	sub->number_of_dependencies = number_of_dependencies;
+	return 0;
+}
+
+drm_public int amdgpu_cs_submission_set_bo_list(amdgpu_cs_submission_handle sub,
+						uint32_t bo_list_handle)
+{
+	if (!sub)
+		return -EINVAL;
+
+	sub->bo_list_handle = bo_list_handle;
+	return 0;
+}
+
+static int amdgpu_cs_submit_chunk_array(amdgpu_device_handle dev,
+					amdgpu_context_handle context,
+					uint32_t bo_list_handle,
+					int num_chunks,
+					uint64_t *chunk_array,
+					uint64_t *seq_no)
+{
+	union drm_amdgpu_cs cs;
+	int r;
+
+	memset(&cs, 0, sizeof(cs));
+	cs.in.chunks = (uint64_t)(uintptr_t)chunk_array;
+	cs.in.ctx_id = context->id;
+	cs.in.bo_list_handle = bo_list_handle;
+	cs.in.num_chunks = num_chunks;
+	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_CS,
+				&cs, sizeof(cs));
+	if (!r && seq_no)
+		*seq_no = cs.out.handle;
+	return r;
+}
+
+drm_public int amdgpu_cs_submission_submit(amdgpu_cs_submission_handle sub,
+					   uint64_t *seq_no)
+{
+	struct drm_amdgpu_cs_chunk *chunk;
+	amdgpu_context_handle context;
+	struct amdgpu_cs_ring_state *state;
+	uint32_t num_chunks;
+	uint64_t seq;
+	int r;
+
+	if (!sub)
+		return -EINVAL;
+
+	context = sub->context;
+	num_chunks = sub->num_fixed_chunks;
+	if (sub->number_of_dependencies) {
+		chunk = &sub->chunks[num_chunks++];
+		chunk->chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
+		chunk->length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 *
+			sub->number_of_dependencies;
+		chunk->chunk_data = (uint64_t)(uintptr_t)sub->dependencies;
+	}
+
+	pthread_mutex_lock(&context->sequence_mutex);
+
+	state = amdgpu_cs_get_ring_state(context, sub->ip_type,
+					 sub->ip_instance, sub->ring, true);
+	if (!state) {
+		r = -ENOMEM;
+		goto error_unlock;
+	}
+
+	if (state->num_sems) {
+		chunk = &sub->chunks[num_chunks++];
+		chunk->chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
+		chunk->length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 *
+			state->num_sems;
+		chunk->chunk_data = (uint64_t)(uintptr_t)state->sem_deps;
+	}
+
+	r = amdgpu_cs_submit_chunk_array(context->dev, context,
+					 sub->bo_list_handle, num_chunks,
+					 sub->chunk_array, &seq);
+	amdgpu_cs_ring_release_sems(state);
+	if (r)
+		goto error_unlock;
+
+	state->last_seq = seq;
+	if (sub->fence_info.handle)
+		amdgpu_cs_track_user_fence(context, state, &sub->fence_info,
+					   seq);
+	if (seq_no)
+		*seq_no = seq;
+error_unlock:
+	pthread_mutex_unlock(&context->sequence_mutex);
+	return r;
+}
+
+drm_public int amdgpu_cs_submission_destroy(amdgpu_cs_submission_handle sub)
+{
+	if (!sub)
+		return -EINVAL;
+
+	free(sub->dependencies);
+	free(sub);
+	return 0;
+}
+
 /**
  * Calculate absolute timeout.
  *
@@ -481,6 +904,7 @@ drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 					    uint64_t flags,
 					    uint32_t *expired)
 {
+	amdgpu_context_handle context;
 	bool busy = true;
 	int r;
 
@@ -488,6 +912,8 @@ drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 		return -EINVAL;
 	if (fence->ip_type >= AMDGPU_HW_IP_NUM)
 		return -EINVAL;
+	if (fence->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return -EINVAL;
 	if (fence->ring >= AMDGPU_CS_MAX_RINGS)
 		return -EINVAL;
 	if (fence->fence == AMDGPU_NULL_SUBMIT_SEQ) {
@@ -497,6 +923,24 @@ drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 
 	*expired = false;
 
+	/* Look at the user fence first, the kernel is only needed if the
+	 * fence hasn't been reached yet and the caller wants to wait.
+	 */
+	context = fence->context;
+	r = amdgpu_cs_user_fence_check(fence);
+	if (r == 1) {
+		__atomic_add_fetch(&context->user_fence_signaled, 1,
+				   __ATOMIC_RELAXED);
+		*expired = true;
+		return 0;
+	}
+	if (r == 0 && !timeout_ns) {
+		__atomic_add_fetch(&context->user_fence_busy, 1,
+				   __ATOMIC_RELAXED);
+		return 0;
+	}
+	__atomic_add_fetch(&context->fence_ioctls, 1, __ATOMIC_RELAXED);
+
 	r = amdgpu_ioctl_wait_cs(fence->context, fence->ip_type,
 				fence->ip_instance, fence->ring,
 			       	fence->fence, timeout_ns, flags, &busy);
@@ -507,6 +951,22 @@ drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 	return r;
 }
 
+drm_public int amdgpu_cs_ctx_query_fence_stats(amdgpu_context_handle context,
+					       struct amdgpu_cs_fence_stats *stats)
+{
+	if (!context || !stats)
+		return -EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->user_fence_signaled =
+		__atomic_load_n(&context->user_fence_signaled, __ATOMIC_RELAXED);
+	stats->user_fence_busy =
+		__atomic_load_n(&context->user_fence_busy, __ATOMIC_RELAXED);
+	stats->ioctls = __atomic_load_n(&context->fence_ioctls, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
 static int amdgpu_ioctl_wait_fences(struct amdgpu_cs_fence *fences,
 				    uint32_t fence_count,
 				    bool wait_all,
@@ -575,6 +1035,336 @@ drm_public int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
 					timeout_ns, status, first);
 }
 
+drm_private void amdgpu_cs_fence_handle_cache_init(struct amdgpu_device *dev)
+{
+	pthread_mutex_init(&dev->fence_handle_cache.mutex, NULL);
+}
+
+static void amdgpu_cs_fence_handle_cache_purge(struct amdgpu_device *dev,
+					       uint32_t ctx_id)
+{
+	struct amdgpu_fence_handle_cache *cache = &dev->fence_handle_cache;
+	struct amdgpu_fence_handle_cache_entry *entry;
+	uint32_t i;
+
+	pthread_mutex_lock(&cache->mutex);
+	for (i = 0; i < AMDGPU_FENCE_HANDLE_CACHE_SIZE; i++) {
+		entry = &cache->entries[i];
+		if (!entry->handle || entry->ctx_id != ctx_id)
+			continue;
+
+		drmSyncobjDestroy(dev->fd, entry->handle);
+		memset(entry, 0, sizeof(*entry));
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+drm_private void amdgpu_cs_fence_handle_cache_fini(struct amdgpu_device *dev)
+{
+	struct amdgpu_fence_handle_cache *cache = &dev->fence_handle_cache;
+	uint32_t i;
+
+	for (i = 0; i < AMDGPU_FENCE_HANDLE_CACHE_SIZE; i++) {
+		if (cache->entries[i].handle)
+			drmSyncobjDestroy(dev->fd, cache->entries[i].handle);
+	}
+	pthread_mutex_destroy(&cache->mutex);
+}
+
+static struct amdgpu_fence_handle_cache_entry *
+amdgpu_cs_fence_handle_cache_entry(struct amdgpu_device *dev,
+				   const struct amdgpu_cs_fence *fence)
+{
+	uint64_t hash;
+
+	hash = fence->fence * 0x9e3779b97f4a7c15ull;
+	hash ^= ((uint64_t)fence->context->id << 32) ^
+		(fence->ip_type << 16) ^ (fence->ip_instance << 8) ^ fence->ring;
+	hash *= 0x9e3779b97f4a7c15ull;
+
+	return &dev->fence_handle_cache.entries[(hash >> 58) &
+		(AMDGPU_FENCE_HANDLE_CACHE_SIZE - 1)];
+}
+
+static bool
+amdgpu_cs_fence_handle_cache_match(const struct amdgpu_fence_handle_cache_entry *entry,
+				   const struct amdgpu_cs_fence *fence)
+{
+	return entry->handle &&
+	       entry->ctx_id == fence->context->id &&
+	       entry->ip_type == fence->ip_type &&
+	       entry->ip_instance == fence->ip_instance &&
+	       entry->ring == fence->ring &&
+	       entry->seq_no == fence->fence;
+}
+
+/**
+ * Get a syncobj for a fence, converting it if it isn't cached yet.
+ *
+ * \p *cached is set to the cache entry the handle belongs to, or NULL if
+ * the caller owns the handle. Either way it must be given back with
+ * amdgpu_cs_fence_handle_put().
+ */
+static int
+amdgpu_cs_fence_handle_get(struct amdgpu_device *dev,
+			   struct amdgpu_cs_fence *fence, uint32_t *handle,
+			   struct amdgpu_fence_handle_cache_entry **cached)
+{
+	struct amdgpu_fence_handle_cache *cache = &dev->fence_handle_cache;
+	struct amdgpu_fence_handle_cache_entry *entry;
+	uint32_t old_handle = 0;
+	int r;
+
+	entry = amdgpu_cs_fence_handle_cache_entry(dev, fence);
+
+	pthread_mutex_lock(&cache->mutex);
+	if (amdgpu_cs_fence_handle_cache_match(entry, fence)) {
+		entry->users++;
+		*handle = entry->handle;
+		*cached = entry;
+		pthread_mutex_unlock(&cache->mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	r = amdgpu_cs_fence_to_handle(dev, fence,
+				      AMDGPU_FENCE_TO_HANDLE_GET_SYNCOBJ,
+				      handle);
+	if (r)
+		return r;
+
+	/* Replace the entry unless another wait is still using it, or
+	 * another thread converted the same fence in the meantime.
+	 */
+	*cached = NULL;
+	pthread_mutex_lock(&cache->mutex);
+	if (!entry->users && !amdgpu_cs_fence_handle_cache_match(entry, fence)) {
+		old_handle = entry->handle;
+		entry->ctx_id = fence->context->id;
+		entry->ip_type = fence->ip_type;
+		entry->ip_instance = fence->ip_instance;
+		entry->ring = fence->ring;
+		entry->seq_no = fence->fence;
+		entry->handle = *handle;
+		entry->users = 1;
+		*cached = entry;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	if (old_handle)
+		drmSyncobjDestroy(dev->fd, old_handle);
+
+	return 0;
+}
+
+static void
+amdgpu_cs_fence_handle_put(struct amdgpu_device *dev, uint32_t handle,
+			   struct amdgpu_fence_handle_cache_entry *cached)
+{
+	struct amdgpu_fence_handle_cache *cache = &dev->fence_handle_cache;
+
+	if (!cached) {
+		drmSyncobjDestroy(dev->fd, handle);
+		return;
+	}
+
+	/* The entry may have been purged along with its context. */
+	pthread_mutex_lock(&cache->mutex);
+	if (cached->handle == handle && cached->users)
+		cached->users--;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/* Whether the user fence already shows the fence as signaled. */
+static bool amdgpu_cs_fence_reached(struct amdgpu_cs_fence *fence)
+{
+	if (fence->fence == AMDGPU_NULL_SUBMIT_SEQ)
+		return true;
+
+	if (amdgpu_cs_user_fence_check(fence) != 1)
+		return false;
+
+	__atomic_add_fetch(&fence->context->user_fence_signaled, 1,
+			   __ATOMIC_RELAXED);
+	return true;
+}
+
+/*
+ * amdgpu_cs_wait_items() without any syncobj: the fences can go straight
+ * to DRM_AMDGPU_WAIT_FENCES, converting them would only cost more ioctls.
+ */
+static int amdgpu_cs_wait_items_fences(const struct amdgpu_cs_wait_item *items,
+				       uint32_t count, bool wait_all,
+				       uint64_t timeout_ns, uint32_t *status,
+				       uint32_t *first)
+{
+	struct amdgpu_cs_fence *fences;
+	uint32_t *index, first_signaled = 0, num_fences = 0;
+	uint32_t i;
+	int r;
+
+	fences = alloca(sizeof(*fences) * count);
+	index = alloca(sizeof(*index) * count);
+
+	for (i = 0; i < count; i++) {
+		fences[num_fences] = items[i].fence;
+		if (amdgpu_cs_fence_reached(&fences[num_fences])) {
+			if (wait_all)
+				continue;
+
+			*status = 1;
+			if (first)
+				*first = i;
+			return 0;
+		}
+		index[num_fences++] = i;
+	}
+
+	if (!num_fences) {
+		*status = 1;
+		if (first)
+			*first = 0;
+		return 0;
+	}
+
+	r = amdgpu_ioctl_wait_fences(fences, num_fences, wait_all, timeout_ns,
+				     status, &first_signaled);
+	if (!r && *status && first)
+		*first = first_signaled < num_fences ?
+			 index[first_signaled] : index[0];
+
+	return r;
+}
+
+drm_public int amdgpu_cs_wait_items(amdgpu_device_handle dev,
+				    const struct amdgpu_cs_wait_item *items,
+				    uint32_t count,
+				    bool wait_all,
+				    uint64_t timeout_ns,
+				    uint32_t flags,
+				    uint32_t *status, uint32_t *first)
+{
+	struct amdgpu_fence_handle_cache_entry **cached;
+	uint32_t *handles, *index, first_signaled = 0, num_handles = 0;
+	bool timeline = false;
+	uint64_t *points, abs_timeout;
+	uint32_t i, num_syncobjs = 0;
+	int r = 0;
+
+	if (!dev || !items || !count || !status)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		const struct amdgpu_cs_fence *fence = &items[i].fence;
+
+		switch (items[i].type) {
+		case AMDGPU_CS_WAIT_ITEM_FENCE:
+			if (!fence->context ||
+			    fence->context->dev != dev ||
+			    fence->ip_type >= AMDGPU_HW_IP_NUM ||
+			    fence->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT ||
+			    fence->ring >= AMDGPU_CS_MAX_RINGS)
+				return -EINVAL;
+			break;
+		case AMDGPU_CS_WAIT_ITEM_SYNCOBJ:
+		case AMDGPU_CS_WAIT_ITEM_TIMELINE:
+			if (!items[i].syncobj)
+				return -EINVAL;
+			num_syncobjs++;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	*status = 0;
+
+	if (!num_syncobjs)
+		return amdgpu_cs_wait_items_fences(items, count, wait_all,
+						   timeout_ns, status, first);
+
+	handles = alloca(sizeof(*handles) * count);
+	index = alloca(sizeof(*index) * count);
+	points = alloca(sizeof(*points) * count);
+	cached = alloca(sizeof(*cached) * count);
+
+	for (i = 0; i < count; i++) {
+		const struct amdgpu_cs_wait_item *item = &items[i];
+		struct amdgpu_cs_fence fence = item->fence;
+
+		points[num_handles] = 0;
+		cached[num_handles] = NULL;
+
+		if (item->type == AMDGPU_CS_WAIT_ITEM_FENCE) {
+			/* Signaled fences complete a wait for any item and
+			 * don't need to be waited for otherwise.
+			 */
+			if (amdgpu_cs_fence_reached(&fence)) {
+				if (wait_all)
+					continue;
+
+				*status = 1;
+				if (first)
+					*first = i;
+				goto out;
+			}
+
+			r = amdgpu_cs_fence_handle_get(dev, &fence,
+						       &handles[num_handles],
+						       &cached[num_handles]);
+			if (r)
+				goto out;
+		} else {
+			handles[num_handles] = item->syncobj;
+			if (item->type == AMDGPU_CS_WAIT_ITEM_TIMELINE) {
+				points[num_handles] = item->point;
+				timeline = true;
+			}
+		}
+		index[num_handles++] = i;
+	}
+
+	if (!num_handles) {
+		*status = 1;
+		if (first)
+			*first = 0;
+		goto out;
+	}
+
+	/* The syncobj wait takes a signed absolute timeout. */
+	abs_timeout = amdgpu_cs_calculate_timeout(timeout_ns);
+	if (abs_timeout > INT64_MAX)
+		abs_timeout = INT64_MAX;
+
+	if (wait_all)
+		flags |= DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL;
+
+	if (timeline)
+		r = drmSyncobjTimelineWait(dev->fd, handles, points,
+					   num_handles, abs_timeout, flags,
+					   &first_signaled);
+	else
+		r = drmSyncobjWait(dev->fd, handles, num_handles, abs_timeout,
+				   flags, &first_signaled);
+
+	if (r == -ETIME) {
+		r = 0;
+	} else if (!r) {
+		*status = 1;
+		if (first)
+			*first = first_signaled < num_handles ?
+				 index[first_signaled] : index[0];
+	}
+
+out:
+	for (i = 0; i < num_handles; i++) {
+		if (items[index[i]].type == AMDGPU_CS_WAIT_ITEM_FENCE)
+			amdgpu_cs_fence_handle_put(dev, handles[i], cached[i]);
+	}
+
+	return r;
+}
+
 drm_public int amdgpu_cs_create_semaphore(amdgpu_semaphore_handle *sem)
 {
 	struct amdgpu_semaphore *gpu_semaphore;
@@ -598,12 +1388,15 @@ drm_public int amdgpu_cs_signal_semaphore(amdgpu_context_handle ctx,
 			       uint32_t ring,
 			       amdgpu_semaphore_handle sem)
 {
+	struct amdgpu_cs_ring_state *state;
 	int ret;
 
 	if (!ctx || !sem)
 		return -EINVAL;
 	if (ip_type >= AMDGPU_HW_IP_NUM)
 		return -EINVAL;
+	if (ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return -EINVAL;
 	if (ring >= AMDGPU_CS_MAX_RINGS)
 		return -EINVAL;
 
@@ -617,7 +1410,8 @@ drm_public int amdgpu_cs_signal_semaphore(amdgpu_context_handle ctx,
 	sem->signal_fence.ip_type = ip_type;
 	sem->signal_fence.ip_instance = ip_instance;
 	sem->signal_fence.ring = ring;
-	sem->signal_fence.fence = ctx->last_seq[ip_type][ip_instance][ring];
+	state = amdgpu_cs_get_ring_state(ctx, ip_type, ip_instance, ring, false);
+	sem->signal_fence.fence = state ? state->last_seq : 0;
 	update_references(NULL, &sem->refcount);
 	ret = 0;
 unlock:
@@ -631,10 +1425,15 @@ drm_public int amdgpu_cs_wait_semaphore(amdgpu_context_handle ctx,
 			     uint32_t ring,
 			     amdgpu_semaphore_handle sem)
 {
+	struct amdgpu_cs_ring_state *state;
+	int r;
+
 	if (!ctx || !sem)
 		return -EINVAL;
 	if (ip_type >= AMDGPU_HW_IP_NUM)
 		return -EINVAL;
+	if (ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return -EINVAL;
 	if (ring >= AMDGPU_CS_MAX_RINGS)
 		return -EINVAL;
 	/* must signal first */
@@ -642,9 +1441,10 @@ drm_public int amdgpu_cs_wait_semaphore(amdgpu_context_handle ctx,
 		return -EINVAL;
 
 	pthread_mutex_lock(&ctx->sequence_mutex);
-	list_add(&sem->list, &ctx->sem_list[ip_type][ip_instance][ring]);
+	state = amdgpu_cs_get_ring_state(ctx, ip_type, ip_instance, ring, true);
+	r = state ? amdgpu_cs_ring_add_sem(state, sem) : -ENOMEM;
 	pthread_mutex_unlock(&ctx->sequence_mutex);
-	return 0;
+	return r;
 }
 
 static int amdgpu_cs_reset_sem(amdgpu_semaphore_handle sem)
@@ -931,23 +1731,15 @@ drm_public int amdgpu_cs_submit_raw2(amdgpu_device_handle dev,
 				     struct drm_amdgpu_cs_chunk *chunks,
 				     uint64_t *seq_no)
 {
-	union drm_amdgpu_cs cs;
 	uint64_t *chunk_array;
-	int i, r;
+	int i;
 
-	memset(&cs, 0, sizeof(cs));
 	chunk_array = alloca(sizeof(uint64_t) * num_chunks);
 	for (i = 0; i < num_chunks; i++)
 		chunk_array[i] = (uint64_t)(uintptr_t)&chunks[i];
-	cs.in.chunks = (uint64_t)(uintptr_t)chunk_array;
-	cs.in.ctx_id = context->id;
-	cs.in.bo_list_handle = bo_list_handle;
-	cs.in.num_chunks = num_chunks;
-	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_CS,
-				&cs, sizeof(cs));
-	if (!r && seq_no)
-		*seq_no = cs.out.handle;
-	return r;
+
+	return amdgpu_cs_submit_chunk_array(dev, context, bo_list_handle,
+					    num_chunks, chunk_array, seq_no);
 }
 
 drm_public void amdgpu_cs_chunk_fence_info_to_data(struct amdgpu_cs_fence_info *fence_info,
@@ -0,0 +1,481 @@
+/*
+ * Copyright 2026 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file amdgpu_cs_sched.c
+ *
+ *  Submits a graph of jobs from a pool of worker threads.
+ *
+ *  A job is handed to the workers once all its dependencies have been
+ *  submitted, and then waits for their fences on the GPU, so independent
+ *  jobs reach the kernel in parallel while dependent ones keep their order.
+ *  Submitted jobs are retired once their fences signaled, so the job table
+ *  stays bounded even if the scheduler never runs idle.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+static uint64_t amdgpu_cs_sched_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Called with the scheduler mutex held. */
+static void amdgpu_cs_sched_make_ready(struct amdgpu_cs_scheduler *sched,
+				       struct amdgpu_cs_sched_job_node *job)
+{
+	job->ready_time = amdgpu_cs_sched_time_ns();
+	list_addtail(&job->list, &sched->ready);
+	sched->queue_depth++;
+	sched->max_queue_depth = MAX2(sched->max_queue_depth,
+				      sched->queue_depth);
+	pthread_cond_signal(&sched->ready_cond);
+}
+
+/* Called with the scheduler mutex held. */
+static void amdgpu_cs_sched_job_done(struct amdgpu_cs_scheduler *sched,
+				     struct amdgpu_cs_sched_job_node *job,
+				     int r, uint64_t seq_no)
+{
+	uint64_t latency = amdgpu_cs_sched_time_ns() - job->ready_time;
+	uint32_t i;
+
+	job->submitted = true;
+	if (r) {
+		job->failed = true;
+		sched->failed++;
+		if (!sched->error)
+			sched->error = r;
+	} else {
+		job->fence.fence = seq_no;
+		sched->submitted++;
+	}
+	sched->total_latency_ns += latency;
+	sched->max_latency_ns = MAX2(sched->max_latency_ns, latency);
+
+	for (i = 0; i < job->num_dependents; i++) {
+		struct amdgpu_cs_sched_job_node *dependent =
+			sched->jobs[job->dependents[i] - sched->first_job_id];
+
+		/* a failed job has no fence to wait for */
+		if (job->failed)
+			dependent->failed = true;
+		else if (job->fence.context)
+			amdgpu_cs_chunk_fence_to_dep(&job->fence,
+				&dependent->deps[dependent->num_deps++]);
+		if (!--dependent->pending_deps)
+			amdgpu_cs_sched_make_ready(sched, dependent);
+	}
+
+	/* only the fence is needed from now on */
+	free(job->chunks);
+	free(job->deps);
+	free(job->dependents);
+	job->chunks = NULL;
+	job->deps = NULL;
+	job->dependents = NULL;
+	job->num_dependents = 0;
+	job->max_dependents = 0;
+
+	if (!--sched->outstanding)
+		pthread_cond_broadcast(&sched->idle_cond);
+}
+
+static int amdgpu_cs_sched_submit(struct amdgpu_cs_scheduler *sched,
+				  struct amdgpu_cs_sched_job_node *job,
+				  uint64_t *seq_no)
+{
+	struct drm_amdgpu_cs_chunk *chunk;
+	uint32_t num_chunks = job->num_chunks;
+	int r;
+
+	if (job->num_deps) {
+		chunk = &job->chunks[num_chunks++];
+		chunk->chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
+		chunk->length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 *
+			job->num_deps;
+		chunk->chunk_data = (uintptr_t)job->deps;
+	}
+
+	r = amdgpu_cs_submit_raw2(sched->dev, job->context, job->bo_list_handle,
+				  num_chunks, job->chunks, seq_no);
+	if (!r && job->seq_no)
+		*job->seq_no = *seq_no;
+
+	return r;
+}
+
+static void *amdgpu_cs_sched_worker(void *data)
+{
+	struct amdgpu_cs_scheduler *sched = data;
+	struct amdgpu_cs_sched_job_node *job;
+	uint64_t seq_no = 0;
+	int r;
+
+	pthread_mutex_lock(&sched->mutex);
+	for (;;) {
+		while (!sched->stop && LIST_IS_EMPTY(&sched->ready))
+			pthread_cond_wait(&sched->ready_cond, &sched->mutex);
+		if (LIST_IS_EMPTY(&sched->ready))
+			break;
+
+		job = LIST_ENTRY(struct amdgpu_cs_sched_job_node,
+				 sched->ready.next, list);
+		list_del(&job->list);
+		sched->queue_depth--;
+		pthread_mutex_unlock(&sched->mutex);
+
+		r = job->failed ? -ECANCELED :
+			amdgpu_cs_sched_submit(sched, job, &seq_no);
+
+		pthread_mutex_lock(&sched->mutex);
+		amdgpu_cs_sched_job_done(sched, job, r, seq_no);
+	}
+	pthread_mutex_unlock(&sched->mutex);
+
+	return NULL;
+}
+
+drm_public int amdgpu_cs_scheduler_create(amdgpu_device_handle dev,
+					  uint32_t num_workers,
+					  amdgpu_cs_scheduler_handle *scheduler)
+{
+	struct amdgpu_cs_scheduler *sched;
+	uint32_t i;
+
+	if (!dev || !num_workers || !scheduler)
+		return -EINVAL;
+
+	sched = calloc(1, sizeof(*sched));
+	if (!sched)
+		return -ENOMEM;
+
+	sched->workers = calloc(num_workers, sizeof(*sched->workers));
+	if (!sched->workers) {
+		free(sched);
+		return -ENOMEM;
+	}
+
+	sched->dev = dev;
+	sched->first_job_id = 1;
+	list_inithead(&sched->ready);
+	pthread_mutex_init(&sched->mutex, NULL);
+	pthread_cond_init(&sched->ready_cond, NULL);
+	pthread_cond_init(&sched->idle_cond, NULL);
+
+	for (i = 0; i < num_workers; i++) {
+		if (pthread_create(&sched->workers[i], NULL,
+				   amdgpu_cs_sched_worker, sched))
+			break;
+	}
+	sched->num_workers = i;
+
+	if (!sched->num_workers) {
+		amdgpu_cs_scheduler_destroy(sched);
+		return -ENOMEM;
+	}
+
+	*scheduler = sched;
+	return 0;
+}
+
+/* Called with the scheduler mutex held. */
+static void amdgpu_cs_sched_free_jobs(struct amdgpu_cs_scheduler *sched,
+				      uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++)
+		free(sched->jobs[i]);
+
+	memmove(sched->jobs, sched->jobs + count,
+		(sched->num_jobs - count) * sizeof(*sched->jobs));
+	sched->first_job_id += count;
+	sched->num_jobs -= count;
+}
+
+/*
+ * Called with the scheduler mutex held when the job table is full. Retires
+ * the oldest jobs if they were all submitted and their fences signaled,
+ * which takes a single ioctl for half the table or more. Jobs after a
+ * failed one are kept, later dependents must still see the failure.
+ */
+static void amdgpu_cs_sched_retire_jobs(struct amdgpu_cs_scheduler *sched)
+{
+	struct amdgpu_cs_fence *fences;
+	uint32_t i, count, num_fences = 0, expired = 0;
+	int r;
+
+	for (count = 0; count < sched->num_jobs; count++) {
+		if (!sched->jobs[count]->submitted ||
+		    sched->jobs[count]->failed)
+			break;
+	}
+	if (count < sched->num_jobs / 2)
+		return;
+
+	fences = malloc(count * sizeof(*fences));
+	if (!fences)
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (sched->jobs[i]->fence.context)
+			fences[num_fences++] = sched->jobs[i]->fence;
+	}
+
+	if (num_fences) {
+		r = amdgpu_cs_wait_fences(fences, num_fences, true, 0,
+					  &expired, NULL);
+		if (r)
+			expired = 0;
+	} else {
+		expired = 1;
+	}
+	free(fences);
+
+	if (expired)
+		amdgpu_cs_sched_free_jobs(sched, count);
+}
+
+drm_public int amdgpu_cs_scheduler_wait_idle(amdgpu_cs_scheduler_handle sched)
+{
+	int r;
+
+	if (!sched)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sched->mutex);
+	while (sched->outstanding)
+		pthread_cond_wait(&sched->idle_cond, &sched->mutex);
+
+	amdgpu_cs_sched_free_jobs(sched, sched->num_jobs);
+	r = sched->error;
+	sched->error = 0;
+	pthread_mutex_unlock(&sched->mutex);
+
+	return r;
+}
+
+drm_public int amdgpu_cs_scheduler_destroy(amdgpu_cs_scheduler_handle sched)
+{
+	uint32_t i;
+
+	if (!sched)
+		return -EINVAL;
+
+	amdgpu_cs_scheduler_wait_idle(sched);
+
+	pthread_mutex_lock(&sched->mutex);
+	sched->stop = true;
+	pthread_cond_broadcast(&sched->ready_cond);
+	pthread_mutex_unlock(&sched->mutex);
+
+	for (i = 0; i < sched->num_workers; i++)
+		pthread_join(sched->workers[i], NULL);
+
+	pthread_cond_destroy(&sched->idle_cond);
+	pthread_cond_destroy(&sched->ready_cond);
+	pthread_mutex_destroy(&sched->mutex);
+	free(sched->jobs);
+	free(sched->workers);
+	free(sched);
+	return 0;
+}
+
+static void amdgpu_cs_sched_job_free(struct amdgpu_cs_sched_job_node *job)
+{
+	free(job->chunks);
+	free(job->deps);
+	free(job);
+}
+
+/* The fence of a job is the one of the ring its first IB goes to. */
+static void amdgpu_cs_sched_job_fence(struct amdgpu_cs_sched_job_node *job)
+{
+	struct drm_amdgpu_cs_chunk_ib *ib;
+	uint32_t i;
+
+	for (i = 0; i < job->num_chunks; i++) {
+		if (job->chunks[i].chunk_id != AMDGPU_CHUNK_ID_IB)
+			continue;
+
+		ib = (struct drm_amdgpu_cs_chunk_ib *)(uintptr_t)
+			job->chunks[i].chunk_data;
+		job->fence.context = job->context;
+		job->fence.ip_type = ib->ip_type;
+		job->fence.ip_instance = ib->ip_instance;
+		job->fence.ring = ib->ring;
+		return;
+	}
+}
+
+drm_public int amdgpu_cs_scheduler_add_job(amdgpu_cs_scheduler_handle sched,
+					   const struct amdgpu_cs_sched_job *desc,
+					   uint32_t *job_id)
+{
+	struct amdgpu_cs_sched_job_node *job, *dep;
+	uint32_t i, id;
+	int r;
+
+	if (!sched || !desc || !desc->context || !job_id)
+		return -EINVAL;
+	if (desc->num_chunks && !desc->chunks)
+		return -EINVAL;
+	if (desc->num_dependencies && !desc->dependencies)
+		return -EINVAL;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return -ENOMEM;
+
+	job->context = desc->context;
+	job->bo_list_handle = desc->bo_list_handle;
+	job->seq_no = desc->seq_no;
+	job->num_chunks = desc->num_chunks;
+	job->chunks = calloc(desc->num_chunks + 1, sizeof(*job->chunks));
+	if (desc->num_dependencies)
+		job->deps = calloc(desc->num_dependencies, sizeof(*job->deps));
+	if (!job->chunks || (desc->num_dependencies && !job->deps)) {
+		amdgpu_cs_sched_job_free(job);
+		return -ENOMEM;
+	}
+	memcpy(job->chunks, desc->chunks,
+	       desc->num_chunks * sizeof(*job->chunks));
+	amdgpu_cs_sched_job_fence(job);
+
+	pthread_mutex_lock(&sched->mutex);
+
+	id = sched->first_job_id + sched->num_jobs;
+	for (i = 0; i < desc->num_dependencies; i++) {
+		uint32_t dep_id = desc->dependencies[i];
+
+		if (!dep_id || dep_id >= id) {
+			r = -EINVAL;
+			goto error_unlock;
+		}
+	}
+
+	if (sched->num_jobs == sched->max_jobs)
+		amdgpu_cs_sched_retire_jobs(sched);
+
+	if (sched->num_jobs == sched->max_jobs) {
+		uint32_t max = MAX2(sched->max_jobs * 2, 64);
+		void *ptr;
+
+		ptr = realloc(sched->jobs, max * sizeof(*sched->jobs));
+		if (!ptr) {
+			r = -ENOMEM;
+			goto error_unlock;
+		}
+		sched->jobs = ptr;
+		sched->max_jobs = max;
+	}
+
+	/* Reserve the dependents slots first so nothing can fail once the
+	 * job is linked into the graph.
+	 */
+	for (i = 0; i < desc->num_dependencies; i++) {
+		if (desc->dependencies[i] < sched->first_job_id)
+			continue;
+
+		dep = sched->jobs[desc->dependencies[i] - sched->first_job_id];
+		if (!dep->submitted &&
+		    dep->num_dependents == dep->max_dependents) {
+			uint32_t max = MAX2(dep->max_dependents * 2, 4);
+			uint32_t *ptr = realloc(dep->dependents,
+						max * sizeof(*ptr));
+
+			if (!ptr) {
+				r = -ENOMEM;
+				goto error_unlock;
+			}
+			dep->dependents = ptr;
+			dep->max_dependents = max;
+		}
+	}
+
+	for (i = 0; i < desc->num_dependencies; i++) {
+		/* retired jobs have already executed */
+		if (desc->dependencies[i] < sched->first_job_id)
+			continue;
+
+		dep = sched->jobs[desc->dependencies[i] - sched->first_job_id];
+		if (dep->submitted) {
+			if (dep->failed)
+				job->failed = true;
+			else if (dep->fence.context)
+				amdgpu_cs_chunk_fence_to_dep(&dep->fence,
+					&job->deps[job->num_deps++]);
+			continue;
+		}
+		dep->dependents[dep->num_dependents++] = id;
+		job->pending_deps++;
+	}
+
+	sched->jobs[sched->num_jobs++] = job;
+	sched->outstanding++;
+	if (!job->pending_deps)
+		amdgpu_cs_sched_make_ready(sched, job);
+
+	pthread_mutex_unlock(&sched->mutex);
+
+	*job_id = id;
+	return 0;
+
+error_unlock:
+	pthread_mutex_unlock(&sched->mutex);
+	amdgpu_cs_sched_job_free(job);
+	return r;
+}
+
+drm_public int amdgpu_cs_scheduler_query_stats(amdgpu_cs_scheduler_handle sched,
+					       struct amdgpu_cs_scheduler_stats *stats)
+{
+	if (!sched || !stats)
+		return -EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+	pthread_mutex_lock(&sched->mutex);
+	stats->submitted = sched->submitted;
+	stats->failed = sched->failed;
+	stats->queue_depth = sched->queue_depth;
+	stats->max_queue_depth = sched->max_queue_depth;
+	stats->outstanding = sched->outstanding;
+	stats->total_latency_ns = sched->total_latency_ns;
+	stats->max_latency_ns = sched->max_latency_ns;
+	pthread_mutex_unlock(&sched->mutex);
+
+	return 0;
+}
@@ -107,6 +107,11 @@ static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 		}
 	}
 
+	amdgpu_bo_cache_fini(&dev->bo_cache);
+	amdgpu_bo_vma_cache_fini(dev);
+	amdgpu_cs_fence_handle_cache_fini(dev);
+	amdgpu_heap_usage_fini(dev);
+
 	close(dev->fd);
 	if ((dev->flink_fd >= 0) && (dev->fd != dev->flink_fd))
 		close(dev->flink_fd);
@@ -224,6 +229,10 @@ static int _amdgpu_device_initialize(int fd,
 	drmFreeVersion(version);
 
 	pthread_mutex_init(&dev->bo_table_mutex, NULL);
+	amdgpu_bo_cache_init(&dev->bo_cache);
+	amdgpu_bo_vma_cache_init(dev);
+	amdgpu_cs_fence_handle_cache_init(dev);
+	amdgpu_heap_usage_init(dev);
 
 	/* Check if acceleration is working. */
 	r = amdgpu_query_info(dev, AMDGPU_INFO_ACCEL_WORKING, 4, &accel_working);
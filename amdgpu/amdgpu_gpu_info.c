@@ -155,35 +155,10 @@ drm_public int amdgpu_query_uq_fw_area_info(amdgpu_device_handle dev,
 			       sizeof(struct drm_amdgpu_info));
 }
 
-drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev)
+static int amdgpu_query_gpu_info_regs(amdgpu_device_handle dev)
 {
 	int r, i;
 
-	r = amdgpu_query_info(dev, AMDGPU_INFO_DEV_INFO, sizeof(dev->dev_info),
-			      &dev->dev_info);
-	if (r)
-		return r;
-
-	dev->info.asic_id = dev->dev_info.device_id;
-	dev->info.chip_rev = dev->dev_info.chip_rev;
-	dev->info.chip_external_rev = dev->dev_info.external_rev;
-	dev->info.family_id = dev->dev_info.family;
-	dev->info.max_engine_clk = dev->dev_info.max_engine_clock;
-	dev->info.max_memory_clk = dev->dev_info.max_memory_clock;
-	dev->info.gpu_counter_freq = dev->dev_info.gpu_counter_freq;
-	dev->info.enabled_rb_pipes_mask = dev->dev_info.enabled_rb_pipes_mask;
-	dev->info.rb_pipes = dev->dev_info.num_rb_pipes;
-	dev->info.ids_flags = dev->dev_info.ids_flags;
-	dev->info.num_hw_gfx_contexts = dev->dev_info.num_hw_gfx_contexts;
-	dev->info.num_shader_engines = dev->dev_info.num_shader_engines;
-	dev->info.num_shader_arrays_per_engine =
-		dev->dev_info.num_shader_arrays_per_engine;
-	dev->info.vram_type = dev->dev_info.vram_type;
-	dev->info.vram_bit_width = dev->dev_info.vram_bit_width;
-	dev->info.ce_ram_size = dev->dev_info.ce_ram_size;
-	dev->info.vce_harvest_config = dev->dev_info.vce_harvest_config;
-	dev->info.pci_rev_id = dev->dev_info.pci_rev;
-
 	if (dev->info.family_id < AMDGPU_FAMILY_AI) {
 		for (i = 0; i < (int)dev->info.num_shader_engines; i++) {
 			unsigned instance = (i << AMDGPU_INFO_MMR_SE_INDEX_SHIFT) |
@@ -236,6 +211,50 @@ drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev)
 			return r;
 	}
 
+	return 0;
+}
+
+drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev)
+{
+	int r;
+
+	r = amdgpu_query_info(dev, AMDGPU_INFO_DEV_INFO, sizeof(dev->dev_info),
+			      &dev->dev_info);
+	if (r)
+		return r;
+
+	dev->info.asic_id = dev->dev_info.device_id;
+	dev->info.chip_rev = dev->dev_info.chip_rev;
+	dev->info.chip_external_rev = dev->dev_info.external_rev;
+	dev->info.family_id = dev->dev_info.family;
+	dev->info.max_engine_clk = dev->dev_info.max_engine_clock;
+	dev->info.max_memory_clk = dev->dev_info.max_memory_clock;
+	dev->info.gpu_counter_freq = dev->dev_info.gpu_counter_freq;
+	dev->info.enabled_rb_pipes_mask = dev->dev_info.enabled_rb_pipes_mask;
+	dev->info.rb_pipes = dev->dev_info.num_rb_pipes;
+	dev->info.ids_flags = dev->dev_info.ids_flags;
+	dev->info.num_hw_gfx_contexts = dev->dev_info.num_hw_gfx_contexts;
+	dev->info.num_shader_engines = dev->dev_info.num_shader_engines;
+	dev->info.num_shader_arrays_per_engine =
+		dev->dev_info.num_shader_arrays_per_engine;
+	dev->info.vram_type = dev->dev_info.vram_type;
+	dev->info.vram_bit_width = dev->dev_info.vram_bit_width;
+	dev->info.ce_ram_size = dev->dev_info.ce_ram_size;
+	dev->info.vce_harvest_config = dev->dev_info.vce_harvest_config;
+	dev->info.pci_rev_id = dev->dev_info.pci_rev;
+
+	/* From GFX9 on only GB_ADDR_CONFIG is read, which is cheaper than
+	 * looking up the cache.
+	 */
+	if (dev->info.family_id >= AMDGPU_FAMILY_AI ||
+	    amdgpu_gpu_info_cache_load(dev)) {
+		r = amdgpu_query_gpu_info_regs(dev);
+		if (r)
+			return r;
+		if (dev->info.family_id < AMDGPU_FAMILY_AI)
+			amdgpu_gpu_info_cache_store(dev);
+	}
+
 	dev->info.cu_active_number = dev->dev_info.cu_active_number;
 	dev->info.cu_ao_mask = dev->dev_info.cu_ao_mask;
 	memcpy(&dev->info.cu_bitmap[0][0], &dev->dev_info.cu_bitmap[0][0], sizeof(dev->info.cu_bitmap));
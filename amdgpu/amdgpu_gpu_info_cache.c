@@ -0,0 +1,207 @@
+/*
+ * Copyright 2026 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file amdgpu_gpu_info_cache.c
+ *
+ *  On-disk cache of the registers amdgpu_query_gpu_info_init() reads, so
+ *  processes starting up on the same GPU don't all read them again.
+ *
+ *  The cache is only used before GFX9, which read a few dozen registers,
+ *  and if AMDGPU_GPU_INFO_CACHE_DIR names a directory.
+ *  An entry is valid for the device node, DRM interface version and
+ *  device info it was written with, and only until the next reboot.
+ *
+ */
+
+// secure_getenv requires _GNU_SOURCE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+#define AMDGPU_GPU_INFO_CACHE_MAGIC	0x43495041	/* "APIC" */
+
+struct amdgpu_gpu_info_cache {
+	/* key, everything up to the register values */
+	uint32_t magic;
+	uint32_t size;
+	char boot_id[40];
+	uint64_t rdev;
+	uint32_t major_version;
+	uint32_t minor_version;
+	struct drm_amdgpu_info_device dev_info;
+
+	/* register values */
+	uint32_t backend_disable[4];
+	uint32_t pa_sc_raster_cfg[4];
+	uint32_t pa_sc_raster_cfg1[4];
+	uint32_t gb_addr_cfg;
+	uint32_t gb_tile_mode[32];
+	uint32_t gb_macro_tile_mode[16];
+	uint32_t mc_arb_ramcfg;
+};
+
+#define AMDGPU_GPU_INFO_CACHE_KEY_SIZE \
+	offsetof(struct amdgpu_gpu_info_cache, backend_disable)
+
+#if HAVE_SECURE_GETENV
+static int amdgpu_gpu_info_cache_key(amdgpu_device_handle dev,
+				     struct amdgpu_gpu_info_cache *key,
+				     char **path)
+{
+	const char *dir = secure_getenv("AMDGPU_GPU_INFO_CACHE_DIR");
+	struct stat st;
+	ssize_t n;
+	int fd;
+
+	if (!dir || !dir[0])
+		return -ENOENT;
+
+	memset(key, 0, sizeof(*key));
+	key->magic = AMDGPU_GPU_INFO_CACHE_MAGIC;
+	key->size = sizeof(*key);
+
+	fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, key->boot_id, sizeof(key->boot_id) - 1);
+	close(fd);
+	if (n <= 0)
+		return -EIO;
+
+	if (fstat(dev->fd, &st))
+		return -errno;
+	key->rdev = st.st_rdev;
+	key->major_version = dev->major_version;
+	key->minor_version = dev->minor_version;
+	key->dev_info = dev->dev_info;
+
+	if (asprintf(path, "%s/amdgpu_gpu_info_%llx", dir,
+		     (unsigned long long)key->rdev) < 0)
+		return -ENOMEM;
+
+	return 0;
+}
+
+drm_private int amdgpu_gpu_info_cache_load(amdgpu_device_handle dev)
+{
+	struct amdgpu_gpu_info_cache key, entry;
+	char *path;
+	ssize_t n;
+	int fd, r;
+
+	r = amdgpu_gpu_info_cache_key(dev, &key, &path);
+	if (r)
+		return r;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, &entry, sizeof(entry));
+	close(fd);
+
+	if (n != sizeof(entry) ||
+	    memcmp(&key, &entry, AMDGPU_GPU_INFO_CACHE_KEY_SIZE))
+		return -ESTALE;
+
+	memcpy(dev->info.backend_disable, entry.backend_disable,
+	       sizeof(entry.backend_disable));
+	memcpy(dev->info.pa_sc_raster_cfg, entry.pa_sc_raster_cfg,
+	       sizeof(entry.pa_sc_raster_cfg));
+	memcpy(dev->info.pa_sc_raster_cfg1, entry.pa_sc_raster_cfg1,
+	       sizeof(entry.pa_sc_raster_cfg1));
+	dev->info.gb_addr_cfg = entry.gb_addr_cfg;
+	memcpy(dev->info.gb_tile_mode, entry.gb_tile_mode,
+	       sizeof(entry.gb_tile_mode));
+	memcpy(dev->info.gb_macro_tile_mode, entry.gb_macro_tile_mode,
+	       sizeof(entry.gb_macro_tile_mode));
+	dev->info.mc_arb_ramcfg = entry.mc_arb_ramcfg;
+
+	return 0;
+}
+
+drm_private void amdgpu_gpu_info_cache_store(amdgpu_device_handle dev)
+{
+	struct amdgpu_gpu_info_cache entry;
+	char *path, *tmp_path;
+	ssize_t n;
+	int fd;
+
+	if (amdgpu_gpu_info_cache_key(dev, &entry, &path))
+		return;
+
+	memcpy(entry.backend_disable, dev->info.backend_disable,
+	       sizeof(entry.backend_disable));
+	memcpy(entry.pa_sc_raster_cfg, dev->info.pa_sc_raster_cfg,
+	       sizeof(entry.pa_sc_raster_cfg));
+	memcpy(entry.pa_sc_raster_cfg1, dev->info.pa_sc_raster_cfg1,
+	       sizeof(entry.pa_sc_raster_cfg1));
+	entry.gb_addr_cfg = dev->info.gb_addr_cfg;
+	memcpy(entry.gb_tile_mode, dev->info.gb_tile_mode,
+	       sizeof(entry.gb_tile_mode));
+	memcpy(entry.gb_macro_tile_mode, dev->info.gb_macro_tile_mode,
+	       sizeof(entry.gb_macro_tile_mode));
+	entry.mc_arb_ramcfg = dev->info.mc_arb_ramcfg;
+
+	/* Readers must never see a partial entry, write a private file
+	 * and move it into place.
+	 */
+	if (asprintf(&tmp_path, "%s.%ld", path, (long)getpid()) < 0) {
+		free(path);
+		return;
+	}
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd >= 0) {
+		n = write(fd, &entry, sizeof(entry));
+		close(fd);
+		if (n != sizeof(entry) || rename(tmp_path, path))
+			unlink(tmp_path);
+	}
+
+	free(tmp_path);
+	free(path);
+}
+#else
+drm_private int amdgpu_gpu_info_cache_load(amdgpu_device_handle dev)
+{
+	return -ENOSYS;
+}
+
+drm_private void amdgpu_gpu_info_cache_store(amdgpu_device_handle dev)
+{
+}
+#endif
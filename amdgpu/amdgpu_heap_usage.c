@@ -0,0 +1,287 @@
+/*
+ * Copyright 2026 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file amdgpu_heap_usage.c
+ *
+ *  Per process accounting of the buffers in each heap, and the kernel heap
+ *  numbers, optionally refreshed by a thread.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+static uint64_t amdgpu_heap_usage_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+drm_private void amdgpu_heap_usage_init(struct amdgpu_device *dev)
+{
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&dev->budget_mutex, NULL);
+	pthread_mutex_init(&dev->budget_thread_mutex, NULL);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&dev->budget_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+drm_private void amdgpu_heap_usage_fini(struct amdgpu_device *dev)
+{
+	amdgpu_heap_usage_set_budget_interval(dev, 0);
+
+	pthread_cond_destroy(&dev->budget_cond);
+	pthread_mutex_destroy(&dev->budget_thread_mutex);
+	pthread_mutex_destroy(&dev->budget_mutex);
+}
+
+static uint32_t amdgpu_heap_usage_bucket(uint64_t size)
+{
+	uint32_t bucket = 0;
+
+	size >>= 13;
+	while (size && bucket < AMDGPU_HEAP_USAGE_BUCKETS - 1) {
+		size >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static void amdgpu_heap_usage_allocated(struct amdgpu_heap_counters *counters,
+					struct amdgpu_bo *bo)
+{
+	uint32_t bucket = amdgpu_heap_usage_bucket(bo->alloc_size);
+	uint64_t live, peak;
+
+	__sync_add_and_fetch(&counters->live_count, 1);
+	__sync_add_and_fetch(&counters->allocations, 1);
+	__sync_add_and_fetch(&counters->size_histogram[bucket], 1);
+	live = __sync_add_and_fetch(&counters->live_bytes, bo->alloc_size);
+
+	peak = counters->peak_bytes;
+	while (live > peak) {
+		uint64_t old = __sync_val_compare_and_swap(&counters->peak_bytes,
+							   peak, live);
+		if (old == peak)
+			break;
+		peak = old;
+	}
+}
+
+drm_private void amdgpu_heap_usage_add(struct amdgpu_bo *bo, uint32_t heap)
+{
+	bo->usage_tracked = true;
+	bo->usage_cached = false;
+	bo->usage_heap = heap;
+	amdgpu_heap_usage_allocated(&bo->dev->heap_usage[heap], bo);
+}
+
+/* Called when the buffer is destroyed, it may still be counted as cached. */
+drm_private void amdgpu_heap_usage_remove(struct amdgpu_bo *bo)
+{
+	struct amdgpu_heap_counters *counters;
+
+	if (!bo->usage_tracked)
+		return;
+
+	counters = &bo->dev->heap_usage[bo->usage_heap];
+	if (bo->usage_cached) {
+		__sync_sub_and_fetch(&counters->cached_count, 1);
+		__sync_sub_and_fetch(&counters->cached_bytes, bo->alloc_size);
+	} else {
+		__sync_sub_and_fetch(&counters->live_count, 1);
+		__sync_sub_and_fetch(&counters->live_bytes, bo->alloc_size);
+	}
+	bo->usage_tracked = false;
+}
+
+/* Called with the cache mutex held when the buffer enters the cache. */
+drm_private void amdgpu_heap_usage_cache(struct amdgpu_bo *bo)
+{
+	struct amdgpu_heap_counters *counters;
+
+	if (!bo->usage_tracked || bo->usage_cached)
+		return;
+
+	counters = &bo->dev->heap_usage[bo->usage_heap];
+	__sync_add_and_fetch(&counters->cached_count, 1);
+	__sync_add_and_fetch(&counters->cached_bytes, bo->alloc_size);
+	__sync_sub_and_fetch(&counters->live_count, 1);
+	__sync_sub_and_fetch(&counters->live_bytes, bo->alloc_size);
+	bo->usage_cached = true;
+}
+
+/* Called with the cache mutex held when the cache hands the buffer out. */
+drm_private void amdgpu_heap_usage_reuse(struct amdgpu_bo *bo)
+{
+	struct amdgpu_heap_counters *counters;
+
+	if (!bo->usage_tracked || !bo->usage_cached)
+		return;
+
+	counters = &bo->dev->heap_usage[bo->usage_heap];
+	__sync_sub_and_fetch(&counters->cached_count, 1);
+	__sync_sub_and_fetch(&counters->cached_bytes, bo->alloc_size);
+	amdgpu_heap_usage_allocated(counters, bo);
+	bo->usage_cached = false;
+}
+
+static int amdgpu_heap_budget_refresh(struct amdgpu_device *dev)
+{
+	struct drm_amdgpu_memory_info info = {};
+	uint64_t now;
+	int r;
+
+	r = amdgpu_query_info(dev, AMDGPU_INFO_MEMORY, sizeof(info), &info);
+	if (r)
+		return r;
+
+	now = amdgpu_heap_usage_time_ns();
+
+	pthread_mutex_lock(&dev->budget_mutex);
+	dev->budget[AMDGPU_HEAP_USAGE_VRAM].size = info.vram.usable_heap_size;
+	dev->budget[AMDGPU_HEAP_USAGE_VRAM].usage = info.vram.heap_usage;
+	dev->budget[AMDGPU_HEAP_USAGE_VRAM].timestamp_ns = now;
+	dev->budget[AMDGPU_HEAP_USAGE_GTT].size = info.gtt.usable_heap_size;
+	dev->budget[AMDGPU_HEAP_USAGE_GTT].usage = info.gtt.heap_usage;
+	dev->budget[AMDGPU_HEAP_USAGE_GTT].timestamp_ns = now;
+	pthread_mutex_unlock(&dev->budget_mutex);
+
+	return 0;
+}
+
+static void *amdgpu_heap_budget_thread(void *data)
+{
+	struct amdgpu_device *dev = data;
+
+	pthread_mutex_lock(&dev->budget_mutex);
+	while (dev->budget_interval_ns) {
+		uint64_t interval = dev->budget_interval_ns, deadline;
+		struct timespec ts;
+
+		pthread_mutex_unlock(&dev->budget_mutex);
+		amdgpu_heap_budget_refresh(dev);
+		pthread_mutex_lock(&dev->budget_mutex);
+
+		deadline = amdgpu_heap_usage_time_ns() + interval;
+		ts.tv_sec = deadline / 1000000000ull;
+		ts.tv_nsec = deadline % 1000000000ull;
+
+		/* Sleep until the next refresh, or until the interval changes */
+		while (dev->budget_interval_ns == interval &&
+		       pthread_cond_timedwait(&dev->budget_cond,
+					      &dev->budget_mutex, &ts) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&dev->budget_mutex);
+
+	return NULL;
+}
+
+drm_public int amdgpu_heap_usage_set_budget_interval(amdgpu_device_handle dev,
+						     uint64_t interval_ns)
+{
+	int r = 0;
+
+	if (!dev)
+		return -EINVAL;
+
+	pthread_mutex_lock(&dev->budget_thread_mutex);
+
+	pthread_mutex_lock(&dev->budget_mutex);
+	dev->budget_interval_ns = interval_ns;
+	pthread_cond_signal(&dev->budget_cond);
+	pthread_mutex_unlock(&dev->budget_mutex);
+
+	if (interval_ns && !dev->budget_thread_running) {
+		r = -pthread_create(&dev->budget_thread, NULL,
+				    amdgpu_heap_budget_thread, dev);
+		if (r) {
+			pthread_mutex_lock(&dev->budget_mutex);
+			dev->budget_interval_ns = 0;
+			pthread_mutex_unlock(&dev->budget_mutex);
+		} else {
+			dev->budget_thread_running = true;
+		}
+	} else if (!interval_ns && dev->budget_thread_running) {
+		pthread_join(dev->budget_thread, NULL);
+		dev->budget_thread_running = false;
+	}
+
+	pthread_mutex_unlock(&dev->budget_thread_mutex);
+
+	return r;
+}
+
+drm_public int amdgpu_query_heap_usage(amdgpu_device_handle dev, uint32_t heap,
+				       uint32_t flags,
+				       struct amdgpu_heap_usage *usage)
+{
+	struct amdgpu_heap_counters *counters;
+	uint32_t i;
+	int r;
+
+	if (!dev || !usage || heap >= AMDGPU_HEAP_USAGE_NUM ||
+	    (flags & ~AMDGPU_HEAP_USAGE_REFRESH_BUDGET))
+		return -EINVAL;
+
+	if (flags & AMDGPU_HEAP_USAGE_REFRESH_BUDGET) {
+		r = amdgpu_heap_budget_refresh(dev);
+		if (r)
+			return r;
+	}
+
+	/* The counters are read one by one, they may be a little apart. */
+	counters = &dev->heap_usage[heap];
+	memset(usage, 0, sizeof(*usage));
+	usage->live_bytes = __atomic_load_n(&counters->live_bytes, __ATOMIC_RELAXED);
+	usage->live_count = __atomic_load_n(&counters->live_count, __ATOMIC_RELAXED);
+	usage->cached_bytes = __atomic_load_n(&counters->cached_bytes, __ATOMIC_RELAXED);
+	usage->cached_count = __atomic_load_n(&counters->cached_count, __ATOMIC_RELAXED);
+	usage->peak_bytes = __atomic_load_n(&counters->peak_bytes, __ATOMIC_RELAXED);
+	usage->allocations = __atomic_load_n(&counters->allocations, __ATOMIC_RELAXED);
+	for (i = 0; i < AMDGPU_HEAP_USAGE_BUCKETS; i++)
+		usage->size_histogram[i] =
+			__atomic_load_n(&counters->size_histogram[i],
+					__ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&dev->budget_mutex);
+	usage->budget_size = dev->budget[heap].size;
+	usage->budget_usage = dev->budget[heap].usage;
+	usage->budget_timestamp_ns = dev->budget[heap].timestamp_ns;
+	pthread_mutex_unlock(&dev->budget_mutex);
+
+	return 0;
+}
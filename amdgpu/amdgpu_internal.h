@@ -27,10 +27,12 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "libdrm_macros.h"
 #include "xf86atomic.h"
 #include "amdgpu.h"
+#include "amdgpu_drm.h"
 #include "util_double_list.h"
 #include "handle_table.h"
 
@@ -39,6 +41,7 @@
 #define __round_mask(x, y) ((__typeof__(x))((y)-1))
 #define ROUND_UP(x, y) ((((x)-1) | __round_mask(x, y))+1)
 #define ROUND_DOWN(x, y) ((x) & ~__round_mask(x, y))
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #define AMDGPU_INVALID_VA_ADDRESS	0xffffffffffffffff
 #define AMDGPU_NULL_SUBMIT_SEQ		0
@@ -49,11 +52,17 @@ struct amdgpu_bo_va_hole {
 	uint64_t size;
 };
 
+struct amdgpu_va_shared;
+
 struct amdgpu_bo_va_mgr {
 	uint64_t va_max;
 	struct list_head va_holes;
 	pthread_mutex_t bo_va_mutex;
 	uint32_t va_alignment;
+	/** Set if the holes are kept in shared memory instead of va_holes,
+	 *  see amdgpu_va_manager_init_shared() */
+	struct amdgpu_va_shared *shared;
+	uint32_t shared_index;
 };
 
 struct amdgpu_va {
@@ -61,6 +70,9 @@ struct amdgpu_va {
 	uint64_t size;
 	enum amdgpu_gpu_va_range range;
 	struct amdgpu_bo_va_mgr *vamgr;
+	/** Range of a shared buffer, see amdgpu_va_range_alloc_shared() */
+	bool shared_buffer;
+	uint64_t shared_key;
 };
 
 struct amdgpu_va_manager {
@@ -72,6 +84,68 @@ struct amdgpu_va_manager {
 	struct amdgpu_bo_va_mgr vamgr_high;
 	/** The VA manager for the 32bit high address space */
 	struct amdgpu_bo_va_mgr vamgr_high_32;
+	/** Mapping of the shared memory, if any */
+	struct amdgpu_va_shared *shared;
+};
+
+struct amdgpu_bo_bucket {
+	uint64_t size;
+	struct list_head list;
+};
+
+struct amdgpu_bo_cache {
+	/** Protects everything below. */
+	pthread_mutex_t mutex;
+	bool enabled;
+	struct amdgpu_bo_bucket cache_bucket[14 * 4];
+	int num_buckets;
+	time_t time;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t purged;
+	uint64_t cached_count;
+	uint64_t cached_size;
+};
+
+/**
+ * Syncobjs amdgpu_cs_wait_items() converted fences to. Direct mapped by a
+ * hash of the fence, a colliding fence replaces the older entry.
+ */
+#define AMDGPU_FENCE_HANDLE_CACHE_SIZE	64
+
+struct amdgpu_fence_handle_cache_entry {
+	uint32_t ctx_id;
+	uint32_t ip_type;
+	uint32_t ip_instance;
+	uint32_t ring;
+	uint64_t seq_no;
+	/* 0 if the entry is empty */
+	uint32_t handle;
+	/* waits currently using the handle, it can't be replaced until 0 */
+	uint32_t users;
+};
+
+struct amdgpu_fence_handle_cache {
+	pthread_mutex_t mutex;
+	struct amdgpu_fence_handle_cache_entry entries[AMDGPU_FENCE_HANDLE_CACHE_SIZE];
+};
+
+/** Per heap counters, updated with atomics */
+struct amdgpu_heap_counters {
+	uint64_t live_bytes;
+	uint64_t live_count;
+	uint64_t cached_bytes;
+	uint64_t cached_count;
+	uint64_t peak_bytes;
+	uint64_t allocations;
+	uint64_t size_histogram[AMDGPU_HEAP_USAGE_BUCKETS];
+};
+
+struct amdgpu_heap_budget {
+	uint64_t size;
+	uint64_t usage;
+	uint64_t timestamp_ns;
 };
 
 struct amdgpu_device {
@@ -93,6 +167,37 @@ struct amdgpu_device {
 	struct amdgpu_gpu_info info;
 
 	struct amdgpu_va_manager va_mgr;
+
+	/** Reuse cache of freed buffers, see amdgpu_bo_cache_enable() */
+	struct amdgpu_bo_cache bo_cache;
+
+	/** Fences converted to syncobjs, see amdgpu_cs_wait_items() */
+	struct amdgpu_fence_handle_cache fence_handle_cache;
+
+	/** Buffers of this process by heap, see amdgpu_query_heap_usage() */
+	struct amdgpu_heap_counters heap_usage[AMDGPU_HEAP_USAGE_NUM];
+
+	/** Kernel heap numbers and the thread refreshing them, see
+	 *  amdgpu_heap_usage_set_budget_interval(). budget_mutex protects
+	 *  the numbers and the interval, budget_thread_mutex serializes
+	 *  starting and stopping the thread. */
+	pthread_mutex_t budget_mutex;
+	pthread_mutex_t budget_thread_mutex;
+	pthread_cond_t budget_cond;
+	pthread_t budget_thread;
+	bool budget_thread_running;
+	uint64_t budget_interval_ns;
+	struct amdgpu_heap_budget budget[AMDGPU_HEAP_USAGE_NUM];
+
+	/** LRU of CPU mappings kept alive after the last amdgpu_bo_cpu_unmap().
+	 *  Protected by vma_mutex, see amdgpu_bo_set_vma_cache_size(). */
+	pthread_mutex_t vma_mutex;
+	struct list_head vma_cache;
+	int vma_count, vma_max;
+	atomic_t vma_open;
+	uint64_t vma_hits;
+	uint64_t vma_misses;
+	uint64_t vma_evictions;
 };
 
 struct amdgpu_bo {
@@ -105,8 +210,31 @@ struct amdgpu_bo {
 	uint32_t flink_name;
 
 	pthread_mutex_t cpu_access_mutex;
+	/* Once cpu_map_count dropped to zero, cpu_ptr is owned by the device
+	 * vma_cache and only accessed with vma_mutex held. */
 	void *cpu_ptr;
 	int64_t cpu_map_count;
+	struct list_head vma_list;
+
+	/* Creation parameters, used as the reuse cache key. */
+	uint64_t phys_alignment;
+	uint64_t alloc_flags;
+	uint32_t preferred_heap;
+	/** True if the buffer may be recycled through the bo_cache */
+	bool reusable;
+	/** Link in the bo_cache bucket and the time it was put there */
+	struct list_head list;
+	time_t free_time;
+	/** GPU VA mappings made through this library and not unmapped yet.
+	 *  Never less than the real number, CLEAR and REPLACE may leave it
+	 *  too high. */
+	atomic_t va_mappings;
+
+	/** Set once the buffer counts for heap_usage[usage_heap] */
+	bool usage_tracked;
+	/** Counted as cached instead of live */
+	bool usage_cached;
+	uint8_t usage_heap;
 };
 
 struct amdgpu_bo_list {
@@ -115,6 +243,92 @@ struct amdgpu_bo_list {
 	uint32_t handle;
 };
 
+/**
+ * BO list kept across submissions.
+ *
+ * index[] is indexed by GEM handle and holds the position in entries[]
+ * plus one, or 0 if the BO is not in the list.
+ */
+struct amdgpu_bo_list_builder {
+	struct amdgpu_device *dev;
+
+	struct drm_amdgpu_bo_list_entry *entries;
+	uint32_t num_entries;
+	uint32_t max_entries;
+
+	uint32_t *index;
+	uint32_t index_size;
+
+	/* kernel BO list, updated lazily when the entries changed */
+	uint32_t kernel_handle;
+	bool kernel_dirty;
+
+	struct drm_amdgpu_bo_list_in chunk_data;
+};
+
+struct amdgpu_bo_va_batch_op {
+	struct amdgpu_bo *bo;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t addr;
+	uint64_t flags;
+	uint32_t ops;
+	bool cancelled;
+	/* for unmaps, bytes of the range covered by cancelled maps */
+	uint64_t cancelled_size;
+};
+
+struct amdgpu_bo_va_batch {
+	struct amdgpu_device *dev;
+
+	struct amdgpu_bo_va_batch_op *ops;
+	uint32_t num_ops;
+	uint32_t max_ops;
+
+	/* timeline point signaled by the last flush, which carries the
+	 * last page table update of the batch */
+	uint32_t last_syncobj;
+	uint64_t last_point;
+
+	struct amdgpu_bo_va_batch_stats stats;
+};
+
+/**
+ * User fence location last used on a ring, kept mapped so fence queries can
+ * be answered from memory.
+ */
+/*
+ * Changed with the context sequence_mutex held, cpu_addr and seq are read
+ * without it. The reference on bo keeps the mapping valid even if the
+ * caller frees the buffer.
+ */
+struct amdgpu_cs_user_fence {
+	struct amdgpu_bo *bo;
+	uint64_t offset;
+	volatile uint64_t *cpu_addr;
+	/* Last submission writing it, later ones are only known to the kernel */
+	uint64_t seq;
+};
+
+#define AMDGPU_CS_RINGS_PER_IP \
+	(AMDGPU_HW_IP_INSTANCE_MAX_COUNT * AMDGPU_CS_MAX_RINGS)
+
+/**
+ * State of one ring of a context.
+ */
+struct amdgpu_cs_ring_state {
+	uint64_t last_seq;
+
+	/* Semaphores the next submission waits for, and their fences
+	 * already in the form of the dependency chunk. */
+	uint32_t num_sems;
+	uint32_t max_sems;
+	struct amdgpu_semaphore **sems;
+	struct drm_amdgpu_cs_chunk_dep *sem_deps;
+
+	struct amdgpu_cs_user_fence user_fence;
+};
+
 struct amdgpu_context {
 	struct amdgpu_device *dev;
 	/** Mutex for accessing fences and to maintain command submissions
@@ -122,8 +336,134 @@ struct amdgpu_context {
 	pthread_mutex_t sequence_mutex;
 	/* context id*/
 	uint32_t id;
-	uint64_t last_seq[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
-	struct list_head sem_list[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+	/* Per ring state, allocated for an IP type on first use */
+	struct amdgpu_cs_ring_state *ring_state[AMDGPU_HW_IP_NUM];
+	/* User fence buffers no longer tracked, which lock free fence
+	 * queries may still be reading */
+	struct amdgpu_bo **retired_fence_bos;
+	uint32_t num_retired_fence_bos;
+	uint32_t max_retired_fence_bos;
+	/* Fence query statistics, updated atomically */
+	uint64_t user_fence_signaled;
+	uint64_t user_fence_busy;
+	uint64_t fence_ioctls;
+};
+
+/**
+ * Prebuilt command submission, see amdgpu_cs_submission_create().
+ *
+ * The chunk array always starts with the IB chunks and the optional fence
+ * chunk. The dependency and semaphore chunks are appended at submit time.
+ */
+#define AMDGPU_CS_SUBMISSION_MAX_CHUNKS	(AMDGPU_CS_MAX_IBS_PER_SUBMIT + 3)
+
+struct amdgpu_cs_submission {
+	struct amdgpu_context *context;
+	uint32_t ip_type;
+	uint32_t ip_instance;
+	uint32_t ring;
+	uint32_t bo_list_handle;
+
+	uint32_t number_of_ibs;
+	uint32_t num_fixed_chunks;
+	uint32_t number_of_dependencies;
+	uint32_t max_dependencies;
+
+	struct drm_amdgpu_cs_chunk_dep *dependencies;
+	struct amdgpu_cs_fence_info fence_info;
+
+	uint64_t chunk_array[AMDGPU_CS_SUBMISSION_MAX_CHUNKS];
+	struct drm_amdgpu_cs_chunk chunks[AMDGPU_CS_SUBMISSION_MAX_CHUNKS];
+	struct drm_amdgpu_cs_chunk_data chunk_data[AMDGPU_CS_MAX_IBS_PER_SUBMIT + 1];
+};
+
+/**
+ * Job of a submission scheduler.
+ *
+ * The caller's chunks are followed by room for the SYNCOBJ_IN chunk with
+ * the syncobjs of the dependencies and the SYNCOBJ_OUT chunk which signals
+ * the job's own syncobj.
+ */
+struct amdgpu_cs_sched_job_node {
+	struct list_head list;
+	struct amdgpu_context *context;
+	uint32_t bo_list_handle;
+	uint32_t num_chunks;
+	struct drm_amdgpu_cs_chunk *chunks;
+	uint64_t *seq_no;
+
+	/* fences of the dependencies submitted so far */
+	struct drm_amdgpu_cs_chunk_dep *deps;
+	uint32_t num_deps;
+
+	/* fence of the submission, no context if the job has no IB */
+	struct amdgpu_cs_fence fence;
+
+	/* dependencies not submitted yet */
+	uint32_t pending_deps;
+	uint32_t *dependents;
+	uint32_t num_dependents;
+	uint32_t max_dependents;
+
+	bool submitted;
+	bool failed;
+	uint64_t ready_time;
+};
+
+struct amdgpu_cs_scheduler {
+	struct amdgpu_device *dev;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t ready_cond;
+	pthread_cond_t idle_cond;
+	struct list_head ready;
+	bool stop;
+
+	pthread_t *workers;
+	uint32_t num_workers;
+
+	/* jobs which may not have executed yet, by id from first_job_id */
+	struct amdgpu_cs_sched_job_node **jobs;
+	uint32_t num_jobs;
+	uint32_t max_jobs;
+	uint32_t first_job_id;
+	uint32_t outstanding;
+	int error;
+
+	/* statistics */
+	uint32_t queue_depth;
+	uint32_t max_queue_depth;
+	uint64_t submitted;
+	uint64_t failed;
+	uint64_t total_latency_ns;
+	uint64_t max_latency_ns;
+};
+
+/**
+ * Ring buffer of a user mode queue.
+ *
+ * Positions are in dwords and only ever grow, the ring index is the position
+ * masked by size_dw - 1. Producers claim space by moving "reserved" forward
+ * and publish it in order by moving "committed"; "flushed" is the last
+ * position written to the wptr and doorbell.
+ */
+struct amdgpu_userq_ring {
+	struct amdgpu_device *dev;
+	uint32_t queue_id;
+
+	uint32_t *ring;
+	uint32_t size_dw;
+	volatile uint64_t *wptr;
+	volatile uint64_t *rptr;
+	volatile uint64_t *doorbell;
+
+	uint64_t reserved;
+	uint64_t committed;
+
+	/* Serializes wptr/doorbell updates and the signal ioctl */
+	pthread_mutex_t flush_mutex;
+	uint64_t flushed;
+	uint32_t signal_syncobj;
 };
 
 /**
@@ -132,7 +472,6 @@ struct amdgpu_context {
  */
 struct amdgpu_semaphore {
 	atomic_t refcount;
-	struct list_head list;
 	struct amdgpu_cs_fence signal_fence;
 };
 
@@ -145,12 +484,51 @@ drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 
 drm_private void amdgpu_vamgr_deinit(struct amdgpu_bo_va_mgr *mgr);
 
+drm_private struct amdgpu_bo_va_mgr *
+amdgpu_va_manager_select(struct amdgpu_va_manager *va_mgr, uint64_t flags);
+
+drm_private int amdgpu_vamgr_shared_find_va(struct amdgpu_bo_va_mgr *mgr,
+					    uint64_t size, uint64_t alignment,
+					    uint64_t base_required,
+					    bool search_from_top,
+					    uint64_t *va_out);
+drm_private void amdgpu_vamgr_shared_free_va(struct amdgpu_bo_va_mgr *mgr,
+					     uint64_t va, uint64_t size);
+drm_private void amdgpu_va_shared_buffer_free(struct amdgpu_va *va);
+drm_private void amdgpu_va_manager_unmap_shared(struct amdgpu_va_manager *va_mgr);
+
 drm_private void amdgpu_parse_asic_ids(struct amdgpu_device *dev);
 
+drm_private void amdgpu_bo_destroy(struct amdgpu_bo *bo);
+
+drm_private void amdgpu_bo_vma_cache_init(struct amdgpu_device *dev);
+drm_private void amdgpu_bo_vma_cache_fini(struct amdgpu_device *dev);
+
+drm_private void amdgpu_bo_cache_init(struct amdgpu_bo_cache *cache);
+drm_private void amdgpu_bo_cache_fini(struct amdgpu_bo_cache *cache);
+drm_private struct amdgpu_bo *
+amdgpu_bo_cache_alloc(struct amdgpu_bo_cache *cache, uint64_t *size,
+		      uint64_t alignment, uint32_t heap, uint64_t flags);
+drm_private int amdgpu_bo_cache_free(struct amdgpu_bo_cache *cache,
+				     struct amdgpu_bo *bo);
+
 drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev);
 
+drm_private int amdgpu_gpu_info_cache_load(amdgpu_device_handle dev);
+drm_private void amdgpu_gpu_info_cache_store(amdgpu_device_handle dev);
+
 drm_private uint64_t amdgpu_cs_calculate_timeout(uint64_t timeout);
 
+drm_private void amdgpu_heap_usage_init(struct amdgpu_device *dev);
+drm_private void amdgpu_heap_usage_fini(struct amdgpu_device *dev);
+drm_private void amdgpu_heap_usage_add(struct amdgpu_bo *bo, uint32_t heap);
+drm_private void amdgpu_heap_usage_remove(struct amdgpu_bo *bo);
+drm_private void amdgpu_heap_usage_cache(struct amdgpu_bo *bo);
+drm_private void amdgpu_heap_usage_reuse(struct amdgpu_bo *bo);
+
+drm_private void amdgpu_cs_fence_handle_cache_init(struct amdgpu_device *dev);
+drm_private void amdgpu_cs_fence_handle_cache_fini(struct amdgpu_device *dev);
+
 /**
  * Inline functions.
  */
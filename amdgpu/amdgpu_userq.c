@@ -21,11 +21,14 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
 #include "xf86drm.h"
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
+#include "util_math.h"
 
 drm_public int
 amdgpu_create_userqueue(amdgpu_device_handle dev,
@@ -121,3 +124,233 @@ amdgpu_userq_wait(amdgpu_device_handle dev,
 
 	return r;
 }
+
+drm_public int
+amdgpu_userq_ring_create(amdgpu_device_handle dev,
+			 const struct amdgpu_userq_ring_info *info,
+			 amdgpu_userq_ring_handle *ring)
+{
+	struct amdgpu_userq_ring *r;
+
+	if (!dev || !info || !ring || !info->ring || !info->wptr || !info->rptr)
+		return -EINVAL;
+
+	/* positions are masked into the ring */
+	if (!info->ring_size_dw ||
+	    (info->ring_size_dw & (info->ring_size_dw - 1)))
+		return -EINVAL;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+
+	r->dev = dev;
+	r->queue_id = info->queue_id;
+	r->ring = info->ring;
+	r->size_dw = info->ring_size_dw;
+	r->wptr = info->wptr;
+	r->rptr = info->rptr;
+	r->doorbell = info->doorbell;
+
+	/* continue where the queue is, it may have been used before */
+	r->reserved = r->committed = r->flushed = *info->wptr;
+	pthread_mutex_init(&r->flush_mutex, NULL);
+
+	*ring = r;
+	return 0;
+}
+
+drm_public int
+amdgpu_userq_ring_destroy(amdgpu_userq_ring_handle ring)
+{
+	if (!ring)
+		return -EINVAL;
+
+	if (ring->signal_syncobj)
+		drmSyncobjDestroy(ring->dev->fd, ring->signal_syncobj);
+	pthread_mutex_destroy(&ring->flush_mutex);
+	free(ring);
+	return 0;
+}
+
+drm_public int
+amdgpu_userq_ring_reserve(amdgpu_userq_ring_handle ring,
+			  uint32_t num_dw, uint64_t *pos)
+{
+	uint64_t old;
+
+	if (!ring || !pos || !num_dw || num_dw > ring->size_dw)
+		return -EINVAL;
+
+	do {
+		old = ring->reserved;
+		if (old + num_dw - *ring->rptr > ring->size_dw)
+			return -EBUSY;
+	} while (__sync_val_compare_and_swap(&ring->reserved, old,
+					     old + num_dw) != old);
+
+	*pos = old;
+	return 0;
+}
+
+drm_public void
+amdgpu_userq_ring_write(amdgpu_userq_ring_handle ring, uint64_t pos,
+			const uint32_t *dw, uint32_t num_dw)
+{
+	uint32_t start = pos & (ring->size_dw - 1);
+	uint32_t first = MIN2(num_dw, ring->size_dw - start);
+
+	memcpy(ring->ring + start, dw, first * 4);
+	memcpy(ring->ring, dw + first, (num_dw - first) * 4);
+}
+
+drm_public int
+amdgpu_userq_ring_commit(amdgpu_userq_ring_handle ring,
+			 uint64_t pos, uint32_t num_dw)
+{
+	unsigned spins = 0;
+
+	if (!ring)
+		return -EINVAL;
+
+	/* Earlier reservations are being written by other threads. That
+	 * only takes as long as a packet copy, unless the writer got
+	 * preempted, so don't burn a whole time slice on it.
+	 */
+	while (*(volatile uint64_t *)&ring->committed != pos) {
+		if (++spins > 1000)
+			sched_yield();
+	}
+
+	/* make the packet visible before the position */
+	__sync_synchronize();
+	*(volatile uint64_t *)&ring->committed = pos + num_dw;
+	return 0;
+}
+
+/* Called with flush_mutex held. */
+static void amdgpu_userq_ring_flush_locked(amdgpu_userq_ring_handle ring)
+{
+	uint64_t committed = *(volatile uint64_t *)&ring->committed;
+
+	if (committed == ring->flushed)
+		return;
+
+	__sync_synchronize();
+	*ring->wptr = committed;
+	if (ring->doorbell) {
+		__sync_synchronize();
+		*ring->doorbell = committed;
+	}
+	ring->flushed = committed;
+}
+
+drm_public int
+amdgpu_userq_ring_flush(amdgpu_userq_ring_handle ring, uint64_t *wptr)
+{
+	if (!ring)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ring->flush_mutex);
+	amdgpu_userq_ring_flush_locked(ring);
+	if (wptr)
+		*wptr = ring->flushed;
+	pthread_mutex_unlock(&ring->flush_mutex);
+	return 0;
+}
+
+drm_public int
+amdgpu_userq_ring_signal(amdgpu_userq_ring_handle ring,
+			 uint32_t syncobj, uint64_t point)
+{
+	struct drm_amdgpu_userq_signal signal_data;
+	uint32_t handle = syncobj;
+	int r;
+
+	if (!ring || !syncobj)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ring->flush_mutex);
+	amdgpu_userq_ring_flush_locked(ring);
+
+	/* The signal ioctl only replaces the fence of binary syncobjs,
+	 * timeline points get the fence through a binary syncobj.
+	 */
+	if (point) {
+		if (!ring->signal_syncobj) {
+			r = drmSyncobjCreate(ring->dev->fd, 0,
+					     &ring->signal_syncobj);
+			if (r)
+				goto out_unlock;
+		}
+		handle = ring->signal_syncobj;
+	}
+
+	memset(&signal_data, 0, sizeof(signal_data));
+	signal_data.queue_id = ring->queue_id;
+	signal_data.syncobj_handles = (uintptr_t)&handle;
+	signal_data.num_syncobj_handles = 1;
+	r = amdgpu_userq_signal(ring->dev, &signal_data);
+	if (r || !point)
+		goto out_unlock;
+
+	r = drmSyncobjTransfer(ring->dev->fd, syncobj, point, handle, 0, 0);
+
+out_unlock:
+	pthread_mutex_unlock(&ring->flush_mutex);
+	return r;
+}
+
+drm_public int
+amdgpu_userq_ring_get_wait_fences(amdgpu_userq_ring_handle ring,
+				  const uint32_t *syncobjs,
+				  const uint64_t *points,
+				  uint32_t count,
+				  struct drm_amdgpu_userq_fence_info *fences,
+				  uint32_t *num_fences)
+{
+	struct drm_amdgpu_userq_wait wait_data;
+	uint32_t *binary, *timeline;
+	uint64_t *timeline_points;
+	uint32_t num_binary = 0, num_timeline = 0, i;
+	int r;
+
+	if (!ring || (count && !syncobjs) || !fences || !num_fences)
+		return -EINVAL;
+	if (count > UINT16_MAX)
+		return -EINVAL;
+
+	/* one allocation for the points and both handle arrays */
+	timeline_points = malloc(count * (sizeof(uint64_t) +
+					  2 * sizeof(uint32_t)) + 1);
+	if (!timeline_points)
+		return -ENOMEM;
+	binary = (uint32_t *)(timeline_points + count);
+	timeline = binary + count;
+
+	for (i = 0; i < count; i++) {
+		if (points && points[i]) {
+			timeline_points[num_timeline] = points[i];
+			timeline[num_timeline++] = syncobjs[i];
+		} else {
+			binary[num_binary++] = syncobjs[i];
+		}
+	}
+
+	memset(&wait_data, 0, sizeof(wait_data));
+	wait_data.waitq_id = ring->queue_id;
+	wait_data.syncobj_handles = (uintptr_t)binary;
+	wait_data.num_syncobj_handles = num_binary;
+	wait_data.syncobj_timeline_handles = (uintptr_t)timeline;
+	wait_data.syncobj_timeline_points = (uintptr_t)timeline_points;
+	wait_data.num_syncobj_timeline_handles = num_timeline;
+	wait_data.num_fences = MIN2(*num_fences, UINT16_MAX);
+	wait_data.out_fences = (uintptr_t)fences;
+
+	r = amdgpu_userq_wait(ring->dev, &wait_data);
+	if (!r)
+		*num_fences = wait_data.num_fences;
+
+	free(timeline_points);
+	return r;
+}
@@ -62,6 +62,10 @@ drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 drm_private void amdgpu_vamgr_deinit(struct amdgpu_bo_va_mgr *mgr)
 {
 	struct amdgpu_bo_va_hole *hole, *tmp;
+
+	if (mgr->shared)
+		return;
+
 	LIST_FOR_EACH_ENTRY_SAFE(hole, tmp, &mgr->va_holes, list) {
 		list_del(&hole->list);
 		free(hole);
@@ -113,6 +117,11 @@ amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 	if (base_required % alignment)
 		return -EINVAL;
 
+	if (mgr->shared)
+		return amdgpu_vamgr_shared_find_va(mgr, size, alignment,
+						   base_required,
+						   search_from_top, va_out);
+
 	pthread_mutex_lock(&mgr->bo_va_mutex);
 	if (!search_from_top) {
 		LIST_FOR_EACH_ENTRY_SAFE_REV(hole, n, &mgr->va_holes, list) {
@@ -174,6 +183,11 @@ amdgpu_vamgr_free_va(struct amdgpu_bo_va_mgr *mgr, uint64_t va, uint64_t size)
 
 	size = ALIGN(size, mgr->va_alignment);
 
+	if (mgr->shared) {
+		amdgpu_vamgr_shared_free_va(mgr, va, size);
+		return;
+	}
+
 	pthread_mutex_lock(&mgr->bo_va_mutex);
 	hole = container_of(&mgr->va_holes, hole, list);
 	LIST_FOR_EACH_ENTRY(next, &mgr->va_holes, list) {
@@ -235,6 +249,26 @@ drm_public int amdgpu_va_range_alloc(amdgpu_device_handle dev,
 				      flags);
 }
 
+drm_private struct amdgpu_bo_va_mgr *
+amdgpu_va_manager_select(struct amdgpu_va_manager *va_mgr, uint64_t flags)
+{
+	/* Clear the flag when the high VA manager is not initialized */
+	if (flags & AMDGPU_VA_RANGE_HIGH && !va_mgr->vamgr_high_32.va_max)
+		flags &= ~AMDGPU_VA_RANGE_HIGH;
+
+	if (flags & AMDGPU_VA_RANGE_HIGH) {
+		if (flags & AMDGPU_VA_RANGE_32_BIT)
+			return &va_mgr->vamgr_high_32;
+		else
+			return &va_mgr->vamgr_high;
+	} else {
+		if (flags & AMDGPU_VA_RANGE_32_BIT)
+			return &va_mgr->vamgr_32;
+		else
+			return &va_mgr->vamgr_low;
+	}
+}
+
 drm_public int amdgpu_va_range_alloc2(amdgpu_va_manager_handle va_mgr,
 				      enum amdgpu_gpu_va_range va_range_type,
 				      uint64_t size,
@@ -248,21 +282,7 @@ drm_public int amdgpu_va_range_alloc2(amdgpu_va_manager_handle va_mgr,
 	bool search_from_top = !!(flags & AMDGPU_VA_RANGE_REPLAYABLE);
 	int ret;
 
-	/* Clear the flag when the high VA manager is not initialized */
-	if (flags & AMDGPU_VA_RANGE_HIGH && !va_mgr->vamgr_high_32.va_max)
-		flags &= ~AMDGPU_VA_RANGE_HIGH;
-
-	if (flags & AMDGPU_VA_RANGE_HIGH) {
-		if (flags & AMDGPU_VA_RANGE_32_BIT)
-			vamgr = &va_mgr->vamgr_high_32;
-		else
-			vamgr = &va_mgr->vamgr_high;
-	} else {
-		if (flags & AMDGPU_VA_RANGE_32_BIT)
-			vamgr = &va_mgr->vamgr_32;
-		else
-			vamgr = &va_mgr->vamgr_low;
-	}
+	vamgr = amdgpu_va_manager_select(va_mgr, flags);
 
 	va_base_alignment = MAX2(va_base_alignment, vamgr->va_alignment);
 	size = ALIGN(size, vamgr->va_alignment);
@@ -273,10 +293,8 @@ drm_public int amdgpu_va_range_alloc2(amdgpu_va_manager_handle va_mgr,
 
 	if (!(flags & AMDGPU_VA_RANGE_32_BIT) && ret) {
 		/* fallback to 32bit address */
-		if (flags & AMDGPU_VA_RANGE_HIGH)
-			vamgr = &va_mgr->vamgr_high_32;
-		else
-			vamgr = &va_mgr->vamgr_32;
+		vamgr = amdgpu_va_manager_select(va_mgr,
+						 flags | AMDGPU_VA_RANGE_32_BIT);
 		ret = amdgpu_vamgr_find_va(vamgr, size,
 					   va_base_alignment, va_base_required,
 					   search_from_top, va_base_allocated);
@@ -304,6 +322,12 @@ drm_public int amdgpu_va_range_free(amdgpu_va_handle va_range_handle)
 	if(!va_range_handle || !va_range_handle->address)
 		return 0;
 
+	if (va_range_handle->shared_buffer) {
+		amdgpu_va_shared_buffer_free(va_range_handle);
+		free(va_range_handle);
+		return 0;
+	}
+
 	amdgpu_vamgr_free_va(va_range_handle->vamgr,
 			va_range_handle->address,
 			va_range_handle->size);
@@ -356,4 +380,7 @@ drm_public void amdgpu_va_manager_deinit(struct amdgpu_va_manager *va_mgr)
 	amdgpu_vamgr_deinit(&va_mgr->vamgr_low);
 	amdgpu_vamgr_deinit(&va_mgr->vamgr_high_32);
 	amdgpu_vamgr_deinit(&va_mgr->vamgr_high);
+
+	if (va_mgr->shared)
+		amdgpu_va_manager_unmap_shared(va_mgr);
 }
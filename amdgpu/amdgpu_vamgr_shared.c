@@ -0,0 +1,739 @@
+/*
+ * Copyright 2026 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file amdgpu_vamgr_shared.c
+ *
+ *  VA manager backend keeping the free ranges in shared memory, so that
+ *  cooperating processes allocate from one address space and can give
+ *  shared buffers the same GPU address everywhere.
+ *
+ *  The segment is mapped at a different address in every process, so
+ *  everything in it is addressed by index. It is protected by a robust
+ *  process shared mutex; a process dying while holding it is detected by
+ *  the next one taking it, which checks what was left behind.
+ *
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+#if HAVE_PTHREAD_MUTEX_ROBUST
+
+#define AMDGPU_VA_SHARED_MAGIC		0x53415641	/* "AVAS" */
+#define AMDGPU_VA_SHARED_VERSION	1
+#define AMDGPU_VA_SHARED_RANGES		4
+#define AMDGPU_VA_SHARED_MAX_HOLES	1024
+/* Must be a power of two, the buffers are an open addressed hash table */
+#define AMDGPU_VA_SHARED_MAX_BUFFERS	1024
+
+enum {
+	AMDGPU_VA_SHARED_UNINITIALIZED,
+	AMDGPU_VA_SHARED_INITIALIZING,
+	AMDGPU_VA_SHARED_READY,
+};
+
+struct amdgpu_va_shared_hole {
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct amdgpu_va_shared_range {
+	uint64_t start;
+	uint64_t max;
+	uint32_t num_holes;
+	/* Sorted by offset, never empty or adjacent to each other */
+	struct amdgpu_va_shared_hole holes[AMDGPU_VA_SHARED_MAX_HOLES];
+};
+
+struct amdgpu_va_shared_buffer {
+	uint64_t key;
+	uint64_t address;
+	uint64_t size;
+	/* 0 if the slot is empty */
+	uint32_t refcount;
+	uint32_t range;
+};
+
+struct amdgpu_va_shared {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t state;
+	/* Process setting the segment up, 0 once done or if it failed */
+	pid_t init_pid;
+	uint32_t alignment;
+	/* Set while the lock holder changes the segment */
+	uint32_t dirty;
+	/* Set once a process died leaving the segment inconsistent */
+	uint32_t broken;
+	uint32_t num_buffers;
+	pthread_mutex_t mutex;
+	struct amdgpu_va_shared_range ranges[AMDGPU_VA_SHARED_RANGES];
+	struct amdgpu_va_shared_buffer buffers[AMDGPU_VA_SHARED_MAX_BUFFERS];
+};
+
+/* Range index in the segment of the managers of a process */
+static struct amdgpu_bo_va_mgr *
+amdgpu_va_shared_vamgr(struct amdgpu_va_manager *va_mgr, uint32_t index)
+{
+	switch (index) {
+	case 0:
+		return &va_mgr->vamgr_32;
+	case 1:
+		return &va_mgr->vamgr_low;
+	case 2:
+		return &va_mgr->vamgr_high_32;
+	default:
+		return &va_mgr->vamgr_high;
+	}
+}
+
+static uint32_t amdgpu_va_shared_hash(uint64_t key)
+{
+	key *= 0x9e3779b97f4a7c15ull;
+	return (key >> 32) & (AMDGPU_VA_SHARED_MAX_BUFFERS - 1);
+}
+
+/* Find the slot of a key, or the empty slot it would go to if insert. */
+static struct amdgpu_va_shared_buffer *
+amdgpu_va_shared_lookup(struct amdgpu_va_shared *shared, uint64_t key,
+			bool insert)
+{
+	uint32_t i, slot = amdgpu_va_shared_hash(key);
+
+	for (i = 0; i < AMDGPU_VA_SHARED_MAX_BUFFERS; i++) {
+		struct amdgpu_va_shared_buffer *buf = &shared->buffers[slot];
+
+		if (!buf->refcount)
+			return insert ? buf : NULL;
+		if (buf->key == key)
+			return buf;
+		slot = (slot + 1) & (AMDGPU_VA_SHARED_MAX_BUFFERS - 1);
+	}
+
+	return NULL;
+}
+
+/* Backward shift deletion, so lookups never need tombstones. */
+static void amdgpu_va_shared_remove(struct amdgpu_va_shared *shared,
+				    struct amdgpu_va_shared_buffer *buf)
+{
+	uint32_t mask = AMDGPU_VA_SHARED_MAX_BUFFERS - 1;
+	uint32_t i = buf - shared->buffers, j = i, k;
+
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!shared->buffers[j].refcount)
+			break;
+
+		/* Move the entry up unless its home slot is in (i, j] */
+		k = amdgpu_va_shared_hash(shared->buffers[j].key);
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+			shared->buffers[i] = shared->buffers[j];
+			i = j;
+		}
+	}
+
+	memset(&shared->buffers[i], 0, sizeof(shared->buffers[i]));
+	shared->num_buffers--;
+}
+
+/* Whether a process that died holding the lock left things intact. */
+static bool amdgpu_va_shared_check(struct amdgpu_va_shared *shared)
+{
+	uint32_t i, j, num_buffers = 0;
+
+	for (i = 0; i < AMDGPU_VA_SHARED_RANGES; i++) {
+		struct amdgpu_va_shared_range *range = &shared->ranges[i];
+		uint64_t end = range->start;
+
+		if (range->num_holes > AMDGPU_VA_SHARED_MAX_HOLES)
+			return false;
+
+		for (j = 0; j < range->num_holes; j++) {
+			struct amdgpu_va_shared_hole *hole = &range->holes[j];
+
+			if (!hole->size || hole->offset < end ||
+			    (j && hole->offset == end) ||
+			    hole->size > range->max - hole->offset)
+				return false;
+			end = hole->offset + hole->size;
+		}
+	}
+
+	for (i = 0; i < AMDGPU_VA_SHARED_MAX_BUFFERS; i++) {
+		struct amdgpu_va_shared_buffer *buf = &shared->buffers[i];
+
+		if (!buf->refcount)
+			continue;
+
+		/* Catches duplicates and broken probe sequences alike */
+		if (buf->range >= AMDGPU_VA_SHARED_RANGES ||
+		    amdgpu_va_shared_lookup(shared, buf->key, false) != buf)
+			return false;
+		num_buffers++;
+	}
+
+	return num_buffers == shared->num_buffers;
+}
+
+static int amdgpu_va_shared_lock(struct amdgpu_va_shared *shared)
+{
+	int r = pthread_mutex_lock(&shared->mutex);
+
+	if (r == EOWNERDEAD) {
+		if (shared->dirty && !amdgpu_va_shared_check(shared))
+			shared->broken = 1;
+		pthread_mutex_consistent(&shared->mutex);
+		r = 0;
+	}
+	if (r)
+		return -r;
+
+	if (shared->broken) {
+		pthread_mutex_unlock(&shared->mutex);
+		return -ENOTRECOVERABLE;
+	}
+
+	shared->dirty = 1;
+	__sync_synchronize();
+	return 0;
+}
+
+static void amdgpu_va_shared_unlock(struct amdgpu_va_shared *shared)
+{
+	__sync_synchronize();
+	shared->dirty = 0;
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+static int amdgpu_va_shared_subtract(struct amdgpu_va_shared_range *range,
+				     uint32_t i, uint64_t start_va,
+				     uint64_t end_va)
+{
+	struct amdgpu_va_shared_hole *hole = &range->holes[i];
+	uint64_t hole_end = hole->offset + hole->size;
+
+	if (start_va > hole->offset && end_va < hole_end) {
+		if (range->num_holes == AMDGPU_VA_SHARED_MAX_HOLES)
+			return -ENOMEM;
+
+		memmove(&range->holes[i + 1], &range->holes[i],
+			(range->num_holes - i) * sizeof(*hole));
+		range->num_holes++;
+		range->holes[i].size = start_va - hole->offset;
+		range->holes[i + 1].offset = end_va;
+		range->holes[i + 1].size = hole_end - end_va;
+	} else if (start_va > hole->offset) {
+		hole->size = start_va - hole->offset;
+	} else if (end_va < hole_end) {
+		hole->offset = end_va;
+		hole->size = hole_end - end_va;
+	} else {
+		memmove(&range->holes[i], &range->holes[i + 1],
+			(range->num_holes - i - 1) * sizeof(*hole));
+		range->num_holes--;
+	}
+
+	return 0;
+}
+
+/* Same placement rules as amdgpu_vamgr_find_va(). */
+static int amdgpu_va_shared_find_locked(struct amdgpu_va_shared_range *range,
+					uint64_t size, uint64_t alignment,
+					uint64_t base_required,
+					bool search_from_top,
+					uint64_t *va_out)
+{
+	uint32_t i, k, n = range->num_holes;
+	uint64_t offset, hole_end;
+	int r;
+
+	for (k = 0; k < n; k++) {
+		struct amdgpu_va_shared_hole *hole;
+
+		i = search_from_top ? n - 1 - k : k;
+		hole = &range->holes[i];
+		hole_end = hole->offset + hole->size;
+
+		if (base_required) {
+			if (hole->offset > base_required ||
+			    hole_end < base_required + size)
+				continue;
+			offset = base_required;
+		} else if (!search_from_top) {
+			uint64_t waste = hole->offset % alignment;
+
+			waste = waste ? alignment - waste : 0;
+			offset = hole->offset + waste;
+			if (offset >= hole_end || size > hole_end - offset)
+				continue;
+		} else {
+			if (size > hole->size)
+				continue;
+
+			offset = hole_end - size;
+			offset -= offset % alignment;
+			if (offset < hole->offset)
+				continue;
+		}
+
+		r = amdgpu_va_shared_subtract(range, i, offset, offset + size);
+		if (!r)
+			*va_out = offset;
+		return r;
+	}
+
+	return -ENOMEM;
+}
+
+static void amdgpu_va_shared_free_locked(struct amdgpu_va_shared_range *range,
+					 uint64_t va, uint64_t size)
+{
+	struct amdgpu_va_shared_hole *prev, *next;
+	uint32_t lo = 0, hi = range->num_holes, mid;
+	bool merge_prev, merge_next;
+
+	/* First hole above the range */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (range->holes[mid].offset > va)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	prev = lo ? &range->holes[lo - 1] : NULL;
+	next = lo < range->num_holes ? &range->holes[lo] : NULL;
+	merge_prev = prev && prev->offset + prev->size == va;
+	merge_next = next && va + size == next->offset;
+
+	if (merge_prev && merge_next) {
+		prev->size += size + next->size;
+		memmove(next, next + 1,
+			(range->num_holes - lo - 1) * sizeof(*next));
+		range->num_holes--;
+	} else if (merge_prev) {
+		prev->size += size;
+	} else if (merge_next) {
+		next->offset = va;
+		next->size += size;
+	} else if (range->num_holes < AMDGPU_VA_SHARED_MAX_HOLES) {
+		memmove(&range->holes[lo + 1], &range->holes[lo],
+			(range->num_holes - lo) * sizeof(*next));
+		range->holes[lo].offset = va;
+		range->holes[lo].size = size;
+		range->num_holes++;
+	}
+	/* Otherwise the range is lost, like when the private manager fails
+	 * to allocate a hole.
+	 */
+}
+
+drm_private int amdgpu_vamgr_shared_find_va(struct amdgpu_bo_va_mgr *mgr,
+					    uint64_t size, uint64_t alignment,
+					    uint64_t base_required,
+					    bool search_from_top,
+					    uint64_t *va_out)
+{
+	struct amdgpu_va_shared *shared = mgr->shared;
+	int r;
+
+	r = amdgpu_va_shared_lock(shared);
+	if (r)
+		return r;
+
+	r = amdgpu_va_shared_find_locked(&shared->ranges[mgr->shared_index],
+					 size, alignment, base_required,
+					 search_from_top, va_out);
+	amdgpu_va_shared_unlock(shared);
+
+	return r;
+}
+
+drm_private void amdgpu_vamgr_shared_free_va(struct amdgpu_bo_va_mgr *mgr,
+					     uint64_t va, uint64_t size)
+{
+	struct amdgpu_va_shared *shared = mgr->shared;
+
+	if (amdgpu_va_shared_lock(shared))
+		return;
+
+	amdgpu_va_shared_free_locked(&shared->ranges[mgr->shared_index],
+				     va, size);
+	amdgpu_va_shared_unlock(shared);
+}
+
+drm_private void amdgpu_va_shared_buffer_free(struct amdgpu_va *va)
+{
+	struct amdgpu_va_shared *shared = va->vamgr->shared;
+	struct amdgpu_va_shared_buffer *buf;
+
+	if (amdgpu_va_shared_lock(shared))
+		return;
+
+	buf = amdgpu_va_shared_lookup(shared, va->shared_key, false);
+	if (buf && buf->refcount == 1) {
+		amdgpu_va_shared_free_locked(&shared->ranges[buf->range],
+					     buf->address, buf->size);
+		amdgpu_va_shared_remove(shared, buf);
+	} else if (buf) {
+		buf->refcount--;
+	}
+	amdgpu_va_shared_unlock(shared);
+}
+
+drm_private void amdgpu_va_manager_unmap_shared(struct amdgpu_va_manager *va_mgr)
+{
+	munmap(va_mgr->shared, sizeof(struct amdgpu_va_shared));
+	va_mgr->shared = NULL;
+}
+
+static int amdgpu_va_shared_setup(struct amdgpu_va_shared *shared,
+				  const uint64_t *start, const uint64_t *max,
+				  uint32_t alignment)
+{
+	pthread_mutexattr_t attr;
+	uint32_t i;
+	int r;
+
+	/* Taking over from a process that died here leaves anything behind */
+	memset(&shared->alignment, 0,
+	       sizeof(*shared) - offsetof(struct amdgpu_va_shared, alignment));
+
+	r = pthread_mutexattr_init(&attr);
+	if (r)
+		return -r;
+	r = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	if (!r)
+		r = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	if (!r)
+		r = pthread_mutex_init(&shared->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	if (r)
+		return -r;
+
+	shared->magic = AMDGPU_VA_SHARED_MAGIC;
+	shared->version = AMDGPU_VA_SHARED_VERSION;
+	shared->size = sizeof(*shared);
+	shared->alignment = alignment;
+
+	for (i = 0; i < AMDGPU_VA_SHARED_RANGES; i++) {
+		struct amdgpu_va_shared_range *range = &shared->ranges[i];
+
+		range->start = start[i];
+		range->max = max[i];
+		if (max[i] > start[i]) {
+			range->holes[0].offset = start[i];
+			range->holes[0].size = max[i] - start[i];
+			range->num_holes = 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Set the segment up if \p owner, the process that was doing it or 0, is
+ * still in charge of it. Returns -EAGAIN if another process took over.
+ */
+static int amdgpu_va_shared_claim_setup(struct amdgpu_va_shared *shared,
+					pid_t owner, const uint64_t *start,
+					const uint64_t *max, uint32_t alignment)
+{
+	int r;
+
+	if (!__sync_bool_compare_and_swap(&shared->init_pid, owner, getpid()))
+		return -EAGAIN;
+
+	shared->state = AMDGPU_VA_SHARED_INITIALIZING;
+	r = amdgpu_va_shared_setup(shared, start, max, alignment);
+	__sync_synchronize();
+	shared->state = r ? AMDGPU_VA_SHARED_UNINITIALIZED :
+			    AMDGPU_VA_SHARED_READY;
+	__sync_synchronize();
+	shared->init_pid = 0;
+	return r;
+}
+
+/*
+ * Wait for another process to set the segment up. If it is still not done
+ * after a second because the process died or failed, set it up instead.
+ */
+static int amdgpu_va_shared_wait_setup(struct amdgpu_va_shared *shared,
+				       const uint64_t *start,
+				       const uint64_t *max, uint32_t alignment)
+{
+	struct timespec delay = { 0, 1000000 };
+	pid_t owner;
+	uint32_t i;
+	int r;
+
+	for (i = 0; i < 1000 && shared->state != AMDGPU_VA_SHARED_READY; i++)
+		nanosleep(&delay, NULL);
+	__sync_synchronize();
+	if (shared->state == AMDGPU_VA_SHARED_READY)
+		return 0;
+
+	owner = shared->init_pid;
+	if (owner && (!kill(owner, 0) || errno != ESRCH))
+		return -EBUSY;
+
+	r = amdgpu_va_shared_claim_setup(shared, owner, start, max, alignment);
+	return r == -EAGAIN ? -EBUSY : r;
+}
+
+drm_public int amdgpu_va_manager_init_shared(amdgpu_va_manager_handle va_mgr,
+					     int shm_fd,
+					     uint64_t low_va_offset,
+					     uint64_t low_va_max,
+					     uint64_t high_va_offset,
+					     uint64_t high_va_max,
+					     uint32_t virtual_address_alignment)
+{
+	uint64_t start[AMDGPU_VA_SHARED_RANGES], max[AMDGPU_VA_SHARED_RANGES];
+	struct amdgpu_va_shared *shared;
+	struct stat st;
+	uint32_t i;
+	int r = 0;
+
+	if (!va_mgr || shm_fd < 0 || !virtual_address_alignment)
+		return -EINVAL;
+
+	/* Same split as amdgpu_va_manager_init() */
+	start[0] = low_va_offset;
+	max[0] = MIN2(low_va_max, 0x100000000ULL);
+	start[1] = max[0];
+	max[1] = MAX2(low_va_max, 0x100000000ULL);
+	start[2] = high_va_offset;
+	max[2] = MIN2(high_va_max, (start[2] & ~0xffffffffULL) + 0x100000000ULL);
+	start[3] = max[2];
+	max[3] = MAX2(high_va_max, (start[3] & ~0xffffffffULL) + 0x100000000ULL);
+
+	if (fstat(shm_fd, &st))
+		return -errno;
+	if (!st.st_size) {
+		if (ftruncate(shm_fd, sizeof(*shared)))
+			return -errno;
+	} else if (st.st_size < (off_t)sizeof(*shared)) {
+		return -EINVAL;
+	}
+
+	shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+		      MAP_SHARED, shm_fd, 0);
+	if (shared == MAP_FAILED)
+		return -errno;
+
+	/* The first process sets the segment up, the others wait for it. */
+	r = -EAGAIN;
+	if (__sync_bool_compare_and_swap(&shared->state,
+					 AMDGPU_VA_SHARED_UNINITIALIZED,
+					 AMDGPU_VA_SHARED_INITIALIZING))
+		r = amdgpu_va_shared_claim_setup(shared, 0, start, max,
+						 virtual_address_alignment);
+	if (r == -EAGAIN)
+		r = amdgpu_va_shared_wait_setup(shared, start, max,
+						virtual_address_alignment);
+	if (r)
+		goto error;
+
+	if (shared->magic != AMDGPU_VA_SHARED_MAGIC ||
+	    shared->version != AMDGPU_VA_SHARED_VERSION ||
+	    shared->size != sizeof(*shared) ||
+	    shared->alignment != virtual_address_alignment) {
+		r = -EINVAL;
+		goto error;
+	}
+	for (i = 0; i < AMDGPU_VA_SHARED_RANGES; i++) {
+		if (shared->ranges[i].start != start[i] ||
+		    shared->ranges[i].max != max[i]) {
+			r = -EINVAL;
+			goto error;
+		}
+	}
+
+	for (i = 0; i < AMDGPU_VA_SHARED_RANGES; i++) {
+		struct amdgpu_bo_va_mgr *vamgr = amdgpu_va_shared_vamgr(va_mgr, i);
+
+		vamgr->va_max = max[i];
+		vamgr->va_alignment = virtual_address_alignment;
+		vamgr->shared = shared;
+		vamgr->shared_index = i;
+	}
+	va_mgr->shared = shared;
+
+	return 0;
+
+error:
+	munmap(shared, sizeof(*shared));
+	return r;
+}
+
+drm_public int amdgpu_va_range_alloc_shared(amdgpu_va_manager_handle va_mgr,
+					    uint64_t key,
+					    enum amdgpu_gpu_va_range va_range_type,
+					    uint64_t size,
+					    uint64_t va_base_alignment,
+					    uint64_t *va_base_allocated,
+					    amdgpu_va_handle *va_range_handle,
+					    uint64_t flags)
+{
+	bool search_from_top = !!(flags & AMDGPU_VA_RANGE_REPLAYABLE);
+	struct amdgpu_va_shared_buffer *buf;
+	struct amdgpu_va_shared *shared;
+	struct amdgpu_bo_va_mgr *vamgr;
+	struct amdgpu_va *va;
+	uint64_t address = 0;
+	int r;
+
+	if (!va_mgr || !va_mgr->shared || !size || !va_base_allocated ||
+	    !va_range_handle)
+		return -EINVAL;
+
+	shared = va_mgr->shared;
+	vamgr = amdgpu_va_manager_select(va_mgr, flags);
+	va_base_alignment = MAX2(va_base_alignment, vamgr->va_alignment);
+	size = ALIGN(size, vamgr->va_alignment);
+
+	va = calloc(1, sizeof(struct amdgpu_va));
+	if (!va)
+		return -ENOMEM;
+
+	r = amdgpu_va_shared_lock(shared);
+	if (r) {
+		free(va);
+		return r;
+	}
+
+	buf = amdgpu_va_shared_lookup(shared, key, true);
+	if (!buf) {
+		r = -ENOSPC;
+	} else if (buf->refcount) {
+		/* Another process or thread got there first */
+		if (size > buf->size || buf->address % va_base_alignment) {
+			r = -EINVAL;
+		} else {
+			buf->refcount++;
+			vamgr = amdgpu_va_shared_vamgr(va_mgr, buf->range);
+			address = buf->address;
+			size = buf->size;
+		}
+	} else {
+		r = amdgpu_va_shared_find_locked(&shared->ranges[vamgr->shared_index],
+						 size, va_base_alignment, 0,
+						 search_from_top, &address);
+		if (r && !(flags & AMDGPU_VA_RANGE_32_BIT)) {
+			/* fallback to 32bit address */
+			vamgr = amdgpu_va_manager_select(va_mgr,
+							 flags | AMDGPU_VA_RANGE_32_BIT);
+			r = amdgpu_va_shared_find_locked(&shared->ranges[vamgr->shared_index],
+							 size, va_base_alignment,
+							 0, search_from_top,
+							 &address);
+		}
+		if (!r) {
+			buf->key = key;
+			buf->address = address;
+			buf->size = size;
+			buf->range = vamgr->shared_index;
+			buf->refcount = 1;
+			shared->num_buffers++;
+		}
+	}
+	amdgpu_va_shared_unlock(shared);
+
+	if (r) {
+		free(va);
+		return r;
+	}
+
+	va->address = address;
+	va->size = size;
+	va->range = va_range_type;
+	va->vamgr = vamgr;
+	va->shared_buffer = true;
+	va->shared_key = key;
+	*va_base_allocated = address;
+	*va_range_handle = va;
+
+	return 0;
+}
+#else
+drm_public int amdgpu_va_manager_init_shared(amdgpu_va_manager_handle va_mgr,
+					     int shm_fd,
+					     uint64_t low_va_offset,
+					     uint64_t low_va_max,
+					     uint64_t high_va_offset,
+					     uint64_t high_va_max,
+					     uint32_t virtual_address_alignment)
+{
+	return -ENOSYS;
+}
+
+drm_public int amdgpu_va_range_alloc_shared(amdgpu_va_manager_handle va_mgr,
+					    uint64_t key,
+					    enum amdgpu_gpu_va_range va_range_type,
+					    uint64_t size,
+					    uint64_t va_base_alignment,
+					    uint64_t *va_base_allocated,
+					    amdgpu_va_handle *va_range_handle,
+					    uint64_t flags)
+{
+	return -ENOSYS;
+}
+
+/* Never called, no manager can be shared without robust mutexes. */
+drm_private int amdgpu_vamgr_shared_find_va(struct amdgpu_bo_va_mgr *mgr,
+					    uint64_t size, uint64_t alignment,
+					    uint64_t base_required,
+					    bool search_from_top,
+					    uint64_t *va_out)
+{
+	return -ENOSYS;
+}
+
+drm_private void amdgpu_vamgr_shared_free_va(struct amdgpu_bo_va_mgr *mgr,
+					     uint64_t va, uint64_t size)
+{
+}
+
+drm_private void amdgpu_va_shared_buffer_free(struct amdgpu_va *va)
+{
+}
+
+drm_private void amdgpu_va_manager_unmap_shared(struct amdgpu_va_manager *va_mgr)
+{
+}
+#endif
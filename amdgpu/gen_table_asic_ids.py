@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+
+# Copyright 2026 Advanced Micro Devices, Inc.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+# OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+# ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+# Helper script that reads amdgpu.ids and writes a static table sorted by
+# device and revision id, so the library can look names up with a binary
+# search instead of parsing the text file.
+#
+# The rules match the text parser in amdgpu_asic_id.c: the first line that
+# is neither empty nor a comment is the version, the name is the third
+# comma separated field with leading blanks removed, and the first entry
+# wins if an id pair is listed twice.
+
+import sys
+
+filename = sys.argv[1]
+towrite = sys.argv[2]
+
+version = None
+entries = {}
+
+with open(filename, 'r') as f:
+    for num, line in enumerate(f, 1):
+        line = line.rstrip('\n')
+        if not line or line.startswith('#'):
+            continue
+
+        if version is None:
+            version = line
+            continue
+
+        fields = line.split(',')
+        try:
+            did = int(fields[0], 16)
+            rid = int(fields[1], 16)
+            name = fields[2].lstrip(' \t')
+        except (IndexError, ValueError):
+            name = ''
+        if not name or did > 0xffff or rid > 0xff:
+            sys.exit('{}:{}: invalid format: {}'.format(filename, num, line))
+
+        entries.setdefault((did, rid), name)
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+with open(towrite, 'w') as f:
+    f.write('''\
+/* AUTOMATICALLY GENERATED by gen_table_asic_ids.py. You should modify
+   amdgpu.ids instead of adding here entries manually! */
+''')
+    f.write('static const char amdgpu_asic_id_table_version[] = {};\n\n'
+            .format(c_string(version or '')))
+    f.write('static const struct amdgpu_asic_id amdgpu_asic_id_table[] = {\n')
+    for (did, rid) in sorted(entries):
+        f.write('    {{ 0x{:04x}, 0x{:02x}, {} }},\n'
+                .format(did, rid, c_string(entries[(did, rid)])))
+    f.write('};\n')
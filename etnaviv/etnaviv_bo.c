@@ -65,7 +65,7 @@ static struct etna_bo *lookup_bo(void *tbl, uint32_t handle)
 		bo = etna_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		drmBOCacheRemove(&bo->cache_entry);
 	}
 
 	return bo;
@@ -87,7 +87,7 @@ static struct etna_bo *bo_from_handle(struct etna_device *dev,
 	bo->handle = handle;
 	bo->flags = flags;
 	atomic_set(&bo->refcnt, 1);
-	list_inithead(&bo->list);
+	bo->cache_entry.flags = flags;
 	/* add ourselves to the handle table: */
 	drmHashInsert(dev->handle_table, handle, bo);
 
@@ -101,10 +101,10 @@ drm_public struct etna_bo *etna_bo_new(struct etna_device *dev, uint32_t size,
 	struct etna_bo *bo;
 	int ret;
 	struct drm_etnaviv_gem_new req = {
-			.flags = flags,
+			.flags = flags & ~DRM_ETNA_GEM_FOR_RENDER,
 	};
 
-	bo = etna_bo_cache_alloc(&dev->bo_cache, &size, flags);
+	bo = etna_bo_cache_alloc(dev->bo_cache, &size, flags);
 	if (bo)
 		return bo;
 
@@ -115,7 +115,7 @@ drm_public struct etna_bo *etna_bo_new(struct etna_device *dev, uint32_t size,
 		return NULL;
 
 	pthread_mutex_lock(&table_lock);
-	bo = bo_from_handle(dev, size, req.handle, flags);
+	bo = bo_from_handle(dev, size, req.handle, req.flags);
 	bo->reuse = 1;
 	pthread_mutex_unlock(&table_lock);
 
@@ -235,7 +235,7 @@ drm_public void etna_bo_del(struct etna_bo *bo)
 
 	pthread_mutex_lock(&table_lock);
 
-	if (bo->reuse && (etna_bo_cache_free(&dev->bo_cache, bo) == 0))
+	if (bo->reuse && (etna_bo_cache_free(dev->bo_cache, bo) == 0))
 		goto out;
 
 	bo_del(bo);
@@ -51,7 +51,7 @@ drm_public struct etna_device *etna_device_new(int fd)
 	dev->fd = fd;
 	dev->handle_table = drmHashCreate();
 	dev->name_table = drmHashCreate();
-	etna_bo_cache_init(&dev->bo_cache);
+	dev->bo_cache = etna_bo_cache_new();
 
 	return dev;
 }
@@ -80,7 +80,7 @@ drm_public struct etna_device *etna_device_ref(struct etna_device *dev)
 
 static void etna_device_del_impl(struct etna_device *dev)
 {
-	etna_bo_cache_cleanup(&dev->bo_cache, 0);
+	drmBOCacheDestroy(dev->bo_cache);
 	drmHashDestroy(dev->handle_table);
 	drmHashDestroy(dev->name_table);
 
@@ -77,6 +77,8 @@ enum etna_param_id {
 #define DRM_ETNA_GEM_CACHE_MASK         0x000f0000
 /* map flags */
 #define DRM_ETNA_GEM_FORCE_MMU          0x00100000
+/* the GPU writes the bo first, so a busy cached bo can be reused */
+#define DRM_ETNA_GEM_FOR_RENDER         0x00200000
 
 /* bo access flags: (keep aligned to ETNA_PREP_x) */
 #define DRM_ETNA_PREP_READ              0x01
@@ -91,6 +93,7 @@ struct etna_device *etna_device_new_dup(int fd);
 struct etna_device *etna_device_ref(struct etna_device *dev);
 void etna_device_del(struct etna_device *dev);
 int etna_device_fd(struct etna_device *dev);
+void etna_device_trim_bo_cache(struct etna_device *dev, uint64_t max_bytes);
 
 /* gpu functions:
  */
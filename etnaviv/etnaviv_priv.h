@@ -40,6 +40,7 @@
 
 #include "libdrm_macros.h"
 #include "xf86drm.h"
+#include "xf86drmBOCache.h"
 #include "xf86atomic.h"
 
 #include "util_double_list.h"
@@ -47,17 +48,6 @@
 #include "etnaviv_drmif.h"
 #include "etnaviv_drm.h"
 
-struct etna_bo_bucket {
-	uint32_t size;
-	struct list_head list;
-};
-
-struct etna_bo_cache {
-	struct etna_bo_bucket cache_bucket[14 * 4];
-	unsigned num_buckets;
-	time_t time;
-};
-
 struct etna_device {
 	int fd;
 	atomic_t refcnt;
@@ -73,16 +63,15 @@ struct etna_device {
 	 */
 	void *handle_table, *name_table;
 
-	struct etna_bo_cache bo_cache;
+	drmBOCachePtr bo_cache;
 
 	int closefd;        /* call close(fd) upon destruction */
 };
 
-drm_private void etna_bo_cache_init(struct etna_bo_cache *cache);
-drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time);
-drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache,
+drm_private drmBOCachePtr etna_bo_cache_new(void);
+drm_private struct etna_bo *etna_bo_cache_alloc(drmBOCachePtr cache,
 		uint32_t *size, uint32_t flags);
-drm_private int etna_bo_cache_free(struct etna_bo_cache *cache, struct etna_bo *bo);
+drm_private int etna_bo_cache_free(drmBOCachePtr cache, struct etna_bo *bo);
 
 /* for where @table_lock is already held: */
 drm_private void etna_device_del_locked(struct etna_device *dev);
@@ -109,8 +98,7 @@ struct etna_bo {
 	uint32_t idx;
 
 	int reuse;
-	struct list_head list;   /* bucket-list entry */
-	time_t free_time;        /* time when added to bucket-list */
+	drmBOCacheEntry cache_entry;
 };
 
 struct etna_gpu {
@@ -49,7 +49,7 @@ static struct fd_bo * lookup_bo(void *tbl, uint32_t key)
 		bo = fd_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		drmBOCacheRemove(&bo->cache_entry);
 	}
 	return bo;
 }
@@ -69,7 +69,7 @@ static struct fd_bo * bo_from_handle(struct fd_device *dev,
 	bo->size = size;
 	bo->handle = handle;
 	atomic_set(&bo->refcnt, 1);
-	list_inithead(&bo->list);
+	bo->cache_entry.cache = NULL;
 	/* add ourself into the handle table: */
 	drmHashInsert(dev->handle_table, handle, bo);
 	return bo;
@@ -77,7 +77,7 @@ static struct fd_bo * bo_from_handle(struct fd_device *dev,
 
 static struct fd_bo *
 bo_new(struct fd_device *dev, uint32_t size, uint32_t flags,
-		struct fd_bo_cache *cache)
+		drmBOCachePtr cache)
 {
 	struct fd_bo *bo = NULL;
 	uint32_t handle;
@@ -87,12 +87,15 @@ bo_new(struct fd_device *dev, uint32_t size, uint32_t flags,
 	if (bo)
 		return bo;
 
+	flags &= ~DRM_FREEDRENO_GEM_FOR_RENDER;
 	ret = dev->funcs->bo_new_handle(dev, size, flags, &handle);
 	if (ret)
 		return NULL;
 
 	pthread_mutex_lock(&table_lock);
 	bo = bo_from_handle(dev, size, handle);
+	if (bo)
+		bo->cache_entry.flags = flags;
 	pthread_mutex_unlock(&table_lock);
 
 	VG_BO_ALLOC(bo);
@@ -103,7 +106,7 @@ bo_new(struct fd_device *dev, uint32_t size, uint32_t flags,
 drm_public struct fd_bo *
 fd_bo_new(struct fd_device *dev, uint32_t size, uint32_t flags)
 {
-	struct fd_bo *bo = bo_new(dev, size, flags, &dev->bo_cache);
+	struct fd_bo *bo = bo_new(dev, size, flags, dev->bo_cache);
 	if (bo)
 		bo->bo_reuse = BO_CACHE;
 	return bo;
@@ -117,7 +120,7 @@ fd_bo_new(struct fd_device *dev, uint32_t size, uint32_t flags)
 drm_private struct fd_bo *
 fd_bo_new_ring(struct fd_device *dev, uint32_t size, uint32_t flags)
 {
-	struct fd_bo *bo = bo_new(dev, size, flags, &dev->ring_cache);
+	struct fd_bo *bo = bo_new(dev, size, flags, dev->ring_cache);
 	if (bo)
 		bo->bo_reuse = RING_CACHE;
 	return bo;
@@ -236,9 +239,9 @@ drm_public void fd_bo_del(struct fd_bo *bo)
 
 	pthread_mutex_lock(&table_lock);
 
-	if ((bo->bo_reuse == BO_CACHE) && (fd_bo_cache_free(&dev->bo_cache, bo) == 0))
+	if ((bo->bo_reuse == BO_CACHE) && (fd_bo_cache_free(dev->bo_cache, bo) == 0))
 		goto out;
-	if ((bo->bo_reuse == RING_CACHE) && (fd_bo_cache_free(&dev->ring_cache, bo) == 0))
+	if ((bo->bo_reuse == RING_CACHE) && (fd_bo_cache_free(dev->ring_cache, bo) == 0))
 		goto out;
 
 	bo_del(bo);
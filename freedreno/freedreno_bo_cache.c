@@ -32,189 +32,131 @@
 drm_private void bo_del(struct fd_bo *bo);
 drm_private extern pthread_mutex_t table_lock;
 
-static void
-add_bucket(struct fd_bo_cache *cache, int size)
+static struct fd_bo * to_fd_bo(drmBOCacheEntryPtr entry)
 {
-	unsigned int i = cache->num_buckets;
-
-	assert(i < ARRAY_SIZE(cache->cache_bucket));
-
-	list_inithead(&cache->cache_bucket[i].list);
-	cache->cache_bucket[i].size = size;
-	cache->num_buckets++;
+	return (struct fd_bo *)((char *)entry - offsetof(struct fd_bo, cache_entry));
 }
 
-/**
- * @coarse: if true, only power-of-two bucket sizes, otherwise
- *    fill in for a bit smoother size curve..
- */
-drm_private void
-fd_bo_cache_init(struct fd_bo_cache *cache, int coarse)
+static int is_idle(drmBOCacheEntryPtr entry)
 {
-	unsigned long size, cache_max_size = 64 * 1024 * 1024;
-
-	/* OK, so power of two buckets was too wasteful of memory.
-	 * Give 3 other sizes between each power of two, to hopefully
-	 * cover things accurately enough.  (The alternative is
-	 * probably to just go for exact matching of sizes, and assume
-	 * that for things like composited window resize the tiled
-	 * width/height alignment and rounding of sizes to pages will
-	 * get us useful cache hit rates anyway)
-	 */
-	add_bucket(cache, 4096);
-	add_bucket(cache, 4096 * 2);
-	if (!coarse)
-		add_bucket(cache, 4096 * 3);
-
-	/* Initialize the linked lists for BO reuse cache. */
-	for (size = 4 * 4096; size <= cache_max_size; size *= 2) {
-		add_bucket(cache, size);
-		if (!coarse) {
-			add_bucket(cache, size + size * 1 / 4);
-			add_bucket(cache, size + size * 2 / 4);
-			add_bucket(cache, size + size * 3 / 4);
-		}
-	}
+	return fd_bo_cpu_prep(to_fd_bo(entry), NULL,
+			DRM_FREEDRENO_PREP_READ |
+			DRM_FREEDRENO_PREP_WRITE |
+			DRM_FREEDRENO_PREP_NOSYNC) == 0;
 }
 
-/* Frees older cached buffers.  Called under table_lock */
-drm_private void
-fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
+static int bo_madvise(drmBOCacheEntryPtr entry, int willneed)
 {
-	int i;
-
-	if (cache->time == time)
-		return;
+	struct fd_bo *bo = to_fd_bo(entry);
 
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		struct fd_bo *bo;
+	/* older kernels never take the pages, but can't tell so either: */
+	if (bo->dev->version < FD_VERSION_MADVISE)
+		return 1;
 
-		while (!LIST_IS_EMPTY(&bucket->list)) {
-			bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
-
-			/* keep things in cache for at least 1 second: */
-			if (time && ((time - bo->free_time) <= 1))
-				break;
-
-			VG_BO_OBTAIN(bo);
-			list_del(&bo->list);
-			bo_del(bo);
-		}
-	}
-
-	cache->time = time;
+	return bo->funcs->madvise(bo, willneed);
 }
 
-static struct fd_bo_bucket * get_bucket(struct fd_bo_cache *cache, uint32_t size)
+/* Called under table_lock */
+static void bo_destroy(drmBOCacheEntryPtr entry)
 {
-	int i;
-
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
-	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
-	}
+	struct fd_bo *bo = to_fd_bo(entry);
 
-	return NULL;
+	VG_BO_OBTAIN(bo);
+	bo_del(bo);
 }
 
-static int is_idle(struct fd_bo *bo)
-{
-	return fd_bo_cpu_prep(bo, NULL,
-			DRM_FREEDRENO_PREP_READ |
-			DRM_FREEDRENO_PREP_WRITE |
-			DRM_FREEDRENO_PREP_NOSYNC) == 0;
-}
+static const drmBOCacheFuncs funcs = {
+		.is_idle = is_idle,
+		.madvise = bo_madvise,
+		.destroy = bo_destroy,
+};
 
-static struct fd_bo *find_in_bucket(struct fd_bo_bucket *bucket, uint32_t flags)
+/**
+ * @coarse: if true, only power-of-two bucket sizes, otherwise
+ *    fill in for a bit smoother size curve..
+ */
+drm_private drmBOCachePtr
+fd_bo_cache_new(int coarse)
 {
-	struct fd_bo *bo = NULL;
-
-	/* TODO .. if we had an ALLOC_FOR_RENDER flag like intel, we could
-	 * skip the busy check.. if it is only going to be a render target
-	 * then we probably don't need to stall..
-	 *
-	 * NOTE that intel takes ALLOC_FOR_RENDER bo's from the list tail
-	 * (MRU, since likely to be in GPU cache), rather than head (LRU)..
-	 */
-	pthread_mutex_lock(&table_lock);
-	if (!LIST_IS_EMPTY(&bucket->list)) {
-		bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
-		/* TODO check for compatible flags? */
-		if (is_idle(bo)) {
-			list_del(&bo->list);
-		} else {
-			bo = NULL;
-		}
-	}
-	pthread_mutex_unlock(&table_lock);
-
-	return bo;
+	return drmBOCacheCreate(&funcs, coarse ? DRM_BO_CACHE_COARSE : 0);
 }
 
 /* NOTE: size is potentially rounded up to bucket size: */
 drm_private struct fd_bo *
-fd_bo_cache_alloc(struct fd_bo_cache *cache, uint32_t *size, uint32_t flags)
+fd_bo_cache_alloc(drmBOCachePtr cache, uint32_t *size, uint32_t flags)
 {
-	struct fd_bo *bo = NULL;
-	struct fd_bo_bucket *bucket;
+	drmBOCacheEntryPtr entry;
+	uint64_t bucket_size;
+	struct fd_bo *bo;
+	int policy;
 
 	*size = ALIGN(*size, 4096);
-	bucket = get_bucket(cache, *size);
+	bucket_size = drmBOCacheBucketSize(cache, *size);
+	if (!bucket_size)
+		return NULL;
+	*size = bucket_size;
+
+	/* a render target doesn't need to wait for the GPU to be done with
+	 * it, so take the most recently freed bo, likely still in GPU cache:
+	 */
+	policy = (flags & DRM_FREEDRENO_GEM_FOR_RENDER) ?
+			DRM_BO_CACHE_MRU : DRM_BO_CACHE_LRU;
+	flags &= ~DRM_FREEDRENO_GEM_FOR_RENDER;
 
 	/* see if we can be green and recycle: */
-retry:
-	if (bucket) {
-		*size = bucket->size;
-		bo = find_in_bucket(bucket, flags);
-		if (bo) {
-			VG_BO_OBTAIN(bo);
-			if (bo->funcs->madvise(bo, TRUE) <= 0) {
-				/* we've lost the backing pages, delete and try again: */
-				pthread_mutex_lock(&table_lock);
-				bo_del(bo);
-				pthread_mutex_unlock(&table_lock);
-				goto retry;
-			}
-			atomic_set(&bo->refcnt, 1);
-			fd_device_ref(bo->dev);
-			return bo;
-		}
-	}
+	pthread_mutex_lock(&table_lock);
+	entry = drmBOCacheAlloc(cache, *size, flags, policy);
+	pthread_mutex_unlock(&table_lock);
+	if (!entry)
+		return NULL;
 
-	return NULL;
+	bo = to_fd_bo(entry);
+	VG_BO_OBTAIN(bo);
+	atomic_set(&bo->refcnt, 1);
+	fd_device_ref(bo->dev);
+	return bo;
 }
 
+/* Called under table_lock */
 drm_private int
-fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo)
+fd_bo_cache_free(drmBOCachePtr cache, struct fd_bo *bo)
 {
-	struct fd_bo_bucket *bucket = get_bucket(cache, bo->size);
+	struct fd_device *dev = bo->dev;
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
 
 	/* see if we can be green and recycle: */
-	if (bucket) {
-		struct timespec time;
+	bo->cache_entry.size = bo->size;
+	if (drmBOCacheRelease(cache, &bo->cache_entry, time.tv_sec))
+		return -1;
 
-		bo->funcs->madvise(bo, FALSE);
+	VG_BO_RELEASE(bo);
+	drmBOCacheExpire(cache, time.tv_sec);
 
-		clock_gettime(CLOCK_MONOTONIC, &time);
+	/* bo's in the bucket cache don't have a ref and
+	 * don't hold a ref to the dev:
+	 */
+	fd_device_del_locked(dev);
 
-		bo->free_time = time.tv_sec;
-		VG_BO_RELEASE(bo);
-		list_addtail(&bo->list, &bucket->list);
-		fd_bo_cache_cleanup(cache, time.tv_sec);
+	return 0;
+}
 
-		/* bo's in the bucket cache don't have a ref and
-		 * don't hold a ref to the dev:
-		 */
-		fd_device_del_locked(bo->dev);
+/* Frees cached bo's, oldest first, until at most @max_bytes are left.
+ * bo's in the ring cache are more expensive to recreate, so they go last.
+ */
+drm_public void
+fd_device_trim_bo_cache(struct fd_device *dev, uint64_t max_bytes)
+{
+	uint64_t ring_bytes;
 
-		return 0;
+	pthread_mutex_lock(&table_lock);
+	ring_bytes = drmBOCacheBytes(dev->ring_cache);
+	if (ring_bytes >= max_bytes) {
+		drmBOCacheTrim(dev->bo_cache, 0);
+		drmBOCacheTrim(dev->ring_cache, max_bytes);
+	} else {
+		drmBOCacheTrim(dev->bo_cache, max_bytes - ring_bytes);
 	}
-
-	return -1;
+	pthread_mutex_unlock(&table_lock);
 }
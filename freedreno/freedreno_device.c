@@ -81,8 +81,8 @@ out:
 	dev->fd = fd;
 	dev->handle_table = drmHashCreate();
 	dev->name_table = drmHashCreate();
-	fd_bo_cache_init(&dev->bo_cache, FALSE);
-	fd_bo_cache_init(&dev->ring_cache, TRUE);
+	dev->bo_cache = fd_bo_cache_new(FALSE);
+	dev->ring_cache = fd_bo_cache_new(TRUE);
 
 	return dev;
 }
@@ -110,7 +110,8 @@ drm_public struct fd_device * fd_device_ref(struct fd_device *dev)
 static void fd_device_del_impl(struct fd_device *dev)
 {
 	int close_fd = dev->closefd ? dev->fd : -1;
-	fd_bo_cache_cleanup(&dev->bo_cache, 0);
+	drmBOCacheDestroy(dev->bo_cache);
+	drmBOCacheDestroy(dev->ring_cache);
 	drmHashDestroy(dev->handle_table);
 	drmHashDestroy(dev->name_table);
 	dev->funcs->destroy(dev);
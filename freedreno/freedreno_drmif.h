@@ -75,6 +75,8 @@ enum fd_param_id {
 #define DRM_FREEDRENO_GEM_CACHE_WBACKWA   0x00800000
 #define DRM_FREEDRENO_GEM_CACHE_MASK      0x00f00000
 #define DRM_FREEDRENO_GEM_GPUREADONLY     0x01000000
+/* the GPU writes the bo first, so a busy cached bo can be reused: */
+#define DRM_FREEDRENO_GEM_FOR_RENDER      0x02000000
 
 /* bo access flags: (keep aligned to MSM_PREP_x) */
 #define DRM_FREEDRENO_PREP_READ           0x01
@@ -89,6 +91,7 @@ struct fd_device * fd_device_new_dup(int fd);
 struct fd_device * fd_device_ref(struct fd_device *dev);
 void fd_device_del(struct fd_device *dev);
 int fd_device_fd(struct fd_device *dev);
+void fd_device_trim_bo_cache(struct fd_device *dev, uint64_t max_bytes);
 
 enum fd_version {
 	FD_VERSION_MADVISE = 1,            /* kernel supports madvise */
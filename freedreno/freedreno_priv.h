@@ -42,6 +42,7 @@
 
 #include "libdrm_macros.h"
 #include "xf86drm.h"
+#include "xf86drmBOCache.h"
 #include "xf86atomic.h"
 
 #include "util_double_list.h"
@@ -68,17 +69,6 @@ struct fd_device_funcs {
 	void (*destroy)(struct fd_device *dev);
 };
 
-struct fd_bo_bucket {
-	uint32_t size;
-	struct list_head list;
-};
-
-struct fd_bo_cache {
-	struct fd_bo_bucket cache_bucket[14 * 4];
-	int num_buckets;
-	time_t time;
-};
-
 struct fd_device {
 	int fd;
 	enum fd_version version;
@@ -97,8 +87,8 @@ struct fd_device {
 
 	const struct fd_device_funcs *funcs;
 
-	struct fd_bo_cache bo_cache;
-	struct fd_bo_cache ring_cache;
+	drmBOCachePtr bo_cache;
+	drmBOCachePtr ring_cache;
 
 	int closefd;        /* call close(fd) upon destruction */
 
@@ -106,11 +96,10 @@ struct fd_device {
 	int bo_size;
 };
 
-drm_private void fd_bo_cache_init(struct fd_bo_cache *cache, int coarse);
-drm_private void fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time);
-drm_private struct fd_bo * fd_bo_cache_alloc(struct fd_bo_cache *cache,
+drm_private drmBOCachePtr fd_bo_cache_new(int coarse);
+drm_private struct fd_bo * fd_bo_cache_alloc(drmBOCachePtr cache,
 		uint32_t *size, uint32_t flags);
-drm_private int fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo);
+drm_private int fd_bo_cache_free(drmBOCachePtr cache, struct fd_bo *bo);
 
 /* for where @table_lock is already held: */
 drm_private void fd_device_del_locked(struct fd_device *dev);
@@ -169,8 +158,7 @@ struct fd_bo {
 		RING_CACHE = 2,
 	} bo_reuse;
 
-	struct list_head list;   /* bucket-list entry */
-	time_t free_time;        /* time when added to bucket-list */
+	drmBOCacheEntry cache_entry;
 };
 
 drm_private struct fd_bo *fd_bo_new_ring(struct fd_device *dev,
@@ -226,7 +214,7 @@ static inline void VG_BO_FREE(struct fd_bo *bo)
  * doesn't attribute ownership to the first one to allocate the recycled
  * bo.
  *
- * Note that the list_head in fd_bo is used to track the buffers in cache
+ * Note that the cache_entry in fd_bo is used to track the buffers in cache
  * so disable error reporting on the range while they are in cache so
  * valgrind doesn't squawk about list traversal.
  *
@@ -39,7 +39,6 @@
 
 struct msm_device {
 	struct fd_device base;
-	struct fd_bo_cache ring_cache;
 	unsigned ring_cnt;
 };
 
@@ -0,0 +1,469 @@
+/*
+ * Copyright © 2026 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * The file is made of windows of window_size bytes. Only the window being
+ * filled and, with a thread, the one after it are mapped. Trace blocks
+ * never straddle two windows: the end of a window that can't hold the next
+ * block is covered by a comment block, which readers skip.
+ *
+ * The thread only maps, prefaults and unmaps windows. Blocks are still
+ * written by the caller: the buffer contents have to be copied before the
+ * exec returns anyway, and copying them into a queue for the thread costs
+ * as much as copying them into the prefaulted window.
+ *
+ * Data lands in the page cache as it is copied in, so the trace survives a
+ * crash of the traced process.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "libdrm_macros.h"
+#include "intel_aub.h"
+#include "intel_aub_writer.h"
+
+/*
+ * The GTT is mapped 64MB at a time as addresses get used, the first 64MB
+ * with the header as the old writer did. Page N goes to 2MB + N * 4KB.
+ */
+#define INTEL_AUB_GTT_STEP	(64ull << 20)
+#define INTEL_AUB_GTT_ENTRY	0x200003
+
+struct intel_aub_writer {
+	int fd;
+	int gen;
+	size_t window_size;
+	unsigned int header_dwords;
+
+	/** Window being filled and its offset in the file */
+	uint8_t *map;
+	uint64_t base;
+	size_t pos;
+
+	uint32_t ring_offset;
+	bool failed;
+
+	/** End of the GTT range mapped so far */
+	uint64_t gtt_end;
+
+	bool threaded;
+	bool stop;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/** Window after the current one, once the thread mapped it */
+	uint8_t *next;
+	bool next_failed;
+	/** Filled window for the thread to unmap */
+	uint8_t *retired;
+};
+
+static uint8_t *
+intel_aub_writer_map_window(struct intel_aub_writer *aub, uint64_t base)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	volatile uint8_t *page;
+	uint8_t *map;
+	size_t i;
+
+	/* Allocate the blocks now rather than when the pages are written */
+	if (posix_fallocate(aub->fd, base, aub->window_size) &&
+	    ftruncate(aub->fd, base + aub->window_size))
+		return NULL;
+
+	map = drm_mmap(NULL, aub->window_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED, aub->fd, base);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	/*
+	 * Take the write faults on the thread rather than in the writer.
+	 * The window is all zeroes, writing them back only dirties it.
+	 */
+	if (aub->threaded) {
+		for (i = 0; i < aub->window_size; i += page_size) {
+			page = map + i;
+			*page = 0;
+		}
+	}
+
+	return map;
+}
+
+static void *
+intel_aub_writer_thread(void *data)
+{
+	struct intel_aub_writer *aub = data;
+
+	pthread_mutex_lock(&aub->mutex);
+	while (!aub->stop) {
+		if (aub->retired) {
+			uint8_t *map = aub->retired;
+
+			aub->retired = NULL;
+			pthread_mutex_unlock(&aub->mutex);
+			drm_munmap(map, aub->window_size);
+			pthread_mutex_lock(&aub->mutex);
+		} else if (!aub->next && !aub->next_failed) {
+			uint64_t base = aub->base + aub->window_size;
+			uint8_t *map;
+
+			pthread_mutex_unlock(&aub->mutex);
+			map = intel_aub_writer_map_window(aub, base);
+			pthread_mutex_lock(&aub->mutex);
+
+			aub->next = map;
+			aub->next_failed = !map;
+			pthread_cond_broadcast(&aub->cond);
+		} else {
+			pthread_cond_wait(&aub->cond, &aub->mutex);
+		}
+	}
+	pthread_mutex_unlock(&aub->mutex);
+
+	return NULL;
+}
+
+static int
+intel_aub_writer_next_window(struct intel_aub_writer *aub)
+{
+	uint8_t *map;
+
+	if (aub->threaded) {
+		pthread_mutex_lock(&aub->mutex);
+		while (!aub->next && !aub->next_failed)
+			pthread_cond_wait(&aub->cond, &aub->mutex);
+
+		/* The thread unmaps retired windows before mapping new ones */
+		map = aub->next;
+		aub->next = NULL;
+		aub->retired = aub->map;
+		if (map)
+			aub->base += aub->window_size;
+		pthread_cond_broadcast(&aub->cond);
+		pthread_mutex_unlock(&aub->mutex);
+	} else {
+		map = intel_aub_writer_map_window(aub,
+						  aub->base + aub->window_size);
+		drm_munmap(aub->map, aub->window_size);
+		if (map)
+			aub->base += aub->window_size;
+	}
+
+	aub->map = map;
+	if (!map)
+		return -ENOSPC;
+
+	aub->pos = 0;
+	return 0;
+}
+
+static uint32_t *
+intel_aub_writer_reserve(struct intel_aub_writer *aub, size_t bytes)
+{
+	size_t left;
+	uint32_t *ptr;
+
+	if (aub->failed)
+		return NULL;
+
+	/*
+	 * What is left of a window is either nothing or enough for a block
+	 * header, so it can always be padded.
+	 */
+	left = aub->window_size - aub->pos;
+	if (bytes != left && bytes + aub->header_dwords * 4 > left) {
+		if (left) {
+			ptr = (uint32_t *)(aub->map + aub->pos);
+			memset(ptr, 0, aub->header_dwords * 4);
+			ptr[0] = CMD_AUB_TRACE_HEADER_BLOCK |
+				 (aub->header_dwords - 2);
+			ptr[1] = AUB_TRACE_OP_COMMENT;
+			ptr[4] = left - aub->header_dwords * 4;
+			aub->pos = aub->window_size;
+		}
+
+		if (intel_aub_writer_next_window(aub)) {
+			fprintf(stderr, "Failed to extend the AUB file: %s\n",
+				strerror(errno));
+			aub->failed = true;
+			return NULL;
+		}
+	}
+
+	ptr = (uint32_t *)(aub->map + aub->pos);
+	aub->pos += bytes;
+
+	return ptr;
+}
+
+static void *
+intel_aub_writer_block(struct intel_aub_writer *aub, uint32_t op,
+		       uint32_t subtype, uint64_t address, size_t size)
+{
+	uint32_t *header;
+
+	header = intel_aub_writer_reserve(aub,
+					  aub->header_dwords * 4 + size);
+	if (!header)
+		return NULL;
+
+	header[0] = CMD_AUB_TRACE_HEADER_BLOCK | (aub->header_dwords - 2);
+	header[1] = op;
+	header[2] = subtype;
+	header[3] = address;
+	header[4] = size;
+	if (aub->gen >= 8)
+		header[5] = address >> 32;
+
+	return header + aub->header_dwords;
+}
+
+/* Writes the GTT entries mapping the addresses up to at least \p end. */
+static int
+intel_aub_writer_map_gtt(struct intel_aub_writer *aub, uint64_t end)
+{
+	unsigned int entry_bytes = aub->gen >= 8 ? 8 : 4;
+	uint64_t entry, count, i;
+	uint32_t *dw;
+
+	if (end > INTEL_AUB_GTT_SIZE)
+		return -EINVAL;
+
+	end = (end + INTEL_AUB_GTT_STEP - 1) & ~(INTEL_AUB_GTT_STEP - 1);
+	if (end > INTEL_AUB_GTT_SIZE)
+		end = INTEL_AUB_GTT_SIZE;
+
+	while (aub->gtt_end < end) {
+		count = (end - aub->gtt_end) / 4096;
+		if (count > INTEL_AUB_MAX_BLOCK / entry_bytes)
+			count = INTEL_AUB_MAX_BLOCK / entry_bytes;
+
+		dw = intel_aub_writer_block(aub, AUB_TRACE_MEMTYPE_GTT_ENTRY |
+						 AUB_TRACE_TYPE_NOTYPE |
+						 AUB_TRACE_OP_DATA_WRITE,
+					    0, aub->gtt_end / 4096 * entry_bytes,
+					    count * entry_bytes);
+		if (!dw)
+			return -ENOSPC;
+
+		entry = INTEL_AUB_GTT_ENTRY + aub->gtt_end;
+		for (i = 0; i < count; i++, entry += 4096) {
+			*dw++ = entry;
+			if (entry_bytes == 8)
+				*dw++ = entry >> 32;
+		}
+		aub->gtt_end += count * 4096;
+	}
+
+	return 0;
+}
+
+static int
+intel_aub_writer_header(struct intel_aub_writer *aub)
+{
+	uint32_t *dw;
+
+	dw = intel_aub_writer_reserve(aub, 13 * 4);
+	if (!dw)
+		return -ENOSPC;
+
+	memset(dw, 0, 13 * 4);
+	dw[0] = CMD_AUB_HEADER | (13 - 2);
+	dw[1] = (4 << AUB_HEADER_MAJOR_SHIFT) | (0 << AUB_HEADER_MINOR_SHIFT);
+	/* Application name, followed by the timestamp and comment length */
+	memcpy(&dw[2], "libdrm", sizeof("libdrm"));
+
+	return intel_aub_writer_map_gtt(aub, INTEL_AUB_GTT_STEP);
+}
+
+drm_private int
+intel_aub_writer_create(const char *filename, int gen, size_t window_size,
+			bool threaded, struct intel_aub_writer **out)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	struct intel_aub_writer *aub;
+	int ret;
+
+	aub = calloc(1, sizeof(*aub));
+	if (!aub)
+		return -ENOMEM;
+
+	if (!window_size)
+		window_size = INTEL_AUB_DEFAULT_WINDOW;
+	if (window_size < 4 * INTEL_AUB_MAX_BLOCK)
+		window_size = 4 * INTEL_AUB_MAX_BLOCK;
+	aub->window_size = (window_size + page_size - 1) & ~(page_size - 1);
+	aub->gen = gen;
+	aub->header_dwords = gen >= 8 ? 6 : 5;
+	aub->threaded = threaded;
+	pthread_mutex_init(&aub->mutex, NULL);
+	pthread_cond_init(&aub->cond, NULL);
+
+	aub->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (aub->fd < 0) {
+		ret = -errno;
+		goto err_free;
+	}
+
+	aub->map = intel_aub_writer_map_window(aub, 0);
+	if (!aub->map) {
+		ret = -errno;
+		goto err_close;
+	}
+
+	ret = intel_aub_writer_header(aub);
+	if (ret)
+		goto err_unmap;
+
+	/* Without the thread, windows are switched by the writer itself */
+	if (threaded &&
+	    pthread_create(&aub->thread, NULL, intel_aub_writer_thread, aub))
+		aub->threaded = false;
+
+	*out = aub;
+	return 0;
+
+err_unmap:
+	drm_munmap(aub->map, aub->window_size);
+err_close:
+	close(aub->fd);
+	unlink(filename);
+err_free:
+	pthread_cond_destroy(&aub->cond);
+	pthread_mutex_destroy(&aub->mutex);
+	free(aub);
+	return ret;
+}
+
+drm_private void
+intel_aub_writer_destroy(struct intel_aub_writer *aub)
+{
+	if (aub->threaded) {
+		pthread_mutex_lock(&aub->mutex);
+		aub->stop = true;
+		pthread_cond_broadcast(&aub->cond);
+		pthread_mutex_unlock(&aub->mutex);
+		pthread_join(aub->thread, NULL);
+
+		if (aub->next)
+			drm_munmap(aub->next, aub->window_size);
+		if (aub->retired)
+			drm_munmap(aub->retired, aub->window_size);
+	}
+
+	if (aub->map)
+		drm_munmap(aub->map, aub->window_size);
+
+	/* Drop the preallocated tail */
+	if (ftruncate(aub->fd, intel_aub_writer_size(aub)))
+		fprintf(stderr, "Failed to truncate the AUB file: %s\n",
+			strerror(errno));
+	close(aub->fd);
+
+	pthread_cond_destroy(&aub->cond);
+	pthread_mutex_destroy(&aub->mutex);
+	free(aub);
+}
+
+drm_private void *
+intel_aub_writer_data(struct intel_aub_writer *aub, uint32_t type,
+		      uint32_t subtype, uint64_t address, size_t size)
+{
+	if (address + size > aub->gtt_end &&
+	    intel_aub_writer_map_gtt(aub, address + size))
+		return NULL;
+
+	return intel_aub_writer_block(aub, AUB_TRACE_MEMTYPE_GTT | type |
+					   AUB_TRACE_OP_DATA_WRITE,
+				      subtype, address, size);
+}
+
+drm_private int
+intel_aub_writer_exec(struct intel_aub_writer *aub, uint32_t ring,
+		      uint64_t address)
+{
+	uint32_t *dw;
+
+	/*
+	 * Writing the ring is what makes the simulator execute it. Each
+	 * exec gets the next slot of the ring.
+	 */
+	dw = intel_aub_writer_block(aub, AUB_TRACE_MEMTYPE_GTT | ring |
+					 AUB_TRACE_OP_COMMAND_WRITE,
+				    0, INTEL_AUB_RING_OFFSET + aub->ring_offset,
+				    16);
+	if (!dw)
+		return -ENOSPC;
+
+	if (aub->gen >= 8) {
+		dw[0] = AUB_MI_BATCH_BUFFER_START | (3 - 2);
+		dw[1] = address;
+		dw[2] = address >> 32;
+	} else {
+		dw[0] = AUB_MI_BATCH_BUFFER_START;
+		dw[1] = address;
+		dw[2] = AUB_MI_NOOP;
+	}
+	dw[3] = AUB_MI_NOOP;
+
+	aub->ring_offset = (aub->ring_offset + 16) % INTEL_AUB_RING_SIZE;
+
+	return 0;
+}
+
+drm_private int
+intel_aub_writer_bmp(struct intel_aub_writer *aub,
+		     int x1, int y1, int width, int height,
+		     int format, int cpp, int pitch,
+		     uint64_t address, uint32_t tiling)
+{
+	uint32_t *dw;
+
+	dw = intel_aub_writer_reserve(aub, 6 * 4);
+	if (!dw)
+		return -ENOSPC;
+
+	dw[0] = CMD_AUB_DUMP_BMP | (6 - 2);
+	dw[1] = (y1 << 16) | x1;
+	dw[2] = (format << 24) | (cpp << 19) | pitch / 4;
+	dw[3] = (height << 16) | width;
+	dw[4] = address;
+	dw[5] = tiling;
+
+	return 0;
+}
+
+drm_private uint64_t
+intel_aub_writer_size(struct intel_aub_writer *aub)
+{
+	return aub->base + aub->pos;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2026 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * @file intel_aub_writer.h
+ *
+ * Writer for AUB trace files, used by the GEM buffer manager.
+ *
+ * The file is written through memory mapped windows of it that are
+ * preallocated ahead of the writer, so appending a block is a copy into
+ * the mapping rather than a write(2).
+ */
+
+#ifndef INTEL_AUB_WRITER_H
+#define INTEL_AUB_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libdrm_macros.h"
+
+/** Largest amount of data in a single trace block */
+#define INTEL_AUB_MAX_BLOCK	(1 << 20)
+
+/** Window size used when none is given */
+#define INTEL_AUB_DEFAULT_WINDOW	(32 << 20)
+
+/** Address of the ring the batch buffers are started from */
+#define INTEL_AUB_RING_OFFSET	0
+#define INTEL_AUB_RING_SIZE	(64 << 10)
+
+/**
+ * GTT addresses a trace can use. The GTT maps them to the pages from 2MB
+ * up, whose addresses have to fit the 32-bit entries before gen8.
+ */
+#define INTEL_AUB_GTT_SIZE	((4ull << 30) - (2 << 20))
+
+struct intel_aub_writer;
+
+/**
+ * Creates \p filename and writes the AUB header and the GTT setup for a
+ * device of generation \p gen to it.
+ *
+ * The file grows by \p window_size bytes at a time. If \p threaded is set,
+ * a thread maps and populates the next window while the current one is
+ * being filled, and unmaps the windows that were filled.
+ */
+drm_private int intel_aub_writer_create(const char *filename, int gen,
+					size_t window_size, bool threaded,
+					struct intel_aub_writer **aub);
+
+/** Unmaps the windows and truncates the file to the data written. */
+drm_private void intel_aub_writer_destroy(struct intel_aub_writer *aub);
+
+/**
+ * Appends a data write of \p size bytes at the GPU address \p address,
+ * preceded by the GTT entries mapping it if it wasn't mapped yet.
+ *
+ * \p size must be a multiple of 4 and at most INTEL_AUB_MAX_BLOCK. The
+ * caller fills the returned memory, which is part of the file, before the
+ * next call on the writer. NULL is returned once writing the file failed,
+ * or if the data goes past INTEL_AUB_GTT_SIZE.
+ */
+drm_private void *intel_aub_writer_data(struct intel_aub_writer *aub,
+					uint32_t type, uint32_t subtype,
+					uint64_t address, size_t size);
+
+/** Appends the ring commands starting the batch buffer at \p address. */
+drm_private int intel_aub_writer_exec(struct intel_aub_writer *aub,
+				      uint32_t ring, uint64_t address);
+
+/** Appends a block asking for the surface at \p address to be saved. */
+drm_private int intel_aub_writer_bmp(struct intel_aub_writer *aub,
+				     int x1, int y1, int width, int height,
+				     int format, int cpp, int pitch,
+				     uint64_t address, uint32_t tiling);
+
+/** Number of bytes appended to the file. */
+drm_private uint64_t intel_aub_writer_size(struct intel_aub_writer *aub);
+
+#endif /* INTEL_AUB_WRITER_H */
@@ -0,0 +1,559 @@
+/*
+ * Copyright © 2026 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Decodes many batch buffer or AUB files at once, one decode context per
+ * worker thread, for going through archives of hang dumps.
+ *
+ * Each file can be decoded to a file of its own, compared with the
+ * <file>-ref.txt next to it like test_decode does, and the opcode counts
+ * of all of them added up.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <err.h>
+
+#include "libdrm_macros.h"
+#include "intel_bufmgr.h"
+#include "intel_chipset.h"
+#include "intel_aub.h"
+
+#define HW_OFFSET 0x12300000
+
+struct batch_file {
+	const char *path;
+	uint32_t devid;
+
+	/** 0, 1 if the decode doesn't match the reference, or -errno */
+	int status;
+	uint64_t size;
+	uint64_t batches;
+	uint64_t packets;
+};
+
+struct worker {
+	pthread_t thread;
+
+	/** Opcode counts of every file the worker decoded */
+	struct drm_intel_decode_opcode_stats *stats;
+	unsigned int num_stats, max_stats;
+};
+
+static struct batch_file *files;
+static unsigned int num_files, next_file;
+
+static const char *output_dir;
+static int output_format = DRM_INTEL_DECODE_FORMAT_TEXT;
+static bool compare, print_stats;
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"usage: intel_batch_decode [-c] [-s] [-J] [-d devid] [-j threads]\n"
+		"                          [-o dir] <batch or aub>...\n"
+		"\n"
+		"  -c   Compare each decode with <file>-ref.txt\n"
+		"  -s   Print the opcode counts of all files\n"
+		"  -J   Write JSON instead of the text dump to -o\n"
+		"  -d   PCI device ID, guessed from the file names otherwise\n"
+		"  -j   Number of threads, defaults to the number of CPUs\n"
+		"  -o   Write the decode of <file> to <dir>/<file>.txt\n");
+	exit(1);
+}
+
+static uint32_t
+infer_devid(const char *filename)
+{
+	static const struct {
+		const char *name;
+		uint16_t devid;
+	} chipsets[] = {
+		{ "830",  0x3577},
+		{ "855",  0x3582},
+		{ "945",  0x2772},
+		{ "gen4", 0x2a02 },
+		{ "gm45", 0x2a42 },
+		{ "gen5", PCI_CHIP_ILD_G },
+		{ "gen6", PCI_CHIP_SANDYBRIDGE_GT2 },
+		{ "gen7", PCI_CHIP_IVYBRIDGE_GT2 },
+		{ "gen8", 0x1616 },
+	};
+	const char *base = strrchr(filename, '/');
+	unsigned int i;
+
+	base = base ? base + 1 : filename;
+	for (i = 0; i < sizeof(chipsets) / sizeof(chipsets[0]); i++) {
+		if (strstr(base, chipsets[i].name))
+			return chipsets[i].devid;
+	}
+
+	return 0;
+}
+
+static bool
+is_aub(const char *path)
+{
+	size_t len = strlen(path);
+
+	return len > 4 && strcmp(path + len - 4, ".aub") == 0;
+}
+
+static void
+decode_batch(struct drm_intel_decode *ctx, struct batch_file *file,
+	     const void *data, uint32_t hw_offset, uint32_t count)
+{
+	drm_intel_decode_set_batch_pointer(ctx, (void *)data, hw_offset,
+					   count);
+	drm_intel_decode(ctx);
+	file->batches++;
+}
+
+/*
+ * Decodes the batch buffers of an AUB trace, the data blocks written with
+ * the AUB_TRACE_TYPE_BATCH type.
+ */
+static int
+decode_aub(struct drm_intel_decode *ctx, struct batch_file *file,
+	   const uint8_t *data, size_t size)
+{
+	size_t pos = 0;
+
+	while (pos + 4 <= size) {
+		const uint32_t *block = (const uint32_t *)(data + pos);
+		size_t len = ((block[0] & 0xffff) + 2) * 4;
+
+		/* The intel_aub.h constants are ints */
+		if ((block[0] & 0xe0000000) != (uint32_t)CMD_AUB ||
+		    pos + len > size)
+			return -EINVAL;
+
+		if ((block[0] & 0xffff0000) ==
+		    (uint32_t)CMD_AUB_TRACE_HEADER_BLOCK) {
+			uint32_t op, bytes;
+
+			if (len < 20)
+				return -EINVAL;
+
+			op = block[1];
+			bytes = block[4];
+			if (bytes > size - pos - len)
+				return -EINVAL;
+
+			if ((op & AUB_TRACE_OPERATION_MASK) ==
+			    AUB_TRACE_OP_DATA_WRITE &&
+			    (op & AUB_TRACE_TYPE_MASK) == AUB_TRACE_TYPE_BATCH)
+				decode_batch(ctx, file, data + pos + len,
+					     block[3], bytes / 4);
+
+			len += (bytes + 3) & ~3;
+		}
+
+		pos += len;
+	}
+
+	return 0;
+}
+
+static int
+compare_ref(const char *path, const char *decode)
+{
+	char *ref_path, *ref;
+	struct stat st;
+	ssize_t n;
+	int fd, ret;
+
+	if (asprintf(&ref_path, "%s-ref.txt", path) < 0)
+		return -ENOMEM;
+	fd = open(ref_path, O_RDONLY | O_CLOEXEC);
+	free(ref_path);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -errno;
+	}
+
+	ref = malloc(st.st_size + 1);
+	if (!ref) {
+		close(fd);
+		return -ENOMEM;
+	}
+	n = read(fd, ref, st.st_size);
+	close(fd);
+	if (n < 0) {
+		free(ref);
+		return -EIO;
+	}
+	ref[n] = '\0';
+
+	ret = strcmp(ref, decode) ? 1 : 0;
+	free(ref);
+
+	return ret;
+}
+
+static int
+write_output(const char *path, const char *decode, size_t size)
+{
+	const char *base = strrchr(path, '/');
+	char *out_path;
+	FILE *out;
+	int ret = 0;
+
+	base = base ? base + 1 : path;
+	if (asprintf(&out_path, "%s/%s.%s", output_dir, base,
+		     output_format == DRM_INTEL_DECODE_FORMAT_JSON ?
+		     "json" : "txt") < 0)
+		return -ENOMEM;
+
+	out = fopen(out_path, "w");
+	free(out_path);
+	if (!out)
+		return -errno;
+	if (fwrite(decode, 1, size, out) != size)
+		ret = -EIO;
+	if (fclose(out))
+		ret = -EIO;
+
+	return ret;
+}
+
+static int
+add_stats(struct worker *worker, struct batch_file *file,
+	  struct drm_intel_decode *ctx)
+{
+	int i, n;
+
+	n = drm_intel_decode_get_opcode_stats(ctx, NULL, 0);
+	if (n <= 0)
+		return n;
+
+	if (worker->num_stats + n > worker->max_stats) {
+		unsigned int max = worker->max_stats ? worker->max_stats : 256;
+		void *tmp;
+
+		while (worker->num_stats + n > max)
+			max *= 2;
+		tmp = realloc(worker->stats, max * sizeof(*worker->stats));
+		if (!tmp)
+			return -ENOMEM;
+		worker->stats = tmp;
+		worker->max_stats = max;
+	}
+
+	n = drm_intel_decode_get_opcode_stats(ctx,
+					      worker->stats + worker->num_stats,
+					      n);
+	for (i = 0; i < n; i++)
+		file->packets += worker->stats[worker->num_stats + i].count;
+	worker->num_stats += n;
+
+	return 0;
+}
+
+static int
+decode_file(struct worker *worker, struct batch_file *file)
+{
+	struct drm_intel_decode *ctx;
+	char *decode = NULL;
+	size_t decode_size = 0;
+	FILE *out = NULL;
+	struct stat st;
+	void *data;
+	int fd, ret;
+
+	fd = open(file->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -errno;
+	}
+
+	file->size = st.st_size;
+	data = st.st_size ? drm_mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				     fd, 0) : NULL;
+	close(fd);
+	if (data == MAP_FAILED)
+		return -errno;
+
+	ctx = drm_intel_decode_context_alloc(file->devid);
+	if (!ctx) {
+		ret = -ENOMEM;
+		goto out_unmap;
+	}
+	drm_intel_decode_set_opcode_stats(ctx, 1);
+
+	if (compare || output_dir) {
+#if HAVE_OPEN_MEMSTREAM
+		out = open_memstream(&decode, &decode_size);
+#else
+		errno = ENOSYS;
+#endif
+		if (!out) {
+			ret = -errno;
+			goto out_ctx;
+		}
+		drm_intel_decode_set_output_file(ctx, out);
+		drm_intel_decode_set_output_format(ctx, output_format);
+	} else {
+		drm_intel_decode_set_output_format(ctx,
+						   DRM_INTEL_DECODE_FORMAT_NONE);
+	}
+
+	if (is_aub(file->path)) {
+		ret = decode_aub(ctx, file, data, st.st_size);
+	} else {
+		decode_batch(ctx, file, data, HW_OFFSET, st.st_size / 4);
+		ret = 0;
+	}
+
+	if (out)
+		fclose(out);
+
+	if (!ret && output_dir)
+		ret = write_output(file->path, decode, decode_size);
+	if (!ret && compare)
+		ret = compare_ref(file->path, decode);
+	if (!ret)
+		ret = add_stats(worker, file, ctx);
+
+	free(decode);
+out_ctx:
+	drm_intel_decode_context_free(ctx);
+out_unmap:
+	if (data)
+		drm_munmap(data, st.st_size);
+
+	return ret;
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct worker *worker = data;
+
+	for (;;) {
+		unsigned int i = __sync_fetch_and_add(&next_file, 1);
+
+		if (i >= num_files)
+			break;
+		files[i].status = decode_file(worker, &files[i]);
+	}
+
+	return NULL;
+}
+
+static int
+stats_compare_opcode(const void *a, const void *b)
+{
+	const struct drm_intel_decode_opcode_stats *sa = a, *sb = b;
+
+	if (sa->opcode != sb->opcode)
+		return sa->opcode < sb->opcode ? -1 : 1;
+	if (sa->name == sb->name)
+		return 0;
+	if (!sa->name || !sb->name)
+		return sa->name ? 1 : -1;
+	return strcmp(sa->name, sb->name);
+}
+
+static int
+stats_compare_dwords(const void *a, const void *b)
+{
+	const struct drm_intel_decode_opcode_stats *sa = a, *sb = b;
+
+	if (sa->dwords != sb->dwords)
+		return sa->dwords > sb->dwords ? -1 : 1;
+	return stats_compare_opcode(a, b);
+}
+
+static void
+report_stats(struct worker *workers, unsigned int num_workers)
+{
+	struct drm_intel_decode_opcode_stats *stats;
+	unsigned int i, n = 0, total = 0;
+
+	for (i = 0; i < num_workers; i++)
+		total += workers[i].num_stats;
+	if (!total)
+		return;
+
+	stats = malloc(total * sizeof(*stats));
+	if (!stats)
+		errx(1, "out of memory");
+	for (i = 0; i < num_workers; i++) {
+		memcpy(stats + n, workers[i].stats,
+		       workers[i].num_stats * sizeof(*stats));
+		n += workers[i].num_stats;
+	}
+
+	/* The same opcode means something else on another gen, keep the
+	 * name in the key.
+	 */
+	qsort(stats, total, sizeof(*stats), stats_compare_opcode);
+	for (i = 1, n = 1; i < total; i++) {
+		if (stats_compare_opcode(&stats[n - 1], &stats[i]) == 0) {
+			stats[n - 1].count += stats[i].count;
+			stats[n - 1].dwords += stats[i].dwords;
+		} else {
+			stats[n++] = stats[i];
+		}
+	}
+	qsort(stats, n, sizeof(*stats), stats_compare_dwords);
+
+	printf("%-10s %-40s %12s %14s\n", "opcode", "name", "packets",
+	       "dwords");
+	for (i = 0; i < n; i++) {
+		printf("0x%08x %-40s %12llu %14llu\n", stats[i].opcode,
+		       stats[i].name ? stats[i].name : "UNKNOWN",
+		       (unsigned long long)stats[i].count,
+		       (unsigned long long)stats[i].dwords);
+	}
+	free(stats);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct worker *workers;
+	unsigned int i, num_workers = 0;
+	uint32_t devid = 0;
+	uint64_t size = 0, batches = 0, packets = 0;
+	struct timespec start, end;
+	double seconds;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "csJd:j:o:")) != -1) {
+		switch (c) {
+		case 'c':
+			compare = true;
+			break;
+		case 's':
+			print_stats = true;
+			break;
+		case 'J':
+			output_format = DRM_INTEL_DECODE_FORMAT_JSON;
+			break;
+		case 'd':
+			devid = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			num_workers = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			output_dir = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind >= argc ||
+	    (compare && output_format != DRM_INTEL_DECODE_FORMAT_TEXT))
+		usage();
+
+	num_files = argc - optind;
+	files = calloc(num_files, sizeof(*files));
+	if (!files)
+		errx(1, "out of memory");
+	for (i = 0; i < num_files; i++) {
+		files[i].path = argv[optind + i];
+		files[i].devid = devid ? devid : infer_devid(files[i].path);
+		if (!files[i].devid)
+			errx(1, "couldn't guess the chipset of `%s', use -d",
+			     files[i].path);
+	}
+
+	if (!num_workers) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		num_workers = cpus > 0 ? cpus : 1;
+	}
+	if (num_workers > num_files)
+		num_workers = num_files;
+
+	workers = calloc(num_workers, sizeof(*workers));
+	if (!workers)
+		errx(1, "out of memory");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num_workers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker_thread,
+				   &workers[i]))
+			errx(1, "couldn't start the worker threads");
+	}
+	for (i = 0; i < num_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; i < num_files; i++) {
+		struct batch_file *file = &files[i];
+
+		if (file->status > 0) {
+			fprintf(stderr, "%s: decode mismatch with reference\n",
+				file->path);
+			ret = 1;
+		} else if (file->status < 0) {
+			fprintf(stderr, "%s: %s\n", file->path,
+				strerror(-file->status));
+			ret = 1;
+		}
+
+		size += file->size;
+		batches += file->batches;
+		packets += file->packets;
+	}
+
+	if (print_stats) {
+		report_stats(workers, num_workers);
+
+		seconds = (end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("%u files, %llu batches, %llu packets, %.1f MB in "
+		       "%.3f s with %u threads (%.1f MB/s)\n", num_files,
+		       (unsigned long long)batches,
+		       (unsigned long long)packets, size / 1e6, seconds,
+		       num_workers, size / 1e6 / seconds);
+	}
+
+	for (i = 0; i < num_workers; i++)
+		free(workers[i].stats);
+	free(workers);
+	free(files);
+
+	return ret;
+}
@@ -109,6 +109,36 @@ typedef struct _drm_intel_aub_annotation {
 	uint32_t ending_offset;
 } drm_intel_aub_annotation;
 
+/** Numbers of one bucket of the GEM buffer object cache */
+typedef struct _drm_intel_bo_cache_stats {
+	/** Size of the buffers in the bucket */
+	unsigned long size;
+	/** Buffers in the bucket now */
+	unsigned int cached;
+	/** Allocations taken from the bucket */
+	uint64_t hits;
+	/** Allocations the bucket had no idle buffer for */
+	uint64_t misses;
+	/** Buffers in the bucket the kernel took the pages of */
+	uint64_t purged;
+	/** Buffers freed after staying unused in the bucket, or trimmed */
+	uint64_t expired;
+} drm_intel_bo_cache_stats;
+
+/** Numbers of the streaming upload path */
+typedef struct _drm_intel_upload_stats {
+	/** drm_intel_bo_subdata() writes that went through the staging buffer */
+	uint64_t staged;
+	/** Writes that went straight to the buffer */
+	uint64_t direct;
+	/** Bytes written */
+	uint64_t bytes;
+	/** Times the staging buffer was written out */
+	uint64_t flushes;
+	/** Buffers moved to the WC domain before being written */
+	uint64_t domain_changes;
+} drm_intel_upload_stats;
+
 #define BO_ALLOC_FOR_RENDER (1<<0)
 
 drm_intel_bo *drm_intel_bo_alloc(drm_intel_bufmgr *bufmgr, const char *name,
@@ -177,9 +207,19 @@ drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 						const char *name,
 						unsigned int handle);
 void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr);
+int drm_intel_bufmgr_gem_enable_softpin(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr);
+int drm_intel_bufmgr_gem_enable_streaming_uploads(drm_intel_bufmgr *bufmgr,
+						  unsigned long staging_size);
+void drm_intel_bufmgr_gem_get_upload_stats(drm_intel_bufmgr *bufmgr,
+					   drm_intel_upload_stats *stats);
 void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
 					     int limit);
+int drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+					 drm_intel_bo_cache_stats *stats,
+					 int count);
+void drm_intel_bufmgr_gem_trim_bo_cache(drm_intel_bufmgr *bufmgr,
+					uint64_t max_bytes);
 int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo);
 int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo);
 int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo);
@@ -200,6 +240,9 @@ void drm_intel_gem_bo_start_gtt_access(drm_intel_bo *bo, int write_enable);
 void
 drm_intel_bufmgr_gem_set_aub_filename(drm_intel_bufmgr *bufmgr,
 				      const char *filename);
+void drm_intel_bufmgr_gem_set_aub_window(drm_intel_bufmgr *bufmgr,
+					 unsigned long window_size,
+					 int background);
 void drm_intel_bufmgr_gem_set_aub_dump(drm_intel_bufmgr *bufmgr, int enable);
 void drm_intel_gem_bo_aub_dump_bmp(drm_intel_bo *bo,
 				   int x1, int y1, int width, int height,
@@ -266,6 +309,63 @@ void drm_intel_bo_fake_disable_backing_store(drm_intel_bo *bo,
 void drm_intel_bufmgr_fake_contended_lock_take(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_fake_evict_all(drm_intel_bufmgr *bufmgr);
 
+/** @{ Output formats of drm_intel_decode() */
+/** The dump, one line per dword */
+#define DRM_INTEL_DECODE_FORMAT_TEXT	0
+/** A JSON object per line of the dump, fields as in drm_intel_decode_line */
+#define DRM_INTEL_DECODE_FORMAT_JSON	1
+/** A struct drm_intel_decode_record per packet, without any text */
+#define DRM_INTEL_DECODE_FORMAT_BINARY	2
+/** Nothing, for opcode statistics */
+#define DRM_INTEL_DECODE_FORMAT_NONE	3
+/** @} */
+
+/** @{ drm_intel_decode_line flags */
+#define DRM_INTEL_DECODE_LINE_HEAD	(1 << 0)
+#define DRM_INTEL_DECODE_LINE_TAIL	(1 << 1)
+/** Not about one dword, like a complaint about a packet length */
+#define DRM_INTEL_DECODE_LINE_MESSAGE	(1 << 2)
+/** @} */
+
+/** A line of drm_intel_decode() output */
+struct drm_intel_decode_line {
+	/** GPU address of the dword, or of the packet for messages */
+	uint32_t offset;
+	/** The dword */
+	uint32_t dword;
+	/** Dword in the packet, 0 for the header */
+	uint32_t index;
+	/** DRM_INTEL_DECODE_LINE_* */
+	uint32_t flags;
+	/** What the dword means, without a trailing newline */
+	const char *text;
+};
+
+/** A packet in DRM_INTEL_DECODE_FORMAT_BINARY output, in host byte order */
+struct drm_intel_decode_record {
+	/** GPU address of the packet */
+	uint32_t offset;
+	/** Header dword with the length and flag fields masked off */
+	uint32_t opcode;
+	/** Length of the packet in dwords */
+	uint32_t dwords;
+};
+
+/** Packets of one opcode seen by drm_intel_decode() */
+struct drm_intel_decode_opcode_stats {
+	/** Header dword with the length and flag fields masked off */
+	uint32_t opcode;
+	/** Name of the packet, NULL if the decoder has none */
+	const char *name;
+	/** Packets decoded */
+	uint64_t count;
+	/** Dwords in those packets */
+	uint64_t dwords;
+};
+
+typedef void (*drm_intel_decode_line_func)(void *data,
+					   const struct drm_intel_decode_line *line);
+
 struct drm_intel_decode *drm_intel_decode_context_alloc(uint32_t devid);
 void drm_intel_decode_context_free(struct drm_intel_decode *ctx);
 void drm_intel_decode_set_batch_pointer(struct drm_intel_decode *ctx,
@@ -276,6 +376,16 @@ void drm_intel_decode_set_dump_past_end(struct drm_intel_decode *ctx,
 void drm_intel_decode_set_head_tail(struct drm_intel_decode *ctx,
 				    uint32_t head, uint32_t tail);
 void drm_intel_decode_set_output_file(struct drm_intel_decode *ctx, FILE *out);
+int drm_intel_decode_set_output_format(struct drm_intel_decode *ctx,
+				       int format);
+void drm_intel_decode_set_output_func(struct drm_intel_decode *ctx,
+				      drm_intel_decode_line_func func,
+				      void *data);
+void drm_intel_decode_set_opcode_stats(struct drm_intel_decode *ctx,
+				       int enable);
+int drm_intel_decode_get_opcode_stats(struct drm_intel_decode *ctx,
+				      struct drm_intel_decode_opcode_stats *stats,
+				      int count);
 void drm_intel_decode(struct drm_intel_decode *ctx);
 
 int drm_intel_reg_read(drm_intel_bufmgr *bufmgr,
@@ -37,6 +37,7 @@
 #include <xf86drm.h>
 #include <xf86atomic.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,6 +48,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdbool.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "errno.h"
 #ifndef ETIME
@@ -54,9 +58,13 @@
 #endif
 #include "libdrm_macros.h"
 #include "libdrm_lists.h"
+#include "xf86drmBOCache.h"
 #include "intel_bufmgr.h"
 #include "intel_bufmgr_priv.h"
 #include "intel_chipset.h"
+#include "intel_aub.h"
+#include "intel_aub_writer.h"
+#include "mm.h"
 #include "string.h"
 
 #include "i915_drm.h"
@@ -79,6 +87,7 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 #define MAX2(A, B) ((A) > (B) ? (A) : (B))
+#define MIN2(A, B) ((A) < (B) ? (A) : (B))
 
 /**
  * upper_32_bits - return bits 32-63 of a number
@@ -98,9 +107,13 @@
 
 typedef struct _drm_intel_bo_gem drm_intel_bo_gem;
 
-struct drm_intel_gem_bo_bucket {
-	drmMMListHead head;
+/** A drm_intel_bo_subdata() write waiting in the staging buffer */
+struct drm_intel_gem_upload {
+	drm_intel_bo *bo;
+	unsigned long offset;
 	unsigned long size;
+	/** Offset of the data in the staging buffer */
+	unsigned long staged;
 };
 
 typedef struct _drm_intel_bufmgr_gem {
@@ -119,10 +132,11 @@ typedef struct _drm_intel_bufmgr_gem {
 	int exec_size;
 	int exec_count;
 
-	/** Array of lists of cached gem objects of power-of-two sizes */
-	struct drm_intel_gem_bo_bucket cache_bucket[14 * 4];
-	int num_buckets;
-	time_t time;
+	/** Stamp of the current walk over relocation trees */
+	uint64_t visit_generation;
+
+	/** Released buffers kept for reuse */
+	drmBOCachePtr bo_cache;
 
 	drmMMListHead managers;
 
@@ -132,6 +146,12 @@ typedef struct _drm_intel_bufmgr_gem {
 	drmMMListHead vma_cache;
 	int vma_count, vma_open, vma_max;
 
+	/**
+	 * GPU addresses handed out to buffers, in pages, if the bufmgr
+	 * softpins everything.
+	 */
+	struct mem_block *address_heap;
+
 	uint64_t gtt_size;
 	int available_fences;
 	int pci_device;
@@ -152,6 +172,29 @@ typedef struct _drm_intel_bufmgr_gem {
 		uint32_t handle;
 	} userptr_active;
 
+	/** AUB trace being written, if enabled */
+	struct intel_aub_writer *aub;
+	char *aub_filename;
+	unsigned long aub_window_size;
+	bool aub_background;
+	/** Bumped each time a trace is started */
+	uint32_t aub_generation;
+	/** AUB addresses of the buffers, in pages */
+	struct mem_block *aub_heap;
+	/** Whether execs with softpinned buffers were left out of the trace */
+	bool aub_skipped_pinned;
+
+	/**
+	 * Streaming uploads: small drm_intel_bo_subdata() writes wait in
+	 * the staging buffer until one of the buffers they target is used.
+	 */
+	uint8_t *upload_staging;
+	unsigned long upload_staging_size;
+	unsigned long upload_staging_used;
+	struct drm_intel_gem_upload *uploads;
+	int upload_count, upload_max;
+	drm_intel_upload_stats upload_stats;
+
 } drm_intel_bufmgr_gem;
 
 #define DRM_INTEL_RELOC_FENCE (1<<0)
@@ -184,6 +227,12 @@ struct _drm_intel_bo_gem {
 	 */
 	int validate_index;
 
+	/**
+	 * visit_generation of the last walk over relocation trees that
+	 * reached this buffer.
+	 */
+	uint64_t visit_generation;
+
 	/**
 	 * Current tiling mode
 	 */
@@ -193,7 +242,8 @@ struct _drm_intel_bo_gem {
 
 	unsigned long kflags;
 
-	time_t free_time;
+	/** GPU address range of the buffer in address_heap */
+	struct mem_block *address_block;
 
 	/** Array passed to the DRM containing relocation information. */
 	struct drm_i915_gem_relocation_entry *relocs;
@@ -224,8 +274,8 @@ struct _drm_intel_bo_gem {
 	int map_count;
 	drmMMListHead vma_list;
 
-	/** BO cache list */
-	drmMMListHead head;
+	/** BO cache entry */
+	drmBOCacheEntry cache_entry;
 
 	/**
 	 * Boolean of whether this BO and its children have been included in
@@ -280,6 +330,29 @@ struct _drm_intel_bo_gem {
 
 	/** Flags that we may need to do the SW_FINISH ioctl on unmap. */
 	bool mapped_cpu_write;
+
+	/**
+	 * Boolean of whether a map__* pointer was handed out, which may be
+	 * written to at any time.
+	 */
+	bool mapped_persistently;
+
+	/** AUB address range of the buffer in aub_heap */
+	struct mem_block *aub_block;
+	/** aub_generation of the trace that has the buffer contents */
+	uint32_t aub_generation;
+	/** Range written since the buffer was last dumped to the AUB trace */
+	unsigned long aub_dirty_start, aub_dirty_end;
+
+	/**
+	 * Boolean of whether the streaming upload path moved the buffer to
+	 * the WC write domain and neither the GPU nor another mapping used
+	 * it since, so it can be written again without a domain change.
+	 */
+	bool wc_write_domain;
+
+	/** Boolean of whether staged uploads target this buffer */
+	bool upload_pending;
 };
 
 static unsigned int
@@ -391,21 +464,51 @@ drm_intel_gem_bo_tile_pitch(drm_intel_bufmgr_gem *bufmgr_gem,
 	return i;
 }
 
-static struct drm_intel_gem_bo_bucket *
-drm_intel_gem_bo_bucket_for_size(drm_intel_bufmgr_gem *bufmgr_gem,
-				 unsigned long size)
+/*
+ * With drm_intel_bufmgr_gem_enable_softpin(), give the buffer its GPU
+ * address. A buffer keeps its address until the GEM object is closed,
+ * also while it waits in the reuse cache.
+ */
+static int
+drm_intel_gem_bo_assign_address(drm_intel_bufmgr_gem *bufmgr_gem,
+				drm_intel_bo_gem *bo_gem)
 {
-	int i;
+	if (bufmgr_gem->address_heap == NULL)
+		return 0;
 
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
+	/* A cached buffer can be reused with a larger alignment */
+	if (bo_gem->address_block && bo_gem->bo.align &&
+	    bo_gem->bo.offset64 % bo_gem->bo.align) {
+		mmFreeMem(bo_gem->address_block);
+		bo_gem->address_block = NULL;
 	}
 
-	return NULL;
+	if (bo_gem->address_block == NULL) {
+		unsigned long pages = (bo_gem->bo.size + 4095) / 4096;
+		int align2 = 0;
+
+		/* Let the kernel use 2MB pages for large buffers */
+		if (bo_gem->bo.size >= 2 * 1024 * 1024)
+			align2 = 9;
+		while ((4096ul << align2) < bo_gem->bo.align)
+			align2++;
+
+		if (pages > INT_MAX)
+			return -ENOSPC;
+
+		bo_gem->address_block = mmAllocMem(bufmgr_gem->address_heap,
+						   pages, align2, 0);
+		if (bo_gem->address_block == NULL)
+			return -ENOSPC;
+
+		bo_gem->bo.offset64 =
+			(uint64_t)bo_gem->address_block->ofs * 4096;
+		bo_gem->bo.offset = bo_gem->bo.offset64;
+	}
+
+	bo_gem->kflags |= EXEC_OBJECT_PINNED | EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+
+	return 0;
 }
 
 static void
@@ -478,7 +581,7 @@ drm_intel_gem_bo_reference(drm_intel_bo *bo)
  * with the intersection of the memory type flags and the union of the
  * access flags.
  */
-static void
+static int
 drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
@@ -492,22 +595,32 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 
 	if (bo_gem->validate_index != -1) {
 		bufmgr_gem->exec2_objects[bo_gem->validate_index].flags |= flags;
-		return;
+		return 0;
 	}
 
-	/* Extend the array of validation entries as necessary. */
+	/* Extend the array of validation entries as necessary. The arrays
+	 * are kept for the next batch.
+	 */
 	if (bufmgr_gem->exec_count == bufmgr_gem->exec_size) {
+		struct drm_i915_gem_exec_object2 *exec2_objects;
+		drm_intel_bo **exec_bos;
 		int new_size = bufmgr_gem->exec_size * 2;
 
 		if (new_size == 0)
-			new_size = 5;
-
-		bufmgr_gem->exec2_objects =
-			realloc(bufmgr_gem->exec2_objects,
-				sizeof(*bufmgr_gem->exec2_objects) * new_size);
-		bufmgr_gem->exec_bos =
-			realloc(bufmgr_gem->exec_bos,
-				sizeof(*bufmgr_gem->exec_bos) * new_size);
+			new_size = 64;
+
+		exec2_objects = realloc(bufmgr_gem->exec2_objects,
+					sizeof(*exec2_objects) * new_size);
+		if (!exec2_objects)
+			return -ENOMEM;
+		bufmgr_gem->exec2_objects = exec2_objects;
+
+		exec_bos = realloc(bufmgr_gem->exec_bos,
+				   sizeof(*exec_bos) * new_size);
+		if (!exec_bos)
+			return -ENOMEM;
+		bufmgr_gem->exec_bos = exec_bos;
+
 		bufmgr_gem->exec_size = new_size;
 	}
 
@@ -524,6 +637,8 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 	bufmgr_gem->exec2_objects[index].rsvd2 = 0;
 	bufmgr_gem->exec_bos[index] = bo;
 	bufmgr_gem->exec_count++;
+
+	return 0;
 }
 
 #define RELOC_BUF_SIZE(x) ((I915_RELOC_HEADER + x * I915_RELOC0_STRIDE) * \
@@ -642,25 +757,40 @@ drm_intel_gem_bo_madvise(drm_intel_bo *bo, int madv)
 		 madv);
 }
 
-/* drop the oldest entries that have been purged by the kernel */
-static void
-drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
-				    struct drm_intel_gem_bo_bucket *bucket)
+static drm_intel_bo_gem *
+drm_intel_gem_bo_from_cache_entry(drmBOCacheEntryPtr entry)
 {
-	while (!DRMLISTEMPTY(&bucket->head)) {
-		drm_intel_bo_gem *bo_gem;
+	return DRMLISTENTRY(drm_intel_bo_gem, entry, cache_entry);
+}
 
-		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-				      bucket->head.next, head);
-		if (drm_intel_gem_bo_madvise_internal
-		    (bufmgr_gem, bo_gem, I915_MADV_DONTNEED))
-			break;
+static int
+drm_intel_gem_bo_cache_is_idle(drmBOCacheEntryPtr entry)
+{
+	return !drm_intel_gem_bo_busy(&drm_intel_gem_bo_from_cache_entry(entry)->bo);
+}
 
-		DRMLISTDEL(&bo_gem->head);
-		drm_intel_gem_bo_free(&bo_gem->bo);
-	}
+static int
+drm_intel_gem_bo_cache_madvise(drmBOCacheEntryPtr entry, int willneed)
+{
+	drm_intel_bo_gem *bo_gem = drm_intel_gem_bo_from_cache_entry(entry);
+
+	return drm_intel_gem_bo_madvise_internal
+		((drm_intel_bufmgr_gem *) bo_gem->bo.bufmgr, bo_gem,
+		 willneed ? I915_MADV_WILLNEED : I915_MADV_DONTNEED);
+}
+
+static void
+drm_intel_gem_bo_cache_destroy(drmBOCacheEntryPtr entry)
+{
+	drm_intel_gem_bo_free(&drm_intel_gem_bo_from_cache_entry(entry)->bo);
 }
 
+static const drmBOCacheFuncs drm_intel_gem_bo_cache_funcs = {
+	.is_idle = drm_intel_gem_bo_cache_is_idle,
+	.madvise = drm_intel_gem_bo_cache_madvise,
+	.destroy = drm_intel_gem_bo_cache_destroy,
+};
+
 static drm_intel_bo *
 drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 				const char *name,
@@ -674,7 +804,7 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 	drm_intel_bo_gem *bo_gem;
 	unsigned int page_size = getpagesize();
 	int ret;
-	struct drm_intel_gem_bo_bucket *bucket;
+	drmBOCacheEntryPtr entry;
 	bool alloc_from_cache;
 	unsigned long bo_size;
 	bool for_render = false;
@@ -682,67 +812,45 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 	if (flags & BO_ALLOC_FOR_RENDER)
 		for_render = true;
 
-	/* Round the allocated size up to a power of two number of pages. */
-	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, size);
+	/* Round the allocated size up to the size of its cache bucket. */
+	bo_size = drmBOCacheBucketSize(bufmgr_gem->bo_cache, size);
 
 	/* If we don't have caching at this size, don't actually round the
 	 * allocation up.
 	 */
-	if (bucket == NULL) {
+	if (bo_size == 0) {
 		bo_size = size;
 		if (bo_size < page_size)
 			bo_size = page_size;
-	} else {
-		bo_size = bucket->size;
 	}
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
 	/* Get a buffer out of the cache if available */
 retry:
 	alloc_from_cache = false;
-	if (bucket != NULL && !DRMLISTEMPTY(&bucket->head)) {
-		if (for_render) {
-			/* Allocate new render-target BOs from the tail (MRU)
-			 * of the list, as it will likely be hot in the GPU
-			 * cache and in the aperture for us.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.prev, head);
-			DRMLISTDEL(&bo_gem->head);
-			alloc_from_cache = true;
+
+	/* Render targets come from the MRU end, as they will likely be hot
+	 * in the GPU cache and in the aperture for us. Other BOs, which we
+	 * are probably going to map first thing to fill them with data,
+	 * only reuse the LRU buffer if it is idle: allocating a new buffer
+	 * is probably faster than waiting for the GPU to finish.
+	 */
+	entry = drmBOCacheAlloc(bufmgr_gem->bo_cache, bo_size, 0,
+				for_render ? DRM_BO_CACHE_MRU :
+					     DRM_BO_CACHE_LRU);
+	if (entry) {
+		bo_gem = drm_intel_gem_bo_from_cache_entry(entry);
+		alloc_from_cache = true;
+		if (for_render)
 			bo_gem->bo.align = alignment;
-		} else {
+		else
 			assert(alignment == 0);
-			/* For non-render-target BOs (where we're probably
-			 * going to map it first thing in order to fill it
-			 * with data), check if the last BO in the cache is
-			 * unbusy, and only reuse in that case. Otherwise,
-			 * allocating a new buffer is probably faster than
-			 * waiting for the GPU to finish.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			if (!drm_intel_gem_bo_busy(&bo_gem->bo)) {
-				alloc_from_cache = true;
-				DRMLISTDEL(&bo_gem->head);
-			}
-		}
-
-		if (alloc_from_cache) {
-			if (!drm_intel_gem_bo_madvise_internal
-			    (bufmgr_gem, bo_gem, I915_MADV_WILLNEED)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				drm_intel_gem_bo_cache_purge_bucket(bufmgr_gem,
-								    bucket);
-				goto retry;
-			}
 
-			if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
-								 tiling_mode,
-								 stride)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				goto retry;
-			}
+		if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
+							 tiling_mode,
+							 stride)) {
+			drm_intel_gem_bo_free(&bo_gem->bo);
+			goto retry;
 		}
 	}
 
@@ -789,6 +897,9 @@ retry:
 			goto err_free;
 	}
 
+	if (drm_intel_gem_bo_assign_address(bufmgr_gem, bo_gem))
+		goto err_free;
+
 	bo_gem->name = name;
 	atomic_set(&bo_gem->refcount, 1);
 	bo_gem->validate_index = -1;
@@ -955,6 +1066,12 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 	bo_gem->has_error = false;
 	bo_gem->reusable = false;
 
+	if (drm_intel_gem_bo_assign_address(bufmgr_gem, bo_gem)) {
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return NULL;
+	}
+
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
@@ -1133,6 +1250,9 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 	if (ret != 0)
 		goto err_unref;
 
+	if (drm_intel_gem_bo_assign_address(bufmgr_gem, bo_gem))
+		goto err_unref;
+
 	/* XXX stride is unknown */
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
 	DBG("bo_create_from_handle: %d (%s)\n", handle, bo_gem->name);
@@ -1174,6 +1294,11 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 		HASH_DELETE(name_hh, bufmgr_gem->name_table, bo_gem);
 	HASH_DELETE(handle_hh, bufmgr_gem->handle_table, bo_gem);
 
+	if (bo_gem->address_block)
+		mmFreeMem(bo_gem->address_block);
+	if (bo_gem->aub_block)
+		mmFreeMem(bo_gem->aub_block);
+
 	/* Close this object */
 	ret = drmCloseBufferHandle(bufmgr_gem->fd, bo_gem->gem_handle);
 	if (ret != 0) {
@@ -1183,51 +1308,202 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 	free(bo);
 }
 
+/**
+ * Records that [offset, offset + size) of the buffer was written by the CPU,
+ * for the next AUB dump to include it.
+ */
 static void
-drm_intel_gem_bo_mark_mmaps_incoherent(drm_intel_bo *bo)
+drm_intel_gem_bo_mark_dirty(drm_intel_bo_gem *bo_gem,
+			    unsigned long offset, unsigned long size)
 {
-#if HAVE_VALGRIND
-	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-
-	if (bo_gem->mem_virtual)
-		VALGRIND_MAKE_MEM_NOACCESS(bo_gem->mem_virtual, bo->size);
+	if (offset < bo_gem->aub_dirty_start)
+		bo_gem->aub_dirty_start = offset;
+	if (offset + size > bo_gem->aub_dirty_end)
+		bo_gem->aub_dirty_end = offset + size;
+}
 
-	if (bo_gem->wc_virtual)
-		VALGRIND_MAKE_MEM_NOACCESS(bo_gem->wc_virtual, bo->size);
+/*
+ * Copies to a mapping with non-temporal stores, which don't pull the
+ * destination into the cache. The stores are only ordered with later
+ * ones by stream_fence().
+ */
+static void
+stream_copy(void *dst, const void *src, unsigned long size)
+{
+#ifdef __SSE2__
+	unsigned long head = -(uintptr_t)dst & 15;
+
+	if (size >= head + 64) {
+		uint8_t *d = (uint8_t *)dst + head;
+		const uint8_t *s = (const uint8_t *)src + head;
+
+		memcpy(dst, src, head);
+		size -= head;
+
+		for (; size >= 64; size -= 64, d += 64, s += 64) {
+			__m128i a = _mm_loadu_si128((const __m128i *)s);
+			__m128i b = _mm_loadu_si128((const __m128i *)s + 1);
+			__m128i c = _mm_loadu_si128((const __m128i *)s + 2);
+			__m128i e = _mm_loadu_si128((const __m128i *)s + 3);
+
+			_mm_stream_si128((__m128i *)d, a);
+			_mm_stream_si128((__m128i *)d + 1, b);
+			_mm_stream_si128((__m128i *)d + 2, c);
+			_mm_stream_si128((__m128i *)d + 3, e);
+		}
 
-	if (bo_gem->gtt_virtual)
-		VALGRIND_MAKE_MEM_NOACCESS(bo_gem->gtt_virtual, bo->size);
+		dst = d;
+		src = s;
+	}
 #endif
+	memcpy(dst, src, size);
 }
 
-/** Frees all cached buffers significantly older than @time. */
 static void
-drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
+stream_fence(void)
 {
-	int i;
+#ifdef __SSE2__
+	_mm_sfence();
+#else
+	__sync_synchronize();
+#endif
+}
 
-	if (bufmgr_gem->time == time)
-		return;
+/**
+ * Moves the buffer to the WC domain, unless it is there already. The WC map
+ * must not be written when this fails, the GPU may still be using the
+ * buffer.
+ */
+static int
+drm_intel_gem_bo_upload_domain(drm_intel_bufmgr_gem *bufmgr_gem,
+			       drm_intel_bo_gem *bo_gem)
+{
+	struct drm_i915_gem_set_domain set_domain;
+	int ret;
+
+	if (bo_gem->wc_write_domain)
+		return 0;
+
+	memclear(set_domain);
+	set_domain.handle = bo_gem->gem_handle;
+	set_domain.read_domains = I915_GEM_DOMAIN_WC;
+	set_domain.write_domain = I915_GEM_DOMAIN_WC;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_SET_DOMAIN,
+		       &set_domain);
+	if (ret != 0) {
+		ret = -errno;
+		DBG("%s:%d: Error setting to WC domain %d: %s\n",
+		    __FILE__, __LINE__, bo_gem->gem_handle, strerror(-ret));
+		return ret;
+	}
+
+	bo_gem->wc_write_domain = true;
+	bufmgr_gem->upload_stats.domain_changes++;
+	return 0;
+}
+
+static int
+drm_intel_gem_bo_pwrite(drm_intel_bufmgr_gem *bufmgr_gem,
+			drm_intel_bo_gem *bo_gem, unsigned long offset,
+			unsigned long size, const void *data)
+{
+	struct drm_i915_gem_pwrite pwrite;
+
+	memclear(pwrite);
+	pwrite.handle = bo_gem->gem_handle;
+	pwrite.offset = offset;
+	pwrite.size = size;
+	pwrite.data_ptr = (uint64_t) (uintptr_t) data;
+	if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_PWRITE, &pwrite))
+		return -errno;
+	return 0;
+}
 
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
+/**
+ * Writes the staged uploads to their buffers, with one domain change per
+ * buffer. Buffers that can't be moved to the WC domain get their uploads
+ * through pwrite, which waits for the GPU. Returns the first error of
+ * those. Called with the bufmgr lock held.
+ */
+static int
+drm_intel_gem_upload_flush(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	int i, err, ret = 0;
 
-		while (!DRMLISTEMPTY(&bucket->head)) {
-			drm_intel_bo_gem *bo_gem;
+	if (!bufmgr_gem->upload_count)
+		return 0;
 
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			if (time - bo_gem->free_time <= 1)
-				break;
+	for (i = 0; i < bufmgr_gem->upload_count; i++) {
+		struct drm_intel_gem_upload *upload = &bufmgr_gem->uploads[i];
+		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) upload->bo;
+		void *data = bufmgr_gem->upload_staging + upload->staged;
 
-			DRMLISTDEL(&bo_gem->head);
+		/* Dropped when the buffer was released */
+		if (!bo_gem)
+			continue;
 
-			drm_intel_gem_bo_free(&bo_gem->bo);
+		bo_gem->upload_pending = false;
+		if (drm_intel_gem_bo_upload_domain(bufmgr_gem, bo_gem) == 0) {
+			stream_copy((uint8_t *)bo_gem->wc_virtual + upload->offset,
+				    data, upload->size);
+			continue;
 		}
+
+		err = drm_intel_gem_bo_pwrite(bufmgr_gem, bo_gem,
+					      upload->offset, upload->size,
+					      data);
+		if (err && !ret)
+			ret = err;
+	}
+	stream_fence();
+
+	bufmgr_gem->upload_count = 0;
+	bufmgr_gem->upload_staging_used = 0;
+	bufmgr_gem->upload_stats.flushes++;
+	return ret;
+}
+
+/** Makes the staged uploads to the buffer visible in it. */
+static int
+drm_intel_gem_bo_flush_uploads(drm_intel_bo *bo)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+
+	if (!bo_gem->upload_pending)
+		return 0;
+	return drm_intel_gem_upload_flush((drm_intel_bufmgr_gem *) bo->bufmgr);
+}
+
+static int
+drm_intel_gem_bo_flush_uploads_unlocked(drm_intel_bo *bo)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	int ret = 0;
+
+	if (bo_gem->upload_pending) {
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		ret = drm_intel_gem_bo_flush_uploads(bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
 	}
+	return ret;
+}
+
+static void
+drm_intel_gem_bo_mark_mmaps_incoherent(drm_intel_bo *bo)
+{
+#if HAVE_VALGRIND
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+
+	if (bo_gem->mem_virtual)
+		VALGRIND_MAKE_MEM_NOACCESS(bo_gem->mem_virtual, bo->size);
+
+	if (bo_gem->wc_virtual)
+		VALGRIND_MAKE_MEM_NOACCESS(bo_gem->wc_virtual, bo->size);
 
-	bufmgr_gem->time = time;
+	if (bo_gem->gtt_virtual)
+		VALGRIND_MAKE_MEM_NOACCESS(bo_gem->gtt_virtual, bo->size);
+#endif
 }
 
 static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
@@ -1305,7 +1581,6 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	struct drm_intel_gem_bo_bucket *bucket;
 	int i;
 
 	/* Unreference all the target buffers */
@@ -1324,6 +1599,16 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->softpin_target_count = 0;
 
+	/* Nobody can see the staged uploads to the buffer anymore */
+	if (bo_gem->upload_pending) {
+		for (i = 0; i < bufmgr_gem->upload_count; i++) {
+			if (bufmgr_gem->uploads[i].bo == bo)
+				bufmgr_gem->uploads[i].bo = NULL;
+		}
+		bo_gem->upload_pending = false;
+	}
+	bo_gem->wc_write_domain = false;
+
 	DBG("bo_unreference final: %d (%s)\n",
 	    bo_gem->gem_handle, bo_gem->name);
 
@@ -1350,17 +1635,13 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 	}
 
-	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, bo->size);
 	/* Put the buffer into our internal cache for reuse if we can. */
-	if (bufmgr_gem->bo_reuse && bo_gem->reusable && bucket != NULL &&
-	    drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
-					      I915_MADV_DONTNEED)) {
-		bo_gem->free_time = time;
-
+	bo_gem->cache_entry.size = bo->size;
+	if (bufmgr_gem->bo_reuse && bo_gem->reusable &&
+	    drmBOCacheRelease(bufmgr_gem->bo_cache, &bo_gem->cache_entry,
+			      time) == 0) {
 		bo_gem->name = NULL;
 		bo_gem->validate_index = -1;
-
-		DRMLISTADDTAIL(&bo_gem->head, &bucket->head);
 	} else {
 		drm_intel_gem_bo_free(bo);
 	}
@@ -1395,7 +1676,7 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
 
 	if (atomic_dec_and_test(&bo_gem->refcount)) {
 		drm_intel_gem_bo_unreference_final(bo, time.tv_sec);
-		drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time.tv_sec);
+		drmBOCacheExpire(bufmgr_gem->bo_cache, time.tv_sec);
 	}
 
 	pthread_mutex_unlock(&bufmgr_gem->lock);
@@ -1416,6 +1697,14 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
 
+	if (write_enable)
+		drm_intel_gem_bo_mark_dirty(bo_gem, 0, bo->size);
+	ret = drm_intel_gem_bo_flush_uploads(bo);
+	if (ret != 0) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return ret;
+	}
+
 	if (bo_gem->map_count++ == 0)
 		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
 
@@ -1463,6 +1752,7 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 		    __FILE__, __LINE__, bo_gem->gem_handle,
 		    strerror(errno));
 	}
+	bo_gem->wc_write_domain = false;
 
 	if (write_enable)
 		bo_gem->mapped_cpu_write = true;
@@ -1484,6 +1774,11 @@ map_gtt(drm_intel_bo *bo)
 	if (bo_gem->is_userptr)
 		return -EINVAL;
 
+	drm_intel_gem_bo_mark_dirty(bo_gem, 0, bo->size);
+	ret = drm_intel_gem_bo_flush_uploads(bo);
+	if (ret != 0)
+		return ret;
+
 	if (bo_gem->map_count++ == 0)
 		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
 
@@ -1537,6 +1832,42 @@ map_gtt(drm_intel_bo *bo)
 	return 0;
 }
 
+static void *
+map_wc(drm_intel_bo *bo)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+
+	if (!bo_gem->wc_virtual) {
+		struct drm_i915_gem_mmap mmap_arg;
+
+		if (bo_gem->map_count++ == 0)
+			drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
+
+		DBG("bo_map: %d (%s), map_count=%d\n",
+		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
+
+		memclear(mmap_arg);
+		mmap_arg.handle = bo_gem->gem_handle;
+		mmap_arg.size = bo->size;
+		mmap_arg.flags = I915_MMAP_WC;
+		if (drmIoctl(bufmgr_gem->fd,
+			     DRM_IOCTL_I915_GEM_MMAP,
+			     &mmap_arg)) {
+			DBG("%s:%d: Error mapping buffer %d (%s): %s .\n",
+			    __FILE__, __LINE__, bo_gem->gem_handle,
+			    bo_gem->name, strerror(errno));
+			if (--bo_gem->map_count == 0)
+				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
+		} else {
+			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
+			bo_gem->wc_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+		}
+	}
+
+	return bo_gem->wc_virtual;
+}
+
 drm_public int
 drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
 {
@@ -1574,6 +1905,7 @@ drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
 		    __FILE__, __LINE__, bo_gem->gem_handle,
 		    strerror(errno));
 	}
+	bo_gem->wc_write_domain = false;
 
 	drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 	VG(VALGRIND_MAKE_MEM_DEFINED(bo_gem->gtt_virtual, bo->size));
@@ -1714,11 +2046,14 @@ static void set_domain(drm_intel_bo *bo, uint32_t read, uint32_t write)
 	arg.write_domain = write;
 	if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_SET_DOMAIN, &arg))
 		assert(false);
+	bo_gem->wc_write_domain = false;
 }
 
 static int mmap_write(drm_intel_bo *bo, unsigned long offset,
 		      unsigned long length, const void *buf)
 {
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	bool mapped_persistently = bo_gem->mapped_persistently;
 	void *map = NULL;
 
 	if (!length)
@@ -1738,6 +2073,9 @@ static int mmap_write(drm_intel_bo *bo, unsigned long offset,
 	assert(map);
 	memcpy((char *)map + offset, buf, length);
 	drm_intel_gem_bo_unmap(bo);
+
+	/* The mapping isn't handed out, the caller marks what it wrote */
+	bo_gem->mapped_persistently = mapped_persistently;
 	return 0;
 }
 
@@ -1745,6 +2083,8 @@ static int mmap_read(drm_intel_bo *bo, unsigned long offset,
 		      unsigned long length, void *buf)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	bool mapped_persistently = bo_gem->mapped_persistently;
 	void *map = NULL;
 
 	if (!length)
@@ -1764,23 +2104,95 @@ static int mmap_read(drm_intel_bo *bo, unsigned long offset,
 	assert(map);
 	memcpy(buf, (char *)map + offset, length);
 	drm_intel_gem_bo_unmap(bo);
+
+	bo_gem->mapped_persistently = mapped_persistently;
 	return 0;
 }
 
+/**
+ * Streaming upload of drm_intel_bo_subdata() data through the WC map of the
+ * buffer. Buffers the GPU may still use since their last domain change get
+ * small writes staged, so the domain change and its wait happen once, when
+ * the buffer is used next. Called with the bufmgr lock held.
+ */
 static int
-drm_intel_gem_bo_subdata(drm_intel_bo *bo, unsigned long offset,
-			 unsigned long size, const void *data)
+drm_intel_gem_bo_upload(drm_intel_bo *bo, unsigned long offset,
+			unsigned long size, const void *data)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	struct drm_i915_gem_pwrite pwrite;
+	struct drm_intel_gem_upload *upload;
+	unsigned long staged_size = ALIGN(size, 16);
 	int ret;
 
-	if (bo_gem->is_userptr)
+	if (offset > bo->size || size > bo->size - offset)
 		return -EINVAL;
 
-	memclear(pwrite);
-	pwrite.handle = bo_gem->gem_handle;
+	if (!map_wc(bo))
+		return -EOPNOTSUPP;
+
+	if (bo_gem->wc_write_domain ||
+	    staged_size > bufmgr_gem->upload_staging_size / 4) {
+		/* Straight to the buffer, after what was staged for it */
+		ret = drm_intel_gem_bo_flush_uploads(bo);
+		if (ret)
+			return ret;
+		/* pwrite does the waiting when the domain can't change */
+		if (drm_intel_gem_bo_upload_domain(bufmgr_gem, bo_gem))
+			return -EOPNOTSUPP;
+		stream_copy((uint8_t *)bo_gem->wc_virtual + offset, data, size);
+		stream_fence();
+		bufmgr_gem->upload_stats.direct++;
+	} else {
+		if (bufmgr_gem->upload_staging_used + staged_size >
+		    bufmgr_gem->upload_staging_size ||
+		    bufmgr_gem->upload_count == bufmgr_gem->upload_max) {
+			ret = drm_intel_gem_upload_flush(bufmgr_gem);
+			if (ret)
+				return ret;
+		}
+
+		upload = &bufmgr_gem->uploads[bufmgr_gem->upload_count++];
+		upload->bo = bo;
+		upload->offset = offset;
+		upload->size = size;
+		upload->staged = bufmgr_gem->upload_staging_used;
+		memcpy(bufmgr_gem->upload_staging + upload->staged, data, size);
+		bufmgr_gem->upload_staging_used += staged_size;
+
+		bo_gem->upload_pending = true;
+		bufmgr_gem->upload_stats.staged++;
+	}
+	bufmgr_gem->upload_stats.bytes += size;
+
+	return 0;
+}
+
+static int
+drm_intel_gem_bo_subdata(drm_intel_bo *bo, unsigned long offset,
+			 unsigned long size, const void *data)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	struct drm_i915_gem_pwrite pwrite;
+	int ret;
+
+	if (bo_gem->is_userptr)
+		return -EINVAL;
+
+	drm_intel_gem_bo_mark_dirty(bo_gem, offset, size);
+
+	/* Shared buffers may change domains behind our back */
+	if (bufmgr_gem->upload_staging && bo_gem->reusable) {
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		ret = drm_intel_gem_bo_upload(bo, offset, size, data);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		if (ret != -EOPNOTSUPP)
+			return ret;
+	}
+
+	memclear(pwrite);
+	pwrite.handle = bo_gem->gem_handle;
 	pwrite.offset = offset;
 	pwrite.size = size;
 	pwrite.data_ptr = (uint64_t) (uintptr_t) data;
@@ -1840,6 +2252,11 @@ drm_intel_gem_bo_get_subdata(drm_intel_bo *bo, unsigned long offset,
 	if (bo_gem->is_userptr)
 		return -EINVAL;
 
+	ret = drm_intel_gem_bo_flush_uploads_unlocked(bo);
+	if (ret != 0)
+		return ret;
+	bo_gem->wc_write_domain = false;
+
 	memclear(pread);
 	pread.handle = bo_gem->gem_handle;
 	pread.offset = offset;
@@ -1942,6 +2359,8 @@ drm_intel_gem_bo_start_gtt_access(drm_intel_bo *bo, int write_enable)
 	struct drm_i915_gem_set_domain set_domain;
 	int ret;
 
+	drm_intel_gem_bo_flush_uploads_unlocked(bo);
+
 	memclear(set_domain);
 	set_domain.handle = bo_gem->gem_handle;
 	set_domain.read_domains = I915_GEM_DOMAIN_GTT;
@@ -1955,33 +2374,34 @@ drm_intel_gem_bo_start_gtt_access(drm_intel_bo *bo, int write_enable)
 		    set_domain.read_domains, set_domain.write_domain,
 		    strerror(errno));
 	}
+	bo_gem->wc_write_domain = false;
 }
 
 static void
 drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
-	int i, ret;
+	int ret;
 
 	free(bufmgr_gem->exec2_objects);
 	free(bufmgr_gem->exec_bos);
 
+	if (bufmgr_gem->aub)
+		intel_aub_writer_destroy(bufmgr_gem->aub);
+	free(bufmgr_gem->aub_filename);
+
+	free(bufmgr_gem->upload_staging);
+	free(bufmgr_gem->uploads);
+
 	pthread_mutex_destroy(&bufmgr_gem->lock);
 
 	/* Free any cached buffer objects we were going to reuse */
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		drm_intel_bo_gem *bo_gem;
-
-		while (!DRMLISTEMPTY(&bucket->head)) {
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			DRMLISTDEL(&bo_gem->head);
+	drmBOCacheDestroy(bufmgr_gem->bo_cache);
 
-			drm_intel_gem_bo_free(&bo_gem->bo);
-		}
-	}
+	if (bufmgr_gem->address_heap)
+		mmDestroy(bufmgr_gem->address_heap);
+	if (bufmgr_gem->aub_heap)
+		mmDestroy(bufmgr_gem->aub_heap);
 
 	/* Release userptr bo kept hanging around for optimisation. */
 	if (bufmgr_gem->userptr_active.ptr) {
@@ -2154,8 +2574,13 @@ drm_intel_gem_bo_emit_reloc_fence(drm_intel_bo *bo, uint32_t offset,
 				  uint32_t target_offset,
 				  uint32_t read_domains, uint32_t write_domain)
 {
-	return do_bo_emit_reloc(bo, offset, target_bo, target_offset,
-				read_domains, write_domain, true);
+	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *)target_bo;
+
+	if (target_bo_gem->kflags & EXEC_OBJECT_PINNED)
+		return drm_intel_gem_bo_add_softpin_target(bo, target_bo);
+	else
+		return do_bo_emit_reloc(bo, offset, target_bo, target_offset,
+					read_domains, write_domain, true);
 }
 
 drm_public int
@@ -2220,15 +2645,23 @@ drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
  * Walk the tree of relocations rooted at BO and accumulate the list of
  * validations to be performed and update the relocation buffers with
  * index values into the validation list.
+ *
+ * Buffers already reached in this walk (stamped with the current
+ * visit_generation) had their subtree added, and aren't walked again.
  */
-static void
+static int
 drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *)bo;
-	int i;
+	int i, ret;
 
 	if (bo_gem->relocs == NULL && bo_gem->softpin_target == NULL)
-		return;
+		return 0;
+
+	if (bo_gem->visit_generation == bufmgr_gem->visit_generation)
+		return 0;
+	bo_gem->visit_generation = bufmgr_gem->visit_generation;
 
 	for (i = 0; i < bo_gem->reloc_count; i++) {
 		drm_intel_bo *target_bo = bo_gem->reloc_target_info[i].bo;
@@ -2240,13 +2673,17 @@ drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 
 		/* Continue walking the tree depth-first. */
-		drm_intel_gem_bo_process_reloc2(target_bo);
+		ret = drm_intel_gem_bo_process_reloc2(target_bo);
+		if (ret)
+			return ret;
 
 		need_fence = (bo_gem->reloc_target_info[i].flags &
 			      DRM_INTEL_RELOC_FENCE);
 
 		/* Add the target to the validate list */
-		drm_intel_add_validate_buffer2(target_bo, need_fence);
+		ret = drm_intel_add_validate_buffer2(target_bo, need_fence);
+		if (ret)
+			return ret;
 	}
 
 	for (i = 0; i < bo_gem->softpin_target_count; i++) {
@@ -2256,9 +2693,15 @@ drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
 			continue;
 
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
-		drm_intel_gem_bo_process_reloc2(target_bo);
-		drm_intel_add_validate_buffer2(target_bo, false);
+		ret = drm_intel_gem_bo_process_reloc2(target_bo);
+		if (ret)
+			return ret;
+		ret = drm_intel_add_validate_buffer2(target_bo, false);
+		if (ret)
+			return ret;
 	}
+
+	return 0;
 }
 
 static void
@@ -2288,12 +2731,221 @@ drm_intel_update_buffer_offsets2 (drm_intel_bufmgr_gem *bufmgr_gem)
 	}
 }
 
+static uint64_t
+drm_intel_gem_bo_aub_address(drm_intel_bufmgr_gem *bufmgr_gem,
+			     drm_intel_bo *bo)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	unsigned long pages = (bo->size + 4095) / 4096;
+
+	/*
+	 * Buffers get an address of their own in the trace, kept for their
+	 * lifetime, so their relocations resolve the same way in every
+	 * batch. Freed buffers give theirs back. 0 if the trace is full.
+	 */
+	if (!bo_gem->aub_block && pages <= INT_MAX) {
+		bo_gem->aub_block = mmAllocMem(bufmgr_gem->aub_heap, pages,
+					       0, 0);
+		if (!bo_gem->aub_block)
+			DBG("No AUB address for %d (%s)\n",
+			    bo_gem->gem_handle, bo_gem->name);
+	}
+
+	return bo_gem->aub_block ? (uint64_t)bo_gem->aub_block->ofs * 4096 : 0;
+}
+
+static void
+drm_intel_gem_bo_aub_read(drm_intel_bufmgr_gem *bufmgr_gem,
+			  drm_intel_bo *bo, unsigned long offset,
+			  unsigned long size, void *data)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	struct drm_i915_gem_pread pread;
+
+	if (bo_gem->is_userptr) {
+		memcpy(data, (char *)bo_gem->user_virtual + offset, size);
+		return;
+	}
+
+	if (bo_gem->mem_virtual && bufmgr_gem->has_llc) {
+		memcpy(data, (char *)bo_gem->mem_virtual + offset, size);
+		return;
+	}
+
+	/* Let the kernel copy straight into the trace file */
+	memclear(pread);
+	pread.handle = bo_gem->gem_handle;
+	pread.offset = offset;
+	pread.size = size;
+	pread.data_ptr = (uint64_t) (uintptr_t) data;
+	if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_PREAD, &pread))
+		memset(data, 0, size);
+}
+
+/**
+ * Writes what changed in the buffer since it was last dumped to the AUB
+ * trace, with the relocations pointing at the AUB addresses of the targets.
+ */
+static void
+drm_intel_gem_bo_aub_write(drm_intel_bufmgr_gem *bufmgr_gem,
+			   drm_intel_bo *bo, uint32_t type)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	uint64_t address = drm_intel_gem_bo_aub_address(bufmgr_gem, bo);
+	unsigned long start, end, offset, size;
+	bool whole;
+	int i;
+
+	if (!address)
+		return;
+
+	/*
+	 * Buffers that may be written behind our back go in whole: those
+	 * still mapped, shared with other processes, or living in user
+	 * memory.
+	 */
+	whole = bo_gem->aub_generation != bufmgr_gem->aub_generation ||
+		bo_gem->map_count || bo_gem->mapped_persistently ||
+		bo_gem->global_name || bo_gem->is_userptr;
+	if (whole) {
+		start = 0;
+		end = bo->size;
+	} else {
+		start = bo_gem->aub_dirty_start & ~3ul;
+		end = MIN2(bo_gem->aub_dirty_end, bo->size);
+	}
+
+	for (offset = start; offset < end; offset += size) {
+		unsigned long copy;
+		uint8_t *data;
+
+		size = MIN2(ALIGN(end - offset, 4), INTEL_AUB_MAX_BLOCK);
+		data = intel_aub_writer_data(bufmgr_gem->aub, type, 0,
+					     address + offset, size);
+		if (!data)
+			return;
+
+		copy = MIN2(size, bo->size - offset);
+		drm_intel_gem_bo_aub_read(bufmgr_gem, bo, offset, copy, data);
+		memset(data + copy, 0, size - copy);
+
+		for (i = 0; i < bo_gem->reloc_count; i++) {
+			struct drm_i915_gem_relocation_entry *reloc =
+				&bo_gem->relocs[i];
+			uint64_t value;
+
+			if (reloc->offset < offset ||
+			    reloc->offset + 4 > offset + size)
+				continue;
+
+			value = drm_intel_gem_bo_aub_address(bufmgr_gem,
+					bo_gem->reloc_target_info[i].bo) +
+				reloc->delta;
+			memcpy(data + reloc->offset - offset, &value,
+			       bufmgr_gem->gen >= 8 &&
+			       reloc->offset + 8 <= offset + size ? 8 : 4);
+		}
+	}
+
+	bo_gem->aub_generation = bufmgr_gem->aub_generation;
+	bo_gem->aub_dirty_start = bo->size;
+	bo_gem->aub_dirty_end = 0;
+}
+
+static void
+drm_intel_gem_aub_exec(drm_intel_bufmgr_gem *bufmgr_gem, drm_intel_bo *batch,
+		       unsigned int flags)
+{
+	uint64_t address;
+	uint32_t ring;
+	int i;
+
+	/*
+	 * The batches hold the addresses of softpinned buffers, which the
+	 * trace can't give them.
+	 */
+	for (i = 0; i < bufmgr_gem->exec_count; i++) {
+		drm_intel_bo_gem *bo_gem =
+			(drm_intel_bo_gem *) bufmgr_gem->exec_bos[i];
+
+		if (bo_gem->kflags & EXEC_OBJECT_PINNED) {
+			if (!bufmgr_gem->aub_skipped_pinned)
+				fprintf(stderr, "Leaving execs with softpinned "
+					"buffers out of the AUB trace\n");
+			bufmgr_gem->aub_skipped_pinned = true;
+			return;
+		}
+	}
+
+	for (i = 0; i < bufmgr_gem->exec_count; i++) {
+		drm_intel_bo *bo = bufmgr_gem->exec_bos[i];
+
+		drm_intel_gem_bo_aub_write(bufmgr_gem, bo,
+					   bo == batch ? AUB_TRACE_TYPE_BATCH :
+					   AUB_TRACE_TYPE_NOTYPE);
+	}
+
+	switch (flags & I915_EXEC_RING_MASK) {
+	case I915_EXEC_BSD:
+		ring = AUB_TRACE_TYPE_RING_PRB1;
+		break;
+	case I915_EXEC_BLT:
+		ring = AUB_TRACE_TYPE_RING_PRB2;
+		break;
+	default:
+		ring = AUB_TRACE_TYPE_RING_PRB0;
+		break;
+	}
+
+	address = drm_intel_gem_bo_aub_address(bufmgr_gem, batch);
+	if (address)
+		intel_aub_writer_exec(bufmgr_gem->aub, ring, address);
+}
+
 drm_public void
 drm_intel_gem_bo_aub_dump_bmp(drm_intel_bo *bo,
 			      int x1, int y1, int width, int height,
 			      enum aub_dump_bmp_format format,
 			      int pitch, int offset)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	uint32_t tiling = 0;
+	uint64_t address;
+	int cpp;
+
+	if (!bufmgr_gem->aub)
+		return;
+
+	switch (format) {
+	case AUB_DUMP_BMP_FORMAT_8BIT:
+		cpp = 1;
+		break;
+	case AUB_DUMP_BMP_FORMAT_ARGB_4444:
+		cpp = 2;
+		break;
+	case AUB_DUMP_BMP_FORMAT_ARGB_0888:
+	case AUB_DUMP_BMP_FORMAT_ARGB_8888:
+		cpp = 4;
+		break;
+	default:
+		fprintf(stderr, "Unknown AUB dump format %d\n", format);
+		return;
+	}
+
+	if (bo_gem->tiling_mode != I915_TILING_NONE)
+		tiling |= 1 << 2;
+	if (bo_gem->tiling_mode == I915_TILING_Y)
+		tiling |= 1 << 3;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	address = bufmgr_gem->aub ?
+		  drm_intel_gem_bo_aub_address(bufmgr_gem, bo) : 0;
+	if (address)
+		intel_aub_writer_bmp(bufmgr_gem->aub, x1, y1, width, height,
+				     format, cpp, pitch, address + offset,
+				     tiling);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 }
 
 static int
@@ -2331,13 +2983,21 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	}
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
+	ret = drm_intel_gem_upload_flush(bufmgr_gem);
+	if (ret != 0)
+		goto skip_execution;
+
 	/* Update indices and set up the validate list. */
-	drm_intel_gem_bo_process_reloc2(bo);
+	bufmgr_gem->visit_generation++;
+	ret = drm_intel_gem_bo_process_reloc2(bo);
 
 	/* Add the batch buffer to the validation list.  There are no relocations
 	 * pointing to it.
 	 */
-	drm_intel_add_validate_buffer2(bo, 0);
+	if (ret == 0)
+		ret = drm_intel_add_validate_buffer2(bo, 0);
+	if (ret != 0)
+		goto skip_execution;
 
 	memclear(execbuf);
 	execbuf.buffers_ptr = (uintptr_t)bufmgr_gem->exec2_objects;
@@ -2349,6 +3009,8 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	execbuf.DR1 = 0;
 	execbuf.DR4 = DR4;
 	execbuf.flags = flags;
+	if (bufmgr_gem->address_heap)
+		execbuf.flags |= I915_EXEC_NO_RELOC;
 	if (ctx == NULL)
 		i915_execbuffer2_set_context_id(execbuf, 0);
 	else
@@ -2363,6 +3025,9 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 		execbuf.flags |= I915_EXEC_FENCE_OUT;
 	}
 
+	if (bufmgr_gem->aub)
+		drm_intel_gem_aub_exec(bufmgr_gem, bo, flags);
+
 	if (bufmgr_gem->no_exec)
 		goto skip_execution;
 
@@ -2394,6 +3059,7 @@ skip_execution:
 		drm_intel_bo_gem *bo_gem = to_bo_gem(bufmgr_gem->exec_bos[i]);
 
 		bo_gem->idle = false;
+		bo_gem->wc_write_domain = false;
 
 		/* Disconnect the buffer from the validate list */
 		bo_gem->validate_index = -1;
@@ -2564,6 +3230,10 @@ drm_intel_gem_bo_set_softpin_offset(drm_intel_bo *bo, uint64_t offset)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
+	/* The bufmgr placed it already */
+	if (bo_gem->address_block)
+		return -EBUSY;
+
 	bo->offset64 = offset;
 	bo->offset = offset;
 	bo_gem->kflags |= EXEC_OBJECT_PINNED;
@@ -2636,6 +3306,9 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 	if (ret)
 		goto err;
 
+	if (drm_intel_gem_bo_assign_address(bufmgr_gem, bo_gem))
+		goto err;
+
 	/* XXX stride is unknown */
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
 
@@ -2654,6 +3327,12 @@ drm_intel_bo_gem_export_to_prime(drm_intel_bo *bo, int *prime_fd)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	int ret;
+
+	/* Other processes don't see staged uploads */
+	ret = drm_intel_gem_bo_flush_uploads_unlocked(bo);
+	if (ret != 0)
+		return ret;
 
 	if (drmPrimeHandleToFD(bufmgr_gem->fd, bo_gem->gem_handle,
 			       DRM_CLOEXEC | DRM_RDWR, prime_fd) != 0)
@@ -2669,6 +3348,11 @@ drm_intel_gem_bo_flink(drm_intel_bo *bo, uint32_t * name)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	int ret;
+
+	ret = drm_intel_gem_bo_flush_uploads_unlocked(bo);
+	if (ret != 0)
+		return ret;
 
 	if (!bo_gem->global_name) {
 		struct drm_gem_flink flink;
@@ -2709,6 +3393,122 @@ drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr)
 	bufmgr_gem->bo_reuse = true;
 }
 
+/**
+ * Makes the bufmgr assign every buffer a fixed GPU address and softpin
+ * it, so no relocation is ever passed to the kernel.
+ *
+ * Addresses come from the low 8TB of the 48-bit PPGTT, the 2^31 pages
+ * mm.c can manage, and buffers keep theirs for their lifetime.
+ * drm_intel_bo_emit_reloc() only records the target for the execbuffer,
+ * the caller writes target_bo->offset64 + target_offset itself.
+ * drm_intel_bo_set_softpin_offset() is refused.
+ *
+ * Has to be called before the first buffer is created, and not while
+ * dumping an AUB trace. Returns -ENODEV without softpin or full 48-bit
+ * PPGTT support.
+ */
+drm_public int
+drm_intel_bufmgr_gem_enable_softpin(drm_intel_bufmgr *bufmgr)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	int ret = 0;
+
+	if (bufmgr_gem->bufmgr.bo_set_softpin_offset == NULL ||
+	    bufmgr_gem->bufmgr.bo_use_48b_address_range == NULL)
+		return -ENODEV;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (bufmgr_gem->address_heap == NULL) {
+		if (bufmgr_gem->handle_table != NULL || bufmgr_gem->aub) {
+			ret = -EBUSY;
+		} else {
+			/* Pages from 4KB up to 8TB, leaving out the NULL page */
+			bufmgr_gem->address_heap = mmInit(1, INT_MAX - 1);
+			if (bufmgr_gem->address_heap == NULL)
+				ret = -ENOMEM;
+		}
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ret;
+}
+
+/**
+ * Makes drm_intel_bo_subdata() write through persistent WC maps of the
+ * buffers instead of pwrite.
+ *
+ * Writes to buffers that were not written since the GPU last used them
+ * are copied to a staging buffer of \p staging_size bytes, and written out
+ * with a single domain change per buffer when one of them is executed,
+ * mapped or read back, or when the staging buffer is full. Later writes,
+ * and those larger than a quarter of the staging buffer, go straight to
+ * the buffer. Both use non-temporal stores where the CPU has them.
+ *
+ * A \p staging_size of zero goes back to pwrite. Returns -ENODEV if the
+ * kernel can't map buffers write-combined.
+ */
+drm_public int
+drm_intel_bufmgr_gem_enable_streaming_uploads(drm_intel_bufmgr *bufmgr,
+					      unsigned long staging_size)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	struct drm_i915_getparam gp;
+	int value = 0, ret = 0;
+
+	memclear(gp);
+	gp.param = I915_PARAM_MMAP_VERSION;
+	gp.value = &value;
+	if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp) ||
+	    value < 1)
+		return -ENODEV;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	ret = drm_intel_gem_upload_flush(bufmgr_gem);
+	if (ret != 0) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return ret;
+	}
+	free(bufmgr_gem->upload_staging);
+	free(bufmgr_gem->uploads);
+	bufmgr_gem->upload_staging = NULL;
+	bufmgr_gem->uploads = NULL;
+	bufmgr_gem->upload_staging_size = 0;
+
+	if (staging_size) {
+		staging_size = ALIGN(staging_size, 4096);
+		bufmgr_gem->upload_max = MAX2(staging_size / 256, 64);
+		bufmgr_gem->upload_staging = malloc(staging_size);
+		bufmgr_gem->uploads = calloc(bufmgr_gem->upload_max,
+					     sizeof(*bufmgr_gem->uploads));
+		if (bufmgr_gem->upload_staging && bufmgr_gem->uploads) {
+			bufmgr_gem->upload_staging_size = staging_size;
+		} else {
+			free(bufmgr_gem->upload_staging);
+			free(bufmgr_gem->uploads);
+			bufmgr_gem->upload_staging = NULL;
+			bufmgr_gem->uploads = NULL;
+			ret = -ENOMEM;
+		}
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ret;
+}
+
+/**
+ * Returns the numbers of the streaming upload path.
+ */
+drm_public void
+drm_intel_bufmgr_gem_get_upload_stats(drm_intel_bufmgr *bufmgr,
+				      drm_intel_upload_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	*stats = bufmgr_gem->upload_stats;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
 /**
  * Disables implicit synchronisation before executing the bo
  *
@@ -2971,9 +3771,15 @@ drm_intel_gem_bo_is_reusable(drm_intel_bo *bo)
 static int
 _drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	int i;
 
+	/* The subtree of a buffer reached before doesn't have it */
+	if (bo_gem->visit_generation == bufmgr_gem->visit_generation)
+		return 0;
+	bo_gem->visit_generation = bufmgr_gem->visit_generation;
+
 	for (i = 0; i < bo_gem->reloc_count; i++) {
 		if (bo_gem->reloc_target_info[i].bo == target_bo)
 			return 1;
@@ -2998,52 +3804,75 @@ _drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 static int
 drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem;
 	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
+	int ret;
 
 	if (bo == NULL || target_bo == NULL)
 		return 0;
-	if (target_bo_gem->used_as_reloc_target)
-		return _drm_intel_gem_bo_references(bo, target_bo);
-	return 0;
-}
-
-static void
-add_bucket(drm_intel_bufmgr_gem *bufmgr_gem, int size)
-{
-	unsigned int i = bufmgr_gem->num_buckets;
+	/* Softpin targets aren't marked */
+	if (!target_bo_gem->used_as_reloc_target &&
+	    !(target_bo_gem->kflags & EXEC_OBJECT_PINNED))
+		return 0;
 
-	assert(i < ARRAY_SIZE(bufmgr_gem->cache_bucket));
+	bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->visit_generation++;
+	ret = _drm_intel_gem_bo_references(bo, target_bo);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 
-	DRMINITLISTHEAD(&bufmgr_gem->cache_bucket[i].head);
-	bufmgr_gem->cache_bucket[i].size = size;
-	bufmgr_gem->num_buckets++;
+	return ret;
 }
 
-static void
-init_cache_buckets(drm_intel_bufmgr_gem *bufmgr_gem)
+/**
+ * Returns the number of buckets in the BO cache, and fills in the numbers
+ * of up to @count of them, smallest first.
+ */
+drm_public int
+drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+				     drm_intel_bo_cache_stats *stats,
+				     int count)
 {
-	unsigned long size, cache_max_size = 64 * 1024 * 1024;
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	drmBOCacheStats *buckets = NULL;
+	int i, num_buckets;
 
-	/* OK, so power of two buckets was too wasteful of memory.
-	 * Give 3 other sizes between each power of two, to hopefully
-	 * cover things accurately enough.  (The alternative is
-	 * probably to just go for exact matching of sizes, and assume
-	 * that for things like composited window resize the tiled
-	 * width/height alignment and rounding of sizes to pages will
-	 * get us useful cache hit rates anyway)
-	 */
-	add_bucket(bufmgr_gem, 4096);
-	add_bucket(bufmgr_gem, 4096 * 2);
-	add_bucket(bufmgr_gem, 4096 * 3);
+	if (count > 0) {
+		buckets = calloc(count, sizeof(*buckets));
+		if (!buckets)
+			return -ENOMEM;
+	}
 
-	/* Initialize the linked lists for BO reuse cache. */
-	for (size = 4 * 4096; size <= cache_max_size; size *= 2) {
-		add_bucket(bufmgr_gem, size);
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	num_buckets = drmBOCacheGetStats(bufmgr_gem->bo_cache, buckets, count);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 
-		add_bucket(bufmgr_gem, size + size * 1 / 4);
-		add_bucket(bufmgr_gem, size + size * 2 / 4);
-		add_bucket(bufmgr_gem, size + size * 3 / 4);
+	for (i = 0; i < num_buckets && i < count; i++) {
+		stats[i].size = buckets[i].size;
+		stats[i].cached = buckets[i].cached;
+		stats[i].hits = buckets[i].hits;
+		stats[i].misses = buckets[i].misses;
+		stats[i].purged = buckets[i].purged;
+		stats[i].expired = buckets[i].expired + buckets[i].trimmed;
 	}
+	free(buckets);
+
+	return num_buckets;
+}
+
+/**
+ * Frees cached buffers, least recently released first, until at most
+ * @max_bytes are left in the BO cache. For use under memory pressure.
+ */
+drm_public void
+drm_intel_bufmgr_gem_trim_bo_cache(drm_intel_bufmgr *bufmgr,
+				   uint64_t max_bytes)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	drmBOCacheTrim(bufmgr_gem->bo_cache, max_bytes);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 }
 
 drm_public void
@@ -3133,6 +3962,30 @@ drm_public void
 drm_intel_bufmgr_gem_set_aub_filename(drm_intel_bufmgr *bufmgr,
 				      const char *filename)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	free(bufmgr_gem->aub_filename);
+	bufmgr_gem->aub_filename = filename ? strdup(filename) : NULL;
+}
+
+/**
+ * Sets how the AUB file is written.
+ *
+ * The file grows by \p window_size bytes at a time, each part of it
+ * being mapped while it is filled. With \p background set, a thread
+ * prepares the next part and releases the filled ones.
+ *
+ * This function has to be called before drm_intel_bufmgr_gem_set_aub_dump()
+ * for it to have any effect.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_aub_window(drm_intel_bufmgr *bufmgr,
+				    unsigned long window_size, int background)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	bufmgr_gem->aub_window_size = window_size;
+	bufmgr_gem->aub_background = background;
 }
 
 /**
@@ -3142,15 +3995,58 @@ drm_intel_bufmgr_gem_set_aub_filename(drm_intel_bufmgr *bufmgr,
  * Packets are emitted in a format somewhat like GPU command packets.
  * You can set up a GTT and upload your objects into the referenced
  * space, then send off batchbuffers and get BMPs out the other end.
+ *
+ * Each batchbuffer execution writes the parts of the buffers that were
+ * mapped or written with drm_intel_bo_subdata() since they were last
+ * dumped. Disabling the dump closes the file.
+ *
+ * Buffers get their trace addresses from a 4GB GTT, and give them back when
+ * they are freed. Softpinned buffers can't be traced: dumping is refused
+ * after drm_intel_bufmgr_gem_enable_softpin(), and executions using buffers
+ * placed with drm_intel_bo_set_softpin_offset() are left out.
  */
 drm_public void
 drm_intel_bufmgr_gem_set_aub_dump(drm_intel_bufmgr *bufmgr, int enable)
 {
-	fprintf(stderr, "libdrm aub dumping is deprecated.\n\n"
-		"Use intel_aubdump from intel-gpu-tools instead.  Install intel-gpu-tools,\n"
-		"then run (for example)\n\n"
-		"\t$ intel_aubdump --output=trace.aub glxgears -geometry 500x500\n\n"
-		"See the intel_aubdump man page for more details.\n");
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	const char *filename;
+	int ret;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (!enable && bufmgr_gem->aub) {
+		intel_aub_writer_destroy(bufmgr_gem->aub);
+		bufmgr_gem->aub = NULL;
+	} else if (enable && bufmgr_gem->address_heap) {
+		fprintf(stderr, "AUB dumping doesn't support softpin\n");
+	} else if (enable && !bufmgr_gem->aub) {
+		if (!bufmgr_gem->aub_heap) {
+			/* Pages after the ring */
+			int first = (INTEL_AUB_RING_OFFSET +
+				     INTEL_AUB_RING_SIZE) / 4096;
+
+			bufmgr_gem->aub_heap =
+				mmInit(first, INTEL_AUB_GTT_SIZE / 4096 - first);
+			if (!bufmgr_gem->aub_heap) {
+				pthread_mutex_unlock(&bufmgr_gem->lock);
+				return;
+			}
+		}
+
+		filename = bufmgr_gem->aub_filename ?
+			   bufmgr_gem->aub_filename : "intel.aub";
+		ret = intel_aub_writer_create(filename, bufmgr_gem->gen,
+					      bufmgr_gem->aub_window_size,
+					      bufmgr_gem->aub_background,
+					      &bufmgr_gem->aub);
+		if (ret) {
+			fprintf(stderr, "Failed to open %s: %s\n",
+				filename, strerror(-ret));
+		} else {
+			/* Every buffer goes in whole the first time */
+			bufmgr_gem->aub_generation++;
+		}
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 }
 
 drm_public drm_intel_context *
@@ -3396,13 +4292,18 @@ drm_public void *drm_intel_gem_bo_map__gtt(drm_intel_bo *bo)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
-	if (bo_gem->gtt_virtual)
+	bo_gem->mapped_persistently = true;
+	if (bo_gem->gtt_virtual && !bo_gem->upload_pending)
 		return bo_gem->gtt_virtual;
 
 	if (bo_gem->is_userptr)
 		return NULL;
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (drm_intel_gem_bo_flush_uploads(bo) != 0) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return NULL;
+	}
 	if (bo_gem->gtt_virtual == NULL) {
 		struct drm_i915_gem_mmap_gtt mmap_arg;
 		void *ptr;
@@ -3444,7 +4345,8 @@ drm_public void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
-	if (bo_gem->mem_virtual)
+	bo_gem->mapped_persistently = true;
+	if (bo_gem->mem_virtual && !bo_gem->upload_pending)
 		return bo_gem->mem_virtual;
 
 	if (bo_gem->is_userptr) {
@@ -3453,6 +4355,10 @@ drm_public void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 	}
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (drm_intel_gem_bo_flush_uploads(bo) != 0) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return NULL;
+	}
 	if (!bo_gem->mem_virtual) {
 		struct drm_i915_gem_mmap mmap_arg;
 
@@ -3488,39 +4394,19 @@ drm_public void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
-	if (bo_gem->wc_virtual)
+	bo_gem->mapped_persistently = true;
+	if (bo_gem->wc_virtual && !bo_gem->upload_pending)
 		return bo_gem->wc_virtual;
 
 	if (bo_gem->is_userptr)
 		return NULL;
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
-	if (!bo_gem->wc_virtual) {
-		struct drm_i915_gem_mmap mmap_arg;
-
-		if (bo_gem->map_count++ == 0)
-			drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
-
-		DBG("bo_map: %d (%s), map_count=%d\n",
-		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
-
-		memclear(mmap_arg);
-		mmap_arg.handle = bo_gem->gem_handle;
-		mmap_arg.size = bo->size;
-		mmap_arg.flags = I915_MMAP_WC;
-		if (drmIoctl(bufmgr_gem->fd,
-			     DRM_IOCTL_I915_GEM_MMAP,
-			     &mmap_arg)) {
-			DBG("%s:%d: Error mapping buffer %d (%s): %s .\n",
-			    __FILE__, __LINE__, bo_gem->gem_handle,
-			    bo_gem->name, strerror(errno));
-			if (--bo_gem->map_count == 0)
-				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
-		} else {
-			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
-			bo_gem->wc_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
-		}
+	if (drm_intel_gem_bo_flush_uploads(bo) != 0) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return NULL;
 	}
+	map_wc(bo);
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	return bo_gem->wc_virtual;
@@ -3615,6 +4501,13 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
         goto exit;
     }
 
+	bufmgr_gem->bo_cache = drmBOCacheCreate(&drm_intel_gem_bo_cache_funcs, 0);
+	if (!bufmgr_gem->bo_cache) {
+		free(bufmgr_gem);
+		bufmgr_gem = NULL;
+		goto exit;
+	}
+
 	gp.param = I915_PARAM_HAS_BSD;
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
 	bufmgr_gem->has_bsd = ret == 0;
@@ -3730,8 +4623,6 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	    drm_intel_gem_get_pipe_from_crtc_id;
 	bufmgr_gem->bufmgr.bo_references = drm_intel_gem_bo_references;
 
-	init_cache_buckets(bufmgr_gem);
-
 	DRMINITLISTHEAD(&bufmgr_gem->vma_cache);
 	bufmgr_gem->vma_max = -1; /* unlimited by default */
 
@@ -28,6 +28,7 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <errno.h>
 
 #include "libdrm_macros.h"
 #include "xf86drm.h"
@@ -40,6 +41,13 @@ struct drm_intel_decode {
 	/** stdio file where the output should land.  Defaults to stdout. */
 	FILE *out;
 
+	/** DRM_INTEL_DECODE_FORMAT_* written to out. */
+	int format;
+
+	/** Function taking the output lines instead of out, or NULL. */
+	drm_intel_decode_line_func line_func;
+	void *line_data;
+
 	/** PCI device ID. */
 	uint32_t devid;
 
@@ -78,21 +86,49 @@ struct drm_intel_decode {
 	bool dump_past_end;
 
 	bool overflowed;
-};
 
-static FILE *out;
-static uint32_t saved_s2 = 0, saved_s4 = 0;
-static char saved_s2_set = 0, saved_s4_set = 0;
-static uint32_t head_offset = 0xffffffff;	/* undefined */
-static uint32_t tail_offset = 0xffffffff;	/* undefined */
+	/** @{ Vertex state from 3DSTATE_LOAD_STATE_IMMEDIATE_1 on gen3. */
+	uint32_t saved_s2, saved_s4;
+	char saved_s2_set, saved_s4_set;
+	/** @} */
+
+	/**
+	 * Line being put together for the JSON sink and line_func, it is
+	 * passed on once the text ends in a newline.
+	 */
+	struct drm_intel_decode_line line;
+	bool line_open;
+	char *text;
+	size_t text_len, text_size;
+
+	/** @{
+	 * Opcode statistics, an open addressed hash table of opcode_stats_size
+	 * entries, unused ones have a count of 0.
+	 */
+	bool opcode_stats;
+	struct drm_intel_decode_opcode_stats *opcode_stats_table;
+	unsigned int opcode_stats_size, opcode_stats_used;
+	/** @} */
+
+	/** @{
+	 * Opcode to opcode table dispatch, entry index + 1 or 0 if there is
+	 * no entry for this device.
+	 */
+	uint8_t index_mi[64];
+	uint8_t index_2d[128];
+	uint8_t index_3d_1d[256];
+	uint8_t index_3d[32];
+	uint8_t index_3d_965[8192];
+	/** @} */
+};
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(A) (sizeof(A)/sizeof(A[0]))
 #endif
 
 #define BUFFER_FAIL(_count, _len, _name) do {			\
-    fprintf(out, "Buffer size too small in %s (%d < %d)\n",	\
-	    (_name), (_count), (_len));				\
+    decode_printf(ctx, "Buffer size too small in %s (%d < %d)\n",	\
+		  (_name), (_count), (_len));			\
     return _count;						\
 } while (0)
 
@@ -107,6 +143,136 @@ static float int_as_float(uint32_t intval)
 	return uval.f;
 }
 
+static bool
+decode_has_text(struct drm_intel_decode *ctx)
+{
+	return ctx->line_func || ctx->format == DRM_INTEL_DECODE_FORMAT_TEXT ||
+		ctx->format == DRM_INTEL_DECODE_FORMAT_JSON;
+}
+
+static void
+decode_json_string(FILE *out, const char *str)
+{
+	const char *p;
+
+	fputc('"', out);
+	for (p = str; *p; p++) {
+		unsigned char c = *p;
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void
+decode_line_emit(struct drm_intel_decode *ctx)
+{
+	struct drm_intel_decode_line *line = &ctx->line;
+	FILE *out = ctx->out;
+
+	ctx->line_open = false;
+	line->text = ctx->text ? ctx->text : "";
+
+	if (ctx->line_func) {
+		ctx->line_func(ctx->line_data, line);
+		return;
+	}
+
+	if (line->flags & DRM_INTEL_DECODE_LINE_MESSAGE) {
+		fprintf(out, "{\"offset\":%u,\"message\":", line->offset);
+	} else {
+		fprintf(out, "{\"offset\":%u,\"index\":%u,\"dword\":%u,",
+			line->offset, line->index, line->dword);
+		if (line->flags & DRM_INTEL_DECODE_LINE_HEAD)
+			fputs("\"mark\":\"HEAD\",", out);
+		else if (line->flags & DRM_INTEL_DECODE_LINE_TAIL)
+			fputs("\"mark\":\"TAIL\",", out);
+		fputs("\"text\":", out);
+	}
+	decode_json_string(out, line->text);
+	fputs("}\n", out);
+}
+
+static void
+decode_line_begin(struct drm_intel_decode *ctx, uint32_t offset,
+		  uint32_t dword, unsigned int index, uint32_t flags)
+{
+	if (ctx->line_open)
+		decode_line_emit(ctx);
+
+	ctx->line.offset = offset;
+	ctx->line.dword = dword;
+	ctx->line.index = index;
+	ctx->line.flags = flags;
+	ctx->line_open = true;
+	ctx->text_len = 0;
+	if (ctx->text)
+		ctx->text[0] = '\0';
+}
+
+static void DRM_PRINTFLIKE(2, 0)
+vdecode_printf(struct drm_intel_decode *ctx, const char *fmt, va_list va)
+{
+	va_list copy;
+	int len;
+
+	if (ctx->format == DRM_INTEL_DECODE_FORMAT_TEXT && !ctx->line_func) {
+		vfprintf(ctx->out, fmt, va);
+		return;
+	}
+
+	if (!decode_has_text(ctx))
+		return;
+
+	/* Text outside of instr_out() is a message of its own. */
+	if (!ctx->line_open)
+		decode_line_begin(ctx, ctx->hw_offset, 0, 0,
+				  DRM_INTEL_DECODE_LINE_MESSAGE);
+
+	va_copy(copy, va);
+	len = vsnprintf(ctx->text ? ctx->text + ctx->text_len : NULL,
+			ctx->text_size - ctx->text_len, fmt, copy);
+	va_end(copy);
+	if (len < 0)
+		return;
+
+	if (ctx->text_len + len >= ctx->text_size) {
+		size_t size = ctx->text_size ? ctx->text_size : 256;
+		char *text;
+
+		while (ctx->text_len + len >= size)
+			size *= 2;
+		text = realloc(ctx->text, size);
+		if (!text)
+			return;
+		ctx->text = text;
+		ctx->text_size = size;
+		vsnprintf(ctx->text + ctx->text_len,
+			  ctx->text_size - ctx->text_len, fmt, va);
+	}
+	ctx->text_len += len;
+
+	if (ctx->text_len && ctx->text[ctx->text_len - 1] == '\n') {
+		ctx->text[--ctx->text_len] = '\0';
+		decode_line_emit(ctx);
+	}
+}
+
+static void DRM_PRINTFLIKE(2, 3)
+decode_printf(struct drm_intel_decode *ctx, const char *fmt, ...)
+{
+	va_list va;
+
+	va_start(va, fmt);
+	vdecode_printf(ctx, fmt, va);
+	va_end(va);
+}
+
 static void DRM_PRINTFLIKE(3, 4)
 instr_out(struct drm_intel_decode *ctx, unsigned int index,
 	  const char *fmt, ...)
@@ -114,26 +280,37 @@ instr_out(struct drm_intel_decode *ctx, unsigned int index,
 	va_list va;
 	const char *parseinfo;
 	uint32_t offset = ctx->hw_offset + index * 4;
+	uint32_t flags = 0;
 
 	if (index > ctx->count) {
 		if (!ctx->overflowed) {
-			fprintf(out, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
+			decode_printf(ctx, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
 			ctx->overflowed = true;
 		}
 		return;
 	}
 
-	if (offset == head_offset)
+	if (!decode_has_text(ctx))
+		return;
+
+	if (offset == ctx->head) {
 		parseinfo = "HEAD";
-	else if (offset == tail_offset)
+		flags = DRM_INTEL_DECODE_LINE_HEAD;
+	} else if (offset == ctx->tail) {
 		parseinfo = "TAIL";
-	else
+		flags = DRM_INTEL_DECODE_LINE_TAIL;
+	} else {
 		parseinfo = "    ";
+	}
+
+	if (ctx->format == DRM_INTEL_DECODE_FORMAT_TEXT && !ctx->line_func)
+		fprintf(ctx->out, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
+			ctx->data[index], index == 0 ? "" : "   ");
+	else
+		decode_line_begin(ctx, offset, ctx->data[index], index, flags);
 
-	fprintf(out, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
-		ctx->data[index], index == 0 ? "" : "   ");
 	va_start(va, fmt);
-	vfprintf(out, fmt, va);
+	vdecode_printf(ctx, fmt, va);
 	va_end(va);
 }
 
@@ -221,65 +398,64 @@ decode_MI_WAIT_FOR_EVENT(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+struct decode_opcode_mi {
+	uint32_t opcode;
+	int len_mask;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+	int (*func)(struct drm_intel_decode *ctx);
+};
+
+static const struct decode_opcode_mi opcodes_mi[] = {
+	{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
+	{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
+	{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
+	{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
+	{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
+	{ 0x04, 0, 1, 1, "MI_FLUSH" },
+	{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
+	{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
+	{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
+	{ 0x00, 0, 1, 1, "MI_NOOP" },
+	{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
+	{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
+	{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", decode_MI_SET_CONTEXT },
+	{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
+	{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
+	{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
+	{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
+	{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", decode_MI_WAIT_FOR_EVENT },
+	{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
+	{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
+	{ 0x28, 0x3f, 3, 3, "MI_REPORT_PERF_COUNT" },
+	{ 0x29, 0xff, 3, 3, "MI_LOAD_REGISTER_MEM" },
+	{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
+};
+
 static int
 decode_mi(struct drm_intel_decode *ctx)
 {
 	unsigned int opcode, len = -1;
 	const char *post_sync_op = "";
 	uint32_t *data = ctx->data;
-
-	struct {
-		uint32_t opcode;
-		int len_mask;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_mi[] = {
-		{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
-		{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
-		{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
-		{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
-		{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
-		{ 0x04, 0, 1, 1, "MI_FLUSH" },
-		{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
-		{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
-		{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
-		{ 0x00, 0, 1, 1, "MI_NOOP" },
-		{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
-		{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
-		{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", decode_MI_SET_CONTEXT },
-		{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
-		{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
-		{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
-		{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
-		{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", decode_MI_WAIT_FOR_EVENT },
-		{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
-		{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
-		{ 0x28, 0x3f, 3, 3, "MI_REPORT_PERF_COUNT" },
-		{ 0x29, 0xff, 3, 3, "MI_LOAD_REGISTER_MEM" },
-		{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
-	}, *opcode_mi = NULL;
+	const struct decode_opcode_mi *opcode_mi = NULL;
 
 	/* check instruction length */
-	for (opcode = 0; opcode < sizeof(opcodes_mi) / sizeof(opcodes_mi[0]);
-	     opcode++) {
-		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
-			len = 1;
-			if (opcodes_mi[opcode].max_len > 1) {
-				len =
-				    (data[0] & opcodes_mi[opcode].len_mask) + 2;
-				if (len < opcodes_mi[opcode].min_len
-				    || len > opcodes_mi[opcode].max_len) {
-					fprintf(out,
-						"Bad length (%d) in %s, [%d, %d]\n",
-						len, opcodes_mi[opcode].name,
-						opcodes_mi[opcode].min_len,
-						opcodes_mi[opcode].max_len);
-				}
+	opcode = ctx->index_mi[(data[0] & 0x1f800000) >> 23];
+	if (opcode) {
+		opcode_mi = &opcodes_mi[opcode - 1];
+		len = 1;
+		if (opcode_mi->max_len > 1) {
+			len = (data[0] & opcode_mi->len_mask) + 2;
+			if (len < opcode_mi->min_len ||
+			    len > opcode_mi->max_len) {
+				decode_printf(ctx,
+					      "Bad length (%d) in %s, [%d, %d]\n",
+					      len, opcode_mi->name,
+					      opcode_mi->min_len,
+					      opcode_mi->max_len);
 			}
-			opcode_mi = &opcodes_mi[opcode];
-			break;
 		}
 	}
 
@@ -352,19 +528,15 @@ decode_mi(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (opcode = 0; opcode < sizeof(opcodes_mi) / sizeof(opcodes_mi[0]);
-	     opcode++) {
-		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
-			unsigned int i;
-
-			instr_out(ctx, 0, "%s\n",
-				  opcodes_mi[opcode].name);
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
+	if (opcode_mi) {
+		unsigned int i;
 
-			return len;
+		instr_out(ctx, 0, "%s\n", opcode_mi->name);
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
 	instr_out(ctx, 0, "MI UNKNOWN\n");
@@ -415,45 +587,47 @@ decode_2d_br01(struct drm_intel_decode *ctx)
 
 }
 
+struct decode_opcode_2d {
+	uint32_t opcode;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+};
+
+static const struct decode_opcode_2d opcodes_2d[] = {
+	{ 0x40, 5, 5, "COLOR_BLT" },
+	{ 0x43, 6, 6, "SRC_COPY_BLT" },
+	{ 0x01, 8, 8, "XY_SETUP_BLT" },
+	{ 0x11, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
+	{ 0x03, 3, 3, "XY_SETUP_CLIP_BLT" },
+	{ 0x24, 2, 2, "XY_PIXEL_BLT" },
+	{ 0x25, 3, 3, "XY_SCANLINES_BLT" },
+	{ 0x26, 4, 4, "Y_TEXT_BLT" },
+	{ 0x31, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
+	{ 0x50, 6, 6, "XY_COLOR_BLT" },
+	{ 0x51, 6, 6, "XY_PAT_BLT" },
+	{ 0x76, 8, 8, "XY_PAT_CHROMA_BLT" },
+	{ 0x72, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
+	{ 0x77, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
+	{ 0x52, 9, 9, "XY_MONO_PAT_BLT" },
+	{ 0x59, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
+	{ 0x53, 8, 8, "XY_SRC_COPY_BLT" },
+	{ 0x54, 8, 8, "XY_MONO_SRC_COPY_BLT" },
+	{ 0x71, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
+	{ 0x55, 9, 9, "XY_FULL_BLT" },
+	{ 0x55, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
+	{ 0x56, 9, 9, "XY_FULL_MONO_SRC_BLT" },
+	{ 0x75, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
+	{ 0x57, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
+	{ 0x58, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
+};
+
 static int
 decode_2d(struct drm_intel_decode *ctx)
 {
 	unsigned int opcode, len;
 	uint32_t *data = ctx->data;
 
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_2d[] = {
-		{ 0x40, 5, 5, "COLOR_BLT" },
-		{ 0x43, 6, 6, "SRC_COPY_BLT" },
-		{ 0x01, 8, 8, "XY_SETUP_BLT" },
-		{ 0x11, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
-		{ 0x03, 3, 3, "XY_SETUP_CLIP_BLT" },
-		{ 0x24, 2, 2, "XY_PIXEL_BLT" },
-		{ 0x25, 3, 3, "XY_SCANLINES_BLT" },
-		{ 0x26, 4, 4, "Y_TEXT_BLT" },
-		{ 0x31, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
-		{ 0x50, 6, 6, "XY_COLOR_BLT" },
-		{ 0x51, 6, 6, "XY_PAT_BLT" },
-		{ 0x76, 8, 8, "XY_PAT_CHROMA_BLT" },
-		{ 0x72, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
-		{ 0x77, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
-		{ 0x52, 9, 9, "XY_MONO_PAT_BLT" },
-		{ 0x59, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
-		{ 0x53, 8, 8, "XY_SRC_COPY_BLT" },
-		{ 0x54, 8, 8, "XY_MONO_SRC_COPY_BLT" },
-		{ 0x71, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
-		{ 0x55, 9, 9, "XY_FULL_BLT" },
-		{ 0x55, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
-		{ 0x56, 9, 9, "XY_FULL_MONO_SRC_BLT" },
-		{ 0x75, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
-		{ 0x57, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
-		{ 0x58, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
-	};
-
 	switch ((data[0] & 0x1fc00000) >> 22) {
 	case 0x25:
 		instr_out(ctx, 0,
@@ -463,7 +637,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SCANLINES_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SCANLINES_BLT\n");
 
 		instr_out(ctx, 1, "dest (%d,%d)\n",
 			  data[1] & 0xffff, data[1] >> 16);
@@ -475,7 +649,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SETUP_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SETUP_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "cliprect (%d,%d)\n",
@@ -493,7 +667,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SETUP_CLIP_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SETUP_CLIP_BLT\n");
 
 		instr_out(ctx, 1, "cliprect (%d,%d)\n",
 			  data[1] & 0xffff, data[2] >> 16);
@@ -505,8 +679,8 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 9)
-			fprintf(out,
-				"Bad count in XY_SETUP_MONO_PATTERN_SL_BLT\n");
+			decode_printf(ctx,
+				      "Bad count in XY_SETUP_MONO_PATTERN_SL_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "cliprect (%d,%d)\n",
@@ -525,7 +699,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 6)
-			fprintf(out, "Bad count in XY_COLOR_BLT\n");
+			decode_printf(ctx, "Bad count in XY_COLOR_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "(%d,%d)\n",
@@ -540,7 +714,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SRC_COPY_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SRC_COPY_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "dst (%d,%d)\n",
@@ -556,29 +730,27 @@ decode_2d(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (opcode = 0; opcode < sizeof(opcodes_2d) / sizeof(opcodes_2d[0]);
-	     opcode++) {
-		if ((data[0] & 0x1fc00000) >> 22 == opcodes_2d[opcode].opcode) {
-			unsigned int i;
-
-			len = 1;
-			instr_out(ctx, 0, "%s\n",
-				  opcodes_2d[opcode].name);
-			if (opcodes_2d[opcode].max_len > 1) {
-				len = (data[0] & 0x000000ff) + 2;
-				if (len < opcodes_2d[opcode].min_len ||
-				    len > opcodes_2d[opcode].max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcodes_2d[opcode].name);
-				}
-			}
-
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+	opcode = ctx->index_2d[(data[0] & 0x1fc00000) >> 22];
+	if (opcode) {
+		const struct decode_opcode_2d *opcode_2d = &opcodes_2d[opcode - 1];
+		unsigned int i;
+
+		len = 1;
+		instr_out(ctx, 0, "%s\n", opcode_2d->name);
+		if (opcode_2d->max_len > 1) {
+			len = (data[0] & 0x000000ff) + 2;
+			if (len < opcode_2d->min_len ||
+			    len > opcode_2d->max_len) {
+				decode_printf(ctx, "Bad count in %s\n",
+					      opcode_2d->name);
 			}
+		}
 
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
 	instr_out(ctx, 0, "2D UNKNOWN\n");
@@ -620,9 +792,10 @@ decode_3d_1c(struct drm_intel_decode *ctx)
 
 /** Sets the string dstname to describe the destination of the PS instruction */
 static void
-i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
+i915_get_instruction_dst(struct drm_intel_decode *ctx, int i, char *dstname,
+			 int do_mask)
 {
-	uint32_t a0 = data[i];
+	uint32_t a0 = ctx->data[i];
 	int dst_nr = (a0 >> 14) & 0xf;
 	char dstmask[8];
 	const char *sat;
@@ -657,22 +830,22 @@ i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
 	switch ((a0 >> 19) & 0x7) {
 	case 0:
 		if (dst_nr > 15)
-			fprintf(out, "bad destination reg R%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg R%d\n", dst_nr);
 		sprintf(dstname, "R%d%s%s", dst_nr, dstmask, sat);
 		break;
 	case 4:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oC%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg oC%d\n", dst_nr);
 		sprintf(dstname, "oC%s%s", dstmask, sat);
 		break;
 	case 5:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oD%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg oD%d\n", dst_nr);
 		sprintf(dstname, "oD%s%s", dstmask, sat);
 		break;
 	case 6:
 		if (dst_nr > 3)
-			fprintf(out, "bad destination reg U%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg U%d\n", dst_nr);
 		sprintf(dstname, "U%d%s%s", dst_nr, dstmask, sat);
 		break;
 	default:
@@ -703,13 +876,14 @@ i915_get_channel_swizzle(uint32_t select)
 }
 
 static void
-i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_src_name(struct drm_intel_decode *ctx,
+			      uint32_t src_type, uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -721,41 +895,42 @@ i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			decode_printf(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 2:
 		sprintf(name, "C%d", src_nr);
 		if (src_nr > 31)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	case 6:
 		sprintf(name, "U%d", src_nr);
 		if (src_nr > 3)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		decode_printf(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
 }
 
-static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src0(struct drm_intel_decode *ctx, int i,
+				      char *srcname)
 {
-	uint32_t a0 = data[i];
-	uint32_t a1 = data[i + 1];
+	uint32_t a0 = ctx->data[i];
+	uint32_t a1 = ctx->data[i + 1];
 	int src_nr = (a0 >> 2) & 0x1f;
 	const char *swizzle_x = i915_get_channel_swizzle((a1 >> 28) & 0xf);
 	const char *swizzle_y = i915_get_channel_swizzle((a1 >> 24) & 0xf);
@@ -763,17 +938,18 @@ static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a1 >> 16) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a0 >> 7) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a0 >> 7) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src1(struct drm_intel_decode *ctx, int i,
+				      char *srcname)
 {
-	uint32_t a1 = data[i + 1];
-	uint32_t a2 = data[i + 2];
+	uint32_t a1 = ctx->data[i + 1];
+	uint32_t a2 = ctx->data[i + 2];
 	int src_nr = (a1 >> 8) & 0x1f;
 	const char *swizzle_x = i915_get_channel_swizzle((a1 >> 4) & 0xf);
 	const char *swizzle_y = i915_get_channel_swizzle((a1 >> 0) & 0xf);
@@ -781,16 +957,17 @@ static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 24) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a1 >> 13) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a1 >> 13) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src2(struct drm_intel_decode *ctx, int i,
+				      char *srcname)
 {
-	uint32_t a2 = data[i + 2];
+	uint32_t a2 = ctx->data[i + 2];
 	int src_nr = (a2 >> 16) & 0x1f;
 	const char *swizzle_x = i915_get_channel_swizzle((a2 >> 12) & 0xf);
 	const char *swizzle_y = i915_get_channel_swizzle((a2 >> 8) & 0xf);
@@ -798,7 +975,7 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 0) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a2 >> 21) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a2 >> 21) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
@@ -806,13 +983,14 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 }
 
 static void
-i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_addr(struct drm_intel_decode *ctx,
+			  uint32_t src_type, uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -824,22 +1002,22 @@ i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			decode_printf(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		decode_printf(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
@@ -851,8 +1029,8 @@ i915_decode_alu1(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
 
 	instr_out(ctx, i++, "%s: %s %s, %s\n", instr_prefix,
 		  op_name, dst, src0);
@@ -866,9 +1044,9 @@ i915_decode_alu2(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1);
@@ -882,10 +1060,10 @@ i915_decode_alu3(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100], src2[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
-	i915_get_instruction_src2(ctx->data, i, src2);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
+	i915_get_instruction_src2(ctx, i, src2);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1, src2);
@@ -903,8 +1081,8 @@ i915_decode_tex(struct drm_intel_decode *ctx, int i,
 	char addr_name[100];
 	int sampler_nr;
 
-	i915_get_instruction_dst(ctx->data, i, dst_name, 0);
-	i915_get_instruction_addr((t1 >> 24) & 0x7,
+	i915_get_instruction_dst(ctx, i, dst_name, 0);
+	i915_get_instruction_addr(ctx, (t1 >> 24) & 0x7,
 				  (t1 >> 17) & 0xf, addr_name);
 	sampler_nr = t0 & 0xf;
 
@@ -930,31 +1108,31 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 	case 1:
 		sprintf(dcl_mask, ".%s%s%s%s", dcl_x, dcl_y, dcl_z, dcl_w);
 		if (strcmp(dcl_mask, ".") == 0)
-			fprintf(out, "bad (empty) dcl mask\n");
+			decode_printf(ctx, "bad (empty) dcl mask\n");
 
 		if (dcl_nr > 10)
-			fprintf(out, "bad T%d dcl register number\n", dcl_nr);
+			decode_printf(ctx, "bad T%d dcl register number\n", dcl_nr);
 		if (dcl_nr < 8) {
 			if (strcmp(dcl_mask, ".x") != 0 &&
 			    strcmp(dcl_mask, ".xy") != 0 &&
 			    strcmp(dcl_mask, ".xz") != 0 &&
 			    strcmp(dcl_mask, ".w") != 0 &&
 			    strcmp(dcl_mask, ".xyzw") != 0) {
-				fprintf(out, "bad T%d.%s dcl mask\n", dcl_nr,
-					dcl_mask);
+				decode_printf(ctx, "bad T%d.%s dcl mask\n", dcl_nr,
+					      dcl_mask);
 			}
 			instr_out(ctx, i++, "%s: DCL T%d%s\n",
 				  instr_prefix, dcl_nr, dcl_mask);
 		} else {
 			if (strcmp(dcl_mask, ".xz") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
-					dcl_mask);
+				decode_printf(ctx, "errataed bad dcl mask %s\n",
+					      dcl_mask);
 			else if (strcmp(dcl_mask, ".xw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
-					dcl_mask);
+				decode_printf(ctx, "errataed bad dcl mask %s\n",
+					      dcl_mask);
 			else if (strcmp(dcl_mask, ".xzw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
-					dcl_mask);
+				decode_printf(ctx, "errataed bad dcl mask %s\n",
+					      dcl_mask);
 
 			if (dcl_nr == 8) {
 				instr_out(ctx, i++,
@@ -989,7 +1167,7 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 			break;
 		}
 		if (dcl_nr > 15)
-			fprintf(out, "bad S%d dcl register number\n", dcl_nr);
+			decode_printf(ctx, "bad S%d dcl register number\n", dcl_nr);
 		instr_out(ctx, i++, "%s: DCL S%d %s\n",
 			  instr_prefix, dcl_nr, sampletype);
 		instr_out(ctx, i++, "%s\n", instr_prefix);
@@ -1263,6 +1441,33 @@ decode_sample_filter(uint32_t mode)
 	return "";
 }
 
+struct decode_opcode_3d_1d {
+	uint32_t opcode;
+	int i830_only;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+};
+
+static const struct decode_opcode_3d_1d opcodes_3d_1d[] = {
+	{ 0x86, 0, 4, 4, "3DSTATE_CHROMA_KEY" },
+	{ 0x88, 0, 2, 2, "3DSTATE_CONSTANT_BLEND_COLOR" },
+	{ 0x99, 0, 2, 2, "3DSTATE_DEFAULT_DIFFUSE" },
+	{ 0x9a, 0, 2, 2, "3DSTATE_DEFAULT_SPECULAR" },
+	{ 0x98, 0, 2, 2, "3DSTATE_DEFAULT_Z" },
+	{ 0x97, 0, 2, 2, "3DSTATE_DEPTH_OFFSET_SCALE" },
+	{ 0x9d, 0, 65, 65, "3DSTATE_FILTER_COEFFICIENTS_4X4" },
+	{ 0x9e, 0, 4, 4, "3DSTATE_MONO_FILTER" },
+	{ 0x89, 0, 4, 4, "3DSTATE_FOG_MODE" },
+	{ 0x8f, 0, 2, 16, "3DSTATE_MAP_PALLETE_LOAD_32" },
+	{ 0x83, 0, 2, 2, "3DSTATE_SPAN_STIPPLE" },
+	{ 0x8c, 1, 2, 2, "3DSTATE_MAP_COORD_TRANSFORM_I830" },
+	{ 0x8b, 1, 2, 2, "3DSTATE_MAP_VERTEX_TRANSFORM_I830" },
+	{ 0x8d, 1, 3, 3, "3DSTATE_W_STATE_I830" },
+	{ 0x01, 1, 2, 2, "3DSTATE_COLOR_FACTOR_I830" },
+	{ 0x02, 1, 2, 2, "3DSTATE_MAP_COORD_SETBIND_I830"},
+};
+
 static int
 decode_3d_1d(struct drm_intel_decode *ctx)
 {
@@ -1272,31 +1477,6 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 	uint32_t *data = ctx->data;
 	uint32_t devid = ctx->devid;
 
-	struct {
-		uint32_t opcode;
-		int i830_only;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d_1d[] = {
-		{ 0x86, 0, 4, 4, "3DSTATE_CHROMA_KEY" },
-		{ 0x88, 0, 2, 2, "3DSTATE_CONSTANT_BLEND_COLOR" },
-		{ 0x99, 0, 2, 2, "3DSTATE_DEFAULT_DIFFUSE" },
-		{ 0x9a, 0, 2, 2, "3DSTATE_DEFAULT_SPECULAR" },
-		{ 0x98, 0, 2, 2, "3DSTATE_DEFAULT_Z" },
-		{ 0x97, 0, 2, 2, "3DSTATE_DEPTH_OFFSET_SCALE" },
-		{ 0x9d, 0, 65, 65, "3DSTATE_FILTER_COEFFICIENTS_4X4" },
-		{ 0x9e, 0, 4, 4, "3DSTATE_MONO_FILTER" },
-		{ 0x89, 0, 4, 4, "3DSTATE_FOG_MODE" },
-		{ 0x8f, 0, 2, 16, "3DSTATE_MAP_PALLETE_LOAD_32" },
-		{ 0x83, 0, 2, 2, "3DSTATE_SPAN_STIPPLE" },
-		{ 0x8c, 1, 2, 2, "3DSTATE_MAP_COORD_TRANSFORM_I830" },
-		{ 0x8b, 1, 2, 2, "3DSTATE_MAP_VERTEX_TRANSFORM_I830" },
-		{ 0x8d, 1, 3, 3, "3DSTATE_W_STATE_I830" },
-		{ 0x01, 1, 2, 2, "3DSTATE_COLOR_FACTOR_I830" },
-		{ 0x02, 1, 2, 2, "3DSTATE_MAP_COORD_SETBIND_I830"},
-	}, *opcode_3d_1d;
-
 	opcode = (data[0] & 0x00ff0000) >> 16;
 
 	switch (opcode) {
@@ -1334,7 +1514,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			instr_out(ctx, i++, "PSC.1\n");
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
 			return len;
 		}
 		return len;
@@ -1350,12 +1530,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 					int tex_num;
 
 					if (word == 2) {
-						saved_s2_set = 1;
-						saved_s2 = data[i];
+						ctx->saved_s2_set = 1;
+						ctx->saved_s2 = data[i];
 					}
 					if (word == 4) {
-						saved_s4_set = 1;
-						saved_s4 = data[i];
+						ctx->saved_s4_set = 1;
+						ctx->saved_s4 = data[i];
 					}
 
 					switch (word) {
@@ -1384,43 +1564,43 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 								 tex_num *
 								 4) & 0xf) {
 							case 0:
-								fprintf(out,
-									"%i=2D ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=2D ",
+									      tex_num);
 								break;
 							case 1:
-								fprintf(out,
-									"%i=3D ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=3D ",
+									      tex_num);
 								break;
 							case 2:
-								fprintf(out,
-									"%i=4D ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=4D ",
+									      tex_num);
 								break;
 							case 3:
-								fprintf(out,
-									"%i=1D ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=1D ",
+									      tex_num);
 								break;
 							case 4:
-								fprintf(out,
-									"%i=2D_16 ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=2D_16 ",
+									      tex_num);
 								break;
 							case 5:
-								fprintf(out,
-									"%i=4D_16 ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=4D_16 ",
+									      tex_num);
 								break;
 							case 0xf:
-								fprintf(out,
-									"%i=NP ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=NP ",
+									      tex_num);
 								break;
 							}
 						}
-						fprintf(out, "\n");
+						decode_printf(ctx, "\n");
 
 						break;
 					case 3:
@@ -1721,8 +1901,8 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
-				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
 		}
 		return len;
 	case 0x03:
@@ -1771,8 +1951,8 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
-				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
 		}
 		return len;
 	case 0x00:
@@ -1973,7 +2153,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_MAP_STATE\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_MAP_STATE\n");
 			return len;
 		}
 		return len;
@@ -2000,16 +2180,16 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
-				"Bad count in 3DSTATE_PIXEL_SHADER_CONSTANTS\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_PIXEL_SHADER_CONSTANTS\n");
 		}
 		return len;
 	case 0x05:
 		instr_out(ctx, 0, "3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		len = (data[0] & 0x000000ff) + 2;
 		if ((len - 1) % 3 != 0 || len > 370) {
-			fprintf(out,
-				"Bad count in 3DSTATE_PIXEL_SHADER_PROGRAM\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		}
 		i = 1;
 		for (instr = 0; instr < (len - 1) / 3; instr++) {
@@ -2086,15 +2266,15 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_SAMPLER_STATE\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_SAMPLER_STATE\n");
 		}
 		return len;
 	case 0x85:
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 2)
-			fprintf(out,
-				"Bad count in 3DSTATE_DEST_BUFFER_VARIABLES\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_DEST_BUFFER_VARIABLES\n");
 
 		instr_out(ctx, 0,
 			  "3DSTATE_DEST_BUFFER_VARIABLES\n");
@@ -2163,8 +2343,8 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 
 			len = (data[0] & 0x0000000f) + 2;
 			if (len != 3)
-				fprintf(out,
-					"Bad count in 3DSTATE_BUFFER_INFO\n");
+				decode_printf(ctx,
+					      "Bad count in 3DSTATE_BUFFER_INFO\n");
 
 			switch ((data[1] >> 24) & 0x7) {
 			case 0x3:
@@ -2196,8 +2376,8 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 3)
-			fprintf(out,
-				"Bad count in 3DSTATE_SCISSOR_RECTANGLE\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_SCISSOR_RECTANGLE\n");
 
 		instr_out(ctx, 0, "3DSTATE_SCISSOR_RECTANGLE\n");
 		instr_out(ctx, 1, "(%d,%d)\n",
@@ -2210,8 +2390,8 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 5)
-			fprintf(out,
-				"Bad count in 3DSTATE_DRAWING_RECTANGLE\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_DRAWING_RECTANGLE\n");
 
 		instr_out(ctx, 0, "3DSTATE_DRAWING_RECTANGLE\n");
 		instr_out(ctx, 1, "%s\n",
@@ -2228,7 +2408,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 7)
-			fprintf(out, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
 
 		instr_out(ctx, 0, "3DSTATE_CLEAR_PARAMETERS\n");
 		instr_out(ctx, 1, "prim_type=%s, clear=%s%s%s\n",
@@ -2245,31 +2425,28 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d_1d); idx++) {
-		opcode_3d_1d = &opcodes_3d_1d[idx];
-		if (opcode_3d_1d->i830_only && !IS_GEN2(devid))
-			continue;
+	idx = ctx->index_3d_1d[opcode];
+	if (idx) {
+		const struct decode_opcode_3d_1d *opcode_3d_1d =
+			&opcodes_3d_1d[idx - 1];
 
-		if (((data[0] & 0x00ff0000) >> 16) == opcode_3d_1d->opcode) {
-			len = 1;
+		len = 1;
 
-			instr_out(ctx, 0, "%s\n",
-				  opcode_3d_1d->name);
-			if (opcode_3d_1d->max_len > 1) {
-				len = (data[0] & 0x0000ffff) + 2;
-				if (len < opcode_3d_1d->min_len ||
-				    len > opcode_3d_1d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d_1d->name);
-				}
-			}
-
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+		instr_out(ctx, 0, "%s\n", opcode_3d_1d->name);
+		if (opcode_3d_1d->max_len > 1) {
+			len = (data[0] & 0x0000ffff) + 2;
+			if (len < opcode_3d_1d->min_len ||
+			    len > opcode_3d_1d->max_len) {
+				decode_printf(ctx, "Bad count in %s\n",
+					      opcode_3d_1d->name);
 			}
+		}
 
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
 	instr_out(ctx, 0, "3D UNKNOWN: 3d_1d opcode = 0x%x\n",
@@ -2285,8 +2462,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	char immediate = (data[0] & (1 << 23)) == 0;
 	unsigned int len, i, j, ret;
 	const char *primtype;
-	int original_s2 = saved_s2;
-	int original_s4 = saved_s4;
+	int original_s2 = ctx->saved_s2;
+	int original_s4 = ctx->saved_s4;
 
 	switch ((data[0] >> 18) & 0xf) {
 	case 0x0:
@@ -2321,8 +2498,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 		break;
 	case 0xa:
 		primtype = "CLEAR_RECT";
-		saved_s4 = 3 << 6;
-		saved_s2 = ~0;
+		ctx->saved_s4 = 3 << 6;
+		ctx->saved_s2 = ~0;
 		break;
 	default:
 		primtype = "unknown";
@@ -2336,8 +2513,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 			  primtype);
 		if (count < len)
 			BUFFER_FAIL(count, len, "3DPRIMITIVE inline");
-		if (!saved_s2_set || !saved_s4_set) {
-			fprintf(out, "unknown vertex format\n");
+		if (!ctx->saved_s2_set || !ctx->saved_s4_set) {
+			decode_printf(ctx, "unknown vertex format\n");
 			for (i = 1; i < len; i++) {
 				instr_out(ctx, i,
 					  "           vertex data (%f float)\n",
@@ -2352,13 +2529,13 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
     if (i < len)							\
 	instr_out(ctx, i, " V%d."fmt"\n", vertex, __VA_ARGS__); \
     else								\
-	fprintf(out, " missing data in V%d\n", vertex);			\
+	decode_printf(ctx, " missing data in V%d\n", vertex);			\
     i++;								\
 } while (0)
 
 				VERTEX_OUT("X = %f", int_as_float(data[i]));
 				VERTEX_OUT("Y = %f", int_as_float(data[i]));
-				switch (saved_s4 >> 6 & 0x7) {
+				switch (ctx->saved_s4 >> 6 & 0x7) {
 				case 0x1:
 					VERTEX_OUT("Z = %f",
 						   int_as_float(data[i]));
@@ -2376,10 +2553,10 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 						   int_as_float(data[i]));
 					break;
 				default:
-					fprintf(out, "bad S4 position mask\n");
+					decode_printf(ctx, "bad S4 position mask\n");
 				}
 
-				if (saved_s4 & (1 << 10)) {
+				if (ctx->saved_s4 & (1 << 10)) {
 					VERTEX_OUT
 					    ("color = (A=0x%02x, R=0x%02x, G=0x%02x, "
 					     "B=0x%02x)", data[i] >> 24,
@@ -2387,7 +2564,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					     (data[i] >> 8) & 0xff,
 					     data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 11)) {
+				if (ctx->saved_s4 & (1 << 11)) {
 					VERTEX_OUT
 					    ("spec = (A=0x%02x, R=0x%02x, G=0x%02x, "
 					     "B=0x%02x)", data[i] >> 24,
@@ -2395,11 +2572,11 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					     (data[i] >> 8) & 0xff,
 					     data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 12))
+				if (ctx->saved_s4 & (1 << 12))
 					VERTEX_OUT("width = 0x%08x)", data[i]);
 
 				for (tc = 0; tc <= 7; tc++) {
-					switch ((saved_s2 >> (tc * 4)) & 0xf) {
+					switch ((ctx->saved_s2 >> (tc * 4)) & 0xf) {
 					case 0x0:
 						VERTEX_OUT("T%d.X = %f", tc,
 							   int_as_float(data
@@ -2454,9 +2631,9 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					case 0xf:
 						break;
 					default:
-						fprintf(out,
-							"bad S2.T%d format\n",
-							tc);
+						decode_printf(ctx,
+							      "bad S2.T%d format\n",
+							      tc);
 					}
 				}
 				vertex++;
@@ -2499,8 +2676,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 							  data[i] >> 16);
 					}
 				}
-				fprintf(out,
-					"3DPRIMITIVE: no terminator found in index buffer\n");
+				decode_printf(ctx,
+					      "3DPRIMITIVE: no terminator found in index buffer\n");
 				ret = count;
 				goto out;
 			} else {
@@ -2532,11 +2709,52 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	}
 
 out:
-	saved_s2 = original_s2;
-	saved_s4 = original_s4;
+	ctx->saved_s2 = original_s2;
+	ctx->saved_s4 = original_s4;
 	return ret;
 }
 
+struct decode_opcode_3d {
+	uint32_t opcode;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+};
+
+static const struct decode_opcode_3d opcodes_3d[] = {
+	{ 0x06, 1, 1, "3DSTATE_ANTI_ALIASING" },
+	{ 0x08, 1, 1, "3DSTATE_BACKFACE_STENCIL_OPS" },
+	{ 0x09, 1, 1, "3DSTATE_BACKFACE_STENCIL_MASKS" },
+	{ 0x16, 1, 1, "3DSTATE_COORD_SET_BINDINGS" },
+	{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
+	{ 0x0b, 1, 1, "3DSTATE_INDEPENDENT_ALPHA_BLEND" },
+	{ 0x0d, 1, 1, "3DSTATE_MODES_4" },
+	{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
+	{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES"},
+};
+
+static int
+decode_3d_generic(struct drm_intel_decode *ctx,
+		  const struct decode_opcode_3d *opcode_3d)
+{
+	unsigned int len = 1, i;
+
+	instr_out(ctx, 0, "%s\n", opcode_3d->name);
+	if (opcode_3d->max_len > 1) {
+		len = (ctx->data[0] & 0xff) + 2;
+		if (len < opcode_3d->min_len ||
+		    len > opcode_3d->max_len) {
+			decode_printf(ctx, "Bad count in %s\n",
+				      opcode_3d->name);
+		}
+	}
+
+	for (i = 1; i < len; i++) {
+		instr_out(ctx, i, "dword %d\n", i);
+	}
+	return len;
+}
+
 static int
 decode_3d(struct drm_intel_decode *ctx)
 {
@@ -2544,23 +2762,6 @@ decode_3d(struct drm_intel_decode *ctx)
 	unsigned int idx;
 	uint32_t *data = ctx->data;
 
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d[] = {
-		{ 0x06, 1, 1, "3DSTATE_ANTI_ALIASING" },
-		{ 0x08, 1, 1, "3DSTATE_BACKFACE_STENCIL_OPS" },
-		{ 0x09, 1, 1, "3DSTATE_BACKFACE_STENCIL_MASKS" },
-		{ 0x16, 1, 1, "3DSTATE_COORD_SET_BINDINGS" },
-		{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
-		{ 0x0b, 1, 1, "3DSTATE_INDEPENDENT_ALPHA_BLEND" },
-		{ 0x0d, 1, 1, "3DSTATE_MODES_4" },
-		{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
-		{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES"},
-	}, *opcode_3d;
-
 	opcode = (data[0] & 0x1f000000) >> 24;
 
 	switch (opcode) {
@@ -2572,27 +2773,9 @@ decode_3d(struct drm_intel_decode *ctx)
 		return decode_3d_1c(ctx);
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d); idx++) {
-		opcode_3d = &opcodes_3d[idx];
-		if (opcode == opcode_3d->opcode) {
-			unsigned int len = 1, i;
-
-			instr_out(ctx, 0, "%s\n", opcode_3d->name);
-			if (opcode_3d->max_len > 1) {
-				len = (data[0] & 0xff) + 2;
-				if (len < opcode_3d->min_len ||
-				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d->name);
-				}
-			}
-
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
-			return len;
-		}
-	}
+	idx = ctx->index_3d[opcode];
+	if (idx)
+		return decode_3d_generic(ctx, &opcodes_3d[idx - 1]);
 
 	instr_out(ctx, 0, "3D UNKNOWN: 3d opcode = 0x%x\n", opcode);
 	return 1;
@@ -2724,7 +2907,7 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 	uint32_t *data = ctx->data;
 
 	if (len != 3)
-		fprintf(out, "Bad count in URB_FENCE\n");
+		decode_printf(ctx, "Bad count in URB_FENCE\n");
 
 	vs_fence = data[1] & 0x3ff;
 	gs_fence = (data[1] >> 10) & 0x3ff;
@@ -2747,13 +2930,13 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 		  "sf fence: %d, vfe_fence: %d, cs_fence: %d\n",
 		  sf_fence, vfe_fence, cs_fence);
 	if (gs_fence < vs_fence)
-		fprintf(out, "gs fence < vs fence!\n");
+		decode_printf(ctx, "gs fence < vs fence!\n");
 	if (clip_fence < gs_fence)
-		fprintf(out, "clip fence < gs fence!\n");
+		decode_printf(ctx, "clip fence < gs fence!\n");
 	if (sf_fence < clip_fence)
-		fprintf(out, "sf fence < clip fence!\n");
+		decode_printf(ctx, "sf fence < clip fence!\n");
 	if (cs_fence < sf_fence)
-		fprintf(out, "cs fence < sf fence!\n");
+		decode_printf(ctx, "cs fence < sf fence!\n");
 
 	return len;
 }
@@ -3129,6 +3312,107 @@ gen7_3DPRIMITIVE(struct drm_intel_decode *ctx)
 	return 7;
 }
 
+struct decode_opcode_3d_965 {
+	uint32_t opcode;
+	uint32_t len_mask;
+	int unsigned min_len;
+	int unsigned max_len;
+	const char *name;
+	int gen;
+	int (*func)(struct drm_intel_decode *ctx);
+};
+
+static const struct decode_opcode_3d_965 opcodes_3d_965[] = {
+	{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
+	{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
+	{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
+	{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
+	{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
+	{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
+	{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
+	{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
+	{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
+	{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
+	{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
+	{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
+	{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
+	{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
+	{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
+	{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
+	{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
+	{ 0x780e, 0xffff, 4, 4, "3DSTATE_CC_STATE_POINTERS", 6, gen6_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780e, 0x00ff, 2, 2, "3DSTATE_CC_STATE_POINTERS", 7, gen7_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
+	{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
+	{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
+	{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
+	{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
+	{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
+	{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
+	{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
+	{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
+	{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
+	{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
+	{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
+	{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
+	{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
+	{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
+	{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
+	{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
+	{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
+	{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
+	{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
+	{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
+	{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
+	{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
+	{ 0x7821, 0x00ff, 2, 2, "3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP", 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
+	{ 0x7823, 0x00ff, 2, 2, "3DSTATE_VIEWPORT_STATE_POINTERS_CC", 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
+	{ 0x7824, 0x00ff, 2, 2, "3DSTATE_BLEND_STATE_POINTERS", 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
+	{ 0x7825, 0x00ff, 2, 2, "3DSTATE_DEPTH_STENCIL_STATE_POINTERS", 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
+	{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
+	{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
+	{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
+	{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
+	{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
+	{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
+	{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
+	{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
+	{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
+	{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
+	{ 0x7830, 0x00ff, 2, 2, "3DSTATE_URB_VS", 7, gen7_3DSTATE_URB_VS },
+	{ 0x7831, 0x00ff, 2, 2, "3DSTATE_URB_HS", 7, gen7_3DSTATE_URB_HS },
+	{ 0x7832, 0x00ff, 2, 2, "3DSTATE_URB_DS", 7, gen7_3DSTATE_URB_DS },
+	{ 0x7833, 0x00ff, 2, 2, "3DSTATE_URB_GS", 7, gen7_3DSTATE_URB_GS },
+	{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
+	{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
+	{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
+	{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
+	{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
+	{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
+	{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
+	{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
+	{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
+	{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
+	{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
+	{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
+	{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
+	{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
+	{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
+	{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
+	{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
+	{ 0x7b00, 0x00ff, 7, 7, "3DPRIMITIVE", 7, gen7_3DPRIMITIVE },
+	{ 0x7b00, 0x00ff, 6, 6, "3DPRIMITIVE", 0, gen4_3DPRIMITIVE },
+};
+
 static int
 decode_3d_965(struct drm_intel_decode *ctx)
 {
@@ -3138,119 +3422,13 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	const char *desc1 = NULL;
 	uint32_t *data = ctx->data;
 	uint32_t devid = ctx->devid;
-
-	struct {
-		uint32_t opcode;
-		uint32_t len_mask;
-		int unsigned min_len;
-		int unsigned max_len;
-		const char *name;
-		int gen;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_3d[] = {
-		{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
-		{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
-		{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
-		{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
-		{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
-		{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
-		{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
-		{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
-		{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
-		{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
-		{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
-		{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
-		{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
-		{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
-		{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
-		{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
-		{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
-		{ 0x780e, 0xffff, 4, 4, NULL, 6, gen6_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780e, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
-		{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
-		{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
-		{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
-		{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
-		{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
-		{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
-		{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
-		{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
-		{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
-		{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
-		{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
-		{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
-		{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
-		{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
-		{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
-		{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
-		{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
-		{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
-		{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
-		{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
-		{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
-		{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
-		{ 0x7821, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
-		{ 0x7823, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
-		{ 0x7824, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
-		{ 0x7825, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
-		{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
-		{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
-		{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
-		{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
-		{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
-		{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
-		{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
-		{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
-		{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
-		{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
-		{ 0x7830, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_VS },
-		{ 0x7831, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_HS },
-		{ 0x7832, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_DS },
-		{ 0x7833, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_GS },
-		{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
-		{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
-		{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
-		{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
-		{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
-		{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
-		{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
-		{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
-		{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
-		{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
-		{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
-		{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
-		{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
-		{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
-		{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
-		{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
-		{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
-		{ 0x7b00, 0x00ff, 7, 7, NULL, 7, gen7_3DPRIMITIVE },
-		{ 0x7b00, 0x00ff, 6, 6, NULL, 0, gen4_3DPRIMITIVE },
-	}, *opcode_3d = NULL;
+	const struct decode_opcode_3d_965 *opcode_3d = NULL;
 
 	opcode = (data[0] & 0xffff0000) >> 16;
 
-	for (i = 0; i < ARRAY_SIZE(opcodes_3d); i++) {
-		if (opcode != opcodes_3d[i].opcode)
-			continue;
-
-		/* If it's marked as not our gen, skip. */
-		if (opcodes_3d[i].gen && opcodes_3d[i].gen != ctx->gen)
-			continue;
-
-		opcode_3d = &opcodes_3d[i];
-		break;
-	}
+	i = ctx->index_3d_965[opcode & 0x1fff];
+	if (i)
+		opcode_3d = &opcodes_3d_965[i - 1];
 
 	if (opcode_3d) {
 		if (opcode_3d->max_len == 1)
@@ -3260,9 +3438,9 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 		if (len < opcode_3d->min_len ||
 		    len > opcode_3d->max_len) {
-			fprintf(out, "Bad length %d in %s, expected %d-%d\n",
-				len, opcode_3d->name,
-				opcode_3d->min_len, opcode_3d->max_len);
+			decode_printf(ctx, "Bad length %d in %s, expected %d-%d\n",
+				      len, opcode_3d->name,
+				      opcode_3d->min_len, opcode_3d->max_len);
 		}
 	} else {
 		len = (data[0] & 0x0000ffff) + 2;
@@ -3297,7 +3475,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		else
 			sba_len = 6;
 		if (len != sba_len)
-			fprintf(out, "Bad count in STATE_BASE_ADDRESS\n");
+			decode_printf(ctx, "Bad count in STATE_BASE_ADDRESS\n");
 
 		state_base_out(ctx, i++, "general");
 		state_base_out(ctx, i++, "surface");
@@ -3326,8 +3504,8 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 	case 0x7801:
 		if (len != 6 && len != 4)
-			fprintf(out,
-				"Bad count in 3DSTATE_BINDING_TABLE_POINTERS\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_BINDING_TABLE_POINTERS\n");
 		if (len == 6) {
 			instr_out(ctx, 0,
 				  "3DSTATE_BINDING_TABLE_POINTERS\n");
@@ -3375,7 +3553,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7808:
 		if ((len - 1) % 4 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
 		instr_out(ctx, 0, "3DSTATE_VERTEX_BUFFERS\n");
 
 		for (i = 1; i < len;) {
@@ -3400,7 +3578,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7809:
 		if ((len + 1) % 2 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
 		instr_out(ctx, 0, "3DSTATE_VERTEX_ELEMENTS\n");
 
 		for (i = 1; i < len;) {
@@ -3628,7 +3806,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	case 0x7a00:
 		if (IS_GEN6(devid) || IS_GEN7(devid)) {
 			if (len != 4 && len != 5)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				decode_printf(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[1] >> 14) & 0x3) {
 			case 0:
@@ -3694,7 +3872,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 			return len;
 		} else {
 			if (len != 4)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				decode_printf(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[0] >> 14) & 0x3) {
 			case 0:
@@ -3742,6 +3920,25 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+static const struct decode_opcode_3d opcodes_3d_i830[] = {
+	{ 0x02, 1, 1, "3DSTATE_MODES_3" },
+	{ 0x03, 1, 1, "3DSTATE_ENABLES_1" },
+	{ 0x04, 1, 1, "3DSTATE_ENABLES_2" },
+	{ 0x05, 1, 1, "3DSTATE_VFT0" },
+	{ 0x06, 1, 1, "3DSTATE_AA" },
+	{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES" },
+	{ 0x08, 1, 1, "3DSTATE_MODES_1" },
+	{ 0x09, 1, 1, "3DSTATE_STENCIL_TEST" },
+	{ 0x0a, 1, 1, "3DSTATE_VFT1" },
+	{ 0x0b, 1, 1, "3DSTATE_INDPT_ALPHA_BLEND" },
+	{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
+	{ 0x0d, 1, 1, "3DSTATE_MAP_BLEND_OP" },
+	{ 0x0e, 1, 1, "3DSTATE_MAP_BLEND_ARG" },
+	{ 0x0f, 1, 1, "3DSTATE_MODES_2" },
+	{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
+	{ 0x16, 1, 1, "3DSTATE_MODES_4"},
+};
+
 static int
 decode_3d_i830(struct drm_intel_decode *ctx)
 {
@@ -3749,30 +3946,6 @@ decode_3d_i830(struct drm_intel_decode *ctx)
 	uint32_t opcode;
 	uint32_t *data = ctx->data;
 
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d[] = {
-		{ 0x02, 1, 1, "3DSTATE_MODES_3" },
-		{ 0x03, 1, 1, "3DSTATE_ENABLES_1" },
-		{ 0x04, 1, 1, "3DSTATE_ENABLES_2" },
-		{ 0x05, 1, 1, "3DSTATE_VFT0" },
-		{ 0x06, 1, 1, "3DSTATE_AA" },
-		{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES" },
-		{ 0x08, 1, 1, "3DSTATE_MODES_1" },
-		{ 0x09, 1, 1, "3DSTATE_STENCIL_TEST" },
-		{ 0x0a, 1, 1, "3DSTATE_VFT1" },
-		{ 0x0b, 1, 1, "3DSTATE_INDPT_ALPHA_BLEND" },
-		{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
-		{ 0x0d, 1, 1, "3DSTATE_MAP_BLEND_OP" },
-		{ 0x0e, 1, 1, "3DSTATE_MAP_BLEND_ARG" },
-		{ 0x0f, 1, 1, "3DSTATE_MODES_2" },
-		{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
-		{ 0x16, 1, 1, "3DSTATE_MODES_4"},
-	}, *opcode_3d;
-
 	opcode = (data[0] & 0x1f000000) >> 24;
 
 	switch (opcode) {
@@ -3784,31 +3957,180 @@ decode_3d_i830(struct drm_intel_decode *ctx)
 		return decode_3d_1c(ctx);
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d); idx++) {
-		opcode_3d = &opcodes_3d[idx];
-		if ((data[0] & 0x1f000000) >> 24 == opcode_3d->opcode) {
-			unsigned int len = 1, i;
+	idx = ctx->index_3d[opcode];
+	if (idx)
+		return decode_3d_generic(ctx, &opcodes_3d_i830[idx - 1]);
 
-			instr_out(ctx, 0, "%s\n", opcode_3d->name);
-			if (opcode_3d->max_len > 1) {
-				len = (data[0] & 0xff) + 2;
-				if (len < opcode_3d->min_len ||
-				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d->name);
-				}
-			}
+	instr_out(ctx, 0, "3D UNKNOWN: 3d_i830 opcode = 0x%x\n",
+		  opcode);
+	return 1;
+}
 
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
-			return len;
+/* Fills in the opcode dispatch tables, the first entry for an opcode wins. */
+#define DECODE_INDEX_ADD(index, opcode, i) do {	\
+	if (!(index)[opcode])				\
+		(index)[opcode] = (i) + 1;		\
+} while (0)
+
+static void
+decode_index_init(struct drm_intel_decode *ctx)
+{
+	uint32_t devid = ctx->devid;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(opcodes_mi); i++)
+		DECODE_INDEX_ADD(ctx->index_mi, opcodes_mi[i].opcode, i);
+
+	for (i = 0; i < ARRAY_SIZE(opcodes_2d); i++)
+		DECODE_INDEX_ADD(ctx->index_2d, opcodes_2d[i].opcode, i);
+
+	for (i = 0; i < ARRAY_SIZE(opcodes_3d_1d); i++) {
+		if (opcodes_3d_1d[i].i830_only && !IS_GEN2(devid))
+			continue;
+		DECODE_INDEX_ADD(ctx->index_3d_1d, opcodes_3d_1d[i].opcode, i);
+	}
+
+	if (IS_GEN3(devid)) {
+		for (i = 0; i < ARRAY_SIZE(opcodes_3d); i++)
+			DECODE_INDEX_ADD(ctx->index_3d, opcodes_3d[i].opcode, i);
+	} else {
+		for (i = 0; i < ARRAY_SIZE(opcodes_3d_i830); i++)
+			DECODE_INDEX_ADD(ctx->index_3d,
+					 opcodes_3d_i830[i].opcode, i);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(opcodes_3d_965); i++) {
+		/* If it's marked as not our gen, skip. */
+		if (opcodes_3d_965[i].gen && opcodes_3d_965[i].gen != ctx->gen)
+			continue;
+		DECODE_INDEX_ADD(ctx->index_3d_965,
+				 opcodes_3d_965[i].opcode & 0x1fff, i);
+	}
+}
+
+static bool
+decode_is_965(struct drm_intel_decode *ctx)
+{
+	return IS_9XX(ctx->devid) && !IS_GEN3(ctx->devid);
+}
+
+/* The header of a packet with the length and flag fields masked off. */
+static uint32_t
+decode_opcode(struct drm_intel_decode *ctx, uint32_t header)
+{
+	switch (header >> 29) {
+	case 0x0:
+		return header & 0xff800000;
+	case 0x2:
+		return header & 0xffc00000;
+	case 0x3:
+		if (decode_is_965(ctx))
+			return header & 0xffff0000;
+
+		switch ((header >> 24) & 0x1f) {
+		case 0x1d:
+			return header & 0xffff0000;
+		case 0x1c:
+			return header & 0xfff80000;
+		default:
+			return header & 0xff000000;
 		}
+	default:
+		return header & 0xe0000000;
 	}
+}
 
-	instr_out(ctx, 0, "3D UNKNOWN: 3d_i830 opcode = 0x%x\n",
-		  opcode);
-	return 1;
+static const char *
+decode_opcode_name(struct drm_intel_decode *ctx, uint32_t opcode)
+{
+	unsigned int idx;
+
+	switch (opcode >> 29) {
+	case 0x0:
+		idx = ctx->index_mi[(opcode >> 23) & 0x3f];
+		return idx ? opcodes_mi[idx - 1].name : NULL;
+	case 0x2:
+		idx = ctx->index_2d[(opcode >> 22) & 0x7f];
+		return idx ? opcodes_2d[idx - 1].name : NULL;
+	case 0x3:
+		if (decode_is_965(ctx)) {
+			idx = ctx->index_3d_965[(opcode >> 16) & 0x1fff];
+			return idx ? opcodes_3d_965[idx - 1].name : NULL;
+		}
+
+		switch ((opcode >> 24) & 0x1f) {
+		case 0x1f:
+			return "3DPRIMITIVE";
+		case 0x1d:
+			idx = ctx->index_3d_1d[(opcode >> 16) & 0xff];
+			return idx ? opcodes_3d_1d[idx - 1].name : NULL;
+		case 0x1c:
+			return NULL;
+		}
+
+		idx = ctx->index_3d[(opcode >> 24) & 0x1f];
+		if (!idx)
+			return NULL;
+		if (IS_GEN3(ctx->devid))
+			return opcodes_3d[idx - 1].name;
+		return opcodes_3d_i830[idx - 1].name;
+	}
+
+	return NULL;
+}
+
+static unsigned int
+decode_opcode_hash(uint32_t opcode)
+{
+	return ((opcode >> 16) * 0x9e3779b1u) >> 16;
+}
+
+static void
+decode_opcode_stats_add(struct drm_intel_decode *ctx, uint32_t opcode,
+			uint32_t dwords)
+{
+	struct drm_intel_decode_opcode_stats *entry;
+	unsigned int mask, i;
+
+	if (ctx->opcode_stats_used * 2 >= ctx->opcode_stats_size) {
+		struct drm_intel_decode_opcode_stats *table, *old;
+		unsigned int size = ctx->opcode_stats_size;
+
+		size = size ? size * 2 : 64;
+		table = calloc(size, sizeof(*table));
+		if (!table)
+			return;
+
+		old = ctx->opcode_stats_table;
+		for (i = 0; i < ctx->opcode_stats_size; i++) {
+			unsigned int j = decode_opcode_hash(old[i].opcode);
+
+			if (!old[i].count)
+				continue;
+			while (table[j & (size - 1)].count)
+				j++;
+			table[j & (size - 1)] = old[i];
+		}
+		free(old);
+
+		ctx->opcode_stats_table = table;
+		ctx->opcode_stats_size = size;
+	}
+
+	mask = ctx->opcode_stats_size - 1;
+	for (i = decode_opcode_hash(opcode);; i++) {
+		entry = &ctx->opcode_stats_table[i & mask];
+		if (!entry->count) {
+			entry->opcode = opcode;
+			ctx->opcode_stats_used++;
+			break;
+		}
+		if (entry->opcode == opcode)
+			break;
+	}
+
+	entry->count++;
+	entry->dwords += dwords;
 }
 
 drm_public struct drm_intel_decode *
@@ -3845,6 +4167,7 @@ drm_intel_decode_context_alloc(uint32_t devid)
 	ctx->devid = devid;
 	ctx->gen = gen;
 	ctx->out = stdout;
+	decode_index_init(ctx);
 
 	return ctx;
 }
@@ -3852,6 +4175,11 @@ drm_intel_decode_context_alloc(uint32_t devid)
 drm_public void
 drm_intel_decode_context_free(struct drm_intel_decode *ctx)
 {
+	if (!ctx)
+		return;
+
+	free(ctx->opcode_stats_table);
+	free(ctx->text);
 	free(ctx);
 }
 
@@ -3886,6 +4214,97 @@ drm_intel_decode_set_output_file(struct drm_intel_decode *ctx,
 	ctx->out = output;
 }
 
+/**
+ * Selects what drm_intel_decode() writes to the output file, one of
+ * DRM_INTEL_DECODE_FORMAT_*.
+ */
+drm_public int
+drm_intel_decode_set_output_format(struct drm_intel_decode *ctx, int format)
+{
+	switch (format) {
+	case DRM_INTEL_DECODE_FORMAT_TEXT:
+	case DRM_INTEL_DECODE_FORMAT_JSON:
+	case DRM_INTEL_DECODE_FORMAT_BINARY:
+	case DRM_INTEL_DECODE_FORMAT_NONE:
+		ctx->format = format;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/**
+ * Passes the lines of the dump to \p func instead of writing them to the
+ * output file, until it is called again with a NULL \p func.
+ */
+drm_public void
+drm_intel_decode_set_output_func(struct drm_intel_decode *ctx,
+				 drm_intel_decode_line_func func, void *data)
+{
+	ctx->line_func = func;
+	ctx->line_data = data;
+}
+
+/**
+ * Starts or stops counting the packets and dwords of each opcode in the
+ * batches decoded, the counts start from zero each time.
+ */
+drm_public void
+drm_intel_decode_set_opcode_stats(struct drm_intel_decode *ctx, int enable)
+{
+	free(ctx->opcode_stats_table);
+	ctx->opcode_stats_table = NULL;
+	ctx->opcode_stats_size = 0;
+	ctx->opcode_stats_used = 0;
+	ctx->opcode_stats = !!enable;
+}
+
+static int
+decode_opcode_stats_compare(const void *a, const void *b)
+{
+	const struct drm_intel_decode_opcode_stats *sa = a, *sb = b;
+
+	return sa->opcode < sb->opcode ? -1 : sa->opcode > sb->opcode;
+}
+
+/**
+ * Copies up to \p count opcode statistics, in opcode order.
+ *
+ * \return the number of opcodes seen, or a negative errno.
+ */
+drm_public int
+drm_intel_decode_get_opcode_stats(struct drm_intel_decode *ctx,
+				  struct drm_intel_decode_opcode_stats *stats,
+				  int count)
+{
+	struct drm_intel_decode_opcode_stats *sorted;
+	unsigned int i, n = 0;
+
+	if (!ctx || count < 0 || (count && !stats))
+		return -EINVAL;
+
+	if (!ctx->opcode_stats_used)
+		return 0;
+
+	sorted = malloc(ctx->opcode_stats_used * sizeof(*sorted));
+	if (!sorted)
+		return -ENOMEM;
+
+	for (i = 0; i < ctx->opcode_stats_size; i++) {
+		if (ctx->opcode_stats_table[i].count)
+			sorted[n++] = ctx->opcode_stats_table[i];
+	}
+	qsort(sorted, n, sizeof(*sorted), decode_opcode_stats_compare);
+
+	for (i = 0; i < n && (int)i < count; i++) {
+		stats[i] = sorted[i];
+		stats[i].name = decode_opcode_name(ctx, sorted[i].opcode);
+	}
+	free(sorted);
+
+	return n;
+}
+
 /**
  * Decodes an i830-i915 batch buffer, writing the output to stdout.
  *
@@ -3897,7 +4316,7 @@ drm_public void
 drm_intel_decode(struct drm_intel_decode *ctx)
 {
 	int ret;
-	unsigned int index = 0;
+	unsigned int index = 0, len;
 	uint32_t devid;
 	int size;
 	void *temp;
@@ -3911,6 +4330,8 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 	 */
 	size = ctx->base_count * 4;
 	temp = malloc(size + 4096);
+	if (!temp)
+		return;
 	memcpy(temp, ctx->base_data, size);
 	memset((char *)temp + size, 0xd0, 4096);
 	ctx->data = temp;
@@ -3919,12 +4340,9 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 	ctx->count = ctx->base_count;
 
 	devid = ctx->devid;
-	head_offset = ctx->head;
-	tail_offset = ctx->tail;
-	out = ctx->out;
 
-	saved_s2_set = 0;
-	saved_s4_set = 1;
+	ctx->saved_s2_set = 0;
+	ctx->saved_s4_set = 1;
 
 	while (ctx->count > 0) {
 		index = 0;
@@ -3939,7 +4357,9 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 			 * since it'll just confuse in the common
 			 * case.
 			 */
+			len = ret;
 			if (ret == -1) {
+				len = 1;
 				if (ctx->dump_past_end) {
 					index++;
 				} else {
@@ -3952,25 +4372,45 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 				index += ret;
 			break;
 		case 0x2:
-			index += decode_2d(ctx);
+			len = decode_2d(ctx);
+			index += len;
 			break;
 		case 0x3:
 			if (IS_9XX(devid) && !IS_GEN3(devid)) {
-				index +=
-				    decode_3d_965(ctx);
+				len = decode_3d_965(ctx);
 			} else if (IS_GEN3(devid)) {
-				index += decode_3d(ctx);
+				len = decode_3d(ctx);
 			} else {
-				index +=
-				    decode_3d_i830(ctx);
+				len = decode_3d_i830(ctx);
 			}
+			index += len;
 			break;
 		default:
 			instr_out(ctx, index, "UNKNOWN\n");
+			len = 1;
 			index++;
 			break;
 		}
-		fflush(out);
+
+		if (len > ctx->count)
+			len = ctx->count;
+		if (ctx->format == DRM_INTEL_DECODE_FORMAT_BINARY ||
+		    ctx->opcode_stats) {
+			uint32_t opcode = decode_opcode(ctx, ctx->data[0]);
+
+			if (ctx->opcode_stats)
+				decode_opcode_stats_add(ctx, opcode, len);
+			if (ctx->format == DRM_INTEL_DECODE_FORMAT_BINARY &&
+			    !ctx->line_func) {
+				struct drm_intel_decode_record record = {
+					.offset = ctx->hw_offset,
+					.opcode = opcode,
+					.dwords = len,
+				};
+
+				fwrite(&record, sizeof(record), 1, ctx->out);
+			}
+		}
 
 		if (ctx->count < index)
 			break;
@@ -3980,5 +4420,10 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 		ctx->hw_offset += 4 * index;
 	}
 
+	if (ctx->line_open)
+		decode_line_emit(ctx);
+	if (!ctx->line_func)
+		fflush(ctx->out);
+
 	free(temp);
 }
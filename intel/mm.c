@@ -22,20 +22,145 @@
  *
  */
 
+/*
+ * Segregated-fit allocator: free blocks are kept in lists by size class,
+ * a power of two split into MM_SL_COUNT linear steps, with a bitmap of the
+ * non-empty lists. All blocks, free or not, stay in a list by address so
+ * freed blocks join their free neighbours in constant time.
+ */
+
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <assert.h>
 
 #include "xf86drm.h"
 #include "libdrm_macros.h"
 #include "mm.h"
 
+#define MM_SL_BITS	3
+#define MM_SL_COUNT	(1 << MM_SL_BITS)
+#define MM_FL_COUNT	32
+
+struct mem_heap {
+	/* mmInit() hands this out, the address list starts and ends here */
+	struct mem_block head;
+
+	unsigned int fl_bitmap;
+	unsigned int sl_bitmap[MM_FL_COUNT];
+	struct mem_block *free[MM_FL_COUNT][MM_SL_COUNT];
+
+	/* Unused block structures, linked by next */
+	struct mem_block *spare;
+
+	int size;
+	int free_size;
+	int free_blocks;
+	int used_blocks;
+};
+
+static inline struct mem_heap *mm_heap(const struct mem_block *block)
+{
+	return (struct mem_heap *)block->heap;
+}
+
+static inline int mm_log2(unsigned int v)
+{
+	return 31 - __builtin_clz(v);
+}
+
+static void mm_mapping(int size, int *fl, int *sl)
+{
+	if (size < MM_SL_COUNT) {
+		*fl = 0;
+		*sl = size;
+	} else {
+		int log = mm_log2(size);
+
+		*fl = log - MM_SL_BITS + 1;
+		*sl = (size >> (log - MM_SL_BITS)) - MM_SL_COUNT;
+	}
+}
+
+static void mm_insert_free(struct mem_heap *heap, struct mem_block *p)
+{
+	int fl, sl;
+
+	mm_mapping(p->size, &fl, &sl);
+
+	p->free = 1;
+	p->prev_free = NULL;
+	p->next_free = heap->free[fl][sl];
+	if (p->next_free)
+		p->next_free->prev_free = p;
+	heap->free[fl][sl] = p;
+
+	heap->fl_bitmap |= 1u << fl;
+	heap->sl_bitmap[fl] |= 1u << sl;
+	heap->free_size += p->size;
+	heap->free_blocks++;
+}
+
+static void mm_remove_free(struct mem_heap *heap, struct mem_block *p)
+{
+	int fl, sl;
+
+	mm_mapping(p->size, &fl, &sl);
+
+	if (p->next_free)
+		p->next_free->prev_free = p->prev_free;
+	if (p->prev_free)
+		p->prev_free->next_free = p->next_free;
+	else
+		heap->free[fl][sl] = p->next_free;
+
+	if (!heap->free[fl][sl]) {
+		heap->sl_bitmap[fl] &= ~(1u << sl);
+		if (!heap->sl_bitmap[fl])
+			heap->fl_bitmap &= ~(1u << fl);
+	}
+
+	p->free = 0;
+	p->next_free = NULL;
+	p->prev_free = NULL;
+	heap->free_size -= p->size;
+	heap->free_blocks--;
+}
+
+static struct mem_block *mm_new_block(struct mem_heap *heap)
+{
+	struct mem_block *p = heap->spare;
+
+	if (p) {
+		heap->spare = p->next;
+		memset(p, 0, sizeof(*p));
+	} else {
+		p = calloc(1, sizeof(*p));
+		if (!p)
+			return NULL;
+	}
+	p->heap = &heap->head;
+	return p;
+}
+
+static void mm_unlink_block(struct mem_heap *heap, struct mem_block *p)
+{
+	p->prev->next = p->next;
+	p->next->prev = p->prev;
+
+	p->next = heap->spare;
+	heap->spare = p;
+}
+
 drm_private void mmDumpMemInfo(const struct mem_block *heap)
 {
 	drmMsg("Memory heap %p:\n", (void *)heap);
 	if (heap == 0) {
 		drmMsg("  heap == 0\n");
 	} else {
+		const struct mem_heap *h = mm_heap(heap);
 		const struct mem_block *p;
+		int fl, sl;
 
 		for (p = heap->next; p != heap; p = p->next) {
 			drmMsg("  Offset:%08x, Size:%08x, %c%c\n", p->ofs,
@@ -45,10 +170,15 @@ drm_private void mmDumpMemInfo(const struct mem_block *heap)
 
 		drmMsg("\nFree list:\n");
 
-		for (p = heap->next_free; p != heap; p = p->next_free) {
-			drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n", p->ofs,
-			       p->size, p->free ? 'F' : '.',
-			       p->reserved ? 'R' : '.');
+		for (fl = 0; fl < MM_FL_COUNT; fl++) {
+			for (sl = 0; sl < MM_SL_COUNT; sl++) {
+				for (p = h->free[fl][sl]; p; p = p->next_free) {
+					drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n",
+					       p->ofs, p->size,
+					       p->free ? 'F' : '.',
+					       p->reserved ? 'R' : '.');
+				}
+			}
 		}
 
 	}
@@ -57,167 +187,193 @@ drm_private void mmDumpMemInfo(const struct mem_block *heap)
 
 drm_private struct mem_block *mmInit(int ofs, int size)
 {
-	struct mem_block *heap, *block;
+	struct mem_heap *heap;
+	struct mem_block *block;
 
-	if (size <= 0)
+	if (size <= 0 || ofs < 0 || ofs > INT_MAX - size)
 		return NULL;
 
-	heap = (struct mem_block *)calloc(1, sizeof(struct mem_block));
+	heap = calloc(1, sizeof(*heap));
 	if (!heap)
 		return NULL;
 
-	block = (struct mem_block *)calloc(1, sizeof(struct mem_block));
+	heap->head.heap = &heap->head;
+	heap->head.next = &heap->head;
+	heap->head.prev = &heap->head;
+
+	block = mm_new_block(heap);
 	if (!block) {
 		free(heap);
 		return NULL;
 	}
 
-	heap->next = block;
-	heap->prev = block;
-	heap->next_free = block;
-	heap->prev_free = block;
-
-	block->heap = heap;
-	block->next = heap;
-	block->prev = heap;
-	block->next_free = heap;
-	block->prev_free = heap;
+	block->next = &heap->head;
+	block->prev = &heap->head;
+	heap->head.next = block;
+	heap->head.prev = block;
 
 	block->ofs = ofs;
 	block->size = size;
-	block->free = 1;
+	heap->size = size;
+	mm_insert_free(heap, block);
+
+	return &heap->head;
+}
+
+/* First aligned offset in p for size, or -1 */
+static int mm_fit(const struct mem_block *p, int size, int mask,
+		  int startSearch)
+{
+	long long startofs = ((long long)p->ofs + mask) & ~(long long)mask;
 
-	return heap;
+	if (startofs < startSearch)
+		startofs = startSearch;
+	if (startofs + size > (long long)p->ofs + p->size)
+		return -1;
+	return startofs;
+}
+
+/*
+ * Any block in the lists from the class of size + mask, rounded up to the
+ * next class, fits.
+ */
+static struct mem_block *mm_find_free(struct mem_heap *heap, long long size)
+{
+	unsigned int map;
+	int fl, sl;
+
+	if (size >= MM_SL_COUNT)
+		size += (1ll << (mm_log2(size) - MM_SL_BITS)) - 1;
+	if (size > INT_MAX)
+		return NULL;
+
+	mm_mapping(size, &fl, &sl);
+
+	map = heap->sl_bitmap[fl] & (~0u << sl);
+	if (!map) {
+		map = fl + 1 < MM_FL_COUNT ?
+			heap->fl_bitmap & (~0u << (fl + 1)) : 0;
+		if (!map)
+			return NULL;
+		fl = __builtin_ctz(map);
+		map = heap->sl_bitmap[fl];
+	}
+	sl = __builtin_ctz(map);
+
+	return heap->free[fl][sl];
+}
+
+/* Look at every free block that may be large enough */
+static struct mem_block *mm_search_free(struct mem_heap *heap, int size,
+					int mask, int startSearch)
+{
+	struct mem_block *p;
+	unsigned int map;
+	int fl, sl;
+
+	mm_mapping(size, &fl, &sl);
+
+	for (; fl < MM_FL_COUNT; fl++, sl = 0) {
+		map = heap->sl_bitmap[fl] & (~0u << sl);
+		while (map) {
+			sl = __builtin_ctz(map);
+			map &= map - 1;
+
+			for (p = heap->free[fl][sl]; p; p = p->next_free) {
+				if (mm_fit(p, size, mask, startSearch) >= 0)
+					return p;
+			}
+		}
+	}
+
+	return NULL;
 }
 
 static struct mem_block *SliceBlock(struct mem_block *p,
 				    int startofs, int size,
 				    int reserved, int alignment)
 {
+	struct mem_heap *heap = mm_heap(p);
 	struct mem_block *newblock;
 
+	mm_remove_free(heap, p);
+
 	/* break left  [p, newblock, p->next], then p = newblock */
 	if (startofs > p->ofs) {
-		newblock =
-		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		newblock = mm_new_block(heap);
+		if (!newblock) {
+			mm_insert_free(heap, p);
 			return NULL;
+		}
 		newblock->ofs = startofs;
 		newblock->size = p->size - (startofs - p->ofs);
-		newblock->free = 1;
-		newblock->heap = p->heap;
 
 		newblock->next = p->next;
 		newblock->prev = p;
 		p->next->prev = newblock;
 		p->next = newblock;
 
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
-
 		p->size -= newblock->size;
+		mm_insert_free(heap, p);
 		p = newblock;
 	}
 
 	/* break right, also [p, newblock, p->next] */
 	if (size < p->size) {
-		newblock =
-		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		newblock = mm_new_block(heap);
+		if (!newblock) {
+			mm_insert_free(heap, p);
 			return NULL;
+		}
 		newblock->ofs = startofs + size;
 		newblock->size = p->size - size;
-		newblock->free = 1;
-		newblock->heap = p->heap;
 
 		newblock->next = p->next;
 		newblock->prev = p;
 		p->next->prev = newblock;
 		p->next = newblock;
 
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
-
 		p->size = size;
+		mm_insert_free(heap, newblock);
 	}
 
 	/* p = middle block */
-	p->free = 0;
-
-	/* Remove p from the free list: 
-	 */
-	p->next_free->prev_free = p->prev_free;
-	p->prev_free->next_free = p->next_free;
-
-	p->next_free = 0;
-	p->prev_free = 0;
-
 	p->reserved = reserved;
+	heap->used_blocks++;
 	return p;
 }
 
 drm_private struct mem_block *mmAllocMem(struct mem_block *heap, int size,
 					 int align2, int startSearch)
 {
-	struct mem_block *p;
-	const int mask = (1 << align2) - 1;
-	int startofs = 0;
-	int endofs;
+	struct mem_heap *h;
+	struct mem_block *p = NULL;
+	int mask, startofs;
 
-	if (!heap || align2 < 0 || size <= 0)
+	if (!heap || align2 < 0 || align2 > 30 || size <= 0)
 		return NULL;
 
-	for (p = heap->next_free; p != heap; p = p->next_free) {
-		assert(p->free);
+	h = mm_heap(heap);
+	mask = (1 << align2) - 1;
 
-		startofs = (p->ofs + mask) & ~mask;
-		if (startofs < startSearch) {
-			startofs = startSearch;
-		}
-		endofs = startofs + size;
-		if (endofs <= (p->ofs + p->size))
-			break;
-	}
-
-	if (p == heap)
+	if (startSearch <= 0)
+		p = mm_find_free(h, (long long)size + mask);
+	if (!p)
+		p = mm_search_free(h, size, mask, startSearch);
+	if (!p)
 		return NULL;
 
-	assert(p->free);
-	p = SliceBlock(p, startofs, size, 0, mask + 1);
-
-	return p;
-}
-
-static int Join2Blocks(struct mem_block *p)
-{
-	/* XXX there should be some assertions here */
+	startofs = mm_fit(p, size, mask, startSearch);
+	assert(p->free && startofs >= 0);
 
-	/* NOTE: heap->free == 0 */
-
-	if (p->free && p->next->free) {
-		struct mem_block *q = p->next;
-
-		assert(p->ofs + p->size == q->ofs);
-		p->size += q->size;
-
-		p->next = q->next;
-		q->next->prev = p;
-
-		q->next_free->prev_free = q->prev_free;
-		q->prev_free->next_free = q->next_free;
-
-		free(q);
-		return 1;
-	}
-	return 0;
+	return SliceBlock(p, startofs, size, 0, mask + 1);
 }
 
 drm_private int mmFreeMem(struct mem_block *b)
 {
+	struct mem_heap *heap;
+	struct mem_block *q;
+
 	if (!b)
 		return 0;
 
@@ -230,31 +386,75 @@ drm_private int mmFreeMem(struct mem_block *b)
 		return -1;
 	}
 
-	b->free = 1;
-	b->next_free = b->heap->next_free;
-	b->prev_free = b->heap;
-	b->next_free->prev_free = b;
-	b->prev_free->next_free = b;
+	heap = mm_heap(b);
+	heap->used_blocks--;
+
+	/* The head of the address list is never free */
+	q = b->next;
+	if (q->free) {
+		assert(b->ofs + b->size == q->ofs);
+		mm_remove_free(heap, q);
+		b->size += q->size;
+		mm_unlink_block(heap, q);
+	}
 
-	Join2Blocks(b);
-	if (b->prev != b->heap)
-		Join2Blocks(b->prev);
+	q = b->prev;
+	if (q->free) {
+		assert(q->ofs + q->size == b->ofs);
+		mm_remove_free(heap, q);
+		q->size += b->size;
+		mm_unlink_block(heap, b);
+		b = q;
+	}
+
+	mm_insert_free(heap, b);
 
 	return 0;
 }
 
+drm_private void mmGetStats(const struct mem_block *heap,
+			    struct mem_stats *stats)
+{
+	const struct mem_heap *h = mm_heap(heap);
+	const struct mem_block *p;
+	int fl, sl;
+
+	stats->size = h->size;
+	stats->free = h->free_size;
+	stats->free_blocks = h->free_blocks;
+	stats->used_blocks = h->used_blocks;
+	stats->largest_free = 0;
+
+	/* The largest block is in the highest non-empty list */
+	if (h->fl_bitmap) {
+		fl = mm_log2(h->fl_bitmap);
+		sl = mm_log2(h->sl_bitmap[fl]);
+		for (p = h->free[fl][sl]; p; p = p->next_free) {
+			if (p->size > stats->largest_free)
+				stats->largest_free = p->size;
+		}
+	}
+}
+
 drm_private void mmDestroy(struct mem_block *heap)
 {
+	struct mem_heap *h;
 	struct mem_block *p;
 
 	if (!heap)
 		return;
 
+	h = mm_heap(heap);
 	for (p = heap->next; p != heap;) {
 		struct mem_block *next = p->next;
 		free(p);
 		p = next;
 	}
+	for (p = h->spare; p;) {
+		struct mem_block *next = p->next;
+		free(p);
+		p = next;
+	}
 
-	free(heap);
+	free(h);
 }
@@ -67,6 +67,22 @@ drm_private extern struct mem_block *mmAllocMem(struct mem_block *heap,
  */
 drm_private extern int mmFreeMem(struct mem_block *b);
 
+/**
+ * Fragmentation report of a heap, sizes in the units of mmInit().
+ * 1 - largest_free / free is the share of free space that can't be
+ * handed out as one block.
+ */
+struct mem_stats {
+	int size;
+	int free;
+	int largest_free;
+	int free_blocks;
+	int used_blocks;
+};
+
+drm_private extern void mmGetStats(const struct mem_block *heap,
+				   struct mem_stats *stats);
+
 /**
  * destroy MM
  */
@@ -29,6 +29,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <err.h>
+#include <time.h>
 
 #include "libdrm_macros.h"
 #include "intel_bufmgr.h"
@@ -42,6 +43,9 @@ usage(void)
 	fprintf(stderr, "usage:\n");
 	fprintf(stderr, "  test_decode <batch>\n");
 	fprintf(stderr, "  test_decode <batch> -dump\n");
+	fprintf(stderr, "  test_decode <batch> -json\n");
+	fprintf(stderr, "  test_decode <batch> -stats\n");
+	fprintf(stderr, "  test_decode <batch> -bench [iterations]\n");
 	exit(1);
 }
 
@@ -68,7 +72,8 @@ read_file(const char *filename, void **ptr, size_t *size)
 }
 
 static void
-dump_batch(struct drm_intel_decode *ctx, const char *batch_filename)
+dump_batch(struct drm_intel_decode *ctx, const char *batch_filename,
+	   int format)
 {
 	void *batch_ptr;
 	size_t batch_size;
@@ -78,10 +83,127 @@ dump_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
 					   batch_size / 4);
 	drm_intel_decode_set_output_file(ctx, stdout);
+	drm_intel_decode_set_output_format(ctx, format);
 
 	drm_intel_decode(ctx);
 }
 
+static void
+dump_stats(struct drm_intel_decode *ctx, const char *batch_filename)
+{
+	struct drm_intel_decode_opcode_stats *stats;
+	int i, n;
+
+	drm_intel_decode_set_opcode_stats(ctx, 1);
+	dump_batch(ctx, batch_filename, DRM_INTEL_DECODE_FORMAT_NONE);
+
+	n = drm_intel_decode_get_opcode_stats(ctx, NULL, 0);
+	stats = calloc(n, sizeof(*stats));
+	if (n < 0 || !stats)
+		errx(1, "couldn't get the opcode statistics");
+	n = drm_intel_decode_get_opcode_stats(ctx, stats, n);
+
+	for (i = 0; i < n; i++) {
+		printf("0x%08x %-40s %8llu packets %10llu dwords\n",
+		       stats[i].opcode,
+		       stats[i].name ? stats[i].name : "UNKNOWN",
+		       (unsigned long long)stats[i].count,
+		       (unsigned long long)stats[i].dwords);
+	}
+	free(stats);
+}
+
+/* Puts the text dump back together from the lines the decoder passes on. */
+static void
+text_line(void *data, const struct drm_intel_decode_line *line)
+{
+	const char *parseinfo = "    ";
+	FILE *out = data;
+
+	if (line->flags & DRM_INTEL_DECODE_LINE_MESSAGE) {
+		fprintf(out, "%s\n", line->text);
+		return;
+	}
+
+	if (line->flags & DRM_INTEL_DECODE_LINE_HEAD)
+		parseinfo = "HEAD";
+	else if (line->flags & DRM_INTEL_DECODE_LINE_TAIL)
+		parseinfo = "TAIL";
+
+	fprintf(out, "0x%08x: %s 0x%08x: %s%s\n", line->offset, parseinfo,
+		line->dword, line->index == 0 ? "" : "   ", line->text);
+}
+
+static void
+count_line(void *data, const struct drm_intel_decode_line *line)
+{
+	(*(uint64_t *)data)++;
+}
+
+static uint64_t
+get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+bench_batch(struct drm_intel_decode *ctx, const char *batch_filename,
+	    unsigned int iterations)
+{
+	static const struct {
+		const char *name;
+		int format;
+		int stats;
+		int func;
+	} sinks[] = {
+		{ "text", DRM_INTEL_DECODE_FORMAT_TEXT },
+		{ "json", DRM_INTEL_DECODE_FORMAT_JSON },
+		{ "binary", DRM_INTEL_DECODE_FORMAT_BINARY },
+		{ "callback", DRM_INTEL_DECODE_FORMAT_TEXT, 0, 1 },
+		{ "stats", DRM_INTEL_DECODE_FORMAT_NONE, 1 },
+	};
+	void *batch_ptr;
+	size_t batch_size;
+	unsigned int i, j;
+	uint64_t lines;
+	FILE *out;
+
+	read_file(batch_filename, &batch_ptr, &batch_size);
+
+	out = fopen("/dev/null", "w");
+	if (!out)
+		errx(1, "couldn't open /dev/null");
+
+	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
+					   batch_size / 4);
+	drm_intel_decode_set_output_file(ctx, out);
+
+	for (i = 0; i < sizeof(sinks) / sizeof(sinks[0]); i++) {
+		uint64_t start, delta;
+
+		drm_intel_decode_set_output_format(ctx, sinks[i].format);
+		drm_intel_decode_set_output_func(ctx, sinks[i].func ?
+						 count_line : NULL, &lines);
+		drm_intel_decode_set_opcode_stats(ctx, sinks[i].stats);
+
+		start = get_time_ns();
+		for (j = 0; j < iterations; j++)
+			drm_intel_decode(ctx);
+		delta = get_time_ns() - start;
+
+		printf("%-10s %10.1f MB/s %8.1f ns/dword\n", sinks[i].name,
+		       (double)batch_size * iterations * 1000.0 / delta,
+		       (double)delta * 4 / batch_size / iterations);
+	}
+
+	drm_intel_decode_set_output_func(ctx, NULL, NULL);
+	drm_intel_decode_set_opcode_stats(ctx, 0);
+	fclose(out);
+}
+
 static void
 compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 {
@@ -128,6 +250,23 @@ compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 	}
 
 	fclose(out);
+	free(ptr);
+
+#if HAVE_OPEN_MEMSTREAM
+	/* The lines passed to a function must make up the same dump. */
+	out = open_memstream(&ptr, &size);
+#endif
+	drm_intel_decode_set_output_func(ctx, text_line, out);
+	drm_intel_decode(ctx);
+	drm_intel_decode_set_output_func(ctx, NULL, NULL);
+	fclose(out);
+
+	if (strcmp(ref_ptr, ptr) != 0) {
+		fprintf(stderr, "Decode lines mismatch with reference `%s'.\n",
+			ref_filename);
+		exit(1);
+	}
+
 	free(ref_filename);
 	free(ptr);
 }
@@ -180,9 +319,16 @@ main(int argc, char **argv)
 
 	ctx = drm_intel_decode_context_alloc(devid);
 
-	if (argc == 3) {
+	if (argc >= 3) {
 		if (strcmp(argv[2], "-dump") == 0)
-			dump_batch(ctx, argv[1]);
+			dump_batch(ctx, argv[1], DRM_INTEL_DECODE_FORMAT_TEXT);
+		else if (strcmp(argv[2], "-json") == 0)
+			dump_batch(ctx, argv[1], DRM_INTEL_DECODE_FORMAT_JSON);
+		else if (strcmp(argv[2], "-stats") == 0)
+			dump_stats(ctx, argv[1]);
+		else if (strcmp(argv[2], "-bench") == 0)
+			bench_batch(ctx, argv[1],
+				    argc > 3 ? strtoul(argv[3], NULL, 0) : 1000);
 		else
 			usage();
 	} else {
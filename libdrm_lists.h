@@ -29,6 +29,9 @@
  * list handling. No list looping yet.
  */
 
+#ifndef LIBDRM_LISTS_H
+#define LIBDRM_LISTS_H
+
 #include <stddef.h>
 
 typedef struct _drmMMListHead
@@ -116,3 +119,5 @@ typedef struct _drmMMListHead
 	(__join)->next->prev = (__list)->prev;				\
 	(__join)->next = (__list)->next;				\
 }
+
+#endif /* LIBDRM_LISTS_H */
@@ -32,10 +32,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include "drm.h"
 #include "libdrm_macros.h"
 #include "xf86drm.h"
+#include "xf86atomic.h"
 #include "radeon_drm.h"
 #include "radeon_surface.h"
 
@@ -92,6 +94,9 @@ enum radeon_family {
     CHIP_LAST,
 };
 
+#define RADEON_SURFACE_CACHE_BUCKETS    256
+#define RADEON_SURFACE_CACHE_SEEN       256
+
 typedef int (*hw_init_surface_t)(struct radeon_surface_manager *surf_man,
                                  struct radeon_surface *surf);
 typedef int (*hw_best_surface_t)(struct radeon_surface_manager *surf_man,
@@ -118,6 +123,17 @@ struct radeon_surface_manager {
     unsigned                    family;
     hw_init_surface_t           surface_init;
     hw_best_surface_t           surface_best;
+    /* layout cache, see radeon_surface_init_cached() */
+    pthread_mutex_t             cache_mutex;
+    struct radeon_surface_layout *cache[RADEON_SURFACE_CACHE_BUCKETS];
+    unsigned                    cache_size;
+    unsigned                    cache_count;
+    uint64_t                    cache_hits;
+    uint64_t                    cache_misses;
+    /* hashes of the keys seen lately, used without the mutex */
+    atomic_t                    cache_seen[RADEON_SURFACE_CACHE_SEEN];
+    /* misses of keys seen for the first time, racy */
+    atomic_t                    cache_unseen;
 };
 
 /* helper */
@@ -2406,6 +2422,263 @@ static int cik_surface_best(struct radeon_surface_manager *surf_man,
 }
 
 
+/* ===========================================================================
+ * layout cache
+ *
+ * Drivers create the same few surfaces over and over, so the layouts are
+ * remembered per manager, which fixes the chip config. The key is every
+ * field of the surface descriptor a layout may depend on. Laying out a
+ * surface with few mipmap levels is cheaper than looking it up, those
+ * bypass the cache, and so does radeon_surface_best() which doesn't build
+ * miptrees.
+ *
+ * Instead of listing what each family writes, a key seen for the second
+ * time is computed twice, the second time with every word outside of the
+ * key inverted. Words that come out equal are written by the computation
+ * and stored, words that come out as they went in are left alone, and
+ * anything else means the layout depends on more than the key and is not
+ * cached. Keys seen once only cost a hash and a slot of a direct mapped
+ * table of the hashes seen lately, which is checked before taking the
+ * mutex. A cached key whose slot was taken over by another key is
+ * computed once more before it's served from the cache again.
+ */
+#define RADEON_SURFACE_CACHE_SIZE       256
+#define RADEON_SURFACE_CACHE_MIN_LEVEL  4
+
+enum radeon_surface_layout_state {
+    RADEON_SURFACE_LAYOUT_CACHED,
+    RADEON_SURFACE_LAYOUT_UNCACHEABLE,
+};
+
+#define RADEON_SURFACE_WORDS    (sizeof(struct radeon_surface) / sizeof(uint32_t))
+
+/* the surface as the words the layout is compared and stored by */
+union radeon_surface_words {
+    struct radeon_surface       surf;
+    uint32_t                    words[RADEON_SURFACE_WORDS];
+};
+
+struct radeon_surface_key {
+    uint32_t                    npix_x;
+    uint32_t                    npix_y;
+    uint32_t                    npix_z;
+    uint32_t                    blk_w;
+    uint32_t                    blk_h;
+    uint32_t                    blk_d;
+    uint32_t                    array_size;
+    uint32_t                    last_level;
+    uint32_t                    bpe;
+    uint32_t                    nsamples;
+    uint32_t                    flags;
+    uint32_t                    bankw;
+    uint32_t                    bankh;
+    uint32_t                    mtilea;
+    uint32_t                    tile_split;
+    uint32_t                    stencil_tile_split;
+    uint64_t                    stencil_offset;
+};
+
+/* words of the surface written by the computation */
+struct radeon_surface_span {
+    uint16_t                    offset;
+    uint16_t                    size;
+};
+
+struct radeon_surface_layout {
+    struct radeon_surface_layout *next;
+    uint32_t                    hash;
+    enum radeon_surface_layout_state state;
+    struct radeon_surface_key   key;
+    unsigned                    num_spans;
+    struct radeon_surface_span  *spans;
+    uint32_t                    *data;
+};
+
+static void radeon_surface_key_get(const struct radeon_surface *surf,
+                                   struct radeon_surface_key *key)
+{
+    key->npix_x = surf->npix_x;
+    key->npix_y = surf->npix_y;
+    key->npix_z = surf->npix_z;
+    key->blk_w = surf->blk_w;
+    key->blk_h = surf->blk_h;
+    key->blk_d = surf->blk_d;
+    key->array_size = surf->array_size;
+    key->last_level = surf->last_level;
+    key->bpe = surf->bpe;
+    key->nsamples = surf->nsamples;
+    key->flags = surf->flags;
+    key->bankw = surf->bankw;
+    key->bankh = surf->bankh;
+    key->mtilea = surf->mtilea;
+    key->tile_split = surf->tile_split;
+    key->stencil_tile_split = surf->stencil_tile_split;
+    key->stencil_offset = surf->stencil_offset;
+}
+
+static void radeon_surface_key_set(struct radeon_surface *surf,
+                                   const struct radeon_surface_key *key)
+{
+    surf->npix_x = key->npix_x;
+    surf->npix_y = key->npix_y;
+    surf->npix_z = key->npix_z;
+    surf->blk_w = key->blk_w;
+    surf->blk_h = key->blk_h;
+    surf->blk_d = key->blk_d;
+    surf->array_size = key->array_size;
+    surf->last_level = key->last_level;
+    surf->bpe = key->bpe;
+    surf->nsamples = key->nsamples;
+    surf->flags = key->flags;
+    surf->bankw = key->bankw;
+    surf->bankh = key->bankh;
+    surf->mtilea = key->mtilea;
+    surf->tile_split = key->tile_split;
+    surf->stencil_tile_split = key->stencil_tile_split;
+    surf->stencil_offset = key->stencil_offset;
+}
+
+/*
+ * Hashes the key fields of the surface in pairs. The multiplications are
+ * independent, only the sum waits for them.
+ */
+static uint32_t radeon_surface_key_hash(const struct radeon_surface *surf)
+{
+    const uint64_t words[] = {
+        surf->npix_x | (uint64_t)surf->npix_y << 32,
+        surf->npix_z | (uint64_t)surf->blk_w << 32,
+        surf->blk_h | (uint64_t)surf->blk_d << 32,
+        surf->array_size | (uint64_t)surf->last_level << 32,
+        surf->bpe | (uint64_t)surf->nsamples << 32,
+        surf->flags | (uint64_t)surf->bankw << 32,
+        surf->bankh | (uint64_t)surf->mtilea << 32,
+        surf->tile_split | (uint64_t)surf->stencil_tile_split << 32,
+        surf->stencil_offset,
+    };
+    uint64_t hash = 0;
+    unsigned i;
+
+    for (i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        hash += (words[i] ^ (words[i] >> 29)) * (0x9e3779b97f4a7c15ull + 2 * i);
+    }
+    return hash ^ (hash >> 32);
+}
+
+static void radeon_surface_cache_flush(struct radeon_surface_manager *surf_man)
+{
+    struct radeon_surface_layout *layout, *next;
+    unsigned i;
+
+    for (i = 0; i < RADEON_SURFACE_CACHE_BUCKETS; i++) {
+        for (layout = surf_man->cache[i]; layout; layout = next) {
+            next = layout->next;
+            free(layout);
+        }
+        surf_man->cache[i] = NULL;
+    }
+    surf_man->cache_count = 0;
+}
+
+/* Returns the link to the entry of the key, or to the end of its bucket */
+static struct radeon_surface_layout **
+radeon_surface_cache_find(struct radeon_surface_manager *surf_man,
+                          const struct radeon_surface_key *key,
+                          uint32_t hash)
+{
+    struct radeon_surface_layout **link;
+
+    link = &surf_man->cache[hash % RADEON_SURFACE_CACHE_BUCKETS];
+    for (; *link; link = &(*link)->next) {
+        if ((*link)->hash == hash && !memcmp(&(*link)->key, key, sizeof(*key))) {
+            break;
+        }
+    }
+    return link;
+}
+
+static void radeon_surface_cache_insert(struct radeon_surface_manager *surf_man,
+                                        struct radeon_surface_layout *layout)
+{
+    struct radeon_surface_layout **bucket;
+
+    if (surf_man->cache_count >= surf_man->cache_size) {
+        radeon_surface_cache_flush(surf_man);
+    }
+    bucket = &surf_man->cache[layout->hash % RADEON_SURFACE_CACHE_BUCKETS];
+    atomic_set(&surf_man->cache_seen[layout->hash % RADEON_SURFACE_CACHE_SEEN],
+               layout->hash);
+    layout->next = *bucket;
+    *bucket = layout;
+    surf_man->cache_count++;
+}
+
+static void radeon_surface_layout_apply(const struct radeon_surface_layout *layout,
+                                        struct radeon_surface *surf)
+{
+    const uint32_t *data = layout->data;
+    unsigned i;
+
+    for (i = 0; i < layout->num_spans; i++) {
+        memcpy((uint32_t *)surf + layout->spans[i].offset, data,
+               layout->spans[i].size * sizeof(uint32_t));
+        data += layout->spans[i].size;
+    }
+}
+
+/*
+ * Builds the layout from the results of the computation on the surface as
+ * given (a) and with everything outside of the key inverted (b), returns
+ * NULL if it can't be cached.
+ */
+static struct radeon_surface_layout *
+radeon_surface_layout_new(const struct radeon_surface_key *key, uint32_t hash,
+                          const uint32_t *a_in, const uint32_t *a_out,
+                          const uint32_t *b_in, const uint32_t *b_out)
+{
+    struct radeon_surface_layout *layout;
+    unsigned i, start, num_spans = 0, size = 0;
+
+    for (i = 0; i < RADEON_SURFACE_WORDS; i++) {
+        if (a_out[i] == b_out[i]) {
+            if (!i || a_out[i - 1] != b_out[i - 1]) {
+                num_spans++;
+            }
+            size++;
+        } else if (a_out[i] != a_in[i] || b_out[i] != b_in[i]) {
+            return NULL;
+        }
+    }
+
+    layout = malloc(sizeof(*layout) +
+                    num_spans * sizeof(struct radeon_surface_span) +
+                    size * sizeof(uint32_t));
+    if (!layout) {
+        return NULL;
+    }
+    layout->hash = hash;
+    layout->state = RADEON_SURFACE_LAYOUT_CACHED;
+    layout->key = *key;
+    layout->num_spans = 0;
+    layout->data = (uint32_t *)(layout + 1);
+    layout->spans = (struct radeon_surface_span *)(layout->data + size);
+
+    size = 0;
+    for (start = 0; start < RADEON_SURFACE_WORDS; start = i) {
+        if (a_out[start] != b_out[start]) {
+            i = start + 1;
+            continue;
+        }
+        for (i = start; i < RADEON_SURFACE_WORDS && a_out[i] == b_out[i]; i++);
+        layout->spans[layout->num_spans].offset = start;
+        layout->spans[layout->num_spans].size = i - start;
+        layout->num_spans++;
+        memcpy(layout->data + size, a_out + start,
+               (i - start) * sizeof(uint32_t));
+        size += i - start;
+    }
+    return layout;
+}
+
 /* ===========================================================================
  * public API
  */
@@ -2419,6 +2692,8 @@ radeon_surface_manager_new(int fd)
         return NULL;
     }
     surf_man->fd = fd;
+    pthread_mutex_init(&surf_man->cache_mutex, NULL);
+    surf_man->cache_size = RADEON_SURFACE_CACHE_SIZE;
     if (radeon_get_value(fd, RADEON_INFO_DEVICE_ID, &surf_man->device_id)) {
         goto out_err;
     }
@@ -2454,6 +2729,7 @@ radeon_surface_manager_new(int fd)
 
     return surf_man;
 out_err:
+    pthread_mutex_destroy(&surf_man->cache_mutex);
     free(surf_man);
     return NULL;
 }
@@ -2461,6 +2737,11 @@ out_err:
 drm_public void
 radeon_surface_manager_free(struct radeon_surface_manager *surf_man)
 {
+    if (surf_man == NULL) {
+        return;
+    }
+    radeon_surface_cache_flush(surf_man);
+    pthread_mutex_destroy(&surf_man->cache_mutex);
     free(surf_man);
 }
 
@@ -2532,9 +2813,8 @@ static int radeon_surface_sanity(struct radeon_surface_manager *surf_man,
     return 0;
 }
 
-drm_public int
-radeon_surface_init(struct radeon_surface_manager *surf_man,
-                    struct radeon_surface *surf)
+static int radeon_surface_init_uncached(struct radeon_surface_manager *surf_man,
+                                        struct radeon_surface *surf)
 {
     unsigned mode, type;
     int r;
@@ -2549,6 +2829,96 @@ radeon_surface_init(struct radeon_surface_manager *surf_man,
     return surf_man->surface_init(surf_man, surf);
 }
 
+static int radeon_surface_init_cached(struct radeon_surface_manager *surf_man,
+                                      struct radeon_surface *surf)
+{
+    union radeon_surface_words a_in, a_out, b_in, b_out;
+    struct radeon_surface_layout *layout, **link;
+    struct radeon_surface_key key;
+    atomic_t *seen;
+    uint32_t hash;
+    unsigned i;
+    int r;
+
+    if (surf_man == NULL || surf == NULL || !surf_man->cache_size ||
+        surf->last_level < RADEON_SURFACE_CACHE_MIN_LEVEL) {
+        return radeon_surface_init_uncached(surf_man, surf);
+    }
+
+    hash = radeon_surface_key_hash(surf);
+    seen = &surf_man->cache_seen[hash % RADEON_SURFACE_CACHE_SEEN];
+    if ((uint32_t)atomic_read(seen) != hash) {
+        /* remember the key, it gets cached if it comes back */
+        atomic_set(seen, hash);
+        /* a locked increment would cost as much as the lookup */
+        atomic_set(&surf_man->cache_unseen,
+                   atomic_read(&surf_man->cache_unseen) + 1);
+        return radeon_surface_init_uncached(surf_man, surf);
+    }
+
+    radeon_surface_key_get(surf, &key);
+    pthread_mutex_lock(&surf_man->cache_mutex);
+    layout = *radeon_surface_cache_find(surf_man, &key, hash);
+    if (layout && layout->state == RADEON_SURFACE_LAYOUT_CACHED) {
+        radeon_surface_layout_apply(layout, surf);
+        surf_man->cache_hits++;
+        pthread_mutex_unlock(&surf_man->cache_mutex);
+        return 0;
+    }
+    surf_man->cache_misses++;
+    pthread_mutex_unlock(&surf_man->cache_mutex);
+    if (layout) {
+        return radeon_surface_init_uncached(surf_man, surf);
+    }
+
+    a_in.surf = *surf;
+    r = radeon_surface_init_uncached(surf_man, surf);
+    if (r) {
+        return r;
+    }
+    a_out.surf = *surf;
+
+    for (i = 0; i < RADEON_SURFACE_WORDS; i++) {
+        b_in.words[i] = ~a_in.words[i];
+    }
+    radeon_surface_key_set(&b_in.surf, &key);
+    b_out = b_in;
+    layout = NULL;
+    if (!radeon_surface_init_uncached(surf_man, &b_out.surf)) {
+        layout = radeon_surface_layout_new(&key, hash, a_in.words, a_out.words,
+                                           b_in.words, b_out.words);
+    }
+    if (!layout) {
+        /* remembered so the key isn't computed twice again */
+        layout = malloc(sizeof(*layout));
+        if (!layout) {
+            return 0;
+        }
+        layout->hash = hash;
+        layout->state = RADEON_SURFACE_LAYOUT_UNCACHEABLE;
+        layout->key = key;
+        layout->num_spans = 0;
+    }
+
+    /* another thread may have cached the key in the meantime */
+    pthread_mutex_lock(&surf_man->cache_mutex);
+    link = radeon_surface_cache_find(surf_man, &key, hash);
+    if (!*link && surf_man->cache_size) {
+        radeon_surface_cache_insert(surf_man, layout);
+        layout = NULL;
+    }
+    pthread_mutex_unlock(&surf_man->cache_mutex);
+    free(layout);
+    return 0;
+}
+
+drm_public int
+radeon_surface_init(struct radeon_surface_manager *surf_man,
+                    struct radeon_surface *surf)
+{
+    return radeon_surface_init_cached(surf_man, surf);
+}
+
 drm_public int
 radeon_surface_best(struct radeon_surface_manager *surf_man,
                     struct radeon_surface *surf)
@@ -2565,3 +2935,26 @@ radeon_surface_best(struct radeon_surface_manager *surf_man,
     }
     return surf_man->surface_best(surf_man, surf);
 }
+
+drm_public void
+radeon_surface_manager_set_cache_size(struct radeon_surface_manager *surf_man,
+                                      unsigned entries)
+{
+    pthread_mutex_lock(&surf_man->cache_mutex);
+    surf_man->cache_size = entries;
+    if (surf_man->cache_count > entries) {
+        radeon_surface_cache_flush(surf_man);
+    }
+    pthread_mutex_unlock(&surf_man->cache_mutex);
+}
+
+drm_public void
+radeon_surface_manager_get_cache_stats(struct radeon_surface_manager *surf_man,
+                                       uint64_t *hits, uint64_t *misses)
+{
+    pthread_mutex_lock(&surf_man->cache_mutex);
+    *hits = surf_man->cache_hits;
+    *misses = surf_man->cache_misses +
+              (uint32_t)atomic_read(&surf_man->cache_unseen);
+    pthread_mutex_unlock(&surf_man->cache_mutex);
+}
@@ -145,5 +145,13 @@ int radeon_surface_init(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
 int radeon_surface_best(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
+/* The manager remembers the layouts radeon_surface_init() computed for
+ * surfaces with 5 or more mip levels, up to 256 of them by default. 0 turns
+ * that off.
+ */
+void radeon_surface_manager_set_cache_size(struct radeon_surface_manager *surf_man,
+                                           unsigned entries);
+void radeon_surface_manager_get_cache_stats(struct radeon_surface_manager *surf_man,
+                                            uint64_t *hits, uint64_t *misses);
 
 #endif
@@ -0,0 +1,2205 @@
+/*
+ * Copyright 2026 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Measures the CPU cost of libdrm_amdgpu paths without a GPU.
+ *
+ * The drm entry points libdrm_amdgpu calls into are replaced by the stand-in
+ * device from amdgpu_stand_in.c, so only the library side is measured.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "xf86drm.h"
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_stand_in.h"
+
+/** Help string for command line parameters */
+static const char usage[] =
+	"Usage: %s [-?h] [-l] [-n iterations] [-s scenario] [-i ids_dir]\n"
+	"where:\n"
+	"	l - List the available scenarios\n"
+	"	n - Number of iterations per scenario (default 100000)\n"
+	"	s - Only run the given scenario, can be used multiple times\n"
+	"	i - Directory with an amdgpu.ids to compare the built-in table with\n"
+	"	h - Display this help\n";
+
+/** Specified options strings for getopt */
+static const char options[] = "?hln:s:i:";
+
+/*
+ * Scenarios.
+ */
+
+static amdgpu_device_handle device_handle;
+static amdgpu_context_handle context_handle;
+static uint64_t iterations = 100000;
+static const char *ids_dir;
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t count, uint64_t delta_ns,
+		   uint64_t ioctls)
+{
+	fprintf(stdout, "%-32s %12.0f ops/s %10.1f ns/op %6.2f ioctls/op\n",
+		name, count * 1e9 / (delta_ns ? delta_ns : 1),
+		(double)delta_ns / count, (double)ioctls / count);
+}
+
+/*
+ * Allocates a buffer and checks whether it came from the reuse cache, and
+ * whether it is the buffer expected to be reused.
+ */
+static int bo_cache_alloc_check(struct amdgpu_bo_alloc_request *alloc,
+				amdgpu_bo_handle expected, bool hit,
+				const char *what, amdgpu_bo_handle *bo)
+{
+	struct amdgpu_bo_cache_stats before, after;
+	int r;
+
+	r = amdgpu_bo_cache_query_stats(device_handle, &before);
+	if (!r)
+		r = amdgpu_bo_alloc(device_handle, alloc, bo);
+	if (!r)
+		r = amdgpu_bo_cache_query_stats(device_handle, &after);
+	if (r)
+		return r;
+
+	if (after.hits != before.hits + hit ||
+	    after.misses != before.misses + !hit ||
+	    (expected && (*bo == expected) != hit)) {
+		fprintf(stderr, "bo cache %s: expected a %s\n", what,
+			hit ? "hit" : "miss");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int bo_cache_check_count(uint64_t count, const char *what)
+{
+	struct amdgpu_bo_cache_stats stats;
+	int r;
+
+	r = amdgpu_bo_cache_query_stats(device_handle, &stats);
+	if (!r && stats.cached_count != count) {
+		fprintf(stderr, "bo cache %s: %" PRIu64 " buffers cached "
+			"instead of %" PRIu64 "\n", what, stats.cached_count,
+			count);
+		r = -EINVAL;
+	}
+	return r;
+}
+
+/*
+ * Hit, miss, the heap, flags and alignment rules, buffers still mapped
+ * into the GPU VA space and expiry.
+ */
+static int check_bo_cache(void)
+{
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	struct timespec expiry = { 2, 100000000 };
+	amdgpu_bo_handle bo, other;
+	uint64_t va = 0x100000000ull;
+	int r;
+
+	alloc.alloc_size = 64 * 1024;
+	alloc.phys_alignment = 4096;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_VRAM;
+
+	r = bo_cache_alloc_check(&alloc, NULL, false, "first alloc", &bo);
+	if (r)
+		return r;
+	amdgpu_bo_free(bo);
+	r = bo_cache_check_count(1, "free");
+	if (r)
+		return r;
+
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	r = bo_cache_alloc_check(&alloc, bo, false, "other heap", &other);
+	if (r)
+		return r;
+	amdgpu_bo_free(other);
+
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_VRAM;
+	alloc.flags = AMDGPU_GEM_CREATE_CPU_ACCESS_REQUIRED;
+	r = bo_cache_alloc_check(&alloc, bo, false, "other flags", &other);
+	if (r)
+		return r;
+	amdgpu_bo_free(other);
+
+	alloc.flags = 0;
+	alloc.phys_alignment = 64 * 1024;
+	r = bo_cache_alloc_check(&alloc, bo, false, "larger alignment",
+				 &other);
+	if (r)
+		return r;
+	amdgpu_bo_free(other);
+	r = bo_cache_check_count(4, "mismatches");
+	if (r)
+		return r;
+
+	/* a smaller size in the same bucket and alignment may reuse it */
+	alloc.alloc_size = 60 * 1024;
+	alloc.phys_alignment = 4096;
+	r = bo_cache_alloc_check(&alloc, bo, true, "same bucket", &bo);
+	if (r)
+		return r;
+
+	/* still mapped, the next owner would inherit the mapping */
+	r = amdgpu_bo_va_op(bo, 0, alloc.alloc_size, va, 0, AMDGPU_VA_OP_MAP);
+	if (r)
+		return r;
+	amdgpu_bo_free(bo);
+	r = bo_cache_check_count(3, "mapped free");
+	if (r)
+		return r;
+
+	r = bo_cache_alloc_check(&alloc, NULL, true, "unmapped", &bo);
+	if (!r)
+		r = amdgpu_bo_va_op(bo, 0, alloc.alloc_size, va, 0,
+				    AMDGPU_VA_OP_MAP);
+	if (!r)
+		r = amdgpu_bo_va_op(bo, 0, alloc.alloc_size, va, 0,
+				    AMDGPU_VA_OP_UNMAP);
+	if (r)
+		return r;
+	amdgpu_bo_free(bo);
+	r = bo_cache_check_count(3, "unmapped free");
+	if (r)
+		return r;
+
+	/* buffers are kept for at least a second, then purged on a free */
+	nanosleep(&expiry, NULL);
+	r = amdgpu_bo_alloc(device_handle, &alloc, &bo);
+	if (r)
+		return r;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	r = amdgpu_bo_alloc(device_handle, &alloc, &other);
+	if (r) {
+		amdgpu_bo_free(bo);
+		return r;
+	}
+	amdgpu_bo_free(other);
+	r = bo_cache_check_count(1, "expiry");
+	amdgpu_bo_free(bo);
+	return r;
+}
+
+/* Allocate and free a frame worth of buffers per iteration */
+static int bench_bo_cache_loop(const char *name, uint64_t frames)
+{
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	amdgpu_bo_handle bos[16];
+	uint64_t start, ioctls, i;
+	int r = 0, j;
+
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < frames && !r; i++) {
+		for (j = 0; j < 16; j++) {
+			alloc.alloc_size = 4096ull << (j % 8);
+			r = amdgpu_bo_alloc(device_handle, &alloc, &bos[j]);
+			if (r)
+				break;
+		}
+		while (j--)
+			amdgpu_bo_free(bos[j]);
+	}
+	report(name, frames * 16, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+	return r;
+}
+
+static int bench_bo_cache(void)
+{
+	uint64_t frames = iterations / 16 ? iterations / 16 : 1;
+	struct amdgpu_bo_cache_stats stats;
+	int r;
+
+	r = bench_bo_cache_loop("bo-cache/off", frames);
+	if (r)
+		return r;
+
+	r = amdgpu_bo_cache_enable(device_handle, true);
+	if (r)
+		return r;
+	r = bench_bo_cache_loop("bo-cache/on", frames);
+	if (!r)
+		r = amdgpu_bo_cache_query_stats(device_handle, &stats);
+	if (!r)
+		fprintf(stdout, "%-32s %" PRIu64 " hits, %" PRIu64 " misses, "
+			"%" PRIu64 " buffers cached\n", "", stats.hits,
+			stats.misses, stats.cached_count);
+	amdgpu_bo_cache_enable(device_handle, false);
+
+	if (!r)
+		r = amdgpu_bo_cache_enable(device_handle, true);
+	if (!r)
+		r = check_bo_cache();
+	amdgpu_bo_cache_enable(device_handle, false);
+	return r;
+}
+
+static int vma_cache_map_check(amdgpu_bo_handle bo, void *expected, bool hit,
+			       const char *what, void **cpu)
+{
+	struct amdgpu_bo_vma_cache_stats before, after;
+	int r;
+
+	r = amdgpu_bo_vma_cache_query_stats(device_handle, &before);
+	if (!r)
+		r = amdgpu_bo_cpu_map(bo, cpu);
+	if (!r)
+		r = amdgpu_bo_vma_cache_query_stats(device_handle, &after);
+	if (r)
+		return r;
+
+	if (after.hits != before.hits + hit ||
+	    after.misses != before.misses + !hit ||
+	    (expected && (*cpu == expected) != hit) ||
+	    (uintptr_t)*cpu % getpagesize()) {
+		fprintf(stderr, "vma cache %s: expected a %s at %p, got %p\n",
+			what, hit ? "hit" : "miss", expected, *cpu);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * A kept-alive mapping goes back to its own buffer only, once, and the
+ * oldest one is unmapped when the limit is reached.
+ */
+static int check_vma_cache(void)
+{
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	struct amdgpu_bo_vma_cache_stats stats;
+	amdgpu_bo_handle a = NULL, b = NULL;
+	void *cpu_a, *cpu_b, *cpu;
+	int r;
+
+	alloc.alloc_size = 64 * 1024;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+
+	r = amdgpu_bo_set_vma_cache_size(device_handle, 2);
+	if (!r)
+		r = amdgpu_bo_alloc(device_handle, &alloc, &a);
+	if (!r)
+		r = amdgpu_bo_alloc(device_handle, &alloc, &b);
+	if (r)
+		goto out;
+
+	r = vma_cache_map_check(a, NULL, false, "first map", &cpu_a);
+	if (!r)
+		r = amdgpu_bo_cpu_unmap(a);
+	if (r)
+		goto out;
+
+	/* same size, but the mapping belongs to the other buffer */
+	r = vma_cache_map_check(b, cpu_a, false, "other buffer", &cpu_b);
+	if (r)
+		goto out;
+
+	r = vma_cache_map_check(a, cpu_a, true, "remap", &cpu);
+	if (r)
+		goto out;
+
+	/* a second user of a mapped buffer doesn't touch the cache */
+	r = amdgpu_bo_cpu_map(a, &cpu);
+	if (!r)
+		r = amdgpu_bo_vma_cache_query_stats(device_handle, &stats);
+	if (r)
+		goto out;
+	if (cpu != cpu_a || stats.cached_count || stats.open_count != 2) {
+		fprintf(stderr, "vma cache nested map: %u cached, %u open\n",
+			stats.cached_count, stats.open_count);
+		r = -EINVAL;
+		goto out;
+	}
+	amdgpu_bo_cpu_unmap(a);
+	amdgpu_bo_cpu_unmap(a);
+	amdgpu_bo_cpu_unmap(b);
+
+	/* with room for one mapping only, the older one goes */
+	r = amdgpu_bo_set_vma_cache_size(device_handle, 1);
+	if (!r)
+		r = vma_cache_map_check(a, NULL, false, "evicted", &cpu);
+	if (!r)
+		r = vma_cache_map_check(b, cpu_b, true, "kept", &cpu);
+	if (r)
+		goto out;
+	amdgpu_bo_cpu_unmap(b);
+	amdgpu_bo_cpu_unmap(a);
+
+out:
+	if (b)
+		amdgpu_bo_free(b);
+	if (a)
+		amdgpu_bo_free(a);
+	if (!r)
+		r = amdgpu_bo_vma_cache_query_stats(device_handle, &stats);
+	if (!r && (stats.cached_count || stats.open_count)) {
+		fprintf(stderr, "vma cache: %u mappings left after free\n",
+			stats.cached_count + stats.open_count);
+		r = -EINVAL;
+	}
+	amdgpu_bo_set_vma_cache_size(device_handle, 0);
+	return r;
+}
+
+/* Map and unmap the same buffers every frame */
+static int bench_vma_cache_loop(const char *name, amdgpu_bo_handle *bos,
+				int num_bos)
+{
+	uint64_t start, ioctls, i;
+	void *cpu;
+	int r = 0, j;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < iterations && !r; i += num_bos) {
+		for (j = 0; j < num_bos && !r; j++) {
+			r = amdgpu_bo_cpu_map(bos[j], &cpu);
+			if (!r)
+				r = amdgpu_bo_cpu_unmap(bos[j]);
+		}
+	}
+	report(name, i, get_time_ns() - start, stand_in_ioctls - ioctls);
+	return r;
+}
+
+static int bench_vma_cache(void)
+{
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	amdgpu_bo_handle bos[16];
+	int r = 0, j;
+
+	alloc.alloc_size = 64 * 1024;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	for (j = 0; j < 16 && !r; j++)
+		r = amdgpu_bo_alloc(device_handle, &alloc, &bos[j]);
+	if (r) {
+		j--;
+		goto out;
+	}
+
+	r = bench_vma_cache_loop("vma-cache/off", bos, j);
+	if (!r)
+		r = amdgpu_bo_set_vma_cache_size(device_handle, 64);
+	if (!r)
+		r = bench_vma_cache_loop("vma-cache/on", bos, j);
+	amdgpu_bo_set_vma_cache_size(device_handle, 0);
+
+out:
+	while (j--)
+		amdgpu_bo_free(bos[j]);
+	if (!r)
+		r = check_vma_cache();
+	return r;
+}
+
+static int bench_cs_submit(void)
+{
+	struct amdgpu_cs_ib_info ibs[AMDGPU_CS_MAX_IBS_PER_SUBMIT];
+	struct amdgpu_cs_fence deps[4];
+	struct amdgpu_cs_request request;
+	amdgpu_cs_submission_handle submission;
+	uint64_t start, ioctls, i, seq_no;
+	unsigned num_ibs;
+	char name[64];
+	int r;
+
+	memset(ibs, 0, sizeof(ibs));
+	memset(deps, 0, sizeof(deps));
+	for (i = 0; i < AMDGPU_CS_MAX_IBS_PER_SUBMIT; i++) {
+		ibs[i].ib_mc_address = 0x100000 + i * 0x1000;
+		ibs[i].size = 64;
+	}
+	for (i = 0; i < 4; i++) {
+		deps[i].context = context_handle;
+		deps[i].ip_type = AMDGPU_HW_IP_COMPUTE;
+		deps[i].fence = i + 1;
+	}
+
+	for (num_ibs = 1; num_ibs <= AMDGPU_CS_MAX_IBS_PER_SUBMIT; num_ibs *= 2) {
+		memset(&request, 0, sizeof(request));
+		request.ip_type = AMDGPU_HW_IP_GFX;
+		request.number_of_ibs = num_ibs;
+		request.ibs = ibs;
+		request.number_of_dependencies = 4;
+		request.dependencies = deps;
+
+		ioctls = stand_in_ioctls;
+		start = get_time_ns();
+		for (i = 0; i < iterations; i++) {
+			r = amdgpu_cs_submit(context_handle, 0, &request, 1);
+			if (r)
+				return r;
+		}
+		snprintf(name, sizeof(name), "cs-submit/%u-ib", num_ibs);
+		report(name, iterations, get_time_ns() - start,
+		       stand_in_ioctls - ioctls);
+
+		r = amdgpu_cs_submission_create(context_handle, &request,
+						&submission);
+		if (r)
+			return r;
+
+		ioctls = stand_in_ioctls;
+		start = get_time_ns();
+		for (i = 0; i < iterations; i++) {
+			ibs[0].size = 64 + (i & 15);
+			amdgpu_cs_submission_update_ib(submission, 0, &ibs[0]);
+			r = amdgpu_cs_submission_submit(submission, &seq_no);
+			if (r)
+				break;
+		}
+		snprintf(name, sizeof(name), "cs-submission/%u-ib", num_ibs);
+		report(name, iterations, get_time_ns() - start,
+		       stand_in_ioctls - ioctls);
+
+		amdgpu_cs_submission_destroy(submission);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+/*
+ * Every submission waits for num_sems semaphores signaled on another
+ * context.
+ */
+static int bench_semaphore_count(amdgpu_context_handle signaler,
+				 unsigned int num_sems)
+{
+	struct amdgpu_cs_ib_info ib = { 0 };
+	struct amdgpu_cs_request request = { 0 };
+	amdgpu_semaphore_handle sems[16];
+	uint64_t start, ioctls, i;
+	unsigned int j;
+	char name[64];
+	int r = 0;
+
+	ib.ib_mc_address = 0x100000;
+	ib.size = 64;
+	request.ip_type = AMDGPU_HW_IP_GFX;
+	request.number_of_ibs = 1;
+	request.ibs = &ib;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; !r && i < iterations; i++) {
+		for (j = 0; !r && j < num_sems; j++) {
+			r = amdgpu_cs_create_semaphore(&sems[j]);
+			if (r)
+				break;
+			amdgpu_cs_signal_semaphore(signaler, AMDGPU_HW_IP_COMPUTE,
+						   0, j % 4, sems[j]);
+			r = amdgpu_cs_wait_semaphore(context_handle,
+						     AMDGPU_HW_IP_GFX, 0, 0,
+						     sems[j]);
+			amdgpu_cs_destroy_semaphore(sems[j]);
+		}
+		if (!r)
+			r = amdgpu_cs_submit(context_handle, 0, &request, 1);
+	}
+	snprintf(name, sizeof(name), "semaphore/%u-sems", num_sems);
+	report(name, iterations, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+	return r;
+}
+
+static int bench_semaphore(void)
+{
+	amdgpu_context_handle signaler, contexts[1000];
+	unsigned int i, n = sizeof(contexts) / sizeof(contexts[0]);
+	int r;
+
+	r = amdgpu_cs_ctx_create(device_handle, &signaler);
+	if (r)
+		return r;
+
+	r = bench_semaphore_count(signaler, 1);
+	if (!r)
+		r = bench_semaphore_count(signaler, 16);
+	amdgpu_cs_ctx_free(signaler);
+	if (r)
+		return r;
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+	{
+		/* heap use of contexts which submitted to one ring */
+		struct amdgpu_cs_ib_info ib = { 0 };
+		struct amdgpu_cs_request request = { 0 };
+		size_t before = mallinfo2().uordblks;
+
+		ib.ib_mc_address = 0x100000;
+		ib.size = 64;
+		request.ip_type = AMDGPU_HW_IP_GFX;
+		request.number_of_ibs = 1;
+		request.ibs = &ib;
+
+		for (i = 0; !r && i < n; i++) {
+			r = amdgpu_cs_ctx_create(device_handle, &contexts[i]);
+			if (!r)
+				r = amdgpu_cs_submit(contexts[i], 0, &request, 1);
+		}
+		if (!r)
+			fprintf(stdout, "semaphore: %zu bytes per context\n",
+				(mallinfo2().uordblks - before) / n);
+		n = i;
+		for (i = 0; i < n; i++)
+			amdgpu_cs_ctx_free(contexts[i]);
+	}
+#endif
+	return r;
+}
+
+/*
+ * Only the kernel knows about submissions after the last one with the user
+ * fence, they must not be reported busy forever.
+ */
+static int check_fence_query_mixed(struct amdgpu_cs_request *request,
+				   const struct amdgpu_cs_fence *fence,
+				   amdgpu_bo_handle fence_bo,
+				   volatile uint64_t *fence_cpu)
+{
+	struct drm_amdgpu_cs_chunk_ib ib = { 0 };
+	struct drm_amdgpu_cs_chunk chunk;
+	struct amdgpu_cs_fence unfenced;
+	uint64_t ioctls, seq_no;
+	uint32_t expired;
+	int r;
+
+	unfenced = *fence;
+	request->fence_info.handle = NULL;
+	r = amdgpu_cs_submit(context_handle, 0, request, 1);
+	if (r)
+		return r;
+	unfenced.fence = request->seq_no;
+
+	ioctls = stand_in_ioctls;
+	r = amdgpu_cs_query_fence_status(&unfenced, 0, 0, &expired);
+	if (r)
+		return r;
+	if (!expired || stand_in_ioctls == ioctls) {
+		fprintf(stderr, "fence without user fence not queried\n");
+		return -EINVAL;
+	}
+
+	ib.ip_type = AMDGPU_HW_IP_GFX;
+	ib.va_start = 0x100000;
+	ib.ib_bytes = 64;
+	chunk.chunk_id = AMDGPU_CHUNK_ID_IB;
+	chunk.length_dw = sizeof(ib) / 4;
+	chunk.chunk_data = (uint64_t)(uintptr_t)&ib;
+	r = amdgpu_cs_submit_raw2(device_handle, context_handle, 0, 1, &chunk,
+				  &seq_no);
+	if (r)
+		return r;
+	unfenced.fence = seq_no;
+
+	ioctls = stand_in_ioctls;
+	r = amdgpu_cs_query_fence_status(&unfenced, 0, 0, &expired);
+	if (r)
+		return r;
+	if (!expired || stand_in_ioctls == ioctls) {
+		fprintf(stderr, "raw submission not queried\n");
+		return -EINVAL;
+	}
+
+	/* The next submission with the user fence covers both again */
+	request->fence_info.handle = fence_bo;
+	r = amdgpu_cs_submit(context_handle, 0, request, 1);
+	if (r)
+		return r;
+	*fence_cpu = request->seq_no - 1;
+
+	ioctls = stand_in_ioctls;
+	r = amdgpu_cs_query_fence_status(&unfenced, 0, 0, &expired);
+	if (r)
+		return r;
+	if (!expired || stand_in_ioctls != ioctls) {
+		fprintf(stderr, "user fence not used again\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * The context keeps the user fence buffer mapped for the queries, which
+ * don't take its lock, even once the caller freed it or moved on to
+ * another one.
+ */
+static int check_fence_query_switch(struct amdgpu_cs_request *request,
+				    amdgpu_bo_handle fence_bo)
+{
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	struct amdgpu_cs_fence fence = { 0 };
+	volatile uint64_t *other_cpu;
+	amdgpu_bo_handle other_bo;
+	uint64_t ioctls;
+	uint32_t expired;
+	void *cpu;
+	int r;
+
+	alloc.alloc_size = 4096;
+	alloc.phys_alignment = 4096;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	r = amdgpu_bo_alloc(device_handle, &alloc, &other_bo);
+	if (r)
+		return r;
+	r = amdgpu_bo_cpu_map(other_bo, &cpu);
+	if (r) {
+		amdgpu_bo_free(other_bo);
+		return r;
+	}
+	other_cpu = cpu;
+
+	request->fence_info.handle = other_bo;
+	r = amdgpu_cs_submit(context_handle, 0, request, 1);
+	if (r) {
+		amdgpu_bo_cpu_unmap(other_bo);
+		amdgpu_bo_free(other_bo);
+		return r;
+	}
+	fence.context = context_handle;
+	fence.ip_type = request->ip_type;
+	fence.fence = request->seq_no;
+	*other_cpu = fence.fence;
+
+	amdgpu_bo_cpu_unmap(other_bo);
+	amdgpu_bo_free(other_bo);
+
+	ioctls = stand_in_ioctls;
+	r = amdgpu_cs_query_fence_status(&fence, 0, 0, &expired);
+	if (r)
+		return r;
+	if (!expired || stand_in_ioctls != ioctls) {
+		fprintf(stderr, "freed user fence buffer not kept\n");
+		return -EINVAL;
+	}
+
+	/* Going back to the first buffer retires the other one */
+	request->fence_info.handle = fence_bo;
+	r = amdgpu_cs_submit(context_handle, 0, request, 1);
+	if (r)
+		return r;
+	ioctls = stand_in_ioctls;
+	r = amdgpu_cs_query_fence_status(&fence, 0, 0, &expired);
+	if (r)
+		return r;
+	if (stand_in_ioctls != ioctls) {
+		fprintf(stderr, "user fence not switched back\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int bench_fence_query(void)
+{
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	struct amdgpu_cs_fence_stats stats;
+	struct amdgpu_cs_ib_info ib = { 0 };
+	struct amdgpu_cs_request request;
+	struct amdgpu_cs_fence fence;
+	amdgpu_bo_handle fence_bo;
+	uint64_t start, ioctls, i;
+	volatile uint64_t *fence_cpu;
+	uint32_t expired;
+	void *cpu;
+	int r;
+
+	alloc.alloc_size = 4096;
+	alloc.phys_alignment = 4096;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	r = amdgpu_bo_alloc(device_handle, &alloc, &fence_bo);
+	if (r)
+		return r;
+
+	r = amdgpu_bo_cpu_map(fence_bo, &cpu);
+	if (r)
+		goto out_free;
+	fence_cpu = cpu;
+
+	ib.ib_mc_address = 0x100000;
+	ib.size = 64;
+	memset(&request, 0, sizeof(request));
+	request.ip_type = AMDGPU_HW_IP_GFX;
+	request.number_of_ibs = 1;
+	request.ibs = &ib;
+
+	memset(&fence, 0, sizeof(fence));
+	fence.context = context_handle;
+	fence.ip_type = AMDGPU_HW_IP_GFX;
+
+	/* Without a user fence every query is an ioctl */
+	r = amdgpu_cs_submit(context_handle, 0, &request, 1);
+	if (r)
+		goto out_unmap;
+	fence.fence = request.seq_no;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < iterations; i++)
+		amdgpu_cs_query_fence_status(&fence, 0, 0, &expired);
+	report("fence-query/ioctl", iterations, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+
+	/* With a mapped user fence, the "GPU" writes the value by hand */
+	request.fence_info.handle = fence_bo;
+	request.fence_info.offset = 0;
+	r = amdgpu_cs_submit(context_handle, 0, &request, 1);
+	if (r)
+		goto out_unmap;
+	fence.fence = request.seq_no;
+
+	*fence_cpu = fence.fence - 1;
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < iterations; i++)
+		amdgpu_cs_query_fence_status(&fence, 0, 0, &expired);
+	report("fence-query/user-fence-busy", iterations,
+	       get_time_ns() - start, stand_in_ioctls - ioctls);
+
+	*fence_cpu = fence.fence;
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < iterations; i++)
+		amdgpu_cs_query_fence_status(&fence, 0, 0, &expired);
+	report("fence-query/user-fence-signaled", iterations,
+	       get_time_ns() - start, stand_in_ioctls - ioctls);
+
+	r = check_fence_query_mixed(&request, &fence, fence_bo, fence_cpu);
+	if (r)
+		goto out_unmap;
+
+	r = check_fence_query_switch(&request, fence_bo);
+	if (r)
+		goto out_unmap;
+
+	r = amdgpu_cs_ctx_query_fence_stats(context_handle, &stats);
+	if (!r)
+		fprintf(stdout, "fence stats: %" PRIu64 " signaled, %" PRIu64
+			" busy, %" PRIu64 " ioctls\n",
+			stats.user_fence_signaled, stats.user_fence_busy,
+			stats.ioctls);
+
+out_unmap:
+	amdgpu_bo_cpu_unmap(fence_bo);
+out_free:
+	amdgpu_bo_free(fence_bo);
+	return r;
+}
+
+/*
+ * Memory backed user queue: a consumer thread plays the firmware and checks
+ * that the packets of every producer arrive complete and in order.
+ */
+
+#define FAKE_USERQ_SIZE_DW	4096
+#define FAKE_USERQ_PRODUCERS	4
+#define FAKE_USERQ_BATCH	8
+
+struct fake_userq {
+	uint32_t ring[FAKE_USERQ_SIZE_DW];
+	volatile uint64_t wptr;
+	volatile uint64_t rptr;
+	volatile uint64_t doorbell;
+	volatile bool done;
+	uint64_t packets;
+	bool corrupted;
+};
+
+static struct fake_userq fake_userq;
+static amdgpu_userq_ring_handle fake_userq_ring;
+
+static void *fake_userq_consumer(void *data)
+{
+	struct fake_userq *q = data;
+	uint32_t next[FAKE_USERQ_PRODUCERS] = { 0 };
+	uint64_t rptr = q->rptr;
+
+	for (;;) {
+		uint64_t wptr = q->doorbell;
+
+		if (rptr == wptr) {
+			if (q->done && q->doorbell == rptr)
+				break;
+			sched_yield();
+			continue;
+		}
+
+		__sync_synchronize();
+		while (rptr < wptr) {
+			uint32_t header = q->ring[rptr % FAKE_USERQ_SIZE_DW];
+			uint32_t producer = header >> 24, len = header & 0xff, i;
+			uint32_t seq;
+
+			if (producer >= FAKE_USERQ_PRODUCERS || !len) {
+				q->corrupted = true;
+				return NULL;
+			}
+			seq = q->ring[(rptr + 1) % FAKE_USERQ_SIZE_DW];
+			if (seq != next[producer]++)
+				q->corrupted = true;
+			for (i = 2; i < len; i++)
+				if (q->ring[(rptr + i) % FAKE_USERQ_SIZE_DW] != seq + i)
+					q->corrupted = true;
+			rptr += len;
+			q->packets++;
+		}
+		__sync_synchronize();
+		q->rptr = rptr;
+	}
+	return NULL;
+}
+
+static void *fake_userq_producer(void *data)
+{
+	uint32_t producer = (uintptr_t)data;
+	uint32_t packet[32], len, i;
+	uint64_t n, pos;
+
+	for (n = 0; n < iterations / FAKE_USERQ_PRODUCERS; n++) {
+		len = 4 + (n * 7 + producer) % 28;
+		packet[0] = producer << 24 | len;
+		packet[1] = n;
+		for (i = 2; i < len; i++)
+			packet[i] = n + i;
+
+		/* the consumer only sees flushed packets */
+		while (amdgpu_userq_ring_reserve(fake_userq_ring, len,
+						 &pos) == -EBUSY) {
+			amdgpu_userq_ring_flush(fake_userq_ring, NULL);
+			sched_yield();
+		}
+		amdgpu_userq_ring_write(fake_userq_ring, pos, packet, len);
+		amdgpu_userq_ring_commit(fake_userq_ring, pos, len);
+
+		if ((n % FAKE_USERQ_BATCH) == FAKE_USERQ_BATCH - 1)
+			amdgpu_userq_ring_flush(fake_userq_ring, NULL);
+	}
+	amdgpu_userq_ring_flush(fake_userq_ring, NULL);
+	return NULL;
+}
+
+static int bench_userq_ring(void)
+{
+	struct amdgpu_userq_ring_info info = { 0 };
+	pthread_t consumer, producers[FAKE_USERQ_PRODUCERS];
+	uint64_t start, ioctls, expected;
+	uintptr_t i;
+	int r;
+
+	memset(&fake_userq, 0, sizeof(fake_userq));
+	info.ring = fake_userq.ring;
+	info.ring_size_dw = FAKE_USERQ_SIZE_DW;
+	info.wptr = &fake_userq.wptr;
+	info.rptr = &fake_userq.rptr;
+	info.doorbell = &fake_userq.doorbell;
+	r = amdgpu_userq_ring_create(device_handle, &info, &fake_userq_ring);
+	if (r)
+		return r;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	pthread_create(&consumer, NULL, fake_userq_consumer, &fake_userq);
+	for (i = 0; i < FAKE_USERQ_PRODUCERS; i++)
+		pthread_create(&producers[i], NULL, fake_userq_producer,
+			       (void *)i);
+	for (i = 0; i < FAKE_USERQ_PRODUCERS; i++)
+		pthread_join(producers[i], NULL);
+	fake_userq.done = true;
+	pthread_join(consumer, NULL);
+
+	expected = iterations / FAKE_USERQ_PRODUCERS * FAKE_USERQ_PRODUCERS;
+	report("userq-ring/4-producers", expected, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+
+	amdgpu_userq_ring_destroy(fake_userq_ring);
+
+	if (fake_userq.corrupted || fake_userq.packets != expected) {
+		fprintf(stderr, "userq ring: %" PRIu64 " of %" PRIu64
+			" packets, %s\n", fake_userq.packets, expected,
+			fake_userq.corrupted ? "corrupted" : "intact");
+		return -EIO;
+	}
+	return 0;
+}
+
+static int bench_device_init_loop(const char *name, uint64_t count,
+				  char **marketing_name)
+{
+	uint32_t major_version, minor_version;
+	amdgpu_device_handle dev;
+	uint64_t start, ioctls, i;
+	int fd, r = 0;
+
+	fd = stand_in_open();
+	if (fd < 0)
+		return fd;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < count; i++) {
+		r = amdgpu_device_initialize2(fd, false, &major_version,
+					      &minor_version, &dev);
+		if (r)
+			break;
+		if (i == 0)
+			*marketing_name = strdup(amdgpu_get_marketing_name(dev) ?
+						 amdgpu_get_marketing_name(dev) : "");
+		amdgpu_device_deinitialize(dev);
+	}
+	if (!r)
+		report(name, count, get_time_ns() - start,
+		       stand_in_ioctls - ioctls);
+
+	close(fd);
+	return r;
+}
+
+static int bench_device_init(void)
+{
+	/* parsing the text table is slow, keep the default run short */
+	uint64_t count = iterations < 10000 ? iterations : 10000;
+	char *builtin_name = NULL, *text_name = NULL;
+	int r;
+
+	unsetenv("AMDGPU_ASIC_ID_TABLE_PATHS");
+	r = bench_device_init_loop("device-init/built-in-ids", count,
+				   &builtin_name);
+	if (r || !ids_dir)
+		goto out;
+
+	setenv("AMDGPU_ASIC_ID_TABLE_PATHS", ids_dir, 1);
+	r = bench_device_init_loop("device-init/amdgpu.ids", count,
+				   &text_name);
+	unsetenv("AMDGPU_ASIC_ID_TABLE_PATHS");
+	if (r)
+		goto out;
+
+	if (strcmp(builtin_name, text_name)) {
+		fprintf(stderr, "marketing name mismatch: \"%s\" vs \"%s\"\n",
+			builtin_name, text_name);
+		r = -EINVAL;
+	}
+
+out:
+	free(builtin_name);
+	free(text_name);
+	return r;
+}
+
+static int bench_gpu_info_cache_loop(const char *name, uint64_t count,
+				     struct amdgpu_gpu_info *info)
+{
+	uint32_t major_version, minor_version;
+	amdgpu_device_handle dev;
+	uint64_t start, ioctls, i;
+	int fd, r = 0;
+
+	fd = stand_in_open();
+	if (fd < 0)
+		return fd;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < count; i++) {
+		r = amdgpu_device_initialize2(fd, false, &major_version,
+					      &minor_version, &dev);
+		if (r)
+			break;
+		amdgpu_query_gpu_info(dev, info);
+		amdgpu_device_deinitialize(dev);
+	}
+	if (!r)
+		report(name, count, get_time_ns() - start,
+		       stand_in_ioctls - ioctls);
+
+	close(fd);
+	return r;
+}
+
+/*
+ * Cached and uncached initialization have to report the same info. From
+ * GFX9 on the cache isn't used at all, so nothing may be written to it.
+ */
+static int bench_gpu_info_cache_family(uint32_t family, const char *label)
+{
+	uint64_t count = iterations < 10000 ? iterations : 10000;
+	struct amdgpu_gpu_info uncached, cached;
+	char dir[] = "/tmp/amdgpu_bench.XXXXXX";
+	char path[sizeof(dir) + 256];
+	char name[64];
+	unsigned entries = 0;
+	DIR *d;
+	struct dirent *entry;
+	int r;
+
+	stand_in_family = family;
+
+	unsetenv("AMDGPU_GPU_INFO_CACHE_DIR");
+	snprintf(name, sizeof(name), "gpu-info/%s-registers", label);
+	r = bench_gpu_info_cache_loop(name, count, &uncached);
+	if (r)
+		goto out;
+
+	if (!mkdtemp(dir)) {
+		r = -errno;
+		goto out;
+	}
+	setenv("AMDGPU_GPU_INFO_CACHE_DIR", dir, 1);
+	snprintf(name, sizeof(name), "gpu-info/%s-cached", label);
+	r = bench_gpu_info_cache_loop(name, count, &cached);
+	unsetenv("AMDGPU_GPU_INFO_CACHE_DIR");
+
+	d = opendir(dir);
+	while (d && (entry = readdir(d))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		unlink(path);
+		entries++;
+	}
+	if (d)
+		closedir(d);
+	rmdir(dir);
+
+	if (!r && memcmp(&uncached, &cached, sizeof(cached))) {
+		fprintf(stderr, "%s gpu info differs with the cache\n", label);
+		r = -EINVAL;
+	}
+	if (!r && !entries != (family >= AMDGPU_FAMILY_AI)) {
+		fprintf(stderr, "%s gpu info cache has %u entries\n", label,
+			entries);
+		r = -EINVAL;
+	}
+
+out:
+	stand_in_family = AMDGPU_FAMILY_NV;
+	return r;
+}
+
+static int bench_gpu_info_cache(void)
+{
+	int r;
+
+	/* pre-GFX9 parts read the most registers */
+	r = bench_gpu_info_cache_family(AMDGPU_FAMILY_CI, "ci");
+	if (!r)
+		r = bench_gpu_info_cache_family(AMDGPU_FAMILY_NV, "nv");
+	return r;
+}
+
+/*
+ * A frame uses the same BOs as the one before, except for 1% which are
+ * replaced by others.
+ */
+static int bench_bo_list_size(uint32_t num_bos, uint64_t frames)
+{
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	amdgpu_bo_handle *bos, *frame;
+	amdgpu_bo_list_builder_handle builder;
+	amdgpu_bo_list_handle list;
+	struct drm_amdgpu_cs_chunk chunk;
+	uint32_t delta = num_bos / 100, pool = num_bos + delta;
+	uint64_t start, ioctls, i, f;
+	uint32_t bo_list;
+	char name[64];
+	int r = 0;
+
+	bos = calloc(pool, sizeof(*bos));
+	frame = calloc(num_bos, sizeof(*frame));
+	if (!bos || !frame) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	alloc.alloc_size = 4096;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	for (i = 0; i < pool; i++) {
+		r = amdgpu_bo_alloc(device_handle, &alloc, &bos[i]);
+		if (r)
+			goto out;
+	}
+
+	/* the BOs of frame f are bos[f * delta ... f * delta + num_bos] */
+#define FRAME_BO(f, i)	bos[((f) * delta + (i)) % pool]
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (f = 0; f < frames; f++) {
+		for (i = 0; i < num_bos; i++)
+			frame[i] = FRAME_BO(f, i);
+		r = amdgpu_bo_list_create(device_handle, num_bos, frame, NULL,
+					  &list);
+		if (r)
+			goto out;
+		amdgpu_bo_list_destroy(list);
+	}
+	snprintf(name, sizeof(name), "bo-list/create/%u", num_bos);
+	report(name, frames, get_time_ns() - start, stand_in_ioctls - ioctls);
+
+	r = amdgpu_bo_list_builder_create(device_handle, &builder);
+	if (r)
+		goto out;
+	for (i = 0; i < num_bos; i++)
+		amdgpu_bo_list_builder_add(builder, FRAME_BO(0, i), 0);
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (f = 1; f <= frames; f++) {
+		for (i = 0; i < delta; i++) {
+			amdgpu_bo_list_builder_remove(builder,
+						      FRAME_BO(f - 1, i));
+			amdgpu_bo_list_builder_add(builder,
+						   FRAME_BO(f, num_bos - delta + i),
+						   0);
+		}
+		r = amdgpu_bo_list_builder_get_handle(builder, &bo_list);
+		if (r)
+			break;
+	}
+	snprintf(name, sizeof(name), "bo-list/builder-handle/%u", num_bos);
+	report(name, frames, get_time_ns() - start, stand_in_ioctls - ioctls);
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (f = frames + 1; !r && f <= 2 * frames; f++) {
+		for (i = 0; i < delta; i++) {
+			amdgpu_bo_list_builder_remove(builder,
+						      FRAME_BO(f - 1, i));
+			amdgpu_bo_list_builder_add(builder,
+						   FRAME_BO(f, num_bos - delta + i),
+						   0);
+		}
+		r = amdgpu_bo_list_builder_get_chunk(builder, &chunk);
+	}
+	snprintf(name, sizeof(name), "bo-list/builder-chunk/%u", num_bos);
+	report(name, frames, get_time_ns() - start, stand_in_ioctls - ioctls);
+#undef FRAME_BO
+
+	amdgpu_bo_list_builder_destroy(builder);
+
+out:
+	for (i = 0; bos && i < pool && bos[i]; i++)
+		amdgpu_bo_free(bos[i]);
+	free(bos);
+	free(frame);
+	return r;
+}
+
+static int bench_bo_list(void)
+{
+	static const uint32_t sizes[] = { 1000, 10000, 50000 };
+	unsigned i;
+	int r;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		/* scale the frame count so every size touches as many BOs */
+		uint64_t frames = iterations * 10 / sizes[i];
+
+		r = bench_bo_list_size(sizes[i], frames ? frames : 1);
+		if (r)
+			return r;
+	}
+	return 0;
+}
+
+/*
+ * Independent chains of jobs spread over a few contexts, with every fourth
+ * job also depending on the previous job of the neighbouring chain.
+ */
+#define CS_SCHED_CHAINS		16
+#define CS_SCHED_CONTEXTS	4
+
+static int bench_cs_scheduler_run(amdgpu_context_handle *contexts,
+				  uint32_t num_jobs, uint32_t num_workers)
+{
+	struct drm_amdgpu_cs_chunk_ib ib = { 0 };
+	struct drm_amdgpu_cs_chunk chunk;
+	struct amdgpu_cs_scheduler_stats stats;
+	struct amdgpu_cs_sched_job job = { 0 };
+	amdgpu_cs_scheduler_handle sched;
+	uint32_t *ids, deps[2], i, c;
+	uint64_t start, ioctls;
+	char name[64];
+	int r;
+
+	ib.ip_type = AMDGPU_HW_IP_COMPUTE;
+	ib.va_start = 0x100000;
+	ib.ib_bytes = 64;
+	chunk.chunk_id = AMDGPU_CHUNK_ID_IB;
+	chunk.length_dw = sizeof(ib) / 4;
+	chunk.chunk_data = (uintptr_t)&ib;
+
+	ids = calloc(num_jobs, sizeof(*ids));
+	if (!ids)
+		return -ENOMEM;
+
+	r = amdgpu_cs_scheduler_create(device_handle, num_workers, &sched);
+	if (r)
+		goto out;
+
+	job.num_chunks = 1;
+	job.chunks = &chunk;
+	job.dependencies = deps;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < num_jobs; i++) {
+		c = i % CS_SCHED_CHAINS;
+		job.context = contexts[c % CS_SCHED_CONTEXTS];
+		job.num_dependencies = 0;
+		if (i >= CS_SCHED_CHAINS) {
+			deps[job.num_dependencies++] = ids[i - CS_SCHED_CHAINS];
+			if ((i / CS_SCHED_CHAINS) % 4 == 0)
+				deps[job.num_dependencies++] =
+					ids[i - CS_SCHED_CHAINS - c +
+					    (c + 1) % CS_SCHED_CHAINS];
+		}
+		r = amdgpu_cs_scheduler_add_job(sched, &job, &ids[i]);
+		if (r)
+			break;
+	}
+	if (!r)
+		r = amdgpu_cs_scheduler_wait_idle(sched);
+	snprintf(name, sizeof(name), "cs-scheduler/%u-workers", num_workers);
+	report(name, num_jobs, get_time_ns() - start, stand_in_ioctls - ioctls);
+
+	if (!r)
+		r = amdgpu_cs_scheduler_query_stats(sched, &stats);
+	if (!r)
+		fprintf(stdout, "%-32s max queue depth %u, latency %.1f us avg "
+			"%.1f us max\n", "", stats.max_queue_depth,
+			stats.total_latency_ns / 1e3 /
+			(stats.submitted ? stats.submitted : 1),
+			stats.max_latency_ns / 1e3);
+
+	amdgpu_cs_scheduler_destroy(sched);
+out:
+	free(ids);
+	return r;
+}
+
+static int bench_cs_scheduler(void)
+{
+	static const uint32_t workers[] = { 1, 2, 4, 8 };
+	struct drm_amdgpu_cs_chunk_ib ib = { 0 };
+	struct drm_amdgpu_cs_chunk chunk;
+	amdgpu_context_handle contexts[CS_SCHED_CONTEXTS] = { 0 };
+	uint32_t num_jobs, i;
+	uint64_t start, ioctls, seq_no;
+	int r = 0;
+
+	/* every submission spends 20us in the stand-in kernel */
+	num_jobs = iterations / 10;
+	if (num_jobs < CS_SCHED_CHAINS)
+		num_jobs = CS_SCHED_CHAINS;
+	stand_in_cs_delay_ns = 20000;
+
+	for (i = 0; i < CS_SCHED_CONTEXTS; i++) {
+		r = amdgpu_cs_ctx_create(device_handle, &contexts[i]);
+		if (r)
+			goto out;
+	}
+
+	ib.ip_type = AMDGPU_HW_IP_COMPUTE;
+	ib.va_start = 0x100000;
+	ib.ib_bytes = 64;
+	chunk.chunk_id = AMDGPU_CHUNK_ID_IB;
+	chunk.length_dw = sizeof(ib) / 4;
+	chunk.chunk_data = (uintptr_t)&ib;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < num_jobs; i++) {
+		r = amdgpu_cs_submit_raw2(device_handle,
+					  contexts[i % CS_SCHED_CONTEXTS], 0,
+					  1, &chunk, &seq_no);
+		if (r)
+			goto out;
+	}
+	report("cs-scheduler/serial", num_jobs, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+
+	for (i = 0; i < sizeof(workers) / sizeof(workers[0]); i++) {
+		r = bench_cs_scheduler_run(contexts, num_jobs, workers[i]);
+		if (r)
+			break;
+	}
+
+out:
+	stand_in_cs_delay_ns = 0;
+	for (i = 0; i < CS_SCHED_CONTEXTS && contexts[i]; i++)
+		amdgpu_cs_ctx_free(contexts[i]);
+	return r;
+}
+
+/*
+ * Frame graph: every frame submits to each context, then every node waits
+ * for all of the frame's fences plus a syncobj from outside.
+ */
+#define WAIT_ITEMS_CONTEXTS	4
+#define WAIT_ITEMS_NODES	8
+
+static int bench_wait_items_frame(amdgpu_context_handle *contexts,
+				  struct drm_amdgpu_cs_chunk *chunk,
+				  struct amdgpu_cs_fence *fences)
+{
+	uint64_t seq_no;
+	uint32_t i;
+	int r;
+
+	for (i = 0; i < WAIT_ITEMS_CONTEXTS; i++) {
+		r = amdgpu_cs_submit_raw2(device_handle, contexts[i], 0, 1,
+					  chunk, &seq_no);
+		if (r)
+			return r;
+
+		fences[i].context = contexts[i];
+		fences[i].ip_type = AMDGPU_HW_IP_COMPUTE;
+		fences[i].fence = seq_no;
+	}
+	return 0;
+}
+
+static int bench_wait_items(void)
+{
+	struct amdgpu_cs_wait_item items[WAIT_ITEMS_CONTEXTS + 1];
+	struct amdgpu_cs_fence fences[WAIT_ITEMS_CONTEXTS] = { 0 };
+	amdgpu_context_handle contexts[WAIT_ITEMS_CONTEXTS] = { 0 };
+	struct drm_amdgpu_cs_chunk_ib ib = { 0 };
+	struct drm_amdgpu_cs_chunk chunk;
+	uint64_t start, ioctls, frames, f;
+	uint32_t i, n, syncobj = 0, status, first;
+	int r;
+
+	frames = iterations / 10 ? iterations / 10 : 1;
+
+	for (i = 0; i < WAIT_ITEMS_CONTEXTS; i++) {
+		r = amdgpu_cs_ctx_create(device_handle, &contexts[i]);
+		if (r)
+			goto out;
+	}
+
+	r = amdgpu_cs_create_syncobj2(device_handle,
+				      DRM_SYNCOBJ_CREATE_SIGNALED, &syncobj);
+	if (r)
+		goto out;
+
+	ib.ip_type = AMDGPU_HW_IP_COMPUTE;
+	ib.va_start = 0x100000;
+	ib.ib_bytes = 64;
+	chunk.chunk_id = AMDGPU_CHUNK_ID_IB;
+	chunk.length_dw = sizeof(ib) / 4;
+	chunk.chunk_data = (uintptr_t)&ib;
+
+	/* Fences and the syncobj waited for separately */
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (f = 0; f < frames && !r; f++) {
+		r = bench_wait_items_frame(contexts, &chunk, fences);
+		for (n = 0; n < WAIT_ITEMS_NODES && !r; n++) {
+			r = amdgpu_cs_wait_fences(fences, WAIT_ITEMS_CONTEXTS,
+						  true, AMDGPU_TIMEOUT_INFINITE,
+						  &status, &first);
+			if (!r)
+				r = amdgpu_cs_syncobj_wait(device_handle,
+							   &syncobj, 1, INT64_MAX,
+							   DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL,
+							   &first);
+		}
+	}
+	report("wait-items/separate", frames, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+	fprintf(stdout, "%-32s %u kernel waits per frame\n", "",
+		WAIT_ITEMS_NODES * 2);
+	if (r)
+		goto out;
+
+	/* One wait per node, fences are converted once per frame */
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (f = 0; f < frames && !r; f++) {
+		r = bench_wait_items_frame(contexts, &chunk, fences);
+		for (i = 0; i < WAIT_ITEMS_CONTEXTS; i++) {
+			items[i].type = AMDGPU_CS_WAIT_ITEM_FENCE;
+			items[i].fence = fences[i];
+		}
+		items[i].type = AMDGPU_CS_WAIT_ITEM_SYNCOBJ;
+		items[i].syncobj = syncobj;
+
+		for (n = 0; n < WAIT_ITEMS_NODES && !r; n++)
+			r = amdgpu_cs_wait_items(device_handle, items,
+						 WAIT_ITEMS_CONTEXTS + 1, true,
+						 AMDGPU_TIMEOUT_INFINITE, 0,
+						 &status, &first);
+		if (!r && !status)
+			r = -ETIME;
+	}
+	report("wait-items/unified", frames, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+	fprintf(stdout, "%-32s %u kernel waits per frame\n", "",
+		WAIT_ITEMS_NODES);
+	if (r)
+		goto out;
+
+	/* Each node waits for one context only, nothing to convert */
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (f = 0; f < frames && !r; f++) {
+		r = bench_wait_items_frame(contexts, &chunk, fences);
+		for (n = 0; n < WAIT_ITEMS_NODES && !r; n++) {
+			items[0].type = AMDGPU_CS_WAIT_ITEM_FENCE;
+			items[0].fence = fences[n % WAIT_ITEMS_CONTEXTS];
+			r = amdgpu_cs_wait_items(device_handle, items, 1, true,
+						 AMDGPU_TIMEOUT_INFINITE, 0,
+						 &status, &first);
+		}
+		if (!r && !status)
+			r = -ETIME;
+	}
+	report("wait-items/one-fence", frames, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+	if (r)
+		goto out;
+
+	/* Only the syncobj from outside */
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (f = 0; f < frames && !r; f++) {
+		r = bench_wait_items_frame(contexts, &chunk, fences);
+		items[0].type = AMDGPU_CS_WAIT_ITEM_SYNCOBJ;
+		items[0].syncobj = syncobj;
+		for (n = 0; n < WAIT_ITEMS_NODES && !r; n++)
+			r = amdgpu_cs_wait_items(device_handle, items, 1, true,
+						 AMDGPU_TIMEOUT_INFINITE, 0,
+						 &status, &first);
+		if (!r && !status)
+			r = -ETIME;
+	}
+	report("wait-items/syncobjs", frames, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+
+out:
+	if (syncobj)
+		amdgpu_cs_destroy_syncobj(device_handle, syncobj);
+	for (i = 0; i < WAIT_ITEMS_CONTEXTS && contexts[i]; i++)
+		amdgpu_cs_ctx_free(contexts[i]);
+	return r;
+}
+
+/*
+ * Synthetic sparse binding trace over a 64MB resource of 64KB pages. Every
+ * frame binds 16 runs of 16 pages in random page order, unbinds the runs
+ * of the frame before page by page, and maps and unmaps 32 scratch pages.
+ */
+#define VA_TRACE_PAGE		(64 * 1024)
+#define VA_TRACE_PAGES		1024
+#define VA_TRACE_RUNS		16
+#define VA_TRACE_RUN_PAGES	16
+#define VA_TRACE_SCRATCH	32
+#define VA_TRACE_BASE		0x400000000ull
+
+struct va_trace_op {
+	uint32_t ops;
+	uint32_t page;
+};
+
+static uint32_t va_trace_random(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+static struct va_trace_op *va_trace_create(uint64_t frames, uint32_t *count)
+{
+	uint32_t runs[2][VA_TRACE_RUNS], order[VA_TRACE_RUNS * VA_TRACE_RUN_PAGES];
+	uint32_t state = 1, n = 0, i, j, k, t, cur, prev;
+	struct va_trace_op *trace;
+
+	trace = calloc(frames * (2 * VA_TRACE_RUNS * VA_TRACE_RUN_PAGES +
+				 2 * VA_TRACE_SCRATCH), sizeof(*trace));
+	if (!trace)
+		return NULL;
+
+	for (i = 0; i < frames; i++) {
+		cur = i & 1;
+		prev = cur ^ 1;
+
+		/* runs don't overlap, each one has its own 64 page slot */
+		for (j = 0; j < VA_TRACE_RUNS; j++)
+			runs[cur][j] = j * 64 + va_trace_random(&state) %
+				(64 - VA_TRACE_RUN_PAGES);
+		for (j = 0; j < VA_TRACE_RUNS * VA_TRACE_RUN_PAGES; j++)
+			order[j] = runs[cur][j / VA_TRACE_RUN_PAGES] +
+				j % VA_TRACE_RUN_PAGES;
+		for (j = VA_TRACE_RUNS * VA_TRACE_RUN_PAGES - 1; j > 0; j--) {
+			k = va_trace_random(&state) % (j + 1);
+			t = order[j];
+			order[j] = order[k];
+			order[k] = t;
+		}
+
+		/* the old runs go first, the new ones may reuse their pages */
+		for (j = 0; i && j < VA_TRACE_RUNS; j++) {
+			for (k = 0; k < VA_TRACE_RUN_PAGES; k++) {
+				trace[n].ops = AMDGPU_VA_OP_UNMAP;
+				trace[n++].page = runs[prev][j] + k;
+			}
+		}
+		for (j = 0; j < VA_TRACE_RUNS * VA_TRACE_RUN_PAGES; j++) {
+			trace[n].ops = AMDGPU_VA_OP_MAP;
+			trace[n++].page = order[j];
+		}
+		for (j = 0; j < VA_TRACE_SCRATCH; j++) {
+			trace[n].ops = AMDGPU_VA_OP_MAP;
+			trace[n++].page = VA_TRACE_PAGES + j;
+		}
+		for (j = 0; j < VA_TRACE_SCRATCH; j++) {
+			trace[n].ops = AMDGPU_VA_OP_UNMAP;
+			trace[n++].page = VA_TRACE_PAGES + j;
+		}
+		/* frame end marker */
+		trace[n].ops = 0;
+		trace[n++].page = 0;
+	}
+
+	*count = n;
+	return trace;
+}
+
+static int bench_va_batch_replay(struct va_trace_op *trace, uint32_t count,
+				 uint64_t frames, amdgpu_bo_handle bo,
+				 uint32_t syncobj)
+{
+	struct amdgpu_bo_va_batch_stats stats;
+	amdgpu_bo_va_batch_handle batch;
+	uint64_t start, ioctls, point, flags;
+	char name[64];
+	uint32_t i;
+	int r = 0;
+
+	flags = AMDGPU_VM_PAGE_READABLE | AMDGPU_VM_PAGE_WRITEABLE;
+
+	/* one ioctl per operation, the last of a frame signals */
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0, point = 1; !r && i < count; i++) {
+		struct va_trace_op *op = &trace[i];
+		bool last = !trace[i + 1].ops;
+
+		if (!op->ops) {
+			point++;
+			continue;
+		}
+		r = amdgpu_bo_va_op_raw2(device_handle, bo,
+					 (uint64_t)op->page * VA_TRACE_PAGE,
+					 VA_TRACE_PAGE,
+					 VA_TRACE_BASE +
+					 (uint64_t)op->page * VA_TRACE_PAGE,
+					 flags, op->ops, last ? syncobj : 0,
+					 last ? point : 0, 0, 0);
+	}
+	snprintf(name, sizeof(name), "va-batch/single/%ldns",
+		 stand_in_va_delay_ns);
+	report(name, frames, get_time_ns() - start, stand_in_ioctls - ioctls);
+	if (r)
+		return r;
+
+	r = amdgpu_bo_va_batch_create(device_handle, &batch);
+	if (r)
+		return r;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0, point = 1; !r && i < count; i++) {
+		struct va_trace_op *op = &trace[i];
+
+		if (!op->ops) {
+			r = amdgpu_bo_va_batch_flush(batch, syncobj, point++,
+						     0, 0);
+			continue;
+		}
+		r = amdgpu_bo_va_batch_add(batch, bo,
+					   (uint64_t)op->page * VA_TRACE_PAGE,
+					   VA_TRACE_PAGE,
+					   VA_TRACE_BASE +
+					   (uint64_t)op->page * VA_TRACE_PAGE,
+					   flags, op->ops);
+	}
+	snprintf(name, sizeof(name), "va-batch/batched/%ldns",
+		 stand_in_va_delay_ns);
+	report(name, frames, get_time_ns() - start, stand_in_ioctls - ioctls);
+
+	if (!r)
+		r = amdgpu_bo_va_batch_query_stats(batch, &stats);
+	if (!r)
+		fprintf(stdout, "va-batch stats: %" PRIu64 " ops, %" PRIu64
+			" coalesced, %" PRIu64 " cancelled, %" PRIu64
+			" ioctls\n", stats.ops, stats.coalesced,
+			stats.cancelled, stats.ioctls);
+
+	amdgpu_bo_va_batch_destroy(batch);
+	return r;
+}
+
+static int bench_va_batch(void)
+{
+	/* library cost alone, and with some page table work per ioctl */
+	static const long delays[] = { 0, 2000 };
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	struct va_trace_op *trace;
+	amdgpu_bo_handle bo;
+	uint32_t count, syncobj, i;
+	uint64_t frames;
+	int r;
+
+	frames = iterations / 100 ? iterations / 100 : 1;
+	trace = va_trace_create(frames, &count);
+	if (!trace)
+		return -ENOMEM;
+
+	alloc.alloc_size = (uint64_t)(VA_TRACE_PAGES + VA_TRACE_SCRATCH) *
+		VA_TRACE_PAGE;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_VRAM;
+	r = amdgpu_bo_alloc(device_handle, &alloc, &bo);
+	if (r)
+		goto out;
+
+	r = amdgpu_cs_create_syncobj2(device_handle, 0, &syncobj);
+	if (r)
+		goto out_bo;
+
+	for (i = 0; !r && i < sizeof(delays) / sizeof(delays[0]); i++) {
+		stand_in_va_delay_ns = delays[i];
+		r = bench_va_batch_replay(trace, count, frames, bo, syncobj);
+	}
+	stand_in_va_delay_ns = 0;
+
+	amdgpu_cs_destroy_syncobj(device_handle, syncobj);
+out_bo:
+	amdgpu_bo_free(bo);
+out:
+	free(trace);
+	return r;
+}
+
+/*
+ * A freed buffer kept by the reuse cache moves from the live to the cached
+ * counters, and back when the cache hands it out again.
+ */
+static int check_heap_usage_cached(void)
+{
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	struct amdgpu_heap_usage before, after;
+	amdgpu_bo_handle bo;
+	int r;
+
+	alloc.alloc_size = 64 * 1024;
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_VRAM;
+
+	r = amdgpu_bo_cache_enable(device_handle, true);
+	if (r)
+		return r;
+
+	r = amdgpu_query_heap_usage(device_handle, AMDGPU_HEAP_USAGE_VRAM, 0,
+				    &before);
+	if (!r)
+		r = amdgpu_bo_alloc(device_handle, &alloc, &bo);
+	if (r)
+		goto out;
+
+	amdgpu_bo_free(bo);
+	r = amdgpu_query_heap_usage(device_handle, AMDGPU_HEAP_USAGE_VRAM, 0,
+				    &after);
+	if (!r && (after.live_bytes != before.live_bytes ||
+		   after.cached_bytes != before.cached_bytes + alloc.alloc_size ||
+		   after.cached_count != before.cached_count + 1)) {
+		fprintf(stderr, "cached buffer not counted as cached\n");
+		r = -EINVAL;
+	}
+	if (r)
+		goto out;
+
+	r = amdgpu_bo_alloc(device_handle, &alloc, &bo);
+	if (r)
+		goto out;
+	r = amdgpu_query_heap_usage(device_handle, AMDGPU_HEAP_USAGE_VRAM, 0,
+				    &after);
+	if (!r && (after.live_bytes != before.live_bytes + alloc.alloc_size ||
+		   after.cached_bytes != before.cached_bytes ||
+		   after.allocations != before.allocations + 2)) {
+		fprintf(stderr, "reused buffer not counted as live\n");
+		r = -EINVAL;
+	}
+	amdgpu_bo_free(bo);
+
+out:
+	/* disabling the cache destroys what it keeps */
+	amdgpu_bo_cache_enable(device_handle, false);
+	if (!r)
+		r = amdgpu_query_heap_usage(device_handle,
+					    AMDGPU_HEAP_USAGE_VRAM, 0, &after);
+	if (!r && (after.live_bytes != before.live_bytes ||
+		   after.cached_bytes != before.cached_bytes)) {
+		fprintf(stderr, "purged buffer still counted\n");
+		r = -EINVAL;
+	}
+	return r;
+}
+
+static int bench_heap_usage(void)
+{
+	struct amdgpu_bo_alloc_request alloc = { 0 };
+	struct timespec delay = { 0, 20000000 };
+	struct amdgpu_heap_usage heap;
+	struct amdgpu_heap_info info;
+	amdgpu_bo_handle bos[16];
+	uint64_t start, ioctls, i;
+	int r = 0, j;
+
+	/* 4KB to 128MB, every size bucket once */
+	alloc.preferred_heap = AMDGPU_GEM_DOMAIN_VRAM;
+	for (j = 0; j < 16 && !r; j++) {
+		alloc.alloc_size = 4096ull << j;
+		r = amdgpu_bo_alloc(device_handle, &alloc, &bos[j]);
+	}
+	if (!r)
+		r = amdgpu_query_heap_usage(device_handle,
+					    AMDGPU_HEAP_USAGE_VRAM, 0, &heap);
+	if (!r) {
+		fprintf(stdout, "%-32s %" PRIu64 " buffers, %" PRIu64 " MB live, "
+			"%" PRIu64 " MB peak, histogram", "", heap.live_count,
+			heap.live_bytes >> 20, heap.peak_bytes >> 20);
+		for (i = 0; i < AMDGPU_HEAP_USAGE_BUCKETS; i++)
+			fprintf(stdout, " %" PRIu64, heap.size_histogram[i]);
+		fprintf(stdout, "\n");
+	}
+	while (j--)
+		amdgpu_bo_free(bos[j]);
+	if (!r)
+		r = check_heap_usage_cached();
+	if (r)
+		return r;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < iterations && !r; i++)
+		r = amdgpu_query_heap_info(device_handle, AMDGPU_GEM_DOMAIN_VRAM,
+					   0, &info);
+	report("heap-usage/query-heap-info", iterations,
+	       get_time_ns() - start, stand_in_ioctls - ioctls);
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < iterations && !r; i++)
+		r = amdgpu_query_heap_usage(device_handle,
+					    AMDGPU_HEAP_USAGE_VRAM, 0, &heap);
+	report("heap-usage/query-usage", iterations, get_time_ns() - start,
+	       stand_in_ioctls - ioctls);
+	if (r)
+		return r;
+
+	/* Budget numbers refreshed by the timer instead of the queries */
+	r = amdgpu_heap_usage_set_budget_interval(device_handle, 1000000);
+	if (r)
+		return r;
+	nanosleep(&delay, NULL);
+	r = amdgpu_query_heap_usage(device_handle, AMDGPU_HEAP_USAGE_VRAM, 0,
+				    &heap);
+	amdgpu_heap_usage_set_budget_interval(device_handle, 0);
+	if (!r)
+		fprintf(stdout, "%-32s budget %" PRIu64 " of %" PRIu64 " MB, "
+			"%.1f ms old with a 1 ms timer\n", "",
+			heap.budget_usage >> 20, heap.budget_size >> 20,
+			(get_time_ns() - heap.budget_timestamp_ns) / 1e6);
+	if (!r && !heap.budget_timestamp_ns)
+		r = -EIO;
+
+	return r;
+}
+
+/*
+ * Two processes sharing a VA manager: the child allocates the ranges of
+ * the shared buffers, the parent then gets the same addresses for them.
+ */
+#define VA_SHARED_BUFFERS	512
+#define VA_SHARED_SIZE		(64 * 1024)
+
+static amdgpu_va_manager_handle va_shared_manager(int fd)
+{
+	amdgpu_va_manager_handle va_mgr = amdgpu_va_manager_alloc();
+
+	if (va_mgr && amdgpu_va_manager_init_shared(va_mgr, fd, 0x200000,
+						    1ull << 47,
+						    0xffff800000000000ull,
+						    0xffffffffffffffffull,
+						    4096)) {
+		free(va_mgr);
+		va_mgr = NULL;
+	}
+	return va_mgr;
+}
+
+static void va_shared_free_manager(amdgpu_va_manager_handle va_mgr)
+{
+	amdgpu_va_manager_deinit(va_mgr);
+	free(va_mgr);
+}
+
+static void va_shared_child(int fd, int out, int in)
+{
+	amdgpu_va_manager_handle va_mgr = va_shared_manager(fd);
+	amdgpu_va_handle handles[VA_SHARED_BUFFERS];
+	uint64_t va[VA_SHARED_BUFFERS];
+	char c;
+	int i;
+
+	if (!va_mgr)
+		_exit(EXIT_FAILURE);
+
+	for (i = 0; i < VA_SHARED_BUFFERS; i++) {
+		if (amdgpu_va_range_alloc_shared(va_mgr, 1000 + i,
+						 amdgpu_gpu_va_range_general,
+						 VA_SHARED_SIZE, 0, &va[i],
+						 &handles[i], 0))
+			_exit(EXIT_FAILURE);
+	}
+	if (write(out, va, sizeof(va)) != sizeof(va))
+		_exit(EXIT_FAILURE);
+
+	/* keep the buffers alive until the parent has them too */
+	if (read(in, &c, 1) != 1)
+		_exit(EXIT_FAILURE);
+	for (i = 0; i < VA_SHARED_BUFFERS; i++)
+		amdgpu_va_range_free(handles[i]);
+	va_shared_free_manager(va_mgr);
+	_exit(EXIT_SUCCESS);
+}
+
+/* Allocates and frees until killed, most likely holding the lock */
+static void va_shared_churn(int fd)
+{
+	amdgpu_va_manager_handle va_mgr = va_shared_manager(fd);
+	amdgpu_va_handle handle;
+	uint64_t va;
+
+	if (!va_mgr)
+		_exit(EXIT_FAILURE);
+
+	for (;;) {
+		if (!amdgpu_va_range_alloc2(va_mgr, amdgpu_gpu_va_range_general,
+					    VA_SHARED_SIZE, 0, 0, &va,
+					    &handle, 0))
+			amdgpu_va_range_free(handle);
+	}
+}
+
+static int bench_va_shared_alloc(const char *name,
+				 amdgpu_va_manager_handle va_mgr)
+{
+	amdgpu_va_handle handle;
+	uint64_t start, va, i;
+	int r = 0;
+
+	start = get_time_ns();
+	for (i = 0; i < iterations && !r; i++) {
+		r = amdgpu_va_range_alloc2(va_mgr, amdgpu_gpu_va_range_general,
+					   VA_SHARED_SIZE, 0, 0, &va, &handle, 0);
+		if (!r)
+			amdgpu_va_range_free(handle);
+	}
+	report(name, iterations, get_time_ns() - start, 0);
+	return r;
+}
+
+static int bench_va_shared(void)
+{
+	amdgpu_va_handle handles[VA_SHARED_BUFFERS];
+	amdgpu_va_manager_handle va_mgr, private_mgr;
+	uint64_t child_va[VA_SHARED_BUFFERS], va, start;
+	int to_child[2], from_child[2], fd, status, i, r;
+	struct timespec delay = { 0, 20000000 };
+	pid_t pid;
+
+	fd = memfd_create("amdgpu_bench_va_shared", MFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	va_mgr = va_shared_manager(fd);
+	private_mgr = amdgpu_va_manager_alloc();
+	if (!va_mgr || !private_mgr) {
+		r = -ENOMEM;
+		goto out;
+	}
+	amdgpu_va_manager_init(private_mgr, 0x200000, 1ull << 47,
+			       0xffff800000000000ull, 0xffffffffffffffffull,
+			       4096);
+
+	r = bench_va_shared_alloc("va-shared/private-alloc", private_mgr);
+	if (!r)
+		r = bench_va_shared_alloc("va-shared/shared-alloc", va_mgr);
+	if (r)
+		goto out;
+
+	if (pipe(to_child) || pipe(from_child)) {
+		r = -errno;
+		goto out;
+	}
+	pid = fork();
+	if (pid == 0)
+		va_shared_child(fd, from_child[1], to_child[0]);
+
+	r = -EIO;
+	if (pid < 0 ||
+	    read(from_child[0], child_va, sizeof(child_va)) != sizeof(child_va))
+		goto out_child;
+
+	start = get_time_ns();
+	for (i = 0; i < VA_SHARED_BUFFERS; i++) {
+		r = amdgpu_va_range_alloc_shared(va_mgr, 1000 + i,
+						 amdgpu_gpu_va_range_general,
+						 VA_SHARED_SIZE, 0, &va,
+						 &handles[i], 0);
+		if (r)
+			break;
+		if (va != child_va[i]) {
+			fprintf(stderr, "buffer %d at 0x%" PRIx64 " instead of "
+				"0x%" PRIx64 "\n", i, va, child_va[i]);
+			r = -EINVAL;
+			break;
+		}
+	}
+	report("va-shared/import", i, get_time_ns() - start, 0);
+	while (i--)
+		amdgpu_va_range_free(handles[i]);
+
+out_child:
+	if (pid > 0) {
+		if (write(to_child[1], "", 1) != 1)
+			kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		if (!r && (!WIFEXITED(status) || WEXITSTATUS(status)))
+			r = -EIO;
+	}
+	close(to_child[0]);
+	close(to_child[1]);
+	close(from_child[0]);
+	close(from_child[1]);
+	if (r)
+		goto out;
+
+	/* A process dying in the middle of an allocation. With many holes
+	 * allocations take long enough for that to be likely.
+	 */
+	for (i = 0; i < VA_SHARED_BUFFERS; i++) {
+		r = amdgpu_va_range_alloc2(va_mgr, amdgpu_gpu_va_range_general,
+					   4096, 0, 0, &va, &handles[i], 0);
+		if (r)
+			goto out;
+		if (i & 1)
+			amdgpu_va_range_free(handles[i - 1]);
+	}
+
+	pid = fork();
+	if (pid == 0)
+		va_shared_churn(fd);
+	if (pid > 0) {
+		nanosleep(&delay, NULL);
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+	}
+
+	r = amdgpu_va_range_alloc2(va_mgr, amdgpu_gpu_va_range_general,
+				   VA_SHARED_SIZE, 0, 0, &va, &handles[0], 0);
+	if (!r)
+		amdgpu_va_range_free(handles[0]);
+	for (i = 1; i < VA_SHARED_BUFFERS; i += 2)
+		amdgpu_va_range_free(handles[i]);
+	if (pid < 0)
+		r = -EIO;
+	fprintf(stdout, "%-32s %s after killing an allocating process\n", "",
+		r == -ENOTRECOVERABLE ? "not recoverable" : r ? "failed" :
+		"recovered");
+	if (r == -ENOTRECOVERABLE)
+		r = 0;
+
+out:
+	if (private_mgr)
+		va_shared_free_manager(private_mgr);
+	if (va_mgr)
+		va_shared_free_manager(va_mgr);
+	close(fd);
+	return r;
+}
+
+static const struct {
+	const char *name;
+	int (*func)(void);
+	const char *description;
+} scenarios[] = {
+	{ "bo-cache", bench_bo_cache,
+	  "amdgpu_bo_alloc() and amdgpu_bo_free() with and without the reuse cache" },
+	{ "vma-cache", bench_vma_cache,
+	  "amdgpu_bo_cpu_map() and amdgpu_bo_cpu_unmap() keeping mappings alive" },
+	{ "cs-submit", bench_cs_submit,
+	  "amdgpu_cs_submit() against a prebuilt amdgpu_cs_submission" },
+	{ "fence-query", bench_fence_query,
+	  "amdgpu_cs_query_fence_status() with and without a user fence" },
+	{ "semaphore", bench_semaphore,
+	  "amdgpu_cs_submit() waiting for semaphores, and context footprint" },
+	{ "userq-ring", bench_userq_ring,
+	  "multi-producer packet submission to a memory backed user queue" },
+	{ "device-init", bench_device_init,
+	  "amdgpu_device_initialize() with the built-in and text ASIC id table" },
+	{ "bo-list", bench_bo_list,
+	  "amdgpu_bo_list_create() against an incremental BO list builder" },
+	{ "gpu-info-cache", bench_gpu_info_cache,
+	  "amdgpu_device_initialize() with and without AMDGPU_GPU_INFO_CACHE_DIR" },
+	{ "cs-scheduler", bench_cs_scheduler,
+	  "dependent submissions through amdgpu_cs_scheduler against a serial loop" },
+	{ "va-batch", bench_va_batch,
+	  "sparse binding trace with amdgpu_bo_va_op_raw2() and a VA batch" },
+	{ "wait-items", bench_wait_items,
+	  "frame graph waiting for fences and a syncobj with one wait per node" },
+	{ "heap-usage", bench_heap_usage,
+	  "amdgpu_query_heap_usage() against amdgpu_query_heap_info()" },
+	{ "va-shared", bench_va_shared,
+	  "VA ranges of buffers shared between processes through shared memory" },
+};
+
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+int main(int argc, char **argv)
+{
+	uint32_t major_version, minor_version;
+	bool selected[NUM_SCENARIOS] = { false };
+	bool any_selected = false;
+	unsigned i;
+	int fd, r, c;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, options)) != -1) {
+		switch (c) {
+		case 'l':
+			for (i = 0; i < NUM_SCENARIOS; i++)
+				fprintf(stdout, "%-16s %s\n", scenarios[i].name,
+					scenarios[i].description);
+			exit(EXIT_SUCCESS);
+		case 'n':
+			iterations = strtoull(optarg, NULL, 0);
+			if (!iterations) {
+				fprintf(stderr, "Invalid iteration count: %s\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'i':
+			ids_dir = optarg;
+			break;
+		case 's':
+			for (i = 0; i < NUM_SCENARIOS; i++)
+				if (!strcmp(optarg, scenarios[i].name))
+					break;
+			if (i == NUM_SCENARIOS) {
+				fprintf(stderr, "Unknown scenario: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			selected[i] = any_selected = true;
+			break;
+		case '?':
+		case 'h':
+			fprintf(stderr, usage, argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			fprintf(stderr, usage, argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	fd = stand_in_open();
+	if (fd < 0) {
+		fprintf(stderr, "Cannot create stand-in device (%d)\n", fd);
+		exit(EXIT_FAILURE);
+	}
+
+	r = amdgpu_device_initialize2(fd, false, &major_version, &minor_version,
+				      &device_handle);
+	if (r) {
+		fprintf(stderr, "amdgpu_device_initialize returned %d\n", r);
+		exit(EXIT_FAILURE);
+	}
+
+	r = amdgpu_cs_ctx_create(device_handle, &context_handle);
+	if (r) {
+		fprintf(stderr, "amdgpu_cs_ctx_create returned %d\n", r);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NUM_SCENARIOS; i++) {
+		if (any_selected && !selected[i])
+			continue;
+
+		r = scenarios[i].func();
+		if (r) {
+			fprintf(stderr, "Scenario %s failed with %d\n",
+				scenarios[i].name, r);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	amdgpu_cs_ctx_free(context_handle);
+	amdgpu_device_deinitialize(device_handle);
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,360 @@
+/*
+ * Copyright 2026 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Stand-in for an amdgpu kernel driver.
+ *
+ * The drm entry points libdrm_amdgpu calls into are replaced by the ones in
+ * this file. Once stand_in_open() was called they answer every request
+ * themselves, backing BO mappings with a memfd, so the CPU cost of the
+ * library can be measured without a GPU. Before that they forward to libdrm.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_stand_in.h"
+
+#define STAND_IN_MMAP_SIZE	(1ull << 32)
+
+static bool stand_in_enabled;
+static uint32_t stand_in_next_handle = 1;
+static uint32_t stand_in_next_ctx = 1;
+static uint64_t stand_in_seq;
+uint64_t stand_in_ioctls;
+uint32_t stand_in_family = AMDGPU_FAMILY_NV;
+
+/* Syncobjs, nonzero once a submission signaled them. Handles past the
+ * table come from fences, and fences here are always signaled.
+ */
+#define STAND_IN_MAX_SYNCOBJS	4096
+static uint32_t stand_in_next_fence_syncobj = STAND_IN_MAX_SYNCOBJS;
+static uint32_t stand_in_next_syncobj = 1;
+static uint8_t stand_in_syncobjs[STAND_IN_MAX_SYNCOBJS];
+
+/* Time the kernel takes for a submission */
+long stand_in_cs_delay_ns;
+
+/* CPU time the kernel spends in a VA operation */
+long stand_in_va_delay_ns;
+
+/* Without a stand-in device everything goes to the real libdrm */
+#define STAND_IN_FORWARD(func, ...)					\
+	do {								\
+		static __typeof__(func) *real_##func;			\
+									\
+		if (!stand_in_enabled) {				\
+			if (!real_##func)				\
+				real_##func = dlsym(RTLD_NEXT, #func);	\
+			return real_##func(__VA_ARGS__);		\
+		}							\
+	} while (0)
+
+drmVersionPtr drmGetVersion(int fd)
+{
+	drmVersionPtr version;
+
+	STAND_IN_FORWARD(drmGetVersion, fd);
+
+	version = calloc(1, sizeof(*version));
+	if (version) {
+		version->version_major = 3;
+		version->version_minor = 61;
+	}
+	return version;
+}
+
+void drmFreeVersion(drmVersionPtr version)
+{
+	static void (*real_drmFreeVersion)(drmVersionPtr);
+
+	if (!stand_in_enabled) {
+		if (!real_drmFreeVersion)
+			real_drmFreeVersion = dlsym(RTLD_NEXT, "drmFreeVersion");
+		real_drmFreeVersion(version);
+		return;
+	}
+
+	free(version);
+}
+
+int drmGetNodeTypeFromFd(int fd)
+{
+	STAND_IN_FORWARD(drmGetNodeTypeFromFd, fd);
+
+	return DRM_NODE_RENDER;
+}
+
+int drmCloseBufferHandle(int fd, uint32_t handle)
+{
+	STAND_IN_FORWARD(drmCloseBufferHandle, fd, handle);
+
+	__sync_fetch_and_add(&stand_in_ioctls, 1);
+	return 0;
+}
+
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	STAND_IN_FORWARD(drmIoctl, fd, request, arg);
+
+	__sync_fetch_and_add(&stand_in_ioctls, 1);
+
+	switch (request) {
+	case DRM_IOCTL_SYNCOBJ_CREATE: {
+		struct drm_syncobj_create *args = arg;
+		uint32_t handle;
+
+		handle = __sync_fetch_and_add(&stand_in_next_syncobj, 1);
+		if (handle >= STAND_IN_MAX_SYNCOBJS) {
+			errno = ENOMEM;
+			return -1;
+		}
+		stand_in_syncobjs[handle] = !!(args->flags &
+					       DRM_SYNCOBJ_CREATE_SIGNALED);
+		args->handle = handle;
+		break;
+	}
+	case DRM_IOCTL_SYNCOBJ_DESTROY: {
+		uint32_t handle = ((struct drm_syncobj_destroy *)arg)->handle;
+
+		if (handle < STAND_IN_MAX_SYNCOBJS)
+			stand_in_syncobjs[handle] = 0;
+		break;
+	}
+	case DRM_IOCTL_SYNCOBJ_WAIT:
+		((struct drm_syncobj_wait *)arg)->first_signaled = 0;
+		break;
+	case DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT:
+		((struct drm_syncobj_timeline_wait *)arg)->first_signaled = 0;
+		break;
+	case DRM_IOCTL_AMDGPU_WAIT_CS:
+		((union drm_amdgpu_wait_cs *)arg)->out.status = 0;
+		break;
+	case DRM_IOCTL_AMDGPU_WAIT_FENCES:
+		((union drm_amdgpu_wait_fences *)arg)->out.status = 1;
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void stand_in_info(struct drm_amdgpu_info *request)
+{
+	void *out = (void *)(uintptr_t)request->return_pointer;
+	struct drm_amdgpu_info_device *dev_info = out;
+
+	memset(out, 0, request->return_size);
+
+	switch (request->query) {
+	case AMDGPU_INFO_ACCEL_WORKING:
+		*(uint32_t *)out = 1;
+		break;
+	case AMDGPU_INFO_DEV_INFO:
+		dev_info->device_id = 0x73bf;
+		dev_info->pci_rev = 0xc0;
+		dev_info->family = stand_in_family;
+		dev_info->num_shader_engines = 4;
+		dev_info->virtual_address_offset = 0x200000;
+		dev_info->virtual_address_max = 1ull << 47;
+		dev_info->virtual_address_alignment = 4096;
+		dev_info->high_va_offset = 0xffff800000000000ull;
+		dev_info->high_va_max = 0xffffffffffffffffull;
+		break;
+	case AMDGPU_INFO_MEMORY: {
+		struct drm_amdgpu_memory_info *mem = out;
+
+		mem->vram.total_heap_size = 8ull << 30;
+		mem->vram.usable_heap_size = mem->vram.total_heap_size - (256 << 20);
+		mem->vram.heap_usage = 1ull << 30;
+		mem->gtt.total_heap_size = 16ull << 30;
+		mem->gtt.usable_heap_size = mem->gtt.total_heap_size - (256 << 20);
+		mem->gtt.heap_usage = 512 << 20;
+		break;
+	}
+	case AMDGPU_INFO_READ_MMR_REG: {
+		uint32_t *values = out, i;
+
+		for (i = 0; i < request->read_mmr_reg.count; i++)
+			values[i] = request->read_mmr_reg.dword_offset + i +
+				request->read_mmr_reg.instance;
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/*
+ * Waiting on a syncobj nothing signaled yet is an error, so submissions
+ * made out of dependency order are caught.
+ */
+static int stand_in_cs(union drm_amdgpu_cs *cs)
+{
+	uint64_t *chunks = (uint64_t *)(uintptr_t)cs->in.chunks;
+	struct drm_amdgpu_cs_chunk_sem *sems;
+	struct drm_amdgpu_cs_chunk *chunk;
+	uint32_t i, j, num_sems;
+
+	for (i = 0; i < cs->in.num_chunks; i++) {
+		chunk = (struct drm_amdgpu_cs_chunk *)(uintptr_t)chunks[i];
+		if (chunk->chunk_id != AMDGPU_CHUNK_ID_SYNCOBJ_IN)
+			continue;
+
+		sems = (void *)(uintptr_t)chunk->chunk_data;
+		num_sems = chunk->length_dw * 4 / sizeof(*sems);
+		for (j = 0; j < num_sems; j++) {
+			if (sems[j].handle < STAND_IN_MAX_SYNCOBJS &&
+			    !stand_in_syncobjs[sems[j].handle])
+				return -EINVAL;
+		}
+	}
+
+	if (stand_in_cs_delay_ns) {
+		struct timespec delay = { 0, stand_in_cs_delay_ns };
+
+		nanosleep(&delay, NULL);
+	}
+
+	for (i = 0; i < cs->in.num_chunks; i++) {
+		chunk = (struct drm_amdgpu_cs_chunk *)(uintptr_t)chunks[i];
+		if (chunk->chunk_id != AMDGPU_CHUNK_ID_SYNCOBJ_OUT)
+			continue;
+
+		sems = (void *)(uintptr_t)chunk->chunk_data;
+		num_sems = chunk->length_dw * 4 / sizeof(*sems);
+		for (j = 0; j < num_sems; j++) {
+			if (sems[j].handle < STAND_IN_MAX_SYNCOBJS)
+				stand_in_syncobjs[sems[j].handle] = 1;
+		}
+	}
+
+	cs->out.handle = __sync_add_and_fetch(&stand_in_seq, 1);
+	return 0;
+}
+
+int drmCommandWrite(int fd, unsigned long index, void *data,
+		    unsigned long size)
+{
+	STAND_IN_FORWARD(drmCommandWrite, fd, index, data, size);
+
+	__sync_fetch_and_add(&stand_in_ioctls, 1);
+
+	if (index == DRM_AMDGPU_INFO)
+		stand_in_info(data);
+	return 0;
+}
+
+int drmCommandWriteRead(int fd, unsigned long index, void *data,
+			unsigned long size)
+{
+	STAND_IN_FORWARD(drmCommandWriteRead, fd, index, data, size);
+
+	__sync_fetch_and_add(&stand_in_ioctls, 1);
+
+	switch (index) {
+	case DRM_AMDGPU_GEM_CREATE: {
+		union drm_amdgpu_gem_create *args = data;
+
+		args->out.handle = __sync_fetch_and_add(&stand_in_next_handle, 1);
+		break;
+	}
+	case DRM_AMDGPU_GEM_MMAP: {
+		union drm_amdgpu_gem_mmap *args = data;
+
+		/* Every handle gets its own 16MB window of the backing file */
+		args->out.addr_ptr = ((uint64_t)args->in.handle << 24) %
+			STAND_IN_MMAP_SIZE;
+		break;
+	}
+	case DRM_AMDGPU_GEM_WAIT_IDLE:
+		((union drm_amdgpu_gem_wait_idle *)data)->out.status = 0;
+		break;
+	case DRM_AMDGPU_CTX: {
+		union drm_amdgpu_ctx *args = data;
+
+		if (args->in.op == AMDGPU_CTX_OP_ALLOC_CTX)
+			args->out.alloc.ctx_id =
+				__sync_fetch_and_add(&stand_in_next_ctx, 1);
+		break;
+	}
+	case DRM_AMDGPU_BO_LIST: {
+		union drm_amdgpu_bo_list *args = data;
+
+		if (args->in.operation == AMDGPU_BO_LIST_OP_CREATE)
+			args->out.list_handle =
+				__sync_fetch_and_add(&stand_in_next_handle, 1);
+		break;
+	}
+	case DRM_AMDGPU_CS:
+		return stand_in_cs(data);
+	case DRM_AMDGPU_FENCE_TO_HANDLE: {
+		union drm_amdgpu_fence_to_handle *args = data;
+
+		args->out.handle =
+			__sync_fetch_and_add(&stand_in_next_fence_syncobj, 1);
+		break;
+	}
+	case DRM_AMDGPU_GEM_VA:
+		/* the page table update runs on the caller's CPU */
+		if (stand_in_va_delay_ns) {
+			struct timespec ts;
+			uint64_t end;
+
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			end = ts.tv_sec * 1000000000ull + ts.tv_nsec +
+				stand_in_va_delay_ns;
+			do {
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+			} while (ts.tv_sec * 1000000000ull + ts.tv_nsec < end);
+		}
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+int stand_in_open(void)
+{
+	int fd = memfd_create("amdgpu_stand_in", MFD_CLOEXEC);
+
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, STAND_IN_MMAP_SIZE)) {
+		close(fd);
+		return -errno;
+	}
+
+	stand_in_enabled = true;
+	return fd;
+}
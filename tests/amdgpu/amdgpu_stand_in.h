@@ -0,0 +1,47 @@
+/*
+ * Copyright 2026 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+#ifndef AMDGPU_STAND_IN_H
+#define AMDGPU_STAND_IN_H
+
+#include <stdint.h>
+
+/** Requests the stand-in answered, ioctls on a real device */
+extern uint64_t stand_in_ioctls;
+
+/** Family reported in the device info */
+extern uint32_t stand_in_family;
+
+/** Time every submission spends in the stand-in kernel */
+extern long stand_in_cs_delay_ns;
+
+/** CPU time every VA operation spends in the stand-in kernel */
+extern long stand_in_va_delay_ns;
+
+/**
+ * Switch to the stand-in and return a file descriptor to pass to
+ * amdgpu_device_initialize(), or a negative error code.
+ */
+int stand_in_open(void);
+
+#endif
@@ -21,7 +21,16 @@
  *
 */
 
+/*
+ * Exercises BO allocation and SDMA copies on a real device, and benchmarks
+ * the allocation and submission paths of libdrm_amdgpu.
+ *
+ * With -d the device is replaced by the stand-in from amdgpu_stand_in.c,
+ * which measures only the CPU cost on the library side and needs no GPU.
+ */
+
 #include <stdio.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -31,6 +40,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "drm.h"
 #include "xf86drmMode.h"
@@ -38,6 +48,7 @@
 #include "amdgpu.h"
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
+#include "amdgpu_stand_in.h"
 
 #define MAX_CARDS_SUPPORTED	4
 #define NUM_BUFFER_OBJECTS	1024
@@ -56,23 +67,38 @@
 						(((s) & 0x1) << 22) |	\
 						(((cnt) & 0xFFFFF) << 0))
 #define SDMA_OPCODE_COPY_SI     3
+#define SDMA_OPCODE_NOP_SI      15
+
+/* Scenarios submit IBs of SDMA NOPs from the second half of the first BO,
+ * so they don't clobber the copy packets of -c.
+ */
+#define NOP_IB_OFFSET		(1024 * 1024)
+#define NOP_IB_DW		8
 
 
 /** Help string for command line parameters */
 static const char usage[] =
-	"Usage: %s [-?h] [-b v|g|vg size] "
-	"[-c from to size count]\n"
+	"Usage: %s [-?h] [-d] [-j] [-n iterations] [-w warmup] [-r seed] "
+	"[-b v|g|vg size] [-c from to size count] [-l] [-s scenario]\n"
 	"where:\n"
 	"	b - Allocate a BO in VRAM, GTT or VRAM|GTT of size bytes.\n"
 	"	    This flag can be used multiple times. The first bo will\n"
 	"	    have id `1`, then second id `2`, ...\n"
 	"       c - Copy size bytes from BO (bo_id1) to BO (bo_id2), count times\n"
+	"       s - Run a benchmark scenario, `all` runs every one. This flag\n"
+	"           can be used multiple times\n"
+	"       l - List the benchmark scenarios\n"
+	"       n - Measured iterations per scenario (default 10000)\n"
+	"       w - Unmeasured iterations before that (default 100)\n"
+	"       r - Seed for the random sizes of the scenarios (default 1)\n"
+	"       j - Write the scenario results as JSON\n"
+	"       d - Use a stand-in instead of a GPU, must come first\n"
 	"       h - Display this help\n"
 	"\n"
 	"Sizes can be postfixes with k, m or g for kilo, mega and gigabyte scaling\n";
 
 /** Specified options strings for getopt */
-static const char options[]   = "?hb:c:";
+static const char options[]   = "?hb:c:ls:n:w:r:jd";
 
 /* Open AMD devices.
  * Returns the fd of the first device it could open.
@@ -144,6 +170,16 @@ uint64_t virtual[NUM_BUFFER_OBJECTS];
 unsigned int num_buffers;
 uint32_t *pm4;
 
+/* Where progress goes, stderr when stdout is for JSON */
+static FILE *log_file;
+
+static bool stand_in;
+static bool json;
+static uint64_t iterations = 10000;
+static uint64_t warmup = 100;
+static uint64_t seed = 1;
+static unsigned int num_results;
+
 int alloc_bo(uint32_t domain, uint64_t size)
 {
 	struct amdgpu_bo_alloc_request request = {};
@@ -176,7 +212,7 @@ int alloc_bo(uint32_t domain, uint64_t size)
 
 	resources[num_buffers] = bo;
 	virtual[num_buffers] = addr;
-	fprintf(stdout, "Allocated BO number %u at 0x%" PRIx64 ", domain 0x%x, size %" PRIu64 "\n",
+	fprintf(log_file, "Allocated BO number %u at 0x%" PRIx64 ", domain 0x%x, size %" PRIu64 "\n",
 		num_buffers++, addr, domain, size);
 	return 0;
 }
@@ -274,11 +310,425 @@ int submit_ib(uint32_t from, uint32_t to, uint64_t size, uint32_t count)
 	delta = stop.tv_nsec + stop.tv_sec * 1000000000UL;
 	delta -= start.tv_nsec + start.tv_sec * 1000000000UL;
 
-	fprintf(stdout, "Submitted %u IBs to copy from %u(%" PRIx64 ") to %u(%" PRIx64 ") %" PRIu64 " bytes took %" PRIu64 " usec\n",
+	fprintf(log_file, "Submitted %u IBs to copy from %u(%" PRIx64 ") to %u(%" PRIx64 ") %" PRIu64 " bytes took %" PRIu64 " usec\n",
 		count, from, virtual[from], to, virtual[to], copied, delta / 1000);
 	return 0;
 }
 
+/*
+ * Benchmark scenarios.
+ *
+ * Every scenario times single operations after a warmup and reports the
+ * mean and percentiles of them. Random sizes come from a seeded generator,
+ * so runs with the same options do the same work.
+ */
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* xorshift64*, good enough to pick sizes */
+static uint64_t next_random(void)
+{
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return seed * 0x2545f4914f6cdd1dull;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_result(const char *name, uint64_t *samples, uint64_t count,
+			 uint64_t ioctls)
+{
+	uint64_t i, total = 0, p50, p90, p99, max;
+
+	qsort(samples, count, sizeof(*samples), compare_u64);
+	for (i = 0; i < count; i++)
+		total += samples[i];
+
+	p50 = samples[(count - 1) * 50 / 100];
+	p90 = samples[(count - 1) * 90 / 100];
+	p99 = samples[(count - 1) * 99 / 100];
+	max = samples[count - 1];
+
+	if (json) {
+		fprintf(stdout, "%s\n    { \"name\": \"%s\", \"ops\": %" PRIu64
+			", \"mean_ns\": %.1f, \"p50_ns\": %" PRIu64
+			", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+			", \"max_ns\": %" PRIu64,
+			num_results ? "," : "", name, count,
+			(double)total / count, p50, p90, p99, max);
+		if (stand_in)
+			fprintf(stdout, ", \"ioctls_per_op\": %.2f",
+				(double)ioctls / count);
+		fprintf(stdout, " }");
+	} else {
+		if (!num_results)
+			fprintf(stdout, "%-28s %10s %10s %10s %10s %10s %10s%s\n",
+				"scenario", "ops", "mean ns", "p50 ns", "p90 ns",
+				"p99 ns", "max ns", stand_in ? "  ioctls/op" : "");
+		fprintf(stdout, "%-28s %10" PRIu64 " %10.1f %10" PRIu64
+			" %10" PRIu64 " %10" PRIu64 " %10" PRIu64,
+			name, count, (double)total / count, p50, p90, p99, max);
+		if (stand_in)
+			fprintf(stdout, " %11.2f", (double)ioctls / count);
+		fprintf(stdout, "\n");
+	}
+	num_results++;
+}
+
+/* Runs op warmup times, then iterations times timing each call. */
+static int run_timed(const char *name, int (*op)(void *data, uint64_t i),
+		     void *data)
+{
+	uint64_t *samples, ioctls, start, i;
+	int r = 0;
+
+	samples = calloc(iterations, sizeof(*samples));
+	if (!samples)
+		return -ENOMEM;
+
+	for (i = 0; !r && i < warmup; i++)
+		r = op(data, i);
+
+	ioctls = stand_in_ioctls;
+	for (i = 0; !r && i < iterations; i++) {
+		start = get_time_ns();
+		r = op(data, warmup + i);
+		samples[i] = get_time_ns() - start;
+	}
+
+	if (!r)
+		print_result(name, samples, iterations,
+			     stand_in_ioctls - ioctls);
+	else
+		fprintf(stderr, "%s failed with %d\n", name, r);
+
+	free(samples);
+	return r;
+}
+
+struct bo_alloc_data {
+	uint32_t domain;
+	uint64_t size;
+};
+
+static int op_bo_alloc(void *data, uint64_t i)
+{
+	struct bo_alloc_data *d = data;
+	struct amdgpu_bo_alloc_request request = {};
+	amdgpu_bo_handle bo;
+	int r;
+
+	request.alloc_size = d->size;
+	request.preferred_heap = d->domain;
+	r = amdgpu_bo_alloc(device_handle, &request, &bo);
+	if (r)
+		return r;
+
+	return amdgpu_bo_free(bo);
+}
+
+static int bench_bo_alloc(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t domain;
+	} heaps[] = {
+		{ "gtt", AMDGPU_GEM_DOMAIN_GTT },
+		{ "vram", AMDGPU_GEM_DOMAIN_VRAM },
+		{ "vram-gtt", AMDGPU_GEM_DOMAIN_VRAM | AMDGPU_GEM_DOMAIN_GTT },
+	};
+	static const uint64_t sizes[] = { 4096, 64 * 1024, 2 * 1024 * 1024 };
+	struct bo_alloc_data data;
+	char name[64];
+	unsigned int h, i;
+	int r;
+
+	for (h = 0; h < sizeof(heaps) / sizeof(heaps[0]); h++) {
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			data.domain = heaps[h].domain;
+			data.size = sizes[i];
+			snprintf(name, sizeof(name), "bo-alloc/%s/%" PRIu64 "k",
+				 heaps[h].name, sizes[i] / 1024);
+			r = run_timed(name, op_bo_alloc, &data);
+			if (r)
+				return r;
+		}
+	}
+	return 0;
+}
+
+#define VA_CHURN_LIVE	256
+
+struct va_churn_data {
+	amdgpu_va_handle handles[VA_CHURN_LIVE];
+};
+
+/* Sizes between 4KB and 16MB, smaller ones more likely */
+static uint64_t random_va_size(void)
+{
+	return 4096ull << (next_random() % 13);
+}
+
+static int op_va_alloc(void *data, uint64_t i)
+{
+	amdgpu_va_handle va;
+	uint64_t addr;
+	int r;
+
+	r = amdgpu_va_range_alloc(device_handle, amdgpu_gpu_va_range_general,
+				  random_va_size(), 0, 0, &addr, &va, 0);
+	if (r)
+		return r;
+
+	return amdgpu_va_range_free(va);
+}
+
+/* Replace a random one of the live ranges, which fragments the VA space */
+static int op_va_churn(void *data, uint64_t i)
+{
+	struct va_churn_data *d = data;
+	unsigned int slot = next_random() % VA_CHURN_LIVE;
+	uint64_t addr;
+	int r;
+
+	if (d->handles[slot]) {
+		r = amdgpu_va_range_free(d->handles[slot]);
+		d->handles[slot] = NULL;
+		if (r)
+			return r;
+	}
+
+	return amdgpu_va_range_alloc(device_handle,
+				     amdgpu_gpu_va_range_general,
+				     random_va_size(), 0, 0, &addr,
+				     &d->handles[slot], 0);
+}
+
+static int bench_va_alloc(void)
+{
+	struct va_churn_data *data;
+	unsigned int i;
+	int r;
+
+	r = run_timed("va-alloc/alloc-free", op_va_alloc, NULL);
+	if (r)
+		return r;
+
+	data = calloc(1, sizeof(*data));
+	if (!data)
+		return -ENOMEM;
+
+	r = run_timed("va-alloc/churn", op_va_churn, data);
+
+	for (i = 0; i < VA_CHURN_LIVE; i++) {
+		if (data->handles[i])
+			amdgpu_va_range_free(data->handles[i]);
+	}
+	free(data);
+	return r;
+}
+
+#define CS_MAX_DEPS	16
+
+struct cs_data {
+	struct amdgpu_cs_request request;
+	struct amdgpu_cs_ib_info ibs[AMDGPU_CS_MAX_IBS_PER_SUBMIT];
+	struct amdgpu_cs_fence deps[CS_MAX_DEPS];
+	struct amdgpu_cs_fence fence;
+};
+
+/* Fill the IB area with SDMA NOPs and set up a request using it */
+static int init_cs_data(struct cs_data *d, unsigned int num_ibs,
+			unsigned int num_deps)
+{
+	uint32_t nop = 0;
+	unsigned int i;
+
+	if (device_handle->info.family_id == AMDGPU_FAMILY_SI)
+		nop = SDMA_PACKET_SI(SDMA_OPCODE_NOP_SI, 0, 0, 0, 0);
+	for (i = 0; i < AMDGPU_CS_MAX_IBS_PER_SUBMIT * NOP_IB_DW; i++)
+		pm4[NOP_IB_OFFSET / 4 + i] = nop;
+
+	memset(d, 0, sizeof(*d));
+	for (i = 0; i < num_ibs; i++) {
+		d->ibs[i].ib_mc_address = virtual[0] + NOP_IB_OFFSET +
+			i * NOP_IB_DW * 4;
+		d->ibs[i].size = NOP_IB_DW;
+	}
+	for (i = 0; i < num_deps; i++) {
+		d->deps[i].context = context_handle;
+		d->deps[i].ip_type = AMDGPU_HW_IP_DMA;
+	}
+
+	d->request.ip_type = AMDGPU_HW_IP_DMA;
+	d->request.number_of_ibs = num_ibs;
+	d->request.ibs = d->ibs;
+	d->request.number_of_dependencies = num_deps;
+	d->request.dependencies = d->deps;
+
+	d->fence.context = context_handle;
+	d->fence.ip_type = AMDGPU_HW_IP_DMA;
+
+	return amdgpu_bo_list_create(device_handle, 1, resources, NULL,
+				     &d->request.resources);
+}
+
+static int wait_cs_data(struct cs_data *d)
+{
+	uint32_t expired;
+
+	d->fence.fence = d->request.seq_no;
+	return amdgpu_cs_query_fence_status(&d->fence, AMDGPU_TIMEOUT_INFINITE,
+					    0, &expired);
+}
+
+static int fini_cs_data(struct cs_data *d)
+{
+	int r = wait_cs_data(d);
+
+	amdgpu_bo_list_destroy(d->request.resources);
+	return r;
+}
+
+/* Depend on the submissions right before this one */
+static int op_cs_submit(void *data, uint64_t i)
+{
+	struct cs_data *d = data;
+	unsigned int k;
+
+	for (k = 0; k < d->request.number_of_dependencies; k++)
+		d->deps[k].fence = d->request.seq_no > k ?
+			d->request.seq_no - k : 0;
+
+	return amdgpu_cs_submit(context_handle, 0, &d->request, 1);
+}
+
+static int bench_cs_submit(void)
+{
+	static const unsigned int deps[] = { 0, 4, CS_MAX_DEPS };
+	struct cs_data data;
+	unsigned int num_ibs, i;
+	char name[64];
+	int r;
+
+	for (num_ibs = 1; num_ibs <= AMDGPU_CS_MAX_IBS_PER_SUBMIT; num_ibs *= 2) {
+		for (i = 0; i < sizeof(deps) / sizeof(deps[0]); i++) {
+			r = init_cs_data(&data, num_ibs, deps[i]);
+			if (r)
+				return r;
+
+			snprintf(name, sizeof(name), "cs-submit/%u-ib/%u-deps",
+				 num_ibs, deps[i]);
+			r = run_timed(name, op_cs_submit, &data);
+			if (fini_cs_data(&data) && !r)
+				r = -EIO;
+			if (r)
+				return r;
+		}
+	}
+	return 0;
+}
+
+static int op_fence_roundtrip(void *data, uint64_t i)
+{
+	int r = op_cs_submit(data, i);
+
+	return r ? r : wait_cs_data(data);
+}
+
+static int op_fence_signaled(void *data, uint64_t i)
+{
+	return wait_cs_data(data);
+}
+
+static int bench_fence_wait(void)
+{
+	struct cs_data data;
+	int r;
+
+	r = init_cs_data(&data, 1, 0);
+	if (r)
+		return r;
+
+	r = run_timed("fence-wait/roundtrip", op_fence_roundtrip, &data);
+	if (!r)
+		r = run_timed("fence-wait/signaled", op_fence_signaled, &data);
+
+	if (fini_cs_data(&data) && !r)
+		r = -EIO;
+	return r;
+}
+
+static int op_cpu_map(void *data, uint64_t i)
+{
+	amdgpu_bo_handle bo = data;
+	void *ptr;
+	int r;
+
+	r = amdgpu_bo_cpu_map(bo, &ptr);
+	if (r)
+		return r;
+
+	/* touch it, so the mapping really gets set up */
+	*(volatile uint32_t *)ptr = i;
+	return amdgpu_bo_cpu_unmap(bo);
+}
+
+static int bench_cpu_map(void)
+{
+	static const uint64_t sizes[] = { 64 * 1024, 2 * 1024 * 1024 };
+	struct amdgpu_bo_alloc_request request = {};
+	amdgpu_bo_handle bo;
+	char name[64];
+	unsigned int i;
+	int r = 0;
+
+	for (i = 0; !r && i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		request.alloc_size = sizes[i];
+		request.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+		r = amdgpu_bo_alloc(device_handle, &request, &bo);
+		if (r)
+			break;
+
+		snprintf(name, sizeof(name), "cpu-map/%" PRIu64 "k",
+			 sizes[i] / 1024);
+		r = run_timed(name, op_cpu_map, bo);
+		amdgpu_bo_free(bo);
+	}
+	return r;
+}
+
+static const struct {
+	const char *name;
+	int (*func)(void);
+	const char *description;
+} scenarios[] = {
+	{ "bo-alloc", bench_bo_alloc,
+	  "amdgpu_bo_alloc()/amdgpu_bo_free() per heap and size" },
+	{ "va-alloc", bench_va_alloc,
+	  "amdgpu_va_range_alloc()/amdgpu_va_range_free() with random sizes" },
+	{ "cs-submit", bench_cs_submit,
+	  "amdgpu_cs_submit() with varying IB and dependency counts" },
+	{ "fence-wait", bench_fence_wait,
+	  "submit and wait for the fence, and wait for a signaled fence" },
+	{ "cpu-map", bench_cpu_map,
+	  "amdgpu_bo_cpu_map()/amdgpu_bo_cpu_unmap() per size" },
+};
+
+#define NUM_SCENARIOS	(sizeof(scenarios) / sizeof(scenarios[0]))
+
 void next_arg(int argc, char **argv, const char *msg)
 {
 	optarg = argv[optind++];
@@ -317,15 +767,17 @@ uint64_t parse_size(void)
 	return size;
 }
 
-int main(int argc, char **argv)
+/* Opens the device and sets up the IB buffer on first use. */
+static void init_device(void)
 {
 	uint32_t major_version, minor_version;
-	uint32_t domain, from, to, count;
-       	uint64_t size;
-	int fd, r, c;
+	int fd, r;
+
+	if (device_handle)
+		return;
 
-	fd = amdgpu_open_device();
-       	if (fd < 0) {
+	fd = stand_in ? stand_in_open() : amdgpu_open_device();
+	if (fd < 0) {
 		perror("Cannot open AMDGPU device");
 		exit(EXIT_FAILURE);
 	}
@@ -342,11 +794,6 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	if (argc == 1) {
-		fprintf(stderr, usage, argv[0]);
-		exit(EXIT_FAILURE);
-	}
-
 	r = alloc_bo(AMDGPU_GEM_DOMAIN_GTT, 2ULL * 1024 * 1024);
 	if (r) {
 		fprintf(stderr, "Buffer allocation failed with %d\n", r);
@@ -358,11 +805,40 @@ int main(int argc, char **argv)
 		fprintf(stderr, "Buffer mapping failed with %d\n", r);
 		exit(EXIT_FAILURE);
 	}
+}
+
+static uint64_t parse_count(const char *what)
+{
+	uint64_t count;
+
+	if (sscanf(optarg, "%" SCNu64, &count) != 1) {
+		fprintf(stderr, "Can't parse %s: %s\n", what, optarg);
+		exit(EXIT_FAILURE);
+	}
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	bool selected[NUM_SCENARIOS] = { false };
+	bool run_scenarios = false;
+	uint32_t domain, from, to, count;
+	uint64_t size;
+	unsigned int i;
+	int r, c;
+
+	if (argc == 1) {
+		fprintf(stderr, usage, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	log_file = stdout;
 
 	opterr = 0;
 	while ((c = getopt(argc, argv, options)) != -1) {
 		switch (c) {
 		case 'b':
+			init_device();
 			if (!strcmp(optarg, "v"))
 				domain = AMDGPU_GEM_DOMAIN_VRAM;
 			else if (!strcmp(optarg, "g"))
@@ -386,6 +862,7 @@ int main(int argc, char **argv)
 			}
 			break;
 		case 'c':
+			init_device();
 			if (sscanf(optarg, "%u", &from) != 1) {
 				fprintf(stderr, "Can't parse from buffer: %s\n", optarg);
 				exit(EXIT_FAILURE);
@@ -405,6 +882,50 @@ int main(int argc, char **argv)
 				exit(EXIT_FAILURE);
 			}
 			break;
+		case 's':
+			for (i = 0; i < NUM_SCENARIOS; i++) {
+				if (!strcmp(optarg, "all") ||
+				    !strcmp(optarg, scenarios[i].name)) {
+					selected[i] = true;
+					run_scenarios = true;
+				}
+			}
+			if (!run_scenarios) {
+				fprintf(stderr, "Unknown scenario: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'l':
+			for (i = 0; i < NUM_SCENARIOS; i++)
+				fprintf(stdout, "%-12s %s\n", scenarios[i].name,
+					scenarios[i].description);
+			exit(EXIT_SUCCESS);
+		case 'n':
+			iterations = parse_count("iterations");
+			if (!iterations) {
+				fprintf(stderr, "Need at least one iteration\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'w':
+			warmup = parse_count("warmup");
+			break;
+		case 'r':
+			seed = parse_count("seed");
+			if (!seed)
+				seed = 1;
+			break;
+		case 'j':
+			json = true;
+			log_file = stderr;
+			break;
+		case 'd':
+			if (device_handle) {
+				fprintf(stderr, "-d must come before -b and -c\n");
+				exit(EXIT_FAILURE);
+			}
+			stand_in = true;
+			break;
 		case '?':
 		case 'h':
 			fprintf(stderr, usage, argv[0]);
@@ -415,5 +936,32 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (!run_scenarios)
+		return EXIT_SUCCESS;
+
+	init_device();
+
+	if (json)
+		fprintf(stdout, "{\n  \"family\": %u,\n  \"stand_in\": %s,\n"
+			"  \"iterations\": %" PRIu64 ",\n  \"warmup\": %" PRIu64
+			",\n  \"seed\": %" PRIu64 ",\n  \"results\": [",
+			device_handle->info.family_id,
+			stand_in ? "true" : "false", iterations, warmup, seed);
+
+	for (i = 0; i < NUM_SCENARIOS; i++) {
+		if (!selected[i])
+			continue;
+
+		r = scenarios[i].func();
+		if (r) {
+			fprintf(stderr, "Scenario %s failed with %d\n",
+				scenarios[i].name, r);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (json)
+		fprintf(stdout, "\n  ]\n}\n");
+
 	return EXIT_SUCCESS;
 }
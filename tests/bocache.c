@@ -0,0 +1,443 @@
+/*
+ * Copyright © 2026 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Tests and benchmark of the buffer object cache in xf86drmBOCache.c.
+ *
+ * The buffers come from a stand-in allocator: malloc()ed structs whose busy
+ * and purged state the tests set, so no device is needed.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "xf86drmBOCache.h"
+
+struct test_bo {
+    drmBOCacheEntry entry;
+    int             busy;
+    int             purged;
+};
+
+static unsigned created, destroyed;
+static int madvise_supported = 1;
+
+static struct test_bo *to_test_bo(drmBOCacheEntryPtr entry)
+{
+    return (struct test_bo *)((char *)entry - offsetof(struct test_bo, entry));
+}
+
+static int test_is_idle(drmBOCacheEntryPtr entry)
+{
+    return !to_test_bo(entry)->busy;
+}
+
+static int test_madvise(drmBOCacheEntryPtr entry, int willneed)
+{
+    /* As the drivers do when the kernel has no madvise */
+    if (!madvise_supported)
+	return 1;
+
+    return !to_test_bo(entry)->purged;
+}
+
+static void test_destroy(drmBOCacheEntryPtr entry)
+{
+    destroyed++;
+    free(to_test_bo(entry));
+}
+
+/* Any buffer serves allocations asking for a subset of its flags */
+static int test_compatible(uint32_t cached_flags, uint32_t flags)
+{
+    return (cached_flags & flags) == flags;
+}
+
+static const drmBOCacheFuncs test_funcs = {
+    .is_idle = test_is_idle,
+    .madvise = test_madvise,
+    .destroy = test_destroy,
+};
+
+static struct test_bo *test_bo_new(uint64_t size, uint32_t flags)
+{
+    struct test_bo *bo = calloc(1, sizeof(*bo));
+
+    if (!bo)
+	abort();
+    bo->entry.size = size;
+    bo->entry.flags = flags;
+    created++;
+    return bo;
+}
+
+static int failures;
+
+#define CHECK(cond)							\
+    do {								\
+	if (!(cond)) {							\
+	    fprintf(stderr, "%s:%d: %s failed\n", __func__, __LINE__,	\
+		    #cond);						\
+	    failures++;							\
+	}								\
+    } while (0)
+
+static drmBOCacheStats bucket_stats(drmBOCachePtr cache, uint64_t size)
+{
+    drmBOCacheStats stats[64];
+    int i, n;
+
+    n = drmBOCacheGetStats(cache, stats, 64);
+    for (i = 0; i < n; i++)
+	if (stats[i].size == size)
+	    return stats[i];
+
+    memset(&stats[0], 0, sizeof(stats[0]));
+    return stats[0];
+}
+
+static void test_buckets(void)
+{
+    drmBOCachePtr fine = drmBOCacheCreate(&test_funcs, 0);
+    drmBOCachePtr coarse = drmBOCacheCreate(&test_funcs, DRM_BO_CACHE_COARSE);
+    drmBOCacheStats stats[64];
+
+    CHECK(drmBOCacheGetStats(fine, stats, 64) == 55);
+    CHECK(drmBOCacheGetStats(coarse, stats, 64) == 15);
+
+    CHECK(drmBOCacheBucketSize(fine, 1) == 4096);
+    CHECK(drmBOCacheBucketSize(fine, 4096) == 4096);
+    CHECK(drmBOCacheBucketSize(fine, 4097) == 8192);
+    CHECK(drmBOCacheBucketSize(fine, 3 * 4096 + 1) == 4 * 4096);
+    CHECK(drmBOCacheBucketSize(fine, 4 * 4096 + 1) == 5 * 4096);
+    CHECK(drmBOCacheBucketSize(fine, 1 << 20) == 1 << 20);
+    CHECK(drmBOCacheBucketSize(fine, (1 << 20) + 1) == (1 << 20) + (1 << 18));
+    CHECK(drmBOCacheBucketSize(fine, 112 << 20) == 112 << 20);
+    CHECK(drmBOCacheBucketSize(fine, (112 << 20) + 1) == 0);
+
+    CHECK(drmBOCacheBucketSize(coarse, 3 * 4096) == 4 * 4096);
+    CHECK(drmBOCacheBucketSize(coarse, (1 << 20) + 1) == 2 << 20);
+    CHECK(drmBOCacheBucketSize(coarse, 64 << 20) == 64 << 20);
+    CHECK(drmBOCacheBucketSize(coarse, (64 << 20) + 1) == 0);
+
+    drmBOCacheDestroy(fine);
+    drmBOCacheDestroy(coarse);
+}
+
+static void test_policy(void)
+{
+    drmBOCachePtr cache = drmBOCacheCreate(&test_funcs, 0);
+    struct test_bo *a = test_bo_new(8192, 0), *b = test_bo_new(8192, 0);
+
+    CHECK(drmBOCacheRelease(cache, &a->entry, 10) == 0);
+    CHECK(drmBOCacheRelease(cache, &b->entry, 10) == 0);
+    CHECK(drmBOCacheBytes(cache) == 16384);
+
+    /* The CPU gets the oldest buffer, the GPU the newest */
+    CHECK(drmBOCacheAlloc(cache, 8000, 0, DRM_BO_CACHE_LRU) == &a->entry);
+    CHECK(drmBOCacheAlloc(cache, 8000, 0, DRM_BO_CACHE_MRU) == &b->entry);
+    CHECK(drmBOCacheAlloc(cache, 8000, 0, DRM_BO_CACHE_LRU) == NULL);
+    CHECK(a->entry.cache == NULL && b->entry.cache == NULL);
+
+    /* A busy oldest buffer fails the CPU, not the GPU */
+    a->busy = 1;
+    CHECK(drmBOCacheRelease(cache, &a->entry, 11) == 0);
+    CHECK(drmBOCacheRelease(cache, &b->entry, 11) == 0);
+    CHECK(drmBOCacheAlloc(cache, 8192, 0, DRM_BO_CACHE_LRU) == NULL);
+    CHECK(drmBOCacheAlloc(cache, 8192, 0, DRM_BO_CACHE_MRU) == &b->entry);
+    CHECK(drmBOCacheAlloc(cache, 8192, 0, DRM_BO_CACHE_MRU) == &a->entry);
+
+    CHECK(bucket_stats(cache, 8192).hits == 4);
+    CHECK(bucket_stats(cache, 8192).misses == 2);
+    CHECK(bucket_stats(cache, 8192).cached == 0);
+
+    test_destroy(&a->entry);
+    test_destroy(&b->entry);
+    drmBOCacheDestroy(cache);
+}
+
+static void test_flags(void)
+{
+    drmBOCacheFuncs funcs = test_funcs;
+    drmBOCachePtr exact = drmBOCacheCreate(&test_funcs, 0);
+    drmBOCachePtr subset;
+    struct test_bo *a = test_bo_new(4096, 0x3), *b = test_bo_new(4096, 0x1);
+
+    funcs.compatible = test_compatible;
+    subset = drmBOCacheCreate(&funcs, 0);
+
+    CHECK(drmBOCacheRelease(exact, &a->entry, 0) == 0);
+    CHECK(drmBOCacheRelease(exact, &b->entry, 0) == 0);
+    CHECK(drmBOCacheAlloc(exact, 4096, 0x2, DRM_BO_CACHE_LRU) == NULL);
+    /* Buffers with other flags are skipped, not mistaken for busy */
+    CHECK(drmBOCacheAlloc(exact, 4096, 0x1, DRM_BO_CACHE_LRU) == &b->entry);
+    CHECK(drmBOCacheAlloc(exact, 4096, 0x3, DRM_BO_CACHE_MRU) == &a->entry);
+
+    CHECK(drmBOCacheRelease(subset, &a->entry, 0) == 0);
+    CHECK(drmBOCacheAlloc(subset, 4096, 0x2, DRM_BO_CACHE_LRU) == &a->entry);
+
+    test_destroy(&a->entry);
+    test_destroy(&b->entry);
+    drmBOCacheDestroy(exact);
+    drmBOCacheDestroy(subset);
+}
+
+static void test_purge(void)
+{
+    drmBOCachePtr cache = drmBOCacheCreate(&test_funcs, 0);
+    struct test_bo *a = test_bo_new(4096, 0), *b = test_bo_new(4096, 0);
+    struct test_bo *c = test_bo_new(4096, 0), *d = test_bo_new(4096, 0);
+    unsigned before = destroyed;
+
+    /* Buffers that lost their pages are not taken in */
+    d->purged = 1;
+    CHECK(drmBOCacheRelease(cache, &d->entry, 0) != 0);
+    test_destroy(&d->entry);
+
+    CHECK(drmBOCacheRelease(cache, &a->entry, 0) == 0);
+    CHECK(drmBOCacheRelease(cache, &b->entry, 0) == 0);
+    CHECK(drmBOCacheRelease(cache, &c->entry, 0) == 0);
+
+    /* The purged buffer is dropped along with the older purged ones */
+    a->purged = b->purged = 1;
+    CHECK(drmBOCacheAlloc(cache, 4096, 0, DRM_BO_CACHE_LRU) == &c->entry);
+    CHECK(destroyed - before == 3);
+    CHECK(bucket_stats(cache, 4096).purged == 2);
+    CHECK(bucket_stats(cache, 4096).hits == 1);
+    CHECK(drmBOCacheBytes(cache) == 0);
+
+    test_destroy(&c->entry);
+    drmBOCacheDestroy(cache);
+}
+
+/* Without madvise in the kernel every buffer is cached and reused */
+static void test_purge_unsupported(void)
+{
+    drmBOCachePtr cache = drmBOCacheCreate(&test_funcs, 0);
+    struct test_bo *a = test_bo_new(4096, 0), *b = test_bo_new(4096, 0);
+    unsigned before = destroyed;
+
+    madvise_supported = 0;
+
+    CHECK(drmBOCacheRelease(cache, &a->entry, 0) == 0);
+    CHECK(drmBOCacheRelease(cache, &b->entry, 0) == 0);
+    CHECK(drmBOCacheAlloc(cache, 4096, 0, DRM_BO_CACHE_LRU) == &a->entry);
+    CHECK(drmBOCacheAlloc(cache, 4096, 0, DRM_BO_CACHE_LRU) == &b->entry);
+    CHECK(destroyed == before);
+    CHECK(bucket_stats(cache, 4096).purged == 0);
+    CHECK(bucket_stats(cache, 4096).hits == 2);
+
+    madvise_supported = 1;
+
+    test_destroy(&a->entry);
+    test_destroy(&b->entry);
+    drmBOCacheDestroy(cache);
+}
+
+static void test_expire(void)
+{
+    drmBOCachePtr cache = drmBOCacheCreate(&test_funcs, 0);
+    struct test_bo *a = test_bo_new(4096, 0), *b = test_bo_new(65536, 0);
+    struct test_bo *c = test_bo_new(4096, 0);
+    unsigned before = destroyed;
+
+    CHECK(drmBOCacheRelease(cache, &a->entry, 10) == 0);
+    CHECK(drmBOCacheRelease(cache, &b->entry, 11) == 0);
+    CHECK(drmBOCacheRelease(cache, &c->entry, 12) == 0);
+
+    /* Buffers are kept for at least a second */
+    drmBOCacheExpire(cache, 11);
+    CHECK(destroyed == before);
+    drmBOCacheExpire(cache, 12);
+    CHECK(destroyed - before == 1 && a->entry.cache == NULL);
+    CHECK(drmBOCacheBytes(cache) == 65536 + 4096);
+    drmBOCacheExpire(cache, 14);
+    CHECK(destroyed - before == 3);
+    CHECK(bucket_stats(cache, 4096).expired == 2);
+    CHECK(bucket_stats(cache, 65536).expired == 1);
+
+    drmBOCacheDestroy(cache);
+}
+
+static void test_trim(void)
+{
+    drmBOCachePtr cache = drmBOCacheCreate(&test_funcs, 0);
+    struct test_bo *bos[4];
+    unsigned before = destroyed;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+	bos[i] = test_bo_new(4096 << i, 0);
+	CHECK(drmBOCacheRelease(cache, &bos[i]->entry, 0) == 0);
+    }
+    CHECK(drmBOCacheBytes(cache) == 15 * 4096);
+
+    /* Oldest first, whatever the bucket */
+    drmBOCacheTrim(cache, 14 * 4096);
+    CHECK(destroyed - before == 1);
+    CHECK(drmBOCacheBytes(cache) == 14 * 4096);
+    CHECK(bucket_stats(cache, 4096).trimmed == 1);
+
+    /* Taken out by the driver, e.g. found by its name */
+    drmBOCacheRemove(&bos[1]->entry);
+    CHECK(drmBOCacheBytes(cache) == 12 * 4096);
+    CHECK(drmBOCacheAlloc(cache, 8192, 0, DRM_BO_CACHE_LRU) == NULL);
+    drmBOCacheRemove(&bos[1]->entry);
+    test_destroy(&bos[1]->entry);
+
+    /* The limit makes room for released buffers, and refuses big ones */
+    drmBOCacheSetLimit(cache, 10 * 4096);
+    CHECK(drmBOCacheBytes(cache) == 8 * 4096);
+    bos[0] = test_bo_new(4 * 4096, 0);
+    CHECK(drmBOCacheRelease(cache, &bos[0]->entry, 0) == 0);
+    CHECK(drmBOCacheBytes(cache) == 4 * 4096);
+    bos[1] = test_bo_new(16 * 4096, 0);
+    CHECK(drmBOCacheRelease(cache, &bos[1]->entry, 0) != 0);
+    test_destroy(&bos[1]->entry);
+
+    drmBOCacheDestroy(cache);
+    CHECK(created == destroyed);
+}
+
+/*
+ * Benchmark: a working set of buffers of random sizes, one released and one
+ * allocated per iteration, with some of the released ones still busy and
+ * the cache limited to 256MB.
+ */
+#define BENCH_LIVE	256
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t bench_size(void)
+{
+    /* Mostly small buffers, up to 8MB */
+    return (uint64_t)(next_rand() % 16 + 1) << (12 + next_rand() % 10);
+}
+
+static void bench(uint64_t iterations)
+{
+    drmBOCachePtr cache = drmBOCacheCreate(&test_funcs, 0);
+    struct test_bo *live[BENCH_LIVE];
+    drmBOCacheStats stats[64];
+    uint64_t i, start, delta, hits = 0, misses = 0, trimmed = 0;
+    unsigned before = created;
+    int j, n;
+
+    drmBOCacheSetLimit(cache, 256 << 20);
+    for (j = 0; j < BENCH_LIVE; j++)
+	live[j] = test_bo_new(drmBOCacheBucketSize(cache, bench_size()), 0);
+
+    start = get_time_ns();
+    for (i = 0; i < iterations; i++) {
+	drmBOCacheEntryPtr entry;
+	uint64_t size = bench_size();
+	int policy = next_rand() % 4 ? DRM_BO_CACHE_LRU : DRM_BO_CACHE_MRU;
+
+	j = next_rand() % BENCH_LIVE;
+	live[j]->busy = !(next_rand() % 8);
+	if (drmBOCacheRelease(cache, &live[j]->entry, i / 100000))
+	    test_destroy(&live[j]->entry);
+	drmBOCacheExpire(cache, i / 100000);
+
+	entry = drmBOCacheAlloc(cache, size, 0, policy);
+	if (entry) {
+	    live[j] = to_test_bo(entry);
+	    live[j]->busy = 0;
+	} else {
+	    live[j] = test_bo_new(drmBOCacheBucketSize(cache, size), 0);
+	}
+    }
+    delta = get_time_ns() - start;
+
+    n = drmBOCacheGetStats(cache, stats, 64);
+    for (j = 0; j < n; j++) {
+	hits += stats[j].hits;
+	misses += stats[j].misses;
+	trimmed += stats[j].trimmed;
+    }
+
+    printf("%-20s %10.0f ops/s %10.1f ns/op\n", "release+alloc",
+	   iterations / (delta / 1e9), (double)delta / iterations);
+    printf("%-20s %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64
+	   " trimmed, %u created\n", "", hits, misses, trimmed,
+	   created - before);
+
+    for (j = 0; j < BENCH_LIVE; j++)
+	test_destroy(&live[j]->entry);
+    drmBOCacheDestroy(cache);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t iterations = 1000000;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+	switch (c) {
+	case 'n':
+	    iterations = strtoull(optarg, NULL, 0);
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    test_buckets();
+    test_policy();
+    test_flags();
+    test_purge();
+    test_purge_unsupported();
+    test_expire();
+    test_trim();
+
+    if (failures) {
+	fprintf(stderr, "%d checks failed\n", failures);
+	return 1;
+    }
+
+    if (iterations)
+	bench(iterations);
+
+    return 0;
+}
@@ -0,0 +1,1117 @@
+/*
+ * Copyright © 2026 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Measures the CPU cost of libdrm_intel paths without a GPU.
+ *
+ * The drm entry points libdrm_intel calls into are replaced by the stand-in
+ * device from intel_stand_in.c, so only the library side is measured.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "i915_drm.h"
+#include "intel_aub.h"
+#include "intel_bufmgr.h"
+#include "intel_stand_in.h"
+#include "mm.h"
+
+/** Help string for command line parameters */
+static const char usage[] =
+	"Usage: %s [-?h] [-l] [-n iterations] [-s scenario] [-t trace]\n"
+	"where:\n"
+	"	l - List the available scenarios\n"
+	"	n - Number of iterations per scenario (default 100000)\n"
+	"	s - Only run the given scenario, can be used multiple times\n"
+	"	t - Allocator trace to replay in mm-trace, lines of\n"
+	"	    \"a <id> <size> <align2>\" and \"f <id>\"\n"
+	"	h - Display this help\n";
+
+/** Specified options strings for getopt */
+static const char options[] = "?hln:s:t:";
+
+/*
+ * Scenarios.
+ */
+
+static drm_intel_bufmgr *bufmgr;
+static uint64_t iterations = 100000;
+static const char *trace_file;
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t count, uint64_t delta_ns,
+		   uint64_t ioctls)
+{
+	fprintf(stdout, "%-32s %12.0f ops/s %10.1f ns/op %6.2f ioctls/op\n",
+		name, count * 1e9 / (delta_ns ? delta_ns : 1),
+		(double)delta_ns / count, (double)ioctls / count);
+}
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+static void bo_cache_totals(drm_intel_bo_cache_stats *totals)
+{
+	drm_intel_bo_cache_stats stats[64];
+	int i, count;
+
+	count = drm_intel_bufmgr_gem_get_cache_stats(bufmgr, stats, 64);
+
+	memset(totals, 0, sizeof(*totals));
+	for (i = 0; i < count && i < 64; i++) {
+		totals->cached += stats[i].cached;
+		totals->hits += stats[i].hits;
+		totals->misses += stats[i].misses;
+		totals->purged += stats[i].purged;
+		totals->expired += stats[i].expired;
+	}
+}
+
+/*
+ * Allocation and release of buffers through the reuse cache, in the
+ * smallest and the largest buckets, and a random mix with a window of
+ * live buffers.
+ */
+static int bench_bo_cache(void)
+{
+	static const struct {
+		const char *name;
+		unsigned long min, max;
+	} sizes[] = {
+		{ "bo-cache/small", 1, 3 * 4096 },
+		{ "bo-cache/large", 64 << 20, 112 << 20 },
+		{ "bo-cache/mixed", 1, 112 << 20 },
+	};
+	drm_intel_bo_cache_stats totals;
+	drm_intel_bo *window[64] = { NULL };
+	uint64_t start, ioctls, i;
+	unsigned s;
+
+	drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		ioctls = stand_in_ioctls;
+		start = get_time_ns();
+		for (i = 0; i < iterations; i++) {
+			unsigned long size = sizes[s].min + next_rand() %
+				(sizes[s].max - sizes[s].min + 1);
+			drm_intel_bo **bo = &window[i % 64];
+
+			if (*bo)
+				drm_intel_bo_unreference(*bo);
+			*bo = drm_intel_bo_alloc(bufmgr, "bench", size, 0);
+			if (!*bo)
+				return -ENOMEM;
+		}
+		report(sizes[s].name, iterations, get_time_ns() - start,
+		       stand_in_ioctls - ioctls);
+	}
+
+	/* Lose the pages of some cached buffers */
+	stand_in_purge_every = 8;
+	for (i = 0; i < iterations; i++) {
+		drm_intel_bo **bo = &window[i % 64];
+
+		drm_intel_bo_unreference(*bo);
+		*bo = drm_intel_bo_alloc(bufmgr, "bench",
+					 1 + next_rand() % (1 << 20), 0);
+		if (!*bo)
+			return -ENOMEM;
+	}
+	stand_in_purge_every = 0;
+
+	for (i = 0; i < 64; i++)
+		drm_intel_bo_unreference(window[i]);
+
+	bo_cache_totals(&totals);
+	fprintf(stdout, "%-32s %u cached, %" PRIu64 " hits, %" PRIu64
+		" misses, %" PRIu64 " purged\n", "", totals.cached,
+		totals.hits, totals.misses, totals.purged);
+	if (!totals.cached || !totals.purged)
+		return -EINVAL;
+
+	/* Let all of them expire, the next release frees them */
+	stand_in_clock_offset += 3;
+	drm_intel_bo_unreference(drm_intel_bo_alloc(bufmgr, "bench",
+						    256 << 20, 0));
+	bo_cache_totals(&totals);
+	fprintf(stdout, "%-32s %u cached, %" PRIu64 " expired\n", "",
+		totals.cached, totals.expired);
+
+	return totals.cached ? -EINVAL : 0;
+}
+
+/*
+ * A batch with relocations to state buffers, which have relocations to
+ * surfaces, which have relocations to a few shared buffers. Most buffers
+ * are reached many times.
+ */
+#define GRAPH_LEAVES	64
+#define GRAPH_SURFACES	256
+#define GRAPH_STATES	256
+#define GRAPH_BATCH_RELOCS	4096
+
+static int exec_graph(drm_intel_bufmgr *mgr, const char *prefix)
+{
+	char name[64];
+	drm_intel_bo *leaves[GRAPH_LEAVES], *surfaces[GRAPH_SURFACES];
+	drm_intel_bo *states[GRAPH_STATES], *batch, *other, *lonely;
+	uint64_t start, ioctls, i, count;
+	int r = 0, found = 0, j;
+
+	for (i = 0; i < GRAPH_LEAVES; i++)
+		leaves[i] = drm_intel_bo_alloc(mgr, "leaf", 4096, 0);
+	for (i = 0; i < GRAPH_SURFACES; i++) {
+		surfaces[i] = drm_intel_bo_alloc(mgr, "surface", 4096, 0);
+		for (j = 0; j < 2 && !r; j++)
+			r = drm_intel_bo_emit_reloc(surfaces[i], j * 4,
+				leaves[next_rand() % GRAPH_LEAVES], 0,
+				I915_GEM_DOMAIN_SAMPLER, 0);
+	}
+	for (i = 0; i < GRAPH_STATES; i++) {
+		states[i] = drm_intel_bo_alloc(mgr, "state", 4096, 0);
+		for (j = 0; j < 16 && !r; j++)
+			r = drm_intel_bo_emit_reloc(states[i], j * 4,
+				surfaces[(i + j * 16) % GRAPH_SURFACES], 0,
+				I915_GEM_DOMAIN_SAMPLER, 0);
+	}
+	batch = drm_intel_bo_alloc(mgr, "batch", 32768, 0);
+	for (i = 0; i < GRAPH_BATCH_RELOCS && !r; i++)
+		r = drm_intel_bo_emit_reloc(batch, i * 4,
+			states[next_rand() % GRAPH_STATES], 0,
+			I915_GEM_DOMAIN_INSTRUCTION, 0);
+
+	/* A relocation target outside of the batch's tree */
+	other = drm_intel_bo_alloc(mgr, "other", 4096, 0);
+	lonely = drm_intel_bo_alloc(mgr, "lonely", 4096, 0);
+	if (!r)
+		r = drm_intel_bo_emit_reloc(other, 0, lonely, 0,
+					    I915_GEM_DOMAIN_RENDER, 0);
+	if (r)
+		goto out;
+
+	count = iterations / 100 ? iterations / 100 : 10;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < count && !r; i++)
+		r = drm_intel_bo_exec(batch, 4096, NULL, 0, 0);
+	snprintf(name, sizeof(name), "%s/exec", prefix);
+	report(name, count, get_time_ns() - start, stand_in_ioctls - ioctls);
+	fprintf(stdout, "%-32s %u buffers in the execbuffer, %u relocations, "
+		"%u softpinned\n", "", stand_in_exec_buffer_count,
+		stand_in_exec_relocs, stand_in_exec_pinned);
+	if (!r && stand_in_exec_buffer_count !=
+	    1 + GRAPH_STATES + GRAPH_SURFACES + GRAPH_LEAVES)
+		r = -EINVAL;
+
+	ioctls = stand_in_ioctls;
+	start = get_time_ns();
+	for (i = 0; i < count; i++)
+		found |= drm_intel_bo_references(batch, lonely);
+	snprintf(name, sizeof(name), "%s/references", prefix);
+	report(name, count, get_time_ns() - start, stand_in_ioctls - ioctls);
+	if (!r && (found || !drm_intel_bo_references(batch, leaves[0])))
+		r = -EINVAL;
+
+out:
+	drm_intel_bo_unreference(batch);
+	drm_intel_bo_unreference(other);
+	drm_intel_bo_unreference(lonely);
+	for (i = 0; i < GRAPH_STATES; i++)
+		drm_intel_bo_unreference(states[i]);
+	for (i = 0; i < GRAPH_SURFACES; i++)
+		drm_intel_bo_unreference(surfaces[i]);
+	for (i = 0; i < GRAPH_LEAVES; i++)
+		drm_intel_bo_unreference(leaves[i]);
+
+	return r;
+}
+
+static int bench_exec_graph(void)
+{
+	return exec_graph(bufmgr, "exec-graph");
+}
+
+static int compare_offsets(const void *a, const void *b)
+{
+	const drm_intel_bo *bo_a = *(drm_intel_bo * const *)a;
+	const drm_intel_bo *bo_b = *(drm_intel_bo * const *)b;
+
+	return bo_a->offset64 < bo_b->offset64 ? -1 :
+		bo_a->offset64 > bo_b->offset64;
+}
+
+/*
+ * Allocation and release without the reuse cache, so every buffer gets a
+ * new GPU address, with a window of live buffers fragmenting the address
+ * space. Then the reloc graph again, with everything softpinned.
+ */
+#define SOFTPIN_WINDOW	4096
+
+static int bench_softpin(void)
+{
+	static drm_intel_bo *window[SOFTPIN_WINDOW];
+	drm_intel_bufmgr *mgrs[2] = { NULL, NULL };
+	uint64_t start, ioctls, i;
+	int fds[2] = { -1, -1 };
+	int r = 0, m;
+
+	for (m = 0; m < 2 && !r; m++) {
+		const char *name = m ? "softpin/alloc" : "softpin/alloc-unpinned";
+
+		fds[m] = stand_in_open();
+		if (fds[m] < 0)
+			return fds[m];
+		mgrs[m] = drm_intel_bufmgr_gem_init(fds[m], 65536);
+		if (!mgrs[m])
+			return -ENOMEM;
+		if (m)
+			r = drm_intel_bufmgr_gem_enable_softpin(mgrs[m]);
+		if (r)
+			break;
+
+		memset(window, 0, sizeof(window));
+		ioctls = stand_in_ioctls;
+		start = get_time_ns();
+		for (i = 0; i < iterations; i++) {
+			drm_intel_bo **bo = &window[next_rand() % SOFTPIN_WINDOW];
+
+			if (*bo)
+				drm_intel_bo_unreference(*bo);
+			*bo = drm_intel_bo_alloc(mgrs[m], "softpin",
+						 4096 << (next_rand() % 10), 0);
+			if (!*bo) {
+				r = -ENOSPC;
+				break;
+			}
+		}
+		report(name, i, get_time_ns() - start, stand_in_ioctls - ioctls);
+
+		/* Live buffers must not overlap */
+		if (m && !r) {
+			drm_intel_bo *sorted[SOFTPIN_WINDOW];
+			int n = 0, j;
+
+			for (j = 0; j < SOFTPIN_WINDOW; j++)
+				if (window[j])
+					sorted[n++] = window[j];
+			qsort(sorted, n, sizeof(*sorted), compare_offsets);
+			for (j = 1; j < n && !r; j++)
+				if (sorted[j - 1]->offset64 + sorted[j - 1]->size >
+				    sorted[j]->offset64 || !sorted[j]->offset64)
+					r = -EINVAL;
+		}
+
+		for (i = 0; i < SOFTPIN_WINDOW; i++)
+			if (window[i])
+				drm_intel_bo_unreference(window[i]);
+	}
+
+	if (!r)
+		r = exec_graph(mgrs[1], "softpin");
+	if (!r && (stand_in_exec_relocs ||
+		   stand_in_exec_pinned != stand_in_exec_buffer_count))
+		r = -EINVAL;
+
+	for (m = 0; m < 2; m++) {
+		if (mgrs[m])
+			drm_intel_bufmgr_destroy(mgrs[m]);
+		if (fds[m] >= 0)
+			close(fds[m]);
+	}
+
+	return r;
+}
+
+/*
+ * Range allocator traces: ids are slots for live blocks, an allocation
+ * into a used slot or a free of an empty one is ignored.
+ */
+struct mm_op {
+	char op;
+	int id, size, align2;
+};
+
+#define MM_TRACE_SLOTS	65536
+#define MM_HEAP_SIZE	(1 << 24)
+
+static struct mm_op *mm_trace_load(const char *path, uint64_t *count)
+{
+	struct mm_op *ops = NULL, op;
+	uint64_t size = 0, n = 0;
+	char line[128];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return NULL;
+
+	while (fgets(line, sizeof(line), f)) {
+		memset(&op, 0, sizeof(op));
+		if (sscanf(line, " a %d %d %d", &op.id, &op.size, &op.align2) == 3)
+			op.op = 'a';
+		else if (sscanf(line, " f %d", &op.id) == 1)
+			op.op = 'f';
+		else
+			continue;
+		if (op.id < 0 || op.id >= MM_TRACE_SLOTS)
+			continue;
+
+		if (n == size) {
+			struct mm_op *tmp;
+
+			size = size ? size * 2 : 4096;
+			tmp = realloc(ops, size * sizeof(*ops));
+			if (!tmp) {
+				free(ops);
+				fclose(f);
+				return NULL;
+			}
+			ops = tmp;
+		}
+		ops[n++] = op;
+	}
+
+	fclose(f);
+	*count = n;
+	return ops;
+}
+
+/*
+ * Steady state: random sizes and alignments in a window of live blocks.
+ * Frames: transient blocks freed at the end of every frame, and some
+ * that live for a few hundred frames.
+ */
+static struct mm_op *mm_trace_generate(int frames, uint64_t count)
+{
+	struct mm_op *ops = calloc(count, sizeof(*ops));
+	uint64_t i;
+
+	if (!ops)
+		return NULL;
+
+	for (i = 0; i + 1 < count; i += 2) {
+		int id;
+
+		if (frames) {
+			int frame = i / 128, slot = i / 2 % 64;
+
+			if (slot < 60) {
+				/* transient, previous frame's copy freed */
+				id = 1024 + (frame % 2) * 64 + slot;
+			} else {
+				/* long lived, replaced every 256 frames */
+				id = (frame / 256 % 4) * 256 + frame % 256;
+				if (frame % 64)
+					id = -1;
+			}
+		} else {
+			id = next_rand() % 4096;
+		}
+
+		if (id < 0) {
+			ops[i].op = ops[i + 1].op = 0;
+			continue;
+		}
+		ops[i].op = 'f';
+		ops[i].id = id;
+		ops[i + 1].op = 'a';
+		ops[i + 1].id = id;
+		ops[i + 1].size = 1 + next_rand() % (frames ? 64 : 512);
+		ops[i + 1].align2 = next_rand() % 4;
+	}
+
+	return ops;
+}
+
+static int mm_trace_replay(const char *name, const struct mm_op *ops,
+			   uint64_t count)
+{
+	static struct mem_block *blocks[MM_TRACE_SLOTS];
+	struct mem_block *heap, *p;
+	struct mem_stats stats;
+	uint64_t start, i, n = 0, failed = 0;
+	int r = 0, used = 0;
+
+	heap = mmInit(0, MM_HEAP_SIZE);
+	if (!heap)
+		return -ENOMEM;
+	memset(blocks, 0, sizeof(blocks));
+
+	start = get_time_ns();
+	for (i = 0; i < count; i++) {
+		const struct mm_op *op = &ops[i];
+
+		if (op->op == 'a' && !blocks[op->id]) {
+			blocks[op->id] = mmAllocMem(heap, op->size,
+						    op->align2, 0);
+			failed += !blocks[op->id];
+			n++;
+		} else if (op->op == 'f' && blocks[op->id]) {
+			mmFreeMem(blocks[op->id]);
+			blocks[op->id] = NULL;
+			n++;
+		}
+	}
+	report(name, n ? n : 1, get_time_ns() - start, 0);
+
+	mmGetStats(heap, &stats);
+	fprintf(stdout, "%-32s %d blocks, %d free in %d ranges, largest %d, "
+		"%.1f%% fragmented, %" PRIu64 " failed\n", "",
+		stats.used_blocks, stats.free, stats.free_blocks,
+		stats.largest_free, stats.free ?
+		100.0 * (stats.free - stats.largest_free) / stats.free : 0.0,
+		failed);
+
+	/* Blocks are aligned, inside the heap, and account for it all */
+	for (p = heap->next; p != heap; p = p->next) {
+		if (p->next != heap && p->ofs + p->size != p->next->ofs)
+			r = -EINVAL;
+		if (!p->free)
+			used += p->size;
+	}
+	for (i = 0; i < MM_TRACE_SLOTS; i++) {
+		p = blocks[i];
+		if (p && (p->free || p->ofs < 0 ||
+			  p->ofs + p->size > MM_HEAP_SIZE))
+			r = -EINVAL;
+	}
+	if (used + stats.free != MM_HEAP_SIZE)
+		r = -EINVAL;
+
+	/* Everything joins up again */
+	for (i = 0; i < MM_TRACE_SLOTS; i++)
+		mmFreeMem(blocks[i]);
+	mmGetStats(heap, &stats);
+	if (stats.free_blocks != 1 || stats.largest_free != MM_HEAP_SIZE)
+		r = -EINVAL;
+
+	mmDestroy(heap);
+	return r;
+}
+
+static int bench_mm_trace(void)
+{
+	struct mm_op *ops;
+	uint64_t count;
+	int r;
+
+	if (trace_file) {
+		ops = mm_trace_load(trace_file, &count);
+		if (!ops)
+			return -errno ? -errno : -ENOMEM;
+		r = mm_trace_replay("mm-trace/file", ops, count);
+		free(ops);
+		return r;
+	}
+
+	count = iterations * 2;
+	ops = mm_trace_generate(0, count);
+	if (!ops)
+		return -ENOMEM;
+	r = mm_trace_replay("mm-trace/steady", ops, count);
+	free(ops);
+	if (r)
+		return r;
+
+	ops = mm_trace_generate(1, count);
+	if (!ops)
+		return -ENOMEM;
+	r = mm_trace_replay("mm-trace/frames", ops, count);
+	free(ops);
+
+	return r;
+}
+
+/*
+ * Execbuffer of a frame-like workload with AUB tracing off and on. Each
+ * exec rewrites the batch and a few small ranges of the state and vertex
+ * buffers; the texture is only written once.
+ */
+#define AUB_STATES	64
+#define AUB_BATCH_USED	4096
+
+static int aub_exec(const char *name, int mode, const char *path)
+{
+	drm_intel_bo *states[AUB_STATES], *vertices, *texture, *batch;
+	uint32_t data[AUB_BATCH_USED / 4];
+	uint64_t start, ioctls, i, count;
+	struct timespec cpu_start, cpu_end;
+	struct stat st;
+	int r = 0, j;
+
+	memset(data, 0, sizeof(data));
+	for (i = 0; i < AUB_STATES; i++)
+		states[i] = drm_intel_bo_alloc(bufmgr, "state", 65536, 0);
+	vertices = drm_intel_bo_alloc(bufmgr, "vertices", 4 << 20, 0);
+	texture = drm_intel_bo_alloc(bufmgr, "texture", 8 << 20, 0);
+	batch = drm_intel_bo_alloc(bufmgr, "batch", 32768, 0);
+
+	if (mode) {
+		drm_intel_bufmgr_gem_set_aub_filename(bufmgr, path);
+		drm_intel_bufmgr_gem_set_aub_window(bufmgr, 0, mode == 2);
+		drm_intel_bufmgr_gem_set_aub_dump(bufmgr, 1);
+	}
+
+	count = iterations / 100 ? iterations / 100 : 10;
+
+	ioctls = stand_in_ioctls;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+	start = get_time_ns();
+	for (i = 0; i < count && !r; i++) {
+		drm_intel_bo_subdata(batch, 0, sizeof(data), data);
+		for (j = 0; j < 4; j++)
+			drm_intel_bo_subdata(states[next_rand() % AUB_STATES],
+					     (next_rand() % 256) * 256, 256,
+					     data);
+		drm_intel_bo_subdata(vertices, (i * 16384) % (4 << 20), 16384,
+				     data);
+
+		for (j = 0; j < AUB_STATES && !r; j++)
+			r = drm_intel_bo_emit_reloc(batch, j * 4, states[j], 0,
+						    I915_GEM_DOMAIN_INSTRUCTION,
+						    0);
+		if (!r)
+			r = drm_intel_bo_emit_reloc(batch, j * 4, vertices, 0,
+						    I915_GEM_DOMAIN_VERTEX, 0);
+		if (!r)
+			r = drm_intel_bo_emit_reloc(batch, j * 4 + 4, texture,
+						    0, I915_GEM_DOMAIN_SAMPLER,
+						    0);
+		if (!r)
+			r = drm_intel_bo_exec(batch, AUB_BATCH_USED, NULL, 0, 0);
+		drm_intel_gem_bo_clear_relocs(batch, 0);
+	}
+	report(name, count, get_time_ns() - start, stand_in_ioctls - ioctls);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+	fprintf(stdout, "%-32s %.1f ns/op of CPU time in the calling thread\n",
+		"", ((cpu_end.tv_sec - cpu_start.tv_sec) * 1e9 +
+		     cpu_end.tv_nsec - cpu_start.tv_nsec) / count);
+
+	if (mode) {
+		drm_intel_bufmgr_gem_set_aub_dump(bufmgr, 0);
+		if (stat(path, &st))
+			r = -errno;
+		else if (!r)
+			fprintf(stdout, "%-32s %.1f MB written, %.1f KB/exec\n",
+				"", st.st_size / 1048576.0,
+				st.st_size / 1024.0 / count);
+		/*
+		 * Every buffer is written out by the first exec, then no more
+		 * than the ranges that changed.
+		 */
+		if (!r && (st.st_size < (12 << 20) ||
+			   st.st_size > (off_t)((17 << 20) + count * (1 << 20))))
+			r = -EINVAL;
+		unlink(path);
+	}
+
+	drm_intel_bo_unreference(batch);
+	drm_intel_bo_unreference(texture);
+	drm_intel_bo_unreference(vertices);
+	for (i = 0; i < AUB_STATES; i++)
+		drm_intel_bo_unreference(states[i]);
+
+	return r;
+}
+
+/*
+ * Checks that every data write of the trace at \p path is to an address the
+ * GTT entries before it mapped, and returns the highest address written.
+ */
+static int aub_check_trace(const char *path, uint64_t *max_address)
+{
+	uint64_t gtt_end = 0, address, end;
+	size_t count, pos, len;
+	uint32_t *dw, size;
+	FILE *file;
+	long bytes;
+	int r = 0;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -errno;
+	fseek(file, 0, SEEK_END);
+	bytes = ftell(file);
+	rewind(file);
+	count = bytes / 4;
+	dw = malloc(count * 4);
+	if (!dw || fread(dw, 4, count, file) != count)
+		r = -EIO;
+	fclose(file);
+
+	*max_address = 0;
+	for (pos = 0; !r && pos < count; pos += len) {
+		unsigned int header = (dw[pos] & 0xffff) + 2;
+
+		len = header;
+		if ((dw[pos] & 0xffff0000) !=
+		    (uint32_t)CMD_AUB_TRACE_HEADER_BLOCK)
+			continue;
+		if (pos + header > count) {
+			r = -EINVAL;
+			break;
+		}
+
+		size = dw[pos + 4];
+		len += size / 4;
+		if ((dw[pos + 1] & AUB_TRACE_OPERATION_MASK) !=
+		    AUB_TRACE_OP_DATA_WRITE)
+			continue;
+
+		address = dw[pos + 3];
+		if (header >= 6)
+			address |= (uint64_t)dw[pos + 5] << 32;
+		if ((dw[pos + 1] & AUB_TRACE_ADDRESS_SPACE_MASK) ==
+		    AUB_TRACE_MEMTYPE_GTT_ENTRY) {
+			/* Entries of 8 bytes from gen8, with 6 dword headers */
+			end = (address + size) / (header >= 6 ? 8 : 4) * 4096;
+			if (address / (header >= 6 ? 8 : 4) * 4096 <= gtt_end &&
+			    end > gtt_end)
+				gtt_end = end;
+		} else if (address + size > gtt_end) {
+			fprintf(stderr, "AUB write at 0x%" PRIx64 " outside of "
+				"the GTT mapped up to 0x%" PRIx64 "\n",
+				address, gtt_end);
+			r = -EINVAL;
+		} else if (address + size > *max_address) {
+			*max_address = address + size;
+		}
+	}
+
+	free(dw);
+	return r;
+}
+
+/*
+ * Buffers allocated and freed while tracing, 160MB in all, and a softpin
+ * bufmgr that must not start a trace.
+ */
+#define AUB_CHURN_BOS	80
+#define AUB_CHURN_SIZE	(2 << 20)
+
+static int aub_churn(const char *path)
+{
+	drm_intel_bufmgr *mgr;
+	drm_intel_bo *batch, *bo;
+	uint64_t max_address = 0;
+	struct stat st;
+	int fd, i, r = 0;
+
+	fd = stand_in_open();
+	if (fd < 0)
+		return fd;
+	/* Without the reuse cache, every buffer is freed */
+	mgr = drm_intel_bufmgr_gem_init(fd, 4096);
+	if (!mgr) {
+		close(fd);
+		return -ENOMEM;
+	}
+
+	drm_intel_bufmgr_gem_set_aub_filename(mgr, path);
+	drm_intel_bufmgr_gem_set_aub_dump(mgr, 1);
+	batch = drm_intel_bo_alloc(mgr, "batch", 4096, 0);
+	for (i = 0; i < AUB_CHURN_BOS && !r; i++) {
+		bo = drm_intel_bo_alloc(mgr, "churn", AUB_CHURN_SIZE, 0);
+		if (!bo) {
+			r = -ENOMEM;
+			break;
+		}
+		r = drm_intel_bo_emit_reloc(batch, 0, bo, 0,
+					    I915_GEM_DOMAIN_SAMPLER, 0);
+		if (!r)
+			r = drm_intel_bo_exec(batch, 8, NULL, 0, 0);
+		drm_intel_gem_bo_clear_relocs(batch, 0);
+		drm_intel_bo_unreference(bo);
+	}
+	drm_intel_bo_unreference(batch);
+	drm_intel_bufmgr_gem_set_aub_dump(mgr, 0);
+	drm_intel_bufmgr_destroy(mgr);
+	close(fd);
+
+	if (!r)
+		r = aub_check_trace(path, &max_address);
+	if (!r)
+		fprintf(stdout, "%-32s %d MB of buffers, highest address "
+			"%" PRIu64 " MB\n", "aub/churn",
+			AUB_CHURN_BOS * (AUB_CHURN_SIZE >> 20),
+			max_address >> 20);
+	/* The addresses of the freed buffers are used again */
+	if (!r && max_address > 4 * AUB_CHURN_SIZE)
+		r = -EINVAL;
+	unlink(path);
+	if (r)
+		return r;
+
+	fd = stand_in_open();
+	if (fd < 0)
+		return fd;
+	mgr = drm_intel_bufmgr_gem_init(fd, 4096);
+	if (!mgr) {
+		close(fd);
+		return -ENOMEM;
+	}
+	r = drm_intel_bufmgr_gem_enable_softpin(mgr);
+	if (!r) {
+		drm_intel_bufmgr_gem_set_aub_filename(mgr, path);
+		drm_intel_bufmgr_gem_set_aub_dump(mgr, 1);
+		if (!stat(path, &st)) {
+			unlink(path);
+			r = -EINVAL;
+		}
+		drm_intel_bufmgr_gem_set_aub_dump(mgr, 0);
+	}
+	drm_intel_bufmgr_destroy(mgr);
+	close(fd);
+
+	return r;
+}
+
+static int bench_aub(void)
+{
+	const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	char path[4096];
+	int r;
+
+	snprintf(path, sizeof(path), "%s/intel_bench-%d.aub", dir, getpid());
+
+	r = aub_exec("aub/off", 0, path);
+	if (!r)
+		r = aub_exec("aub/on", 1, path);
+	if (!r)
+		r = aub_exec("aub/on-background", 2, path);
+	if (!r)
+		r = aub_churn(path);
+
+	return r;
+}
+
+/*
+ * Uploads of various sizes with drm_intel_bo_subdata() to random places in a
+ * few buffers, with an execbuffer using all of them every UPLOAD_BATCH
+ * uploads, through pwrite and through the streaming path.
+ */
+#define UPLOAD_BOS	8
+#define UPLOAD_BO_SIZE	(2 << 20)
+#define UPLOAD_BATCH	64
+
+static int upload_domain_failure(const char *name, drm_intel_bo *bo,
+				 drm_intel_bo *batch, uint8_t *shadow,
+				 uint8_t *data, unsigned long size)
+{
+	drm_intel_upload_stats before, after;
+	uint64_t pwrites;
+	int r;
+
+	/* Write out what is staged, reading back leaves the WC domain */
+	r = drm_intel_bo_exec(batch, 4096, NULL, 0, 0);
+	if (!r)
+		r = drm_intel_bo_get_subdata(bo, 0, size, data);
+	if (r)
+		return r;
+
+	stand_in_set_domain_error = EIO;
+	drm_intel_bufmgr_gem_get_upload_stats(bufmgr, &before);
+	pwrites = stand_in_pwrites;
+
+	/* Staged, written out by the execbuffer */
+	memset(data, 0x5a, size);
+	r = drm_intel_bo_subdata(bo, 0, 16, data);
+	memcpy(shadow, data, 16);
+	if (!r)
+		r = drm_intel_bo_emit_reloc(batch, 0, bo, 0,
+					    I915_GEM_DOMAIN_SAMPLER, 0);
+	if (!r)
+		r = drm_intel_bo_exec(batch, 4096, NULL, 0, 0);
+	drm_intel_gem_bo_clear_relocs(batch, 0);
+
+	/* Too large to stage */
+	if (!r)
+		r = drm_intel_bo_subdata(bo, 0, UPLOAD_BO_SIZE / 2, shadow);
+	drm_intel_bufmgr_gem_get_upload_stats(bufmgr, &after);
+	stand_in_set_domain_error = 0;
+
+	if (!r && (after.direct != before.direct ||
+		   stand_in_pwrites - pwrites != 2)) {
+		fprintf(stderr, "%s: wrote through the WC map without a domain "
+			"change\n", name);
+		r = -EINVAL;
+	}
+	return r;
+}
+
+static int upload_run(const char *name, unsigned long size, bool streaming)
+{
+	drm_intel_bo *bos[UPLOAD_BOS], *batch;
+	drm_intel_upload_stats before, after;
+	uint8_t *shadow[UPLOAD_BOS], *data, *check;
+	uint64_t start, ioctls, domains, delta, i, count;
+	unsigned long offset;
+	int r = 0, j, k;
+
+	if (streaming) {
+		r = drm_intel_bufmgr_gem_enable_streaming_uploads(bufmgr,
+								  1 << 20);
+		if (r)
+			return r;
+	}
+
+	data = malloc(size);
+	check = malloc(UPLOAD_BO_SIZE);
+	if (!data || !check)
+		return -ENOMEM;
+	batch = drm_intel_bo_alloc(bufmgr, "batch", 4096, 0);
+	for (j = 0; j < UPLOAD_BOS; j++) {
+		bos[j] = drm_intel_bo_alloc(bufmgr, "upload", UPLOAD_BO_SIZE, 0);
+		shadow[j] = malloc(UPLOAD_BO_SIZE);
+		if (!shadow[j])
+			return -ENOMEM;
+		/* Buffers from the reuse cache are not cleared */
+		r = drm_intel_bo_get_subdata(bos[j], 0, UPLOAD_BO_SIZE,
+					     shadow[j]);
+		if (r)
+			return r;
+	}
+
+	/* About 256MB of data per run, at least 4 batches of it */
+	count = (256ull << 20) / size;
+	if (count > iterations)
+		count = iterations;
+	if (count < 4 * UPLOAD_BATCH)
+		count = 4 * UPLOAD_BATCH;
+
+	drm_intel_bufmgr_gem_get_upload_stats(bufmgr, &before);
+	ioctls = stand_in_ioctls;
+	domains = stand_in_set_domains;
+	delta = 0;
+	for (i = 0; i < count && !r; i++) {
+		k = next_rand() % UPLOAD_BOS;
+		offset = (next_rand() % (UPLOAD_BO_SIZE / size)) * size;
+		memset(data, i, size);
+
+		start = get_time_ns();
+		r = drm_intel_bo_subdata(bos[k], offset, size, data);
+		if (!r && i % UPLOAD_BATCH == UPLOAD_BATCH - 1) {
+			for (j = 0; j < UPLOAD_BOS && !r; j++)
+				r = drm_intel_bo_emit_reloc(batch, j * 4,
+							    bos[j], 0,
+							    I915_GEM_DOMAIN_SAMPLER,
+							    0);
+			if (!r)
+				r = drm_intel_bo_exec(batch, 4096, NULL, 0, 0);
+			drm_intel_gem_bo_clear_relocs(batch, 0);
+		}
+		delta += get_time_ns() - start;
+
+		memcpy(shadow[k] + offset, data, size);
+	}
+	drm_intel_bufmgr_gem_get_upload_stats(bufmgr, &after);
+
+	report(name, count, delta, stand_in_ioctls - ioctls);
+	fprintf(stdout, "%-32s %.1f MB/s, %" PRIu64 " domain changes\n",
+		"", count * size / 1048576.0 / (delta / 1e9),
+		stand_in_set_domains - domains);
+	if (streaming)
+		fprintf(stdout, "%-32s %" PRIu64 " staged, %" PRIu64
+			" direct, %" PRIu64 " flushes\n", "",
+			after.staged - before.staged,
+			after.direct - before.direct,
+			after.flushes - before.flushes);
+
+	/*
+	 * Without a domain change the WC map is left alone: direct writes and
+	 * staged ones go through pwrite instead.
+	 */
+	if (!r && streaming)
+		r = upload_domain_failure(name, bos[0], batch, shadow[0], data,
+					  size);
+
+	/* Writes past the end are refused and leave the buffer alone */
+	if (!r && (drm_intel_bo_subdata(bos[0], UPLOAD_BO_SIZE - size / 2,
+					size, data) != -EINVAL ||
+		   drm_intel_bo_subdata(bos[0], ULONG_MAX - size / 2, size,
+					data) != -EINVAL)) {
+		fprintf(stderr, "%s: write past the end accepted\n", name);
+		r = -EINVAL;
+	}
+
+	for (j = 0; j < UPLOAD_BOS && !r; j++) {
+		r = drm_intel_bo_get_subdata(bos[j], 0, UPLOAD_BO_SIZE, check);
+		if (!r && memcmp(check, shadow[j], UPLOAD_BO_SIZE)) {
+			fprintf(stderr, "%s: buffer %d differs from what was "
+				"uploaded\n", name, j);
+			r = -EINVAL;
+		}
+	}
+
+	for (j = 0; j < UPLOAD_BOS; j++) {
+		drm_intel_bo_unreference(bos[j]);
+		free(shadow[j]);
+	}
+	drm_intel_bo_unreference(batch);
+	free(check);
+	free(data);
+
+	if (streaming)
+		drm_intel_bufmgr_gem_enable_streaming_uploads(bufmgr, 0);
+
+	return r;
+}
+
+static int bench_upload(void)
+{
+	static const unsigned long sizes[] = { 64, 256, 4096, 65536, 1 << 20 };
+	char name[64];
+	unsigned i;
+	int r = 0;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !r; i++) {
+		snprintf(name, sizeof(name), "upload/pwrite-%lu", sizes[i]);
+		r = upload_run(name, sizes[i], false);
+		if (r)
+			break;
+		snprintf(name, sizeof(name), "upload/streaming-%lu", sizes[i]);
+		r = upload_run(name, sizes[i], true);
+	}
+
+	return r;
+}
+
+static const struct {
+	const char *name;
+	int (*func)(void);
+	const char *description;
+} scenarios[] = {
+	{ "bo-cache", bench_bo_cache,
+	  "drm_intel_bo_alloc() and release through the BO reuse cache" },
+	{ "exec-graph", bench_exec_graph,
+	  "execbuffer and drm_intel_bo_references() over a shared reloc graph" },
+	{ "softpin", bench_softpin,
+	  "GPU address allocation and execbuffer with everything softpinned" },
+	{ "mm-trace", bench_mm_trace,
+	  "mmAllocMem() and mmFreeMem() replaying allocator traces" },
+	{ "aub", bench_aub,
+	  "execbuffer with AUB tracing off and on" },
+	{ "upload", bench_upload,
+	  "drm_intel_bo_subdata() through pwrite and streaming uploads" },
+};
+
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+int main(int argc, char **argv)
+{
+	bool selected[NUM_SCENARIOS] = { false };
+	bool any_selected = false;
+	unsigned i;
+	int fd, r, c;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, options)) != -1) {
+		switch (c) {
+		case 'l':
+			for (i = 0; i < NUM_SCENARIOS; i++)
+				fprintf(stdout, "%-16s %s\n", scenarios[i].name,
+					scenarios[i].description);
+			exit(EXIT_SUCCESS);
+		case 'n':
+			iterations = strtoull(optarg, NULL, 0);
+			if (!iterations) {
+				fprintf(stderr, "Invalid iteration count: %s\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 't':
+			trace_file = optarg;
+			break;
+		case 's':
+			for (i = 0; i < NUM_SCENARIOS; i++)
+				if (!strcmp(optarg, scenarios[i].name))
+					break;
+			if (i == NUM_SCENARIOS) {
+				fprintf(stderr, "Unknown scenario: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			selected[i] = any_selected = true;
+			break;
+		case '?':
+		case 'h':
+			fprintf(stderr, usage, argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			fprintf(stderr, usage, argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	fd = stand_in_open();
+	if (fd < 0) {
+		fprintf(stderr, "Cannot create stand-in device (%d)\n", fd);
+		exit(EXIT_FAILURE);
+	}
+
+	bufmgr = drm_intel_bufmgr_gem_init(fd, 65536);
+	if (!bufmgr) {
+		fprintf(stderr, "drm_intel_bufmgr_gem_init failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NUM_SCENARIOS; i++) {
+		if (any_selected && !selected[i])
+			continue;
+
+		r = scenarios[i].func();
+		if (r) {
+			fprintf(stderr, "Scenario %s failed with %d\n",
+				scenarios[i].name, r);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	drm_intel_bufmgr_destroy(bufmgr);
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
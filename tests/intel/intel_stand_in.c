@@ -0,0 +1,324 @@
+/*
+ * Copyright © 2026 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Stand-in for an i915 kernel driver.
+ *
+ * The drm entry points libdrm_intel calls into are replaced by the ones in
+ * this file. Once stand_in_open() was called they answer every request
+ * themselves, so the CPU cost of the library can be measured without a
+ * GPU. Before that they forward to libdrm.
+ *
+ * Buffers get memory once they are mapped, read or written: a memfd that
+ * pwrite and pread copy to and from, and mmap maps.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "xf86drm.h"
+#include "i915_drm.h"
+#include "intel_stand_in.h"
+
+static bool stand_in_enabled;
+static uint32_t stand_in_next_handle = 1;
+static unsigned stand_in_madvise_count;
+uint64_t stand_in_ioctls;
+uint32_t stand_in_exec_buffer_count;
+uint32_t stand_in_exec_relocs;
+uint32_t stand_in_exec_pinned;
+int stand_in_busy;
+unsigned stand_in_purge_every;
+time_t stand_in_clock_offset;
+uint64_t stand_in_set_domains;
+int stand_in_set_domain_error;
+uint64_t stand_in_pwrites;
+
+struct stand_in_object {
+	uint64_t size;
+	int fd;
+};
+
+static pthread_mutex_t stand_in_objects_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct stand_in_object *stand_in_objects;
+static uint32_t stand_in_objects_size;
+
+/* Without a stand-in device everything goes to the real libdrm */
+#define STAND_IN_FORWARD(func, ...)					\
+	do {								\
+		static __typeof__(func) *real_##func;			\
+									\
+		if (!stand_in_enabled) {				\
+			if (!real_##func)				\
+				real_##func = dlsym(RTLD_NEXT, #func);	\
+			return real_##func(__VA_ARGS__);		\
+		}							\
+	} while (0)
+
+int clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	static __typeof__(clock_gettime) *real_clock_gettime;
+	int ret;
+
+	if (!real_clock_gettime)
+		real_clock_gettime = dlsym(RTLD_NEXT, "clock_gettime");
+
+	ret = real_clock_gettime(clock, ts);
+	if (!ret && clock == CLOCK_MONOTONIC)
+		ts->tv_sec += stand_in_clock_offset;
+	return ret;
+}
+
+static void stand_in_object_create(uint32_t handle, uint64_t size)
+{
+	pthread_mutex_lock(&stand_in_objects_mutex);
+	if (handle >= stand_in_objects_size) {
+		uint32_t count = stand_in_objects_size ?
+				 stand_in_objects_size * 2 : 1024;
+		struct stand_in_object *objects;
+
+		while (count <= handle)
+			count *= 2;
+		objects = realloc(stand_in_objects, count * sizeof(*objects));
+		if (!objects)
+			abort();
+		memset(objects + stand_in_objects_size, 0,
+		       (count - stand_in_objects_size) * sizeof(*objects));
+		stand_in_objects = objects;
+		stand_in_objects_size = count;
+	}
+	stand_in_objects[handle].size = size;
+	stand_in_objects[handle].fd = -1;
+	pthread_mutex_unlock(&stand_in_objects_mutex);
+}
+
+/*
+ * The memfd of a buffer, created the first time its memory is used. As in
+ * the kernel, the range used has to be inside the buffer.
+ */
+static int stand_in_object_fd(uint32_t handle, uint64_t offset,
+			      uint64_t size)
+{
+	struct stand_in_object *object;
+	int fd = -1;
+
+	pthread_mutex_lock(&stand_in_objects_mutex);
+	if (handle < stand_in_objects_size) {
+		object = &stand_in_objects[handle];
+		if (offset > object->size || size > object->size - offset) {
+			pthread_mutex_unlock(&stand_in_objects_mutex);
+			errno = EINVAL;
+			return -1;
+		}
+		if (object->fd < 0 && object->size) {
+			object->fd = memfd_create("stand_in_object",
+						  MFD_CLOEXEC);
+			if (object->fd >= 0 &&
+			    ftruncate(object->fd, object->size)) {
+				close(object->fd);
+				object->fd = -1;
+			}
+		}
+		fd = object->fd;
+	}
+	pthread_mutex_unlock(&stand_in_objects_mutex);
+
+	if (fd < 0)
+		errno = ENOENT;
+	return fd;
+}
+
+int drmCloseBufferHandle(int fd, uint32_t handle)
+{
+	STAND_IN_FORWARD(drmCloseBufferHandle, fd, handle);
+
+	__sync_fetch_and_add(&stand_in_ioctls, 1);
+
+	pthread_mutex_lock(&stand_in_objects_mutex);
+	if (handle < stand_in_objects_size) {
+		if (stand_in_objects[handle].fd >= 0)
+			close(stand_in_objects[handle].fd);
+		stand_in_objects[handle].fd = -1;
+		stand_in_objects[handle].size = 0;
+	}
+	pthread_mutex_unlock(&stand_in_objects_mutex);
+	return 0;
+}
+
+static int stand_in_pwrite(struct drm_i915_gem_pwrite *args)
+{
+	int fd = stand_in_object_fd(args->handle, args->offset, args->size);
+
+	if (fd < 0 || pwrite(fd, (void *)(uintptr_t)args->data_ptr,
+			     args->size, args->offset) != (ssize_t)args->size)
+		return -1;
+	return 0;
+}
+
+static int stand_in_pread(struct drm_i915_gem_pread *args)
+{
+	int fd = stand_in_object_fd(args->handle, args->offset, args->size);
+
+	if (fd < 0 || pread(fd, (void *)(uintptr_t)args->data_ptr,
+			    args->size, args->offset) != (ssize_t)args->size)
+		return -1;
+	return 0;
+}
+
+static int stand_in_mmap(struct drm_i915_gem_mmap *args)
+{
+	int fd = stand_in_object_fd(args->handle, args->offset, args->size);
+	void *map;
+
+	if (fd < 0)
+		return -1;
+
+	map = mmap(NULL, args->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, args->offset);
+	if (map == MAP_FAILED)
+		return -1;
+
+	args->addr_ptr = (uintptr_t)map;
+	return 0;
+}
+
+static int stand_in_getparam(drm_i915_getparam_t *gp)
+{
+	switch (gp->param) {
+	case I915_PARAM_CHIPSET_ID:
+		*gp->value = 0x1912;	/* Skylake GT2 */
+		break;
+	case I915_PARAM_HAS_ALIASING_PPGTT:
+		*gp->value = 3;
+		break;
+	case I915_PARAM_NUM_FENCES_AVAIL:
+		*gp->value = 32;
+		break;
+	case I915_PARAM_MMAP_VERSION:
+	case I915_PARAM_HAS_EXECBUF2:
+	case I915_PARAM_HAS_BSD:
+	case I915_PARAM_HAS_BLT:
+	case I915_PARAM_HAS_RELAXED_FENCING:
+	case I915_PARAM_HAS_EXEC_ASYNC:
+	case I915_PARAM_HAS_WAIT_TIMEOUT:
+	case I915_PARAM_HAS_LLC:
+	case I915_PARAM_HAS_VEBOX:
+	case I915_PARAM_HAS_EXEC_SOFTPIN:
+		*gp->value = 1;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	STAND_IN_FORWARD(drmIoctl, fd, request, arg);
+
+	__sync_fetch_and_add(&stand_in_ioctls, 1);
+
+	switch (request) {
+	case DRM_IOCTL_I915_GETPARAM:
+		return stand_in_getparam(arg);
+	case DRM_IOCTL_I915_GEM_GET_APERTURE: {
+		struct drm_i915_gem_get_aperture *args = arg;
+
+		args->aper_size = 4ull << 30;
+		args->aper_available_size = args->aper_size - (64 << 20);
+		break;
+	}
+	case DRM_IOCTL_I915_GEM_CREATE: {
+		struct drm_i915_gem_create *args = arg;
+
+		args->handle = __sync_fetch_and_add(&stand_in_next_handle, 1);
+		stand_in_object_create(args->handle, args->size);
+		break;
+	}
+	case DRM_IOCTL_I915_GEM_PWRITE:
+		__sync_fetch_and_add(&stand_in_pwrites, 1);
+		return stand_in_pwrite(arg);
+	case DRM_IOCTL_I915_GEM_PREAD:
+		return stand_in_pread(arg);
+	case DRM_IOCTL_I915_GEM_MMAP:
+		return stand_in_mmap(arg);
+	case DRM_IOCTL_I915_GEM_SET_DOMAIN:
+		if (stand_in_set_domain_error) {
+			errno = stand_in_set_domain_error;
+			return -1;
+		}
+		__sync_fetch_and_add(&stand_in_set_domains, 1);
+		break;
+	case DRM_IOCTL_I915_GEM_EXECBUFFER2:
+	case DRM_IOCTL_I915_GEM_EXECBUFFER2_WR: {
+		struct drm_i915_gem_execbuffer2 *args = arg;
+		struct drm_i915_gem_exec_object2 *objects =
+			(void *)(uintptr_t)args->buffers_ptr;
+		uint32_t i;
+
+		stand_in_exec_buffer_count = args->buffer_count;
+		stand_in_exec_relocs = 0;
+		stand_in_exec_pinned = 0;
+		for (i = 0; i < args->buffer_count; i++) {
+			stand_in_exec_relocs += objects[i].relocation_count;
+			if (objects[i].flags & EXEC_OBJECT_PINNED)
+				stand_in_exec_pinned++;
+		}
+		break;
+	}
+	case DRM_IOCTL_I915_GEM_BUSY:
+		((struct drm_i915_gem_busy *)arg)->busy = stand_in_busy;
+		break;
+	case DRM_IOCTL_I915_GEM_MADVISE: {
+		struct drm_i915_gem_madvise *args = arg;
+
+		args->retained = 1;
+		if (args->madv == I915_MADV_WILLNEED && stand_in_purge_every &&
+		    ++stand_in_madvise_count % stand_in_purge_every == 0)
+			args->retained = 0;
+		break;
+	}
+	default:
+		break;
+	}
+	return 0;
+}
+
+int stand_in_open(void)
+{
+	int fd = memfd_create("intel_stand_in", MFD_CLOEXEC);
+
+	if (fd < 0)
+		return -errno;
+
+	stand_in_enabled = true;
+	return fd;
+}
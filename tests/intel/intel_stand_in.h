@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2026 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef INTEL_STAND_IN_H
+#define INTEL_STAND_IN_H
+
+#include <stdint.h>
+#include <time.h>
+
+/** Requests the stand-in answered, ioctls on a real device */
+extern uint64_t stand_in_ioctls;
+
+/** Number of buffers in the last execbuffer */
+extern uint32_t stand_in_exec_buffer_count;
+
+/** Relocations and softpinned buffers in the last execbuffer */
+extern uint32_t stand_in_exec_relocs;
+extern uint32_t stand_in_exec_pinned;
+
+/** Report every buffer busy */
+extern int stand_in_busy;
+
+/** Lose the pages of every nth buffer the library marks as needed again */
+extern unsigned stand_in_purge_every;
+
+/** Seconds added to CLOCK_MONOTONIC */
+extern time_t stand_in_clock_offset;
+
+/** Domain changes requested */
+extern uint64_t stand_in_set_domains;
+
+/** Error domain changes fail with, 0 to let them succeed */
+extern int stand_in_set_domain_error;
+
+/** pwrite requests */
+extern uint64_t stand_in_pwrites;
+
+/**
+ * Switch to the stand-in and return a file descriptor to pass to
+ * drm_intel_bufmgr_gem_init(), or a negative error code.
+ */
+int stand_in_open(void);
+
+#endif
@@ -0,0 +1,531 @@
+/*
+ * Copyright © 2026 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Checks that the layouts radeon_surface_init() and radeon_surface_best()
+ * return from the layout cache are the ones they compute, for every family,
+ * then measures how many surfaces can be created per second.
+ *
+ * The device queries of the surface manager are answered by a stand-in, so
+ * no radeon device is needed.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "radeon_drm.h"
+#include "radeon_surface.h"
+
+static const struct {
+    uint32_t    device_id;
+    const char  *family;
+} chips[] = {
+#define CHIPSET(pci_id, name, fam) { pci_id, #fam },
+#include "r600_pci_ids.h"
+#undef CHIPSET
+};
+
+/*
+ * Tiling configs in both the r600 and the evergreen+ layout of the value.
+ * Every family is checked with the first one, the first family of each
+ * generation with all of them.
+ */
+static const struct {
+    uint32_t    tiling_config;
+    int         version_minor;
+} configs[] = {
+    { 0x1112, 40 },
+    { 0x2013, 40 },
+    { 0x0046, 40 },
+    { 0x0122, 0 },
+};
+
+static uint32_t stand_in_device_id;
+static uint32_t stand_in_tiling_config;
+static int stand_in_version_minor;
+
+int drmCommandWriteRead(int fd, unsigned long index, void *data,
+                        unsigned long size)
+{
+    struct drm_radeon_info *info = data;
+    uint32_t *value = (uint32_t *)(uintptr_t)info->value;
+    unsigned i;
+
+    if (index != DRM_RADEON_INFO) {
+        return -EINVAL;
+    }
+
+    switch (info->request) {
+    case RADEON_INFO_DEVICE_ID:
+        *value = stand_in_device_id;
+        return 0;
+    case RADEON_INFO_TILING_CONFIG:
+        *value = stand_in_tiling_config;
+        return 0;
+    case RADEON_INFO_SI_TILE_MODE_ARRAY:
+        /* P8_32x32_16x16 with every tile split, bank size and aspect */
+        for (i = 0; i < 32; i++) {
+            value[i] = (12 << 6) | ((i % 7) << 11) | ((i % 2) << 14) |
+                       (((i / 2) % 4) << 16) | ((i % 3) << 18) |
+                       (((i % 3) + 1) << 20) | ((i % 4) << 25);
+        }
+        return 0;
+    case RADEON_INFO_CIK_MACROTILE_MODE_ARRAY:
+        for (i = 0; i < 16; i++) {
+            value[i] = (i % 4) | (((i / 4) % 4) << 2) | ((i % 3) << 4) |
+                       (((i + 2) % 4) << 6);
+        }
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+drmVersionPtr drmGetVersion(int fd)
+{
+    drmVersionPtr version = calloc(1, sizeof(*version));
+
+    if (version) {
+        version->version_major = 2;
+        version->version_minor = stand_in_version_minor;
+    }
+    return version;
+}
+
+void drmFreeVersion(drmVersionPtr version)
+{
+    free(version);
+}
+
+static struct radeon_surface_manager *manager_new(uint32_t device_id,
+                                                  int config)
+{
+    stand_in_device_id = device_id;
+    stand_in_tiling_config = configs[config].tiling_config;
+    stand_in_version_minor = configs[config].version_minor;
+    return radeon_surface_manager_new(-1);
+}
+
+/*
+ * Correctness: every combination of the descriptor fields below, on every
+ * family and tiling config. The surfaces are filled with garbage outside of
+ * the descriptor, which the cache has to leave alone.
+ */
+static const unsigned types[] = {
+    RADEON_SURF_TYPE_1D, RADEON_SURF_TYPE_2D, RADEON_SURF_TYPE_3D,
+    RADEON_SURF_TYPE_CUBEMAP, RADEON_SURF_TYPE_1D_ARRAY,
+    RADEON_SURF_TYPE_2D_ARRAY,
+};
+
+static const unsigned modes[] = {
+    RADEON_SURF_MODE_LINEAR, RADEON_SURF_MODE_LINEAR_ALIGNED,
+    RADEON_SURF_MODE_1D, RADEON_SURF_MODE_2D,
+};
+
+static const unsigned flag_sets[] = {
+    0,
+    RADEON_SURF_SCANOUT,
+    RADEON_SURF_ZBUFFER,
+    RADEON_SURF_SBUFFER,
+    RADEON_SURF_ZBUFFER | RADEON_SURF_SBUFFER,
+    RADEON_SURF_ZBUFFER | RADEON_SURF_SBUFFER | RADEON_SURF_HAS_SBUFFER_MIPTREE,
+    RADEON_SURF_FMASK,
+};
+
+static const unsigned bpes[] = { 1, 2, 4, 8, 16 };
+static const unsigned sample_counts[] = { 1, 2, 4, 8 };
+
+static const struct {
+    unsigned    x, y, z, array_size, last_level;
+} sizes[] = {
+    { 1, 1, 1, 1, 0 },
+    { 33, 17, 5, 3, 5 },
+    { 640, 480, 1, 1, 0 },
+    { 1920, 1080, 1, 6, 10 },
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static void fill_garbage(struct radeon_surface *surf)
+{
+    uint32_t *words = (uint32_t *)surf;
+    uint32_t garbage = next_rand() | next_rand() << 24;
+    unsigned i;
+
+    for (i = 0; i < sizeof(*surf) / sizeof(uint32_t); i++) {
+        words[i] = garbage ^ i * 0x9e3779b9;
+    }
+}
+
+static unsigned checked, mismatches;
+
+static int compare(const char *family, int config, const char *op,
+                   const struct radeon_surface *desc, int r_ref, int r,
+                   const struct radeon_surface *ref,
+                   const struct radeon_surface *surf)
+{
+    checked++;
+    if (r == r_ref && (r || !memcmp(ref, surf, sizeof(*surf)))) {
+        return 0;
+    }
+
+    if (mismatches++ < 10) {
+        fprintf(stdout, "%s config %d %s %ux%ux%u array %u levels %u bpe %u "
+                "samples %u flags 0x%x: %s\n", family, config, op,
+                desc->npix_x, desc->npix_y, desc->npix_z, desc->array_size,
+                desc->last_level, desc->bpe, desc->nsamples, desc->flags,
+                r != r_ref ? "different return value" : "different layout");
+    }
+    return -1;
+}
+
+/*
+ * One descriptor through an uncached and a cached manager: seen for the
+ * first time, cached, then from the cache.
+ */
+static void check_surface(struct radeon_surface_manager *uncached,
+                          struct radeon_surface_manager *cached,
+                          const char *family, int config,
+                          const struct radeon_surface *desc)
+{
+    struct radeon_surface surf, ref;
+    int pass, r, r_ref;
+
+    for (pass = 0; pass < 3; pass++) {
+        fill_garbage(&surf);
+        memcpy(&surf, desc, offsetof(struct radeon_surface, bo_size));
+        surf.bankw = desc->bankw;
+        surf.bankh = desc->bankh;
+        surf.mtilea = desc->mtilea;
+        surf.tile_split = desc->tile_split;
+        surf.stencil_tile_split = desc->stencil_tile_split;
+        surf.stencil_offset = desc->stencil_offset;
+
+        ref = surf;
+        r_ref = radeon_surface_best(uncached, &ref);
+        r = radeon_surface_best(cached, &surf);
+        if (compare(family, config, "best", desc, r_ref, r, &ref, &surf) ||
+            r) {
+            continue;
+        }
+
+        /* As drivers do, init with the hints best chose */
+        r_ref = radeon_surface_init(uncached, &ref);
+        r = radeon_surface_init(cached, &surf);
+        compare(family, config, "init", desc, r_ref, r, &ref, &surf);
+    }
+}
+
+static const char *first_families[] = { "R600", "CEDAR", "TAHITI", "BONAIRE" };
+
+static uint64_t total_hits, total_misses;
+
+static int test_family(const char *family, uint32_t device_id)
+{
+    struct radeon_surface_manager *uncached, *cached;
+    struct radeon_surface desc;
+    uint64_t hits, misses, family_hits = 0;
+    unsigned config, num_configs = 1, t, m, f, b, n, s, index;
+
+    for (t = 0; t < ARRAY_SIZE(first_families); t++) {
+        if (!strcmp(family, first_families[t])) {
+            num_configs = ARRAY_SIZE(configs);
+        }
+    }
+
+    for (config = 0; config < num_configs; config++) {
+        uncached = manager_new(device_id, config);
+        cached = manager_new(device_id, config);
+        if (!uncached || !cached) {
+            fprintf(stdout, "%s: failed to create the surface managers\n",
+                    family);
+            return -1;
+        }
+        radeon_surface_manager_set_cache_size(uncached, 0);
+
+        memset(&desc, 0, sizeof(desc));
+        desc.blk_w = desc.blk_h = desc.blk_d = 1;
+        for (t = 0; t < ARRAY_SIZE(types); t++)
+        for (m = 0; m < ARRAY_SIZE(modes); m++)
+        for (f = 0; f < ARRAY_SIZE(flag_sets); f++)
+        for (index = 0; index < 2; index++)
+        for (b = 0; b < ARRAY_SIZE(bpes); b++)
+        for (n = 0; n < ARRAY_SIZE(sample_counts); n++)
+        for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+            desc.npix_x = sizes[s].x;
+            desc.npix_y = sizes[s].y;
+            desc.npix_z = sizes[s].z;
+            desc.array_size = sizes[s].array_size;
+            desc.last_level = sizes[s].last_level;
+            desc.bpe = bpes[b];
+            desc.nsamples = sample_counts[n];
+            desc.flags = RADEON_SURF_SET(types[t], TYPE) |
+                         RADEON_SURF_SET(modes[m], MODE) | flag_sets[f] |
+                         (index ? RADEON_SURF_HAS_TILE_MODE_INDEX : 0);
+            check_surface(uncached, cached, family, config, &desc);
+        }
+
+        radeon_surface_manager_get_cache_stats(uncached, &hits, &misses);
+        if (hits) {
+            fprintf(stdout, "%s: cache hits with the cache off\n", family);
+            mismatches++;
+        }
+        radeon_surface_manager_get_cache_stats(cached, &hits, &misses);
+        family_hits += hits;
+        total_hits += hits;
+        total_misses += misses;
+
+        radeon_surface_manager_free(uncached);
+        radeon_surface_manager_free(cached);
+    }
+
+    /* The last pass on each descriptor has to come from the cache */
+    if (!family_hits) {
+        fprintf(stdout, "%s: no cache hits\n", family);
+        mismatches++;
+    }
+    return 0;
+}
+
+/*
+ * Benchmark: surfaces a video player and a game keep creating, and surfaces
+ * of a different size every time, with and without the cache.
+ */
+static const struct {
+    unsigned    x, y, bpe, last_level, flags;
+} workload[] = {
+    /* NV12 video frames and their chroma planes */
+    { 1920, 1088, 1, 0, RADEON_SURF_MODE_2D },
+    { 960, 544, 2, 0, RADEON_SURF_MODE_2D },
+    { 1280, 720, 1, 0, RADEON_SURF_MODE_2D },
+    { 640, 368, 2, 0, RADEON_SURF_MODE_2D },
+    /* Scanout and depth/stencil buffers */
+    { 1920, 1080, 4, 0, RADEON_SURF_MODE_2D | RADEON_SURF_SCANOUT },
+    { 1920, 1080, 4, 0, RADEON_SURF_MODE_2D | RADEON_SURF_ZBUFFER |
+                        RADEON_SURF_SBUFFER | RADEON_SURF_HAS_SBUFFER_MIPTREE },
+    /* Mipmapped textures */
+    { 256, 256, 4, 8, RADEON_SURF_MODE_2D },
+    { 512, 512, 4, 9, RADEON_SURF_MODE_2D },
+    { 1024, 1024, 4, 10, RADEON_SURF_MODE_2D },
+    { 2048, 2048, 8, 11, RADEON_SURF_MODE_2D },
+    { 128, 64, 16, 7, RADEON_SURF_MODE_1D },
+    { 64, 64, 4, 0, RADEON_SURF_MODE_LINEAR_ALIGNED },
+};
+
+static const struct {
+    const char  *name;
+    const char  *family;
+} bench_families[] = {
+    { "r600", "RV770" },
+    { "evergreen", "CYPRESS" },
+    { "si", "TAHITI" },
+    { "cik", "BONAIRE" },
+};
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t device_id_of(const char *family)
+{
+    unsigned i;
+
+    for (i = 0; i < ARRAY_SIZE(chips); i++) {
+        if (!strcmp(chips[i].family, family)) {
+            return chips[i].device_id;
+        }
+    }
+    return 0;
+}
+
+static int bench_run(struct radeon_surface_manager *surf_man, uint64_t first,
+                     uint64_t count, int unique)
+{
+    struct radeon_surface surf;
+    uint64_t i;
+    unsigned w;
+
+    for (i = first; i < first + count; i++) {
+        w = i % ARRAY_SIZE(workload);
+        memset(&surf, 0, sizeof(surf));
+        surf.npix_x = workload[w].x + (unique ? i % 4096 : 0);
+        surf.npix_y = workload[w].y;
+        surf.npix_z = 1;
+        surf.blk_w = surf.blk_h = surf.blk_d = 1;
+        surf.array_size = 1;
+        surf.last_level = workload[w].last_level;
+        surf.bpe = workload[w].bpe;
+        surf.nsamples = 1;
+        surf.flags = RADEON_SURF_SET(RADEON_SURF_TYPE_2D, TYPE) |
+                     RADEON_SURF_HAS_TILE_MODE_INDEX | workload[w].flags;
+        if (radeon_surface_best(surf_man, &surf) ||
+            radeon_surface_init(surf_man, &surf)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * The managers without and with the cache take turns on chunks of the
+ * workload, and the fastest chunk of each counts, which keeps the noise of
+ * a shared machine out of the comparison.
+ */
+#define BENCH_CHUNK     1200
+
+static int bench(uint64_t iterations)
+{
+    struct radeon_surface_manager *surf_man[2];
+    uint64_t i, start, delta, best[2], hits, misses;
+    unsigned f, unique, cache;
+    char name[64];
+    int r = 0;
+
+    for (f = 0; f < ARRAY_SIZE(bench_families); f++) {
+        for (unique = 0; unique < 2; unique++) {
+            for (cache = 0; cache < 2; cache++) {
+                surf_man[cache] =
+                    manager_new(device_id_of(bench_families[f].family), 0);
+                best[cache] = UINT64_MAX;
+            }
+            if (!surf_man[0] || !surf_man[1]) {
+                r = -1;
+                goto out;
+            }
+            radeon_surface_manager_set_cache_size(surf_man[0], 0);
+
+            for (i = 0; i < iterations; i += BENCH_CHUNK) {
+                for (cache = 0; cache < 2; cache++) {
+                    start = get_time_ns();
+                    if (bench_run(surf_man[cache], i, BENCH_CHUNK, unique)) {
+                        r = -1;
+                        goto out;
+                    }
+                    delta = get_time_ns() - start;
+                    if (delta < best[cache]) {
+                        best[cache] = delta;
+                    }
+                }
+            }
+
+            for (cache = 0; cache < 2; cache++) {
+                snprintf(name, sizeof(name), "%s/%s-%s",
+                         bench_families[f].name,
+                         unique ? "unique" : "repeated",
+                         cache ? "cached" : "uncached");
+                printf("%-32s %10.0f surfaces/s %8.1f ns/surface",
+                       name, BENCH_CHUNK / (best[cache] / 1e9),
+                       (double)best[cache] / BENCH_CHUNK);
+                if (cache) {
+                    radeon_surface_manager_get_cache_stats(surf_man[cache],
+                                                           &hits, &misses);
+                    printf("  x%.2f, %" PRIu64 " hits, %" PRIu64 " misses",
+                           (double)best[0] / best[1], hits, misses);
+                }
+                printf("\n");
+            }
+out:
+            radeon_surface_manager_free(surf_man[0]);
+            radeon_surface_manager_free(surf_man[1]);
+            if (r) {
+                return r;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t iterations = 100000;
+    unsigned i, j;
+    int c, err;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+        case 'n':
+            iterations = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /*
+     * Keep the complaints about MSAA surfaces on kernels without 2D tiling
+     * out of the log, the results are compared anyway.
+     */
+    fflush(stderr);
+    err = dup(STDERR_FILENO);
+    if (!freopen("/dev/null", "w", stderr)) {
+        return 1;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(chips); i++) {
+        /* The first device of each family */
+        for (j = 0; j < i; j++) {
+            if (!strcmp(chips[j].family, chips[i].family)) {
+                break;
+            }
+        }
+        if (j == i && test_family(chips[i].family, chips[i].device_id)) {
+            return 1;
+        }
+    }
+    fflush(stderr);
+    dup2(err, STDERR_FILENO);
+    close(err);
+
+    printf("%u surfaces checked, %u mismatches, %" PRIu64 " hits, %" PRIu64
+           " misses\n", checked, mismatches, total_hits, total_misses);
+    if (mismatches) {
+        return 1;
+    }
+
+    if (iterations && bench(iterations)) {
+        fprintf(stderr, "benchmark failed\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * Copyright © 2026 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Buffer object cache shared by freedreno, etnaviv and intel.
+ *
+ * Every cached buffer is on two lists: the one of its bucket, which
+ * allocations search, and the one of the whole cache, which expiry and
+ * trimming drop buffers from. Both are in release order, oldest first.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdrm_macros.h"
+#include "xf86drmBOCache.h"
+
+#define BO_CACHE_PAGE_SIZE	4096
+#define BO_CACHE_MAX_SIZE	(64 * 1024 * 1024)
+#define BO_CACHE_MAX_BUCKETS	(3 + 4 * 13)
+
+typedef struct _drmBOCacheBucket {
+    drmMMListHead   head;
+    drmBOCacheStats stats;
+} drmBOCacheBucket;
+
+typedef struct _drmBOCache {
+    drmBOCacheFuncs  funcs;
+    uint32_t         flags;
+    int              num_buckets;
+    uint64_t         bytes;
+    uint64_t         max_bytes;
+    time_t           time;
+    drmMMListHead    lru;
+    drmBOCacheBucket buckets[BO_CACHE_MAX_BUCKETS];
+} drmBOCache;
+
+/*
+ * The bucket layout built by drmBOCacheCreate(). Fine: 1, 2 and 3 pages,
+ * then 4/4, 5/4, 6/4 and 7/4 of every power of two number of pages from 4
+ * on. Coarse: every power of two number of pages.
+ */
+static drmBOCacheBucket *drmBOCacheBucketFor(drmBOCachePtr cache,
+					     uint64_t size)
+{
+    uint64_t pages, step;
+    int order, i;
+
+    if (size > cache->buckets[cache->num_buckets - 1].stats.size)
+	return NULL;
+
+    pages = (size + BO_CACHE_PAGE_SIZE - 1) / BO_CACHE_PAGE_SIZE;
+    if (cache->flags & DRM_BO_CACHE_COARSE) {
+	i = pages <= 1 ? 0 : 64 - __builtin_clzll(pages - 1);
+    } else if (pages <= 4) {
+	i = pages ? pages - 1 : 0;
+    } else {
+	/* 2^order < pages <= 2^(order + 1), order >= 2 */
+	order = 63 - __builtin_clzll(pages - 1);
+	step = 1ull << (order - 2);
+	i = 3 + 4 * (order - 2) + (pages - (1ull << order) + step - 1) / step;
+    }
+
+    return &cache->buckets[i];
+}
+
+static void drmBOCacheAddBucket(drmBOCachePtr cache, uint64_t size)
+{
+    drmBOCacheBucket *bucket = &cache->buckets[cache->num_buckets++];
+
+    assert(cache->num_buckets <= BO_CACHE_MAX_BUCKETS);
+
+    DRMINITLISTHEAD(&bucket->head);
+    bucket->stats.size = size;
+}
+
+static int drmBOCacheCompatible(uint32_t cached_flags, uint32_t flags)
+{
+    return cached_flags == flags;
+}
+
+drm_public drmBOCachePtr drmBOCacheCreate(const drmBOCacheFuncs *funcs,
+					  uint32_t flags)
+{
+    drmBOCachePtr cache;
+    uint64_t size;
+    int i;
+
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+	return NULL;
+
+    cache->funcs = *funcs;
+    if (!cache->funcs.compatible)
+	cache->funcs.compatible = drmBOCacheCompatible;
+    cache->flags = flags;
+    cache->max_bytes = UINT64_MAX;
+    DRMINITLISTHEAD(&cache->lru);
+
+    drmBOCacheAddBucket(cache, BO_CACHE_PAGE_SIZE);
+    drmBOCacheAddBucket(cache, BO_CACHE_PAGE_SIZE * 2);
+    if (!(flags & DRM_BO_CACHE_COARSE))
+	drmBOCacheAddBucket(cache, BO_CACHE_PAGE_SIZE * 3);
+
+    for (size = 4 * BO_CACHE_PAGE_SIZE; size <= BO_CACHE_MAX_SIZE; size *= 2) {
+	drmBOCacheAddBucket(cache, size);
+	if (!(flags & DRM_BO_CACHE_COARSE)) {
+	    drmBOCacheAddBucket(cache, size + size * 1 / 4);
+	    drmBOCacheAddBucket(cache, size + size * 2 / 4);
+	    drmBOCacheAddBucket(cache, size + size * 3 / 4);
+	}
+    }
+
+    /* The computed bucket has to agree with the layout */
+    for (i = 0; i < cache->num_buckets; i++) {
+	drmBOCacheBucket *bucket = &cache->buckets[i];
+
+	assert(drmBOCacheBucketFor(cache, bucket->stats.size) == bucket);
+	assert(i == 0 ||
+	       drmBOCacheBucketFor(cache, bucket[-1].stats.size + 1) == bucket);
+	(void)bucket;
+    }
+
+    return cache;
+}
+
+static void drmBOCacheUnlink(drmBOCachePtr cache, drmBOCacheEntryPtr entry)
+{
+    drmBOCacheBucket *bucket = &cache->buckets[entry->bucket];
+
+    DRMLISTDELINIT(&entry->bucket_link);
+    DRMLISTDELINIT(&entry->lru_link);
+    bucket->stats.cached--;
+    cache->bytes -= entry->size;
+    entry->cache = NULL;
+}
+
+/* Drops buffers from the old end until at most max_bytes are cached */
+static void drmBOCacheShrink(drmBOCachePtr cache, uint64_t max_bytes)
+{
+    while (cache->bytes > max_bytes) {
+	drmBOCacheEntryPtr entry = DRMLISTENTRY(drmBOCacheEntry,
+						cache->lru.next, lru_link);
+
+	cache->buckets[entry->bucket].stats.trimmed++;
+	drmBOCacheUnlink(cache, entry);
+	cache->funcs.destroy(entry);
+    }
+}
+
+drm_public void drmBOCacheDestroy(drmBOCachePtr cache)
+{
+    if (!cache)
+	return;
+
+    drmBOCacheShrink(cache, 0);
+    free(cache);
+}
+
+drm_public uint64_t drmBOCacheBucketSize(drmBOCachePtr cache, uint64_t size)
+{
+    drmBOCacheBucket *bucket;
+
+    if (!cache)
+	return 0;
+
+    bucket = drmBOCacheBucketFor(cache, size);
+    return bucket ? bucket->stats.size : 0;
+}
+
+/* Drops the oldest buffers of the bucket that the kernel purged */
+static void drmBOCachePurge(drmBOCachePtr cache, drmBOCacheBucket *bucket)
+{
+    while (!DRMLISTEMPTY(&bucket->head)) {
+	drmBOCacheEntryPtr entry = DRMLISTENTRY(drmBOCacheEntry,
+						bucket->head.next, bucket_link);
+
+	if (cache->funcs.madvise(entry, 0))
+	    break;
+
+	bucket->stats.purged++;
+	drmBOCacheUnlink(cache, entry);
+	cache->funcs.destroy(entry);
+    }
+}
+
+drm_public drmBOCacheEntryPtr drmBOCacheAlloc(drmBOCachePtr cache,
+					      uint64_t size, uint32_t flags,
+					      int policy)
+{
+    drmBOCacheBucket *bucket;
+    drmBOCacheEntryPtr entry;
+    drmMMListHead *link;
+
+    if (!cache)
+	return NULL;
+
+    bucket = drmBOCacheBucketFor(cache, size);
+    if (!bucket)
+	return NULL;
+
+retry:
+    entry = NULL;
+    if (policy == DRM_BO_CACHE_MRU) {
+	/* Likely still hot in the GPU caches, the GPU waits if needed */
+	for (link = bucket->head.prev; link != &bucket->head;
+	     link = link->prev) {
+	    drmBOCacheEntryPtr e = DRMLISTENTRY(drmBOCacheEntry, link,
+						bucket_link);
+
+	    if (cache->funcs.compatible(e->flags, flags)) {
+		entry = e;
+		break;
+	    }
+	}
+    } else {
+	/*
+	 * The CPU is going to fill the buffer. If the oldest one is still
+	 * busy the younger ones are as well, and allocating a new buffer is
+	 * probably faster than waiting for the GPU.
+	 */
+	DRMLISTFOREACH(link, &bucket->head) {
+	    drmBOCacheEntryPtr e = DRMLISTENTRY(drmBOCacheEntry, link,
+						bucket_link);
+
+	    if (!cache->funcs.compatible(e->flags, flags))
+		continue;
+	    if (!cache->funcs.is_idle || cache->funcs.is_idle(e))
+		entry = e;
+	    break;
+	}
+    }
+
+    if (!entry) {
+	bucket->stats.misses++;
+	return NULL;
+    }
+
+    drmBOCacheUnlink(cache, entry);
+
+    if (cache->funcs.madvise && cache->funcs.madvise(entry, 1) <= 0) {
+	/* The kernel took the pages, probably from older buffers too */
+	bucket->stats.purged++;
+	cache->funcs.destroy(entry);
+	drmBOCachePurge(cache, bucket);
+	goto retry;
+    }
+
+    bucket->stats.hits++;
+    return entry;
+}
+
+drm_public int drmBOCacheRelease(drmBOCachePtr cache, drmBOCacheEntryPtr entry,
+				 time_t time)
+{
+    drmBOCacheBucket *bucket;
+
+    if (!cache || entry->size > cache->max_bytes)
+	return -1;
+
+    bucket = drmBOCacheBucketFor(cache, entry->size);
+    if (!bucket)
+	return -1;
+
+    if (cache->funcs.madvise && cache->funcs.madvise(entry, 0) == 0)
+	return -1;
+
+    if (cache->bytes + entry->size > cache->max_bytes)
+	drmBOCacheShrink(cache, cache->max_bytes - entry->size);
+
+    entry->cache = cache;
+    entry->bucket = bucket - cache->buckets;
+    entry->free_time = time;
+    DRMLISTADDTAIL(&entry->bucket_link, &bucket->head);
+    DRMLISTADDTAIL(&entry->lru_link, &cache->lru);
+    bucket->stats.cached++;
+    cache->bytes += entry->size;
+
+    return 0;
+}
+
+drm_public void drmBOCacheRemove(drmBOCacheEntryPtr entry)
+{
+    if (entry->cache)
+	drmBOCacheUnlink(entry->cache, entry);
+}
+
+drm_public void drmBOCacheExpire(drmBOCachePtr cache, time_t time)
+{
+    if (!cache || cache->time == time)
+	return;
+
+    cache->time = time;
+    while (!DRMLISTEMPTY(&cache->lru)) {
+	drmBOCacheEntryPtr entry = DRMLISTENTRY(drmBOCacheEntry,
+						cache->lru.next, lru_link);
+
+	/* Keep buffers for at least a second */
+	if (time - entry->free_time <= 1)
+	    break;
+
+	cache->buckets[entry->bucket].stats.expired++;
+	drmBOCacheUnlink(cache, entry);
+	cache->funcs.destroy(entry);
+    }
+}
+
+drm_public void drmBOCacheTrim(drmBOCachePtr cache, uint64_t max_bytes)
+{
+    if (cache)
+	drmBOCacheShrink(cache, max_bytes);
+}
+
+drm_public void drmBOCacheSetLimit(drmBOCachePtr cache, uint64_t max_bytes)
+{
+    if (!cache)
+	return;
+
+    cache->max_bytes = max_bytes;
+    drmBOCacheShrink(cache, max_bytes);
+}
+
+drm_public uint64_t drmBOCacheBytes(drmBOCachePtr cache)
+{
+    return cache ? cache->bytes : 0;
+}
+
+drm_public int drmBOCacheGetStats(drmBOCachePtr cache, drmBOCacheStats *stats,
+				  int count)
+{
+    int i;
+
+    if (!cache)
+	return 0;
+
+    for (i = 0; i < cache->num_buckets && i < count; i++)
+	stats[i] = cache->buckets[i].stats;
+
+    return cache->num_buckets;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2026 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * \file xf86drmBOCache.h
+ *
+ * Size bucketed cache of released buffer objects, shared by the drivers.
+ *
+ * Buffers embed a drmBOCacheEntry. Released buffers are kept in buckets of
+ * 1, 2 and 3 pages, then of 4/4, 5/4, 6/4 and 7/4 of every power of two
+ * number of pages up to 112MB (or of the powers of two only up to 64MB,
+ * with DRM_BO_CACHE_COARSE). The bucket of a size is computed, not
+ * searched for.
+ *
+ * The cache does no locking: the driver serializes the calls on a cache
+ * with the lock that protects its buffers.
+ */
+
+#ifndef _XF86DRMBOCACHE_H_
+#define _XF86DRMBOCACHE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "libdrm_lists.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** drmBOCacheCreate() flag: power of two bucket sizes only */
+#define DRM_BO_CACHE_COARSE	(1 << 0)
+
+/** drmBOCacheAlloc() policies */
+#define DRM_BO_CACHE_LRU	0	/* Oldest idle buffer, to be filled by the CPU */
+#define DRM_BO_CACHE_MRU	1	/* Newest buffer, even if busy, for the GPU */
+
+typedef struct _drmBOCache *drmBOCachePtr;
+
+/** Part of a buffer object the cache keeps it by */
+typedef struct _drmBOCacheEntry {
+    drmMMListHead bucket_link;	/* In the bucket, oldest first */
+    drmMMListHead lru_link;	/* In the whole cache, oldest first */
+    drmBOCachePtr cache;	/* The cache holding the buffer, or NULL */
+    uint64_t      size;		/* Size of the buffer, set by the driver */
+    uint32_t      flags;	/* Allocation flags, set by the driver */
+    uint32_t      bucket;
+    time_t        free_time;
+} drmBOCacheEntry, *drmBOCacheEntryPtr;
+
+/** Callbacks of the driver owning the buffers */
+typedef struct _drmBOCacheFuncs {
+    /** Returns non-zero if the GPU is done with the buffer */
+    int  (*is_idle)(drmBOCacheEntryPtr entry);
+    /**
+     * Tells the kernel whether the buffer's pages are needed. Returns zero
+     * only if they were reclaimed, so drivers whose kernel can't tell
+     * have to return non-zero. Optional.
+     */
+    int  (*madvise)(drmBOCacheEntryPtr entry, int willneed);
+    /** Frees a buffer the cache drops */
+    void (*destroy)(drmBOCacheEntryPtr entry);
+    /**
+     * Returns non-zero if a buffer created with \p cached_flags can serve
+     * an allocation with \p flags. Flags have to be equal without it.
+     */
+    int  (*compatible)(uint32_t cached_flags, uint32_t flags);
+} drmBOCacheFuncs;
+
+/** Counters of one bucket */
+typedef struct _drmBOCacheStats {
+    uint64_t size;	/* Size of the buffers in the bucket */
+    uint64_t cached;	/* Buffers in the bucket */
+    uint64_t hits;	/* Allocations served from the bucket */
+    uint64_t misses;	/* Allocations the bucket could not serve */
+    uint64_t purged;	/* Buffers whose pages the kernel reclaimed */
+    uint64_t expired;	/* Buffers dropped after a while in the cache */
+    uint64_t trimmed;	/* Buffers dropped to stay within a memory limit */
+} drmBOCacheStats;
+
+extern drmBOCachePtr drmBOCacheCreate(const drmBOCacheFuncs *funcs,
+				      uint32_t flags);
+/** Destroys the cache and every buffer in it */
+extern void drmBOCacheDestroy(drmBOCachePtr cache);
+
+/** Size buffers of \p size are created with to be cached, 0 if they can't */
+extern uint64_t drmBOCacheBucketSize(drmBOCachePtr cache, uint64_t size);
+
+/**
+ * Takes a buffer of the bucket of \p size that is compatible with \p flags
+ * out of the cache, with its pages back, or returns NULL.
+ */
+extern drmBOCacheEntryPtr drmBOCacheAlloc(drmBOCachePtr cache, uint64_t size,
+					  uint32_t flags, int policy);
+/**
+ * Puts a buffer into the cache, \p time being CLOCK_MONOTONIC in seconds.
+ * Returns non-zero if the driver has to free it instead.
+ */
+extern int drmBOCacheRelease(drmBOCachePtr cache, drmBOCacheEntryPtr entry,
+			     time_t time);
+/** Takes a cached buffer the driver found another way out of the cache */
+extern void drmBOCacheRemove(drmBOCacheEntryPtr entry);
+
+/** Drops the buffers cached for more than a second before \p time */
+extern void drmBOCacheExpire(drmBOCachePtr cache, time_t time);
+/** Drops the oldest buffers until at most \p max_bytes are cached */
+extern void drmBOCacheTrim(drmBOCachePtr cache, uint64_t max_bytes);
+/** Makes drmBOCacheRelease() keep the cache within \p max_bytes */
+extern void drmBOCacheSetLimit(drmBOCachePtr cache, uint64_t max_bytes);
+/** Bytes of buffers in the cache */
+extern uint64_t drmBOCacheBytes(drmBOCachePtr cache);
+
+/**
+ * Returns the number of buckets, and fills in the counters of up to
+ * \p count of them, smallest first.
+ */
+extern int drmBOCacheGetStats(drmBOCachePtr cache, drmBOCacheStats *stats,
+			      int count);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif